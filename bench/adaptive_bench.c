@@ -0,0 +1,139 @@
+/**
+ * @file adaptive_bench.c
+ * @brief Compares adaptive supersampling against uniform supersampling at a fixed sample count: the
+ * primary rays each traces, the time taken, and the root mean square error of the drawn image against
+ * a reference accumulated with many more samples. Frames are rendered headless on the calling thread.
+ *
+ * Usage: adaptive_bench [max error] [fixed samples] [reference samples] [resolution]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "FPToolkit.h"
+#include "M3d_matrix_tools.h"
+#include "raytrace.h"
+#include "camera.h"
+#include "mesh.h"
+#include "framebuffer.h"
+#include "bench_mesh.h"
+#include "bench_util.h"
+
+static double rms_error(const int* frame, const int* reference, int num_pixels){
+    double sum = 0;
+    for(int i = 0; i < num_pixels; i++){
+        for(int shift = 0; shift <= 16; shift += 8){
+            double difference = (((frame[i] >> shift) & 255) - ((reference[i] >> shift) & 255)) / 255.0;
+            sum += difference * difference / 3;
+        }
+    }
+    return sqrt(sum / num_pixels);
+}
+
+int main(int argc, char** argv){
+    double max_error = argc > 1 ? atof(argv[1]) : 0.02;
+    int fixed_samples = argc > 2 ? atoi(argv[2]) : 16;
+    int reference_samples = argc > 3 ? atoi(argv[3]) : 256;
+    int resolution = argc > 4 ? atoi(argv[4]) : 128;
+    int num_pixels = resolution * resolution;
+    G_choose_headless_display();
+    G_init_graphics(resolution, resolution);
+    set_raytrace_threads(1);
+
+    Mesh* ball = make_sphere_mesh(30, 40);
+    ball->material = (PhongMaterial){
+        .base_color={0.2, 0.4, 0.8},
+        .diffuse={0.2, 0.4, 0.8},
+        .specular={WHITE},
+        .shininess=40
+    };
+    ball->roughness = 0.6;
+    translate_mesh(ball, (Vector3){-0.8, 0, 0});
+    apply_mesh_transform(ball);
+
+    // Mostly empty background and flat ground, with a few edges, highlights and reflections
+    RaytracedParametricObject3D objects[2] = {
+        {.object_type=BOX, .roughness=0.8,
+         .material={.base_color={0.9, 0.6, 0.2}, .diffuse={0.9, 0.6, 0.2}, .specular={WHITE}, .shininess=20}},
+        {.object_type=PLANE, .roughness=0.9,
+         .material={.base_color={0.6, 0.6, 0.6}, .diffuse={0.6, 0.6, 0.6}, .specular={WHITE}, .shininess=5}}
+    };
+    int box_types[5] = {SX, SY, SZ, RY, TX};
+    double box_params[5] = {0.1, 0.9, 0.6, 30, 0.9};
+    M3d_make_movement_sequence_matrix(objects[0].transform, objects[0].inverse, 5, box_types, box_params);
+    int plane_types[1] = {TY};
+    double plane_params[1] = {-1};
+    M3d_make_movement_sequence_matrix(objects[1].transform, objects[1].inverse, 1, plane_types, plane_params);
+
+    Camera cam = {
+        .eye={0, 0.3, -4},
+        .coi={0, 0, 0},
+        .up={0, 1.3, -4},
+        .half_fov_degrees=30,
+        .near_clip_plane=0.01,
+        .far_clip_plane=100
+    };
+    make_camera_view_matrix(cam.view_matrix, cam.inverse_view_matrix, cam);
+    PhongLight light = {
+        .position={3, 5, -4},
+        .diffuse={WHITE},
+        .specular={WHITE}
+    };
+
+    int* reference = (int*)malloc(sizeof(int) * num_pixels);
+    int* frame = (int*)malloc(sizeof(int) * num_pixels);
+    if(reference == NULL || frame == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for frames\n");
+        exit(1);
+    }
+    AccumulationBuffer accumulation = new_accumulation_buffer(resolution, resolution);
+    for(int pass = 0; pass < reference_samples; pass++){
+        raytrace_scene_pass(&accumulation, cam, objects, 2, ball, 1, false, &light, 1, 2);
+    }
+    G_rgb(0, 0, 0);
+    G_clear();
+    present_accumulation_buffer(&accumulation);
+    read_frame(reference, resolution);
+
+    printf("%dx%d, error against %d samples per pixel\n", resolution, resolution, reference_samples);
+    printf("%-22s %14s %12s %12s\n", "mode", "samples/pixel", "ms", "rms error");
+
+    G_rgb(0, 0, 0);
+    G_clear();
+    raytrace_scene(resolution, resolution, cam, objects, 2, ball, 1, false, &light, 1, 2);
+    read_frame(frame, resolution);
+    printf("%-22s %14d %12s %12.5f\n", "single sample", 1, "-", rms_error(frame, reference, num_pixels));
+
+    clear_accumulation_buffer(&accumulation);
+    double start = now_seconds();
+    for(int pass = 0; pass < fixed_samples; pass++){
+        raytrace_scene_pass(&accumulation, cam, objects, 2, ball, 1, false, &light, 1, 2);
+    }
+    G_rgb(0, 0, 0);
+    G_clear();
+    present_accumulation_buffer(&accumulation);
+    double fixed_time = now_seconds() - start;
+    read_frame(frame, resolution);
+    char name[32];
+    snprintf(name, sizeof(name), "fixed %d", fixed_samples);
+    printf("%-22s %14d %12.2f %12.5f\n", name, fixed_samples, fixed_time * 1000, rms_error(frame, reference, num_pixels));
+
+    int settings[3][2] = {{4, 32}, {8, 32}, {8, 64}};
+    for(int i = 0; i < 3; i++){
+        G_rgb(0, 0, 0);
+        G_clear();
+        start = now_seconds();
+        double samples = raytrace_scene_adaptive(resolution, resolution, cam, objects, 2, ball, 1, false, &light, 1, 2,
+                                                 settings[i][0], settings[i][1], max_error);
+        double adaptive_time = now_seconds() - start;
+        read_frame(frame, resolution);
+        snprintf(name, sizeof(name), "adaptive %d-%d", settings[i][0], settings[i][1]);
+        printf("%-22s %14.2f %12.2f %12.5f\n", name, samples, adaptive_time * 1000, rms_error(frame, reference, num_pixels));
+    }
+
+    free(reference);
+    free(frame);
+    delete_accumulation_buffer(&accumulation);
+    delete_mesh(*ball);
+    free(ball);
+    return 0;
+}
@@ -0,0 +1,156 @@
+/**
+ * @file bench_mesh.h
+ * @brief Generated test meshes shared by the benchmarks
+ */
+#ifndef BENCH_MESH_H
+#define BENCH_MESH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "mesh.h"
+#include "M3d_matrix_tools.h"
+#include "parametric.h"
+
+/**
+ * @brief Allocates a mesh with room for a given number of vertices and triangles
+ */
+static inline Mesh* allocate_bench_mesh(int num_vertices, int num_tris){
+    Mesh* mesh = (Mesh*)malloc(sizeof(Mesh));
+    if(mesh == NULL) goto MEM_ERROR;
+    mesh->num_vertices = num_vertices;
+    mesh->num_tris = num_tris;
+    mesh->vertices = (Vertex*)malloc(sizeof(Vertex) * mesh->num_vertices);
+    mesh->tris = (Triangle*)malloc(sizeof(Triangle) * mesh->num_tris);
+    if(mesh->vertices == NULL || mesh->tris == NULL) goto MEM_ERROR;
+    return mesh;
+    MEM_ERROR:
+    fprintf(stderr, "Failed to allocate sufficient memory for mesh\n");
+    exit(1);
+}
+
+/**
+ * @brief Builds the indexed arrays, bounds and BVH of a mesh whose vertices and triangles are filled in,
+ * the same way get_mesh finishes a loaded mesh
+ */
+static inline void finish_bench_mesh(Mesh* mesh){
+    build_indexed_mesh(mesh);
+    compute_face_normals(mesh);
+    compute_mesh_bounds(mesh);
+    M3d_make_identity(mesh->transform);
+    M3d_make_identity(mesh->inverse_transform);
+    mesh->hidden = false;
+    mesh->bvh = NULL_BVH;
+    build_mesh_bvh(mesh);
+}
+
+/**
+ * @brief Builds a unit UV sphere
+ */
+static inline Mesh* make_sphere_mesh(int rings, int segments){
+    Mesh* mesh = allocate_bench_mesh((rings + 1) * segments, 2 * rings * segments);
+
+    for(int r = 0; r <= rings; r++){
+        double v = M_PI * r / rings;
+        for(int s = 0; s < segments; s++){
+            double u = 2 * M_PI * s / segments;
+            Vertex* vertex = &mesh->vertices[r * segments + s];
+            vertex->position = (Vector3){cos(u) * sin(v), cos(v), sin(u) * sin(v)};
+            vertex->position_static = vertex->position;
+            vertex->normal = vertex->position;
+            vertex->normal_static = vertex->position;
+        }
+    }
+
+    int t = 0;
+    for(int r = 0; r < rings; r++){
+        for(int s = 0; s < segments; s++){
+            Vertex* a = &mesh->vertices[r * segments + s];
+            Vertex* b = &mesh->vertices[r * segments + (s + 1) % segments];
+            Vertex* c = &mesh->vertices[(r + 1) * segments + s];
+            Vertex* d = &mesh->vertices[(r + 1) * segments + (s + 1) % segments];
+            mesh->tris[t++] = (Triangle){a, b, c};
+            mesh->tris[t++] = (Triangle){b, d, c};
+        }
+    }
+    finish_bench_mesh(mesh);
+    return mesh;
+}
+
+/**
+ * @brief Builds a flat square grid on the xz plane from -size to size. It is wound like the water planes,
+ * so compute_plane_normals turns its normals up
+ */
+static inline Mesh* make_grid_mesh(int cells, double size){
+    Mesh* mesh = allocate_bench_mesh((cells + 1) * (cells + 1), 2 * cells * cells);
+    for(int z = 0; z <= cells; z++){
+        for(int x = 0; x <= cells; x++){
+            Vertex* vertex = &mesh->vertices[z * (cells + 1) + x];
+            vertex->position = (Vector3){size * (2.0 * x / cells - 1), 0, size * (2.0 * z / cells - 1)};
+            vertex->position_static = vertex->position;
+            vertex->normal = (Vector3){0, 1, 0};
+            vertex->normal_static = vertex->normal;
+        }
+    }
+
+    int t = 0;
+    for(int z = 0; z < cells; z++){
+        for(int x = 0; x < cells; x++){
+            Vertex* a = &mesh->vertices[z * (cells + 1) + x];
+            Vertex* b = &mesh->vertices[z * (cells + 1) + x + 1];
+            Vertex* c = &mesh->vertices[(z + 1) * (cells + 1) + x];
+            Vertex* d = &mesh->vertices[(z + 1) * (cells + 1) + x + 1];
+            mesh->tris[t++] = (Triangle){a, b, c};
+            mesh->tris[t++] = (Triangle){b, d, c};
+        }
+    }
+    finish_bench_mesh(mesh);
+    return mesh;
+}
+
+/**
+ * @brief Builds the torus of param_torus, with TORUS_MAJOR_RADIUS and TORUS_MINOR_RADIUS as they are now
+ */
+static inline Mesh* make_torus_mesh(int rings, int segments){
+    Mesh* mesh = allocate_bench_mesh(rings * segments, 2 * rings * segments);
+    for(int r = 0; r < rings; r++){
+        double u = 2 * M_PI * r / rings;
+        for(int s = 0; s < segments; s++){
+            double v = 2 * M_PI * s / segments;
+            Vertex* vertex = &mesh->vertices[r * segments + s];
+            vertex->position = param_torus(u, v);
+            vertex->position_static = vertex->position;
+            vertex->normal = (Vector3){cos(u) * cos(v), cos(u) * sin(v), sin(u)};
+            vertex->normal_static = vertex->normal;
+        }
+    }
+
+    int t = 0;
+    for(int r = 0; r < rings; r++){
+        for(int s = 0; s < segments; s++){
+            Vertex* a = &mesh->vertices[r * segments + s];
+            Vertex* b = &mesh->vertices[r * segments + (s + 1) % segments];
+            Vertex* c = &mesh->vertices[(r + 1) % rings * segments + s];
+            Vertex* d = &mesh->vertices[(r + 1) % rings * segments + (s + 1) % segments];
+            mesh->tris[t++] = (Triangle){a, b, c};
+            mesh->tris[t++] = (Triangle){b, d, c};
+        }
+    }
+    finish_bench_mesh(mesh);
+    return mesh;
+}
+
+/**
+ * @brief Adds up the arrays a mesh holds
+ */
+static inline size_t bench_mesh_bytes(const Mesh* mesh){
+    size_t bytes = sizeof(Mesh);
+    bytes += mesh->num_vertices * (sizeof(Vertex) + 2 * sizeof(Vector3));
+    bytes += mesh->num_tris * (sizeof(Triangle) + 3 * sizeof(uint32_t) + sizeof(Vector3) + 9 * sizeof(double));
+    bytes += mesh->bvh.num_nodes * sizeof(BVHNode) + mesh->bvh.num_prims * sizeof(int);
+    bytes += mesh->tri_blocks.num_nodes * sizeof(BVHNode);
+    bytes += mesh->tri_blocks.num_blocks * mesh->tri_blocks.width * (9 * sizeof(float) + sizeof(int));
+    return bytes;
+}
+
+#endif
@@ -0,0 +1,70 @@
+/**
+ * @file bench_util.h
+ * @brief Timing, frame capture and parametric drawing helpers shared by the benchmarks
+ */
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <time.h>
+#include "FPToolkit.h"
+#include "parametric.h"
+
+/**
+ * @brief Gets the time on the monotonic clock, in seconds
+ */
+static inline double now_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Copies the square FPToolkit window into an array of resolution * resolution pixels, row by row
+ */
+static inline void read_frame(int* pixels, int resolution){
+    for(int y = 0; y < resolution; y++){
+        for(int x = 0; x < resolution; x++) pixels[y * resolution + x] = G_get_pixel(x, y);
+    }
+}
+
+// How many times counted_sphere and counted_torus have been called
+static long evaluations = 0;
+
+/**
+ * @brief param_sphere, counting its calls in evaluations
+ */
+static inline Vector3 counted_sphere(double u, double v){
+    evaluations++;
+    return param_sphere(u, v);
+}
+
+/**
+ * @brief param_torus, counting its calls in evaluations
+ */
+static inline Vector3 counted_torus(double u, double v){
+    evaluations++;
+    return param_torus(u, v);
+}
+
+/**
+ * @brief Clears the square FPToolkit window and a z-buffer, draws parametric objects into them and copies
+ * the frame into an array of resolution * resolution pixels
+ *
+ * @return The seconds draw_parametric_objects_3d took
+ */
+static inline double draw_parametric_frame(ParametricObject3D* objects, int num_objects, Camera cam,
+                                           PhongLight* lights, int num_lights, enum ViewMode mode,
+                                           int resolution, double (*z_buffer)[resolution], int* pixels){
+    G_rgb(0, 0, 0);
+    G_clear();
+    for(int x = 0; x < resolution; x++){
+        for(int y = 0; y < resolution; y++) z_buffer[x][y] = 1;
+    }
+    double start = now_seconds();
+    draw_parametric_objects_3d(objects, num_objects, cam, lights, num_lights, resolution, resolution, z_buffer, mode);
+    double seconds = now_seconds() - start;
+    read_frame(pixels, resolution);
+    return seconds;
+}
+
+#endif
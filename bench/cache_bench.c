@@ -0,0 +1,143 @@
+/**
+ * @file cache_bench.c
+ * @brief Re-renders a scene after a series of edits with raytrace_scene_cached and with raytrace_scene,
+ * printing for each edit how many pixels the cache traced again, the time both took, and how many
+ * pixels of the two frames differ. Frames are rendered headless on the calling thread with shadows on.
+ *
+ * Usage: cache_bench [resolution]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "FPToolkit.h"
+#include "M3d_matrix_tools.h"
+#include "raytrace.h"
+#include "camera.h"
+#include "mesh.h"
+#include "bench_mesh.h"
+#include "bench_util.h"
+
+#define NUM_OBJECTS 6
+#define BALL_RINGS 30
+#define BALL_SEGMENTS 40
+
+static void place_sphere(RaytracedParametricObject3D* object, double radius, Vector3 center){
+    int types[4] = {SX, SY, SZ, TX};
+    double params[4] = {radius, radius, radius, center.x};
+    M3d_make_movement_sequence_matrix(object->transform, object->inverse, 4, types, params);
+    double translation[4][4];
+    double inverse[4][4];
+    M3d_make_translation(translation, 0, center.y, center.z);
+    M3d_make_translation(inverse, 0, -center.y, -center.z);
+    M3d_mat_mult(object->transform, translation, object->transform);
+    M3d_mat_mult(object->inverse, object->inverse, inverse);
+}
+
+/**
+ * @brief Pushes every third ring of a sphere from make_sphere_mesh in towards its center, moving the vertices
+ * in place. The poles and the equator stay where they are, so the bounds don't change
+ */
+static void dent_sphere_mesh(Mesh* mesh, int rings, int segments){
+    for(int r = 1; r < rings; r += 3){
+        for(int s = 0; s < segments; s++){
+            mesh->positions[r * segments + s] = vec3_scale(mesh->positions[r * segments + s], 0.9);
+        }
+    }
+    copy_positions_to_vertices(mesh);
+    compute_face_normals(mesh);
+    compute_triangle_records(mesh);
+    refit_mesh_bvh(mesh);
+}
+
+int main(int argc, char** argv){
+    int resolution = argc > 1 ? atoi(argv[1]) : 192;
+    int num_pixels = resolution * resolution;
+    G_choose_headless_display();
+    G_init_graphics(resolution, resolution);
+    set_raytrace_threads(1);
+    invert_shadows();
+
+    Mesh* ball = make_sphere_mesh(BALL_RINGS, BALL_SEGMENTS);
+    ball->material = (PhongMaterial){
+        .base_color={0.2, 0.4, 0.8},
+        .diffuse={0.2, 0.4, 0.8},
+        .specular={WHITE},
+        .shininess=40
+    };
+    ball->roughness = 0.6;
+    translate_mesh(ball, (Vector3){-0.9, 0, 0.5});
+
+    PhongMaterial shiny = {.base_color={0.8, 0.3, 0.3}, .diffuse={0.8, 0.3, 0.3}, .specular={WHITE}, .shininess=60};
+    RaytracedParametricObject3D objects[NUM_OBJECTS];
+    for(int o = 0; o < NUM_OBJECTS - 1; o++){
+        objects[o] = (RaytracedParametricObject3D){.object_type=SPHERE, .material=shiny, .roughness=0.7};
+        place_sphere(&objects[o], 0.2, (Vector3){-1.2 + 0.6 * o, -0.8, -1.2});
+    }
+    objects[NUM_OBJECTS - 1] = (RaytracedParametricObject3D){.object_type=PLANE, .roughness=0.8,
+        .material={.base_color={0.6, 0.6, 0.6}, .diffuse={0.6, 0.6, 0.6}, .specular={WHITE}, .shininess=5}};
+    int plane_types[1] = {TY};
+    double plane_params[1] = {-1};
+    M3d_make_movement_sequence_matrix(objects[NUM_OBJECTS - 1].transform, objects[NUM_OBJECTS - 1].inverse, 1, plane_types, plane_params);
+
+    Camera cam = {
+        .eye={0, 0.5, -4},
+        .coi={0, -0.3, 0},
+        .up={0, 1.5, -4},
+        .half_fov_degrees=30,
+        .near_clip_plane=0.01,
+        .far_clip_plane=100
+    };
+    make_camera_view_matrix(cam.view_matrix, cam.inverse_view_matrix, cam);
+    PhongLight light = {
+        .position={3, 5, -4},
+        .diffuse={WHITE},
+        .specular={WHITE}
+    };
+
+    int* reference = (int*)malloc(sizeof(int) * num_pixels);
+    int* frame = (int*)malloc(sizeof(int) * num_pixels);
+    if(reference == NULL || frame == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for frames\n");
+        exit(1);
+    }
+    HitCache cache = new_hit_cache(resolution, resolution);
+    const char* edits[] = {"first frame", "nothing", "smooth normals", "small sphere moved", "mesh moved",
+                           "mesh edited in place", "light moved", "camera moved"};
+    int num_edits = sizeof(edits) / sizeof(edits[0]);
+
+    printf("%dx%d, shadows on\n", resolution, resolution);
+    printf("%-20s %10s %12s %12s %10s\n", "edit", "retraced", "cached ms", "full ms", "differing");
+    for(int e = 0; e < num_edits; e++){
+        if(e == 2) invert_smooth_lighting_normals();
+        if(e == 3) place_sphere(&objects[4], 0.2, (Vector3){1.2, -0.8, -1.6});
+        if(e == 4) translate_mesh(ball, (Vector3){0, 0.2, 0});
+        if(e == 5) dent_sphere_mesh(ball, BALL_RINGS, BALL_SEGMENTS);
+        if(e == 6) light.position = (Vector3){-3, 5, -4};
+        if(e == 7) translate_camera(&cam, (Vector3){0.1, 0, 0}, GLOBAL);
+
+        G_rgb(0, 0, 0);
+        G_clear();
+        double start = now_seconds();
+        raytrace_scene(resolution, resolution, cam, objects, NUM_OBJECTS, ball, 1, false, &light, 1, 3);
+        double full_time = now_seconds() - start;
+        read_frame(reference, resolution);
+
+        G_rgb(0, 0, 0);
+        G_clear();
+        start = now_seconds();
+        int retraced = raytrace_scene_cached(&cache, cam, objects, NUM_OBJECTS, ball, 1, false, &light, 1, 3);
+        double cached_time = now_seconds() - start;
+        read_frame(frame, resolution);
+
+        int differing = 0;
+        for(int i = 0; i < num_pixels; i++) differing += frame[i] != reference[i];
+        printf("%-20s %10d %12.2f %12.2f %10d\n", edits[e], retraced, cached_time * 1000, full_time * 1000, differing);
+    }
+
+    free(reference);
+    free(frame);
+    delete_hit_cache(&cache);
+    delete_mesh(*ball);
+    free(ball);
+    return 0;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file deferred_bench.c
+ * @brief Draws twelve nested tori around a sphere under four lights, nearest first and farthest first,
+ * with forward and deferred shading. Prints the time per frame for each view mode and the pixels that differ between
+ * the two. Frames are drawn headless on the calling thread as triangles, with the LIT mode also drawn
+ * one pixel per sample.
+ *
+ * Usage: deferred_bench [resolution]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "FPToolkit.h"
+#include "M3d_matrix_tools.h"
+#include "parametric.h"
+#include "camera.h"
+#include "bench_util.h"
+
+#define NUM_SHAPES 13
+#define NUM_LIGHTS 4
+
+int main(int argc, char** argv){
+    int resolution = argc > 1 ? atoi(argv[1]) : 256;
+    int num_pixels = resolution * resolution;
+    G_choose_headless_display();
+    G_init_graphics(resolution, resolution);
+    TORUS_MAJOR_RADIUS = 1;
+    TORUS_MINOR_RADIUS = 0.25;
+
+    Camera cam = {
+        .eye={0, 0.5, -6},
+        .coi={0, 0, 0},
+        .up={0, 1.5, -6},
+        .half_fov_degrees=30,
+        .near_clip_plane=0.01,
+        .far_clip_plane=100
+    };
+    make_camera_view_matrix(cam.view_matrix, cam.inverse_view_matrix, cam);
+    // Several lights make every shaded sample cost more, as a lit scene would
+    PhongLight lights[NUM_LIGHTS];
+    for(int l = 0; l < NUM_LIGHTS; l++){
+        lights[l] = (PhongLight){
+            .position={6 * cos(l * M_PI / 2), 5, -4 + 3 * sin(l * M_PI / 2)},
+            .diffuse={0.5, 0.5, 0.5},
+            .specular={0.5, 0.5, 0.5}
+        };
+    }
+    PhongMaterial shiny = {.base_color={0.8, 0.3, 0.3}, .diffuse={0.8, 0.3, 0.3}, .specular={WHITE}, .shininess=60};
+    // The tori face the camera and shrink around a sphere, so from the front each pixel is covered many times
+    ParametricObject3D shapes[NUM_SHAPES];
+    for(int s = 0; s < NUM_SHAPES; s++){
+        bool sphere = s == NUM_SHAPES - 1;
+        shapes[s] = (ParametricObject3D){
+            .f=sphere ? param_sphere : param_torus,
+            .u_start=0, .u_end=2 * M_PI, .u_step=0.05,
+            .v_start=0, .v_end=sphere ? M_PI : 2 * M_PI, .v_step=0.05,
+            .material=shiny
+        };
+        double scale = sphere ? 0.3 : 2.0 - 0.14 * s;
+        int types[4] = {SX, SY, SZ, TZ};
+        double params[4] = {scale, scale, scale, 0.2 * s};
+        double inverse[4][4];
+        M3d_make_movement_sequence_matrix(shapes[s].transform, inverse, 4, types, params);
+    }
+
+    int* forward = (int*)malloc(sizeof(int) * num_pixels);
+    int* deferred = (int*)malloc(sizeof(int) * num_pixels);
+    double (*z_buffer)[resolution] = malloc(sizeof(double) * num_pixels);
+    if(forward == NULL || deferred == NULL || z_buffer == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for frames\n");
+        exit(1);
+    }
+
+    printf("%d objects, %dx%d\n", NUM_SHAPES, resolution, resolution);
+    printf("%-10s %-8s %-14s %12s %12s %10s\n", "drawing", "mode", "order", "forward ms", "deferred ms", "differing");
+    const char* mode_names[5] = {"LIT", "UNLIT", "Z_BUFF", "NORMAL", "UV"};
+    invert_rasterize_parametric_triangles();
+    for(int run = 0; run < 12; run++){
+        bool triangles = run < 10;
+        enum ViewMode mode = triangles ? (enum ViewMode)(run / 2) : LIT;
+        bool far_first = run % 2 == 1;
+        if(run == 10) invert_rasterize_parametric_triangles();
+        // Reversing the objects flips whether nearer surfaces are drawn before or after the ones they hide
+        for(int s = 0; s < NUM_SHAPES / 2 && run % 2 == 1; s++){
+            ParametricObject3D swap = shapes[s];
+            shapes[s] = shapes[NUM_SHAPES - 1 - s];
+            shapes[NUM_SHAPES - 1 - s] = swap;
+        }
+        // One frame first to fill the tessellation cache
+        draw_parametric_frame(shapes, NUM_SHAPES, cam, lights, NUM_LIGHTS, mode, resolution, z_buffer, forward);
+        double forward_time = draw_parametric_frame(shapes, NUM_SHAPES, cam, lights, NUM_LIGHTS, mode, resolution, z_buffer, forward);
+        invert_deferred_parametric_shading();
+        double deferred_time = draw_parametric_frame(shapes, NUM_SHAPES, cam, lights, NUM_LIGHTS, mode, resolution, z_buffer, deferred);
+        invert_deferred_parametric_shading();
+        int differing = 0;
+        for(int p = 0; p < num_pixels; p++) differing += forward[p] != deferred[p];
+        printf("%-10s %-8s %-14s %12.2f %12.2f %10d\n", triangles ? "triangles" : "samples", mode_names[mode],
+               far_first ? "farthest first" : "nearest first", forward_time * 1000, deferred_time * 1000, differing);
+        for(int s = 0; s < NUM_SHAPES / 2 && run % 2 == 1; s++){
+            ParametricObject3D swap = shapes[s];
+            shapes[s] = shapes[NUM_SHAPES - 1 - s];
+            shapes[NUM_SHAPES - 1 - s] = swap;
+        }
+    }
+
+    free(forward);
+    free(deferred);
+    free(z_buffer);
+    return 0;
+}
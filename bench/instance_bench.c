@@ -0,0 +1,101 @@
+/**
+ * @file instance_bench.c
+ * @brief Renders a field of instances of one mesh, walking the top level BVH over the instances
+ * against testing every instance in turn, and compares the memory the instances take with what
+ * baked copies of the mesh would. Frames are rendered headless on the calling thread and compared
+ * pixel for pixel.
+ *
+ * Usage: instance_bench [instances] [resolution]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "FPToolkit.h"
+#include "raytrace.h"
+#include "camera.h"
+#include "mesh.h"
+#include "bench_mesh.h"
+#include "bench_util.h"
+
+static double render_frame(int* pixels, int resolution, Camera cam, Mesh* meshes, int num_meshes, PhongLight* light){
+    double start = now_seconds();
+    G_rgb(0, 0, 0);
+    G_clear();
+    raytrace_scene(resolution, resolution, cam, NULL, 0, meshes, num_meshes, false, light, 1, 2);
+    double elapsed = now_seconds() - start;
+    read_frame(pixels, resolution);
+    return elapsed;
+}
+
+int main(int argc, char** argv){
+    int num_instances = argc > 1 ? atoi(argv[1]) : 500;
+    int resolution = argc > 2 ? atoi(argv[2]) : 128;
+    G_choose_headless_display();
+    G_init_graphics(resolution, resolution);
+    set_raytrace_threads(1);
+
+    Mesh* rock = make_sphere_mesh(60, 80);
+    rock->material = (PhongMaterial){
+        .base_color={0.5, 0.45, 0.4},
+        .diffuse={0.5, 0.45, 0.4},
+        .specular={WHITE},
+        .shininess=10
+    };
+    rock->roughness = 0.8;
+
+    // Scatter squashed and turned rocks over a square field
+    Mesh* instances = (Mesh*)malloc(sizeof(Mesh) * num_instances);
+    int* fast_frame = (int*)malloc(sizeof(int) * resolution * resolution);
+    int* slow_frame = (int*)malloc(sizeof(int) * resolution * resolution);
+    if(instances == NULL || fast_frame == NULL || slow_frame == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for instances\n");
+        exit(1);
+    }
+    int side = (int)ceil(sqrt(num_instances));
+    srand(1);
+    for(int i = 0; i < num_instances; i++){
+        instances[i] = instance_mesh(rock);
+        double size = 0.2 + 0.2 * rand() / RAND_MAX;
+        scale_mesh(&instances[i], (Vector3){size * 1.5, size * 0.6, size});
+        rotate_mesh_y_degrees(&instances[i], 360.0 * rand() / RAND_MAX);
+        translate_mesh(&instances[i], (Vector3){i % side - side / 2.0, 0, i / side - side / 2.0});
+    }
+
+    Camera cam = {
+        .eye={0, side * 0.6, -side * 0.9},
+        .coi={0, 0, 0},
+        .up={0, side * 0.6 + 1, -side * 0.9},
+        .half_fov_degrees=30,
+        .near_clip_plane=0.01,
+        .far_clip_plane=side * 10.0
+    };
+    make_camera_view_matrix(cam.view_matrix, cam.inverse_view_matrix, cam);
+    PhongLight light = {
+        .position={side, side * 2.0, -side},
+        .diffuse={WHITE},
+        .specular={WHITE}
+    };
+
+    double fast_time = render_frame(fast_frame, resolution, cam, instances, num_instances, &light);
+    invert_use_instance_bvh();
+    double slow_time = render_frame(slow_frame, resolution, cam, instances, num_instances, &light);
+    invert_use_instance_bvh();
+    int differing = 0;
+    for(int p = 0; p < resolution * resolution; p++) differing += fast_frame[p] != slow_frame[p];
+
+    size_t instanced_bytes = bench_mesh_bytes(rock) + num_instances * sizeof(Mesh);
+    size_t baked_bytes = num_instances * bench_mesh_bytes(rock);
+    printf("%d instances of %d triangles, %dx%d\n", num_instances, rock->num_tris, resolution, resolution);
+    printf("memory: %.1f MB instanced, %.1f MB as baked copies\n", instanced_bytes / 1e6, baked_bytes / 1e6);
+    printf("%-16s %12s %10s\n", "mode", "ms/frame", "speedup");
+    printf("%-16s %12.2f %10s\n", "every instance", slow_time * 1000, "1.00x");
+    printf("%-16s %12.2f %9.2fx\n", "instance bvh", fast_time * 1000, slow_time / fast_time);
+    printf("pixels differing: %d\n", differing);
+
+    free(instances);
+    free(fast_frame);
+    free(slow_frame);
+    delete_mesh(*rock);
+    free(rock);
+    return 0;
+}
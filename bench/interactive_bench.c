@@ -0,0 +1,100 @@
+/**
+ * @file interactive_bench.c
+ * @brief Drives an interactive render through a camera orbit followed by still frames, printing for
+ * every frame the time it took and the quality it was traced at, against the time of one full
+ * resolution, full bounce frame. Frames are rendered headless on the calling thread.
+ *
+ * Usage: interactive_bench [target ms] [moving frames] [still frames] [resolution]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "FPToolkit.h"
+#include "M3d_matrix_tools.h"
+#include "raytrace.h"
+#include "camera.h"
+#include "mesh.h"
+#include "framebuffer.h"
+#include "bench_mesh.h"
+#include "bench_util.h"
+
+int main(int argc, char** argv){
+    double target_ms = argc > 1 ? atof(argv[1]) : 20;
+    int moving_frames = argc > 2 ? atoi(argv[2]) : 12;
+    int still_frames = argc > 3 ? atoi(argv[3]) : 8;
+    int resolution = argc > 4 ? atoi(argv[4]) : 256;
+    G_choose_headless_display();
+    G_init_graphics(resolution, resolution);
+    set_raytrace_threads(1);
+    invert_shadows();
+
+    Mesh* ball = make_sphere_mesh(30, 40);
+    ball->material = (PhongMaterial){
+        .base_color={0.2, 0.4, 0.8},
+        .diffuse={0.2, 0.4, 0.8},
+        .specular={WHITE},
+        .shininess=40
+    };
+    ball->roughness = 0.3;
+    translate_mesh(ball, (Vector3){-0.8, 0, 0});
+    apply_mesh_transform(ball);
+
+    RaytracedParametricObject3D objects[2] = {
+        {.object_type=BOX, .roughness=0.5,
+         .material={.base_color={0.9, 0.6, 0.2}, .diffuse={0.9, 0.6, 0.2}, .specular={WHITE}, .shininess=20}},
+        {.object_type=PLANE, .roughness=0.4,
+         .material={.base_color={0.6, 0.6, 0.6}, .diffuse={0.6, 0.6, 0.6}, .specular={WHITE}, .shininess=5}}
+    };
+    int box_types[5] = {SX, SY, SZ, RY, TX};
+    double box_params[5] = {0.1, 0.9, 0.6, 30, 0.9};
+    M3d_make_movement_sequence_matrix(objects[0].transform, objects[0].inverse, 5, box_types, box_params);
+    int plane_types[1] = {TY};
+    double plane_params[1] = {-1};
+    M3d_make_movement_sequence_matrix(objects[1].transform, objects[1].inverse, 1, plane_types, plane_params);
+
+    Camera cam = {
+        .eye={0, 0.3, -4},
+        .coi={0, 0, 0},
+        .up={0, 1.3, -4},
+        .half_fov_degrees=30,
+        .near_clip_plane=0.01,
+        .far_clip_plane=100
+    };
+    make_camera_view_matrix(cam.view_matrix, cam.inverse_view_matrix, cam);
+    PhongLight light = {
+        .position={3, 5, -4},
+        .diffuse={WHITE},
+        .specular={WHITE}
+    };
+
+    double start = now_seconds();
+    G_rgb(0, 0, 0);
+    G_clear();
+    raytrace_scene(resolution, resolution, cam, objects, 2, ball, 1, false, &light, 1, 0);
+    double full_time = now_seconds() - start;
+    printf("%dx%d, target %.1f ms per frame, one full frame takes %.2f ms\n",
+           resolution, resolution, target_ms, full_time * 1000);
+    printf("%6s %8s %10s %11s %8s %9s\n", "frame", "camera", "ms", "pixel size", "bounces", "samples");
+
+    // Orbits the camera around the origin
+    double orbit[4][4];
+    M3d_make_y_rotation_cs(orbit, cos(3 * M_PI / 180), sin(3 * M_PI / 180));
+    InteractiveRender render = new_interactive_render(resolution, resolution, target_ms / 1000, 16);
+    double worst_moving = 0;
+    for(int frame = 0; frame < moving_frames + still_frames; frame++){
+        bool moving = frame < moving_frames;
+        if(moving) transform_camera(&cam, orbit);
+        start = now_seconds();
+        bool drawn = raytrace_scene_interactive(&render, cam, objects, 2, ball, 1, false, &light, 1, 0);
+        double frame_time = now_seconds() - start;
+        if(moving && frame > 0 && frame_time > worst_moving) worst_moving = frame_time;
+        printf("%6d %8s %10.2f %11d %8d %9d%s\n", frame, moving ? "moving" : "still", frame_time * 1000,
+               render.pixel_size, render.bounces, render.accumulation.passes, drawn ? "" : " (refined)");
+    }
+    printf("slowest moving frame after the first: %.2f ms\n", worst_moving * 1000);
+
+    delete_interactive_render(&render);
+    delete_mesh(*ball);
+    free(ball);
+    return 0;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file packet_bench.c
+ * @brief Measures raytrace_scene() with primary rays traced one at a time against packets traced
+ * with every vector instruction set this CPU supports, and checks that every packet frame matches
+ * the scalar one pixel for pixel. Frames are rendered headless on the calling thread.
+ *
+ * Usage: packet_bench [resolution] [mesh.ply]
+ * Without a .ply file a finely tessellated sphere is generated instead.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "FPToolkit.h"
+#include "raytrace.h"
+#include "raypacket.h"
+#include "camera.h"
+#include "mesh.h"
+#include "bench_mesh.h"
+#include "bench_util.h"
+
+// Each mode renders frames until it has been running for at least this long
+static const double TIME_BUDGET_SECONDS = 3.0;
+
+/**
+ * @brief Renders frames until the time budget runs out
+ *
+ * @return double Seconds per frame
+ */
+static double render_frames(int resolution, Camera cam, Mesh* mesh, PhongLight* light, int depth){
+    int frames = 0;
+    double start = now_seconds();
+    double elapsed;
+    do {
+        G_rgb(0, 0, 0);
+        G_clear();
+        raytrace_scene(resolution, resolution, cam, NULL, 0, mesh, 1, false, light, 1, depth);
+        frames++;
+        elapsed = now_seconds() - start;
+    } while(elapsed < TIME_BUDGET_SECONDS);
+    return elapsed / frames;
+}
+
+int main(int argc, char** argv){
+    int resolution = argc > 1 ? atoi(argv[1]) : 256;
+    G_choose_headless_display();
+    G_init_graphics(resolution, resolution);
+    set_raytrace_threads(1);
+
+    Mesh* mesh = argc > 2 ? get_mesh(argv[2]) : make_sphere_mesh(300, 340);
+    mesh->material = (PhongMaterial){
+        .base_color={GRAY},
+        .diffuse={GRAY},
+        .specular={WHITE},
+        .shininess=20
+    };
+    mesh->roughness = 0.5;
+
+    Vector3 center = vec3_scale(vec3_add(mesh->bounding_box_min, mesh->bounding_box_max), 0.5);
+    double radius = vec3_distance(mesh->bounding_box_min, mesh->bounding_box_max) / 2;
+    Camera cam = {
+        .eye=vec3_add(center, (Vector3){0, radius * 0.5, -radius * 2.5}),
+        .coi=center,
+        .up=vec3_add(center, VEC3_UP),
+        .half_fov_degrees=30,
+        .near_clip_plane=0.01,
+        .far_clip_plane=radius * 10
+    };
+    make_camera_view_matrix(cam.view_matrix, cam.inverse_view_matrix, cam);
+    PhongLight light = {
+        .position=vec3_add(cam.eye, (Vector3){radius, radius, 0}),
+        .diffuse={WHITE},
+        .specular={WHITE}
+    };
+
+    int* scalar_frame = (int*)malloc(sizeof(int) * resolution * resolution);
+    int* packet_frame = (int*)malloc(sizeof(int) * resolution * resolution);
+    if(scalar_frame == NULL || packet_frame == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for frames\n");
+        exit(1);
+    }
+
+    const char* isas[] = {"sse2", "avx2", "avx512", "generic"};
+    int depths[] = {1, 6};
+    printf("%d triangles, %dx%d frames, best instruction set %s\n", mesh->num_tris, resolution, resolution, ray_packet_isa());
+    printf("%-8s %-6s %12s %10s %16s\n", "mode", "depth", "ms/frame", "speedup", "pixels differing");
+    for(int d = 0; d < 2; d++){
+        invert_use_ray_packets();
+        double scalar_time = render_frames(resolution, cam, mesh, &light, depths[d]);
+        read_frame(scalar_frame, resolution);
+        invert_use_ray_packets();
+        printf("%-8s %-6d %12.2f %10s %16s\n", "scalar", depths[d], scalar_time * 1000, "1.00x", "-");
+
+        for(int i = 0; i < (int)(sizeof(isas) / sizeof(isas[0])); i++){
+            if(!set_ray_packet_isa(isas[i])) continue;
+            double time = render_frames(resolution, cam, mesh, &light, depths[d]);
+            read_frame(packet_frame, resolution);
+            int differing = 0;
+            for(int p = 0; p < resolution * resolution; p++) differing += packet_frame[p] != scalar_frame[p];
+            printf("%-8s %-6d %12.2f %9.2fx %16d\n", isas[i], depths[d], time * 1000, scalar_time / time, differing);
+        }
+    }
+
+    free(scalar_frame);
+    free(packet_frame);
+    delete_mesh(*mesh);
+    free(mesh);
+    return 0;
+}
@@ -0,0 +1,130 @@
+/**
+ * @file parametric_bench.c
+ * @brief Draws two spheres and two tori with the parametric rasterizer, plotting one pixel per sample
+ * and as scan converted triangles, at a few u/v steps. Prints the time per frame, the surface function
+ * evaluations, and the pixels covered by a finely tessellated reference but left empty, either as holes
+ * between samples or by the flat chords of a coarse tessellation. Then moves the camera away and compares
+ * fixed step samples with samples spaced adaptively on screen at each distance. Frames are drawn headless
+ * in the LIT view mode.
+ *
+ * Usage: parametric_bench [resolution]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "FPToolkit.h"
+#include "M3d_matrix_tools.h"
+#include "parametric.h"
+#include "camera.h"
+#include "bench_util.h"
+
+#define NUM_SHAPES 4
+
+static double draw_frame(ParametricObject3D* shapes, double step, Camera cam, PhongLight* light,
+                         int resolution, double (*z_buffer)[resolution], int* pixels){
+    for(int s = 0; s < NUM_SHAPES; s++){
+        shapes[s].u_step = step;
+        shapes[s].v_step = step;
+    }
+    // Every frame tessellates from scratch, so steps that were drawn before are not cheaper
+    clear_parametric_tessellations();
+    evaluations = 0;
+    return draw_parametric_frame(shapes, NUM_SHAPES, cam, light, 1, LIT, resolution, z_buffer, pixels);
+}
+
+int main(int argc, char** argv){
+    int resolution = argc > 1 ? atoi(argv[1]) : 256;
+    int num_pixels = resolution * resolution;
+    G_choose_headless_display();
+    G_init_graphics(resolution, resolution);
+    TORUS_MAJOR_RADIUS = 0.35;
+    TORUS_MINOR_RADIUS = 0.15;
+
+    Camera cam = {
+        .eye={0, 1.5, -3.5},
+        .coi={0, -0.5, 0},
+        .up={0, 2.5, -3.5},
+        .half_fov_degrees=30,
+        .near_clip_plane=0.01,
+        .far_clip_plane=100
+    };
+    make_camera_view_matrix(cam.view_matrix, cam.inverse_view_matrix, cam);
+    PhongLight light = {
+        .position={3, 5, -4},
+        .diffuse={WHITE},
+        .specular={WHITE}
+    };
+    PhongMaterial shiny = {.base_color={0.8, 0.3, 0.3}, .diffuse={0.8, 0.3, 0.3}, .specular={WHITE}, .shininess=60};
+    ParametricObject3D shapes[NUM_SHAPES];
+    for(int s = 0; s < NUM_SHAPES; s++){
+        bool sphere = s % 2 == 0;
+        shapes[s] = (ParametricObject3D){
+            .f=sphere ? counted_sphere : counted_torus,
+            .u_start=0, .u_end=2 * M_PI,
+            .v_start=0, .v_end=sphere ? M_PI : 2 * M_PI,
+            .material=shiny
+        };
+        int types[2] = {SX, TX};
+        double params[2] = {1, -1.5 + s};
+        double inverse[4][4];
+        M3d_make_movement_sequence_matrix(shapes[s].transform, inverse, 2, types, params);
+    }
+
+    int* reference = (int*)malloc(sizeof(int) * num_pixels);
+    int* frame = (int*)malloc(sizeof(int) * num_pixels);
+    double (*z_buffer)[resolution] = malloc(sizeof(double) * num_pixels);
+    if(reference == NULL || frame == NULL || z_buffer == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for frames\n");
+        exit(1);
+    }
+    invert_rasterize_parametric_triangles();
+    draw_frame(shapes, 0.01, cam, &light, resolution, z_buffer, reference);
+    invert_rasterize_parametric_triangles();
+
+    printf("%dx%d, missing pixels against triangles with a step of 0.01\n", resolution, resolution);
+    printf("%-12s %8s %12s %14s %8s\n", "mode", "step", "ms", "evaluations", "missing");
+    double splat_steps[3] = {0.02, 0.01, 0.004};
+    double triangle_steps[3] = {0.2, 0.1, 0.05};
+    for(int pass = 0; pass < 2; pass++){
+        bool triangles = pass == 1;
+        if(triangles) invert_rasterize_parametric_triangles();
+        for(int i = 0; i < 3; i++){
+            double step = triangles ? triangle_steps[i] : splat_steps[i];
+            double seconds = draw_frame(shapes, step, cam, &light, resolution, z_buffer, frame);
+            int missing = 0;
+            for(int p = 0; p < num_pixels; p++) missing += reference[p] != 0 && frame[p] == 0;
+            printf("%-12s %8.3f %12.2f %14ld %8d\n", triangles ? "triangles" : "samples", step, seconds * 1000, evaluations, missing);
+        }
+    }
+
+    invert_rasterize_parametric_triangles();
+    invert_adaptive_parametric_sampling();
+    double seconds = draw_frame(shapes, 0.01, cam, &light, resolution, z_buffer, frame);
+    int missing = 0;
+    for(int p = 0; p < num_pixels; p++) missing += reference[p] != 0 && frame[p] == 0;
+    printf("%-12s %8s %12.2f %14ld %8d\n", "adaptive", "-", seconds * 1000, evaluations, missing);
+
+    // Moving the camera away shrinks the shapes on screen, and adaptive sampling should shrink its work with them
+    printf("\n%-10s %10s %14s %12s %14s %12s\n", "distance", "covered", "fixed ms", "fixed evals", "adaptive ms", "adaptive evals");
+    double distances[4] = {1, 2, 4, 8};
+    for(int d = 0; d < 4; d++){
+        Camera far_cam = cam;
+        far_cam.eye = vec3_add(cam.coi, vec3_scale(vec3_sub(cam.eye, cam.coi), distances[d]));
+        far_cam.up = vec3_add(far_cam.eye, vec3_sub(cam.up, cam.eye));
+        make_camera_view_matrix(far_cam.view_matrix, far_cam.inverse_view_matrix, far_cam);
+        double adaptive_seconds = draw_frame(shapes, 0.01, far_cam, &light, resolution, z_buffer, frame);
+        long adaptive_evaluations = evaluations;
+        int covered = 0;
+        for(int p = 0; p < num_pixels; p++) covered += frame[p] != 0;
+        invert_adaptive_parametric_sampling();
+        double fixed_seconds = draw_frame(shapes, 0.01, far_cam, &light, resolution, z_buffer, frame);
+        invert_adaptive_parametric_sampling();
+        printf("%-10.0f %10d %14.2f %12ld %14.2f %12ld\n", distances[d], covered, fixed_seconds * 1000, evaluations,
+               adaptive_seconds * 1000, adaptive_evaluations);
+    }
+
+    free(reference);
+    free(frame);
+    free(z_buffer);
+    return 0;
+}
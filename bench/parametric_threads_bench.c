@@ -0,0 +1,106 @@
+/**
+ * @file parametric_threads_bench.c
+ * @brief Draws a scene of 24 parametric objects, rings of nested tori around spheres, serially and on the
+ * tile binned parametric thread pool with a few thread counts. Prints the time per frame and the pixels
+ * and z-buffer entries that differ from the serial frame, for samples, adaptive samples and triangles.
+ * Frames are drawn headless in the LIT view mode.
+ *
+ * Usage: parametric_threads_bench [resolution]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "FPToolkit.h"
+#include "M3d_matrix_tools.h"
+#include "parametric.h"
+#include "camera.h"
+#include "bench_util.h"
+
+#define NUM_SHAPES 24
+
+int main(int argc, char** argv){
+    int resolution = argc > 1 ? atoi(argv[1]) : 256;
+    int num_pixels = resolution * resolution;
+    G_choose_headless_display();
+    G_init_graphics(resolution, resolution);
+    TORUS_MAJOR_RADIUS = 0.35;
+    TORUS_MINOR_RADIUS = 0.08;
+
+    Camera cam = {
+        .eye={0, 2.5, -4.5},
+        .coi={0, 0, 0},
+        .up={0, 3.5, -4.5},
+        .half_fov_degrees=30,
+        .near_clip_plane=0.01,
+        .far_clip_plane=100
+    };
+    make_camera_view_matrix(cam.view_matrix, cam.inverse_view_matrix, cam);
+    PhongLight light = {
+        .position={3, 5, -4},
+        .diffuse={WHITE},
+        .specular={WHITE}
+    };
+    PhongMaterial shiny = {.base_color={0.8, 0.3, 0.3}, .diffuse={0.8, 0.3, 0.3}, .specular={WHITE}, .shininess=60};
+    // Six stacks of a sphere inside three nested tori, scaled up around it and turned to overlap
+    ParametricObject3D shapes[NUM_SHAPES];
+    for(int s = 0; s < NUM_SHAPES; s++){
+        int stack = s / 4, layer = s % 4;
+        bool sphere = layer == 0;
+        shapes[s] = (ParametricObject3D){
+            .f=sphere ? param_sphere : param_torus,
+            .u_start=0, .u_end=2 * M_PI, .u_step=0.02,
+            .v_start=0, .v_end=sphere ? M_PI : 2 * M_PI, .v_step=0.02,
+            .material=shiny
+        };
+        double scale = sphere ? 0.25 : 0.6 + 0.45 * layer;
+        int types[6] = {SX, SY, SZ, RX, TX, TZ};
+        double params[6] = {scale, scale, scale, 40.0 * layer, -2 + 2.0 * (stack % 3), -1 + 2.0 * (stack / 3)};
+        double inverse[4][4];
+        M3d_make_movement_sequence_matrix(shapes[s].transform, inverse, 6, types, params);
+    }
+
+    int* serial = (int*)malloc(sizeof(int) * num_pixels);
+    int* frame = (int*)malloc(sizeof(int) * num_pixels);
+    double (*serial_z)[resolution] = malloc(sizeof(double) * num_pixels);
+    double (*z_buffer)[resolution] = malloc(sizeof(double) * num_pixels);
+    if(serial == NULL || frame == NULL || serial_z == NULL || z_buffer == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for frames\n");
+        exit(1);
+    }
+
+    printf("%d objects, %dx%d\n", NUM_SHAPES, resolution, resolution);
+    printf("%-18s %8s %12s %10s %10s\n", "mode", "threads", "ms", "pixels", "depths");
+    const char* modes[3] = {"samples", "adaptive samples", "triangles"};
+    int thread_counts[4] = {1, 2, 4, 0};
+    for(int m = 0; m < 3; m++){
+        if(m == 1) invert_adaptive_parametric_sampling();
+        if(m == 2){
+            invert_adaptive_parametric_sampling();
+            invert_rasterize_parametric_triangles();
+        }
+        for(int t = 0; t < 4; t++){
+            set_parametric_threads(thread_counts[t]);
+            // A frame to fill the tessellation cache, so only drawing is timed
+            draw_parametric_frame(shapes, NUM_SHAPES, cam, &light, 1, LIT, resolution, z_buffer, frame);
+            bool is_serial = thread_counts[t] == 1;
+            double seconds = draw_parametric_frame(shapes, NUM_SHAPES, cam, &light, 1, LIT, resolution, is_serial ? serial_z : z_buffer, is_serial ? serial : frame);
+            int differing_pixels = 0, differing_depths = 0;
+            if(!is_serial){
+                for(int p = 0; p < num_pixels; p++) differing_pixels += frame[p] != serial[p];
+                for(int x = 0; x < resolution; x++){
+                    for(int y = 0; y < resolution; y++) differing_depths += z_buffer[x][y] != serial_z[x][y];
+                }
+            }
+            char threads[16];
+            if(thread_counts[t] > 0) snprintf(threads, sizeof(threads), "%d", thread_counts[t]);
+            else snprintf(threads, sizeof(threads), "all");
+            printf("%-18s %8s %12.2f %10d %10d\n", modes[m], threads, seconds * 1000, differing_pixels, differing_depths);
+        }
+    }
+
+    free(serial);
+    free(frame);
+    free(serial_z);
+    free(z_buffer);
+    return 0;
+}
@@ -0,0 +1,109 @@
+/**
+ * @file primitive_bench.c
+ * @brief Renders a torus standing on a ground plane as analytic objects, and again as a tessellated
+ * torus mesh on a grid mesh at a few tessellation levels, comparing the time per frame and the memory
+ * each takes. Frames are rendered headless on the calling thread with shadows on.
+ *
+ * Usage: primitive_bench [resolution]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "FPToolkit.h"
+#include "M3d_matrix_tools.h"
+#include "raytrace.h"
+#include "camera.h"
+#include "mesh.h"
+#include "parametric.h"
+#include "bench_mesh.h"
+#include "bench_util.h"
+
+static double render_frame(int resolution, Camera cam, RaytracedParametricObject3D* objs, int num_objs,
+                           Mesh* meshes, int num_meshes, PhongLight* light){
+    double start = now_seconds();
+    G_rgb(0, 0, 0);
+    G_clear();
+    raytrace_scene(resolution, resolution, cam, objs, num_objs, meshes, num_meshes, false, light, 1, 2);
+    return now_seconds() - start;
+}
+
+int main(int argc, char** argv){
+    int resolution = argc > 1 ? atoi(argv[1]) : 128;
+    G_choose_headless_display();
+    G_init_graphics(resolution, resolution);
+    set_raytrace_threads(1);
+    invert_shadows();
+    TORUS_MAJOR_RADIUS = 0.7;
+    TORUS_MINOR_RADIUS = 0.3;
+
+    PhongMaterial torus_material = {
+        .base_color={0.8, 0.5, 0.2},
+        .diffuse={0.8, 0.5, 0.2},
+        .specular={WHITE},
+        .shininess=40
+    };
+    PhongMaterial ground_material = {
+        .base_color={0.4, 0.6, 0.4},
+        .diffuse={0.4, 0.6, 0.4},
+        .specular={WHITE},
+        .shininess=5
+    };
+
+    // The ring of param_torus lies in the xy plane, so the torus stands on its edge facing the camera
+    RaytracedParametricObject3D objects[2] = {
+        {.object_type=TORUS, .material=torus_material, .roughness=0.7},
+        {.object_type=PLANE, .material=ground_material, .roughness=0.9}
+    };
+    int torus_types[1] = {TY};
+    double torus_params[1] = {0};
+    M3d_make_movement_sequence_matrix(objects[0].transform, objects[0].inverse, 1, torus_types, torus_params);
+    int ground_types[1] = {TY};
+    double ground_params[1] = {-1};
+    M3d_make_movement_sequence_matrix(objects[1].transform, objects[1].inverse, 1, ground_types, ground_params);
+
+    Camera cam = {
+        .eye={0, 0.5, -3},
+        .coi={0, 0, 0},
+        .up={0, 1.5, -3},
+        .half_fov_degrees=30,
+        .near_clip_plane=0.01,
+        .far_clip_plane=100
+    };
+    make_camera_view_matrix(cam.view_matrix, cam.inverse_view_matrix, cam);
+    PhongLight light = {
+        .position={3, 5, -4},
+        .diffuse={WHITE},
+        .specular={WHITE}
+    };
+
+    double analytic_time = render_frame(resolution, cam, objects, 2, NULL, 0, &light);
+    printf("torus on a ground plane, %dx%d, shadows on\n", resolution, resolution);
+    printf("%-22s %10s %12s %12s\n", "geometry", "triangles", "memory KB", "ms/frame");
+    printf("%-22s %10d %12.1f %12.2f\n", "analytic objects", 0, sizeof(objects) / 1e3, analytic_time * 1000);
+
+    int levels[3] = {32, 128, 512};
+    for(int l = 0; l < 3; l++){
+        Mesh meshes[2];
+        Mesh* torus = make_torus_mesh(levels[l], levels[l] * 2);
+        Mesh* ground = make_grid_mesh(1, 50);
+        meshes[0] = *torus;
+        meshes[1] = *ground;
+        meshes[0].material = torus_material;
+        meshes[0].roughness = 0.7;
+        meshes[1].material = ground_material;
+        meshes[1].roughness = 0.9;
+        translate_mesh(&meshes[1], (Vector3){0, -1, 0});
+        apply_mesh_transform(&meshes[1]);
+        double mesh_time = render_frame(resolution, cam, NULL, 0, meshes, 2, &light);
+
+        char name[32];
+        snprintf(name, sizeof(name), "meshes, %d rings", levels[l]);
+        printf("%-22s %10d %12.1f %12.2f\n", name, meshes[0].num_tris + meshes[1].num_tris,
+               (bench_mesh_bytes(&meshes[0]) + bench_mesh_bytes(&meshes[1])) / 1e3, mesh_time * 1000);
+        delete_mesh(meshes[0]);
+        delete_mesh(meshes[1]);
+        free(torus);
+        free(ground);
+    }
+    return 0;
+}
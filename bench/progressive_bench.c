@@ -0,0 +1,134 @@
+/**
+ * @file progressive_bench.c
+ * @brief Accumulates passes of a progressive render and measures how fast the image converges: after
+ * every doubling of the sample count it prints the time taken so far and the root mean square error
+ * against a reference accumulated with many more samples. Also checks that the first pass matches
+ * raytrace_scene exactly. Frames are rendered headless on the calling thread.
+ *
+ * Usage: progressive_bench [max samples] [reference samples] [resolution]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "FPToolkit.h"
+#include "M3d_matrix_tools.h"
+#include "raytrace.h"
+#include "camera.h"
+#include "mesh.h"
+#include "framebuffer.h"
+#include "bench_mesh.h"
+#include "bench_util.h"
+
+/**
+ * @brief Gets the average of a pixel of an accumulation buffer, as present_accumulation_buffer draws it
+ * over a black background
+ */
+static Color3 average(const AccumulationBuffer* accumulation, int i){
+    if(accumulation->samples[i] == 0) return (Color3){BLACK};
+    return vec3_scale(accumulation->sums[i], 1.0 / accumulation->samples[i]);
+}
+
+static double rms_error(const AccumulationBuffer* accumulation, const AccumulationBuffer* reference){
+    double sum = 0;
+    int num_pixels = accumulation->width * accumulation->height;
+    for(int i = 0; i < num_pixels; i++){
+        Color3 difference = vec3_sub(average(accumulation, i), average(reference, i));
+        sum += vec3_dot_prod(difference, difference) / 3;
+    }
+    return sqrt(sum / num_pixels);
+}
+
+int main(int argc, char** argv){
+    int max_samples = argc > 1 ? atoi(argv[1]) : 64;
+    int reference_samples = argc > 2 ? atoi(argv[2]) : 512;
+    int resolution = argc > 3 ? atoi(argv[3]) : 96;
+    G_choose_headless_display();
+    G_init_graphics(resolution, resolution);
+    set_raytrace_threads(1);
+
+    Mesh* ball = make_sphere_mesh(30, 40);
+    ball->material = (PhongMaterial){
+        .base_color={0.2, 0.4, 0.8},
+        .diffuse={0.2, 0.4, 0.8},
+        .specular={WHITE},
+        .shininess=40
+    };
+    ball->roughness = 0.6;
+    translate_mesh(ball, (Vector3){-0.8, 0, 0});
+    apply_mesh_transform(ball);
+
+    // A thin box and a plane seen at a grazing angle give plenty of hard edges to alias
+    RaytracedParametricObject3D objects[2] = {
+        {.object_type=BOX, .roughness=0.8,
+         .material={.base_color={0.9, 0.6, 0.2}, .diffuse={0.9, 0.6, 0.2}, .specular={WHITE}, .shininess=20}},
+        {.object_type=PLANE, .roughness=0.9,
+         .material={.base_color={0.6, 0.6, 0.6}, .diffuse={0.6, 0.6, 0.6}, .specular={WHITE}, .shininess=5}}
+    };
+    int box_types[5] = {SX, SY, SZ, RY, TX};
+    double box_params[5] = {0.1, 0.9, 0.6, 30, 0.9};
+    M3d_make_movement_sequence_matrix(objects[0].transform, objects[0].inverse, 5, box_types, box_params);
+    int plane_types[1] = {TY};
+    double plane_params[1] = {-1};
+    M3d_make_movement_sequence_matrix(objects[1].transform, objects[1].inverse, 1, plane_types, plane_params);
+
+    Camera cam = {
+        .eye={0, 0.3, -4},
+        .coi={0, 0, 0},
+        .up={0, 1.3, -4},
+        .half_fov_degrees=30,
+        .near_clip_plane=0.01,
+        .far_clip_plane=100
+    };
+    make_camera_view_matrix(cam.view_matrix, cam.inverse_view_matrix, cam);
+    PhongLight light = {
+        .position={3, 5, -4},
+        .diffuse={WHITE},
+        .specular={WHITE}
+    };
+
+    AccumulationBuffer reference = new_accumulation_buffer(resolution, resolution);
+    for(int pass = 0; pass < reference_samples; pass++){
+        raytrace_scene_pass(&reference, cam, objects, 2, ball, 1, false, &light, 1, 2);
+    }
+
+    // The first pass must sample exactly the rays of raytrace_scene
+    AccumulationBuffer accumulation = new_accumulation_buffer(resolution, resolution);
+    raytrace_scene_pass(&accumulation, cam, objects, 2, ball, 1, false, &light, 1, 2);
+    G_rgb(0, 0, 0);
+    G_clear();
+    present_accumulation_buffer(&accumulation);
+    int* first_pass = (int*)malloc(sizeof(int) * resolution * resolution);
+    if(first_pass == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for frames\n");
+        exit(1);
+    }
+    read_frame(first_pass, resolution);
+    G_rgb(0, 0, 0);
+    G_clear();
+    raytrace_scene(resolution, resolution, cam, objects, 2, ball, 1, false, &light, 1, 2);
+    int differing = 0;
+    for(int y = 0; y < resolution; y++){
+        for(int x = 0; x < resolution; x++) differing += first_pass[y * resolution + x] != G_get_pixel(x, y);
+    }
+
+    printf("%dx%d, error against %d samples per pixel\n", resolution, resolution, reference_samples);
+    printf("%8s %12s %12s\n", "samples", "ms total", "rms error");
+    clear_accumulation_buffer(&accumulation);
+    double elapsed = 0;
+    for(int samples = 1; samples <= max_samples; samples++){
+        double start = now_seconds();
+        raytrace_scene_pass(&accumulation, cam, objects, 2, ball, 1, false, &light, 1, 2);
+        elapsed += now_seconds() - start;
+        if((samples & (samples - 1)) == 0){
+            printf("%8d %12.2f %12.5f\n", samples, elapsed * 1000, rms_error(&accumulation, &reference));
+        }
+    }
+    printf("first pass pixels differing from raytrace_scene: %d\n", differing);
+
+    free(first_pass);
+    delete_accumulation_buffer(&accumulation);
+    delete_accumulation_buffer(&reference);
+    delete_mesh(*ball);
+    free(ball);
+    return 0;
+}
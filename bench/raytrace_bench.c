@@ -0,0 +1,179 @@
+/**
+ * @file raytrace_bench.c
+ * @brief Measures mesh ray throughput of raytrace() with and without the mesh BVH, with the
+ * packed triangle records against the pointer based triangles, and with shadow rays. Where the
+ * kernel allows it, last level cache misses per ray are read from the hardware counters too.
+ *
+ * Usage: raytrace_bench [resolution] [mesh.ply]
+ * Without a .ply file a finely tessellated sphere is generated instead.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "raytrace.h"
+#include "camera.h"
+#include "mesh.h"
+#include "matrix.h"
+#include "trig.h"
+#include "M3d_matrix_tools.h"
+#include "bench_mesh.h"
+#include "bench_util.h"
+
+// Each mode stops early once it has been tracing for this long
+static const double TIME_BUDGET_SECONDS = 5.0;
+
+/**
+ * @brief Opens a counter of this thread's last level cache misses
+ *
+ * @return int The counter's file descriptor, or -1 if counters aren't available
+ */
+static int open_cache_miss_counter(){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static bool use_bvh = true;
+static bool use_records = true;
+static bool use_shadows = false;
+
+static void set_mode(bool bvh, bool records, bool shadows){
+    if(bvh != use_bvh) invert_use_mesh_bvh();
+    if(records != use_records) invert_use_triangle_records();
+    if(shadows != use_shadows) invert_shadows();
+    use_bvh = bvh;
+    use_records = records;
+    use_shadows = shadows;
+}
+
+/**
+ * @brief Traces rays through the pixels of the frame in a scattered order until every pixel is
+ * traced or the time budget runs out
+ *
+ * @return double rays per second
+ */
+static double trace_rays(Camera cam, Mesh* mesh, PhongLight* lights, int num_lights,
+                         int resolution, int depth, int* rays_out, int* hits_out, long long* misses_out){
+    double film_extent = tan(to_radians(cam.half_fov_degrees));
+    int num_pixels = resolution * resolution;
+    int hits = 0;
+    int rays = 0;
+    int counter = open_cache_miss_counter();
+    if(counter >= 0){
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    double start = now_seconds();
+    double elapsed = 0;
+
+    for(int i = 0; i < num_pixels; i++){
+        // 7919 is prime so this visits every pixel once, spread over the whole frame
+        int pixel = (int)(((long)i * 7919) % num_pixels);
+        int x = pixel % resolution;
+        int y = pixel / resolution;
+        Vector3 pixel_camera_space = {
+            ((x - (resolution / 2.0)) / resolution) * (film_extent * 2),
+            ((y - (resolution / 2.0)) / resolution) * (film_extent * 2),
+            1
+        };
+        Ray ray = {
+            .origin=cam.eye,
+            .direction=vec3_sub(mat4_mult_point(pixel_camera_space, cam.inverse_view_matrix), cam.eye)
+        };
+        RayHitInfo hit;
+        if(raytrace(&hit, ray, depth, NULL, 0, mesh, 1, false, lights, num_lights)) hits++;
+        rays++;
+
+        if((rays & 63) == 0){
+            elapsed = now_seconds() - start;
+            if(elapsed > TIME_BUDGET_SECONDS) break;
+        }
+    }
+    elapsed = now_seconds() - start;
+    *misses_out = -1;
+    if(counter >= 0){
+        long long misses;
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if(read(counter, &misses, sizeof(misses)) == sizeof(misses)) *misses_out = misses;
+        close(counter);
+    }
+    *rays_out = rays;
+    *hits_out = hits;
+    return rays / elapsed;
+}
+
+int main(int argc, char** argv){
+    int resolution = argc > 1 ? atoi(argv[1]) : 256;
+
+    double build_start = now_seconds();
+    Mesh* mesh = argc > 2 ? get_mesh(argv[2]) : make_sphere_mesh(300, 340);
+    double build_time = now_seconds() - build_start;
+    mesh->material = (PhongMaterial){
+        .base_color={GRAY},
+        .diffuse={GRAY},
+        .specular={WHITE},
+        .shininess=20
+    };
+    mesh->roughness = 0.5;
+
+    Vector3 center = vec3_scale(vec3_add(mesh->bounding_box_min, mesh->bounding_box_max), 0.5);
+    double radius = vec3_distance(mesh->bounding_box_min, mesh->bounding_box_max) / 2;
+    Camera cam = {
+        .eye=vec3_add(center, (Vector3){0, radius * 0.5, -radius * 2.5}),
+        .coi=center,
+        .up=vec3_add(center, VEC3_UP),
+        .half_fov_degrees=30,
+        .near_clip_plane=0.01,
+        .far_clip_plane=radius * 10
+    };
+    make_camera_view_matrix(cam.view_matrix, cam.inverse_view_matrix, cam);
+    PhongLight light = {
+        .position=vec3_add(cam.eye, (Vector3){radius, radius, 0}),
+        .diffuse={WHITE},
+        .specular={WHITE}
+    };
+
+    printf("%d triangles, %d BVH nodes, load + build %.3fs\n", mesh->num_tris, mesh->bvh.num_nodes, build_time);
+    printf("%-10s %-6s %10s %10s %14s %14s\n", "mode", "depth", "rays", "hits", "rays/sec", "misses/ray");
+
+    // "tris" follows the vertex pointers of mesh->tris, the others read the packed triangle records.
+    // "shadow" also traces an any-hit shadow ray to the light from every lit hit
+    struct { const char* name; bool bvh; bool records; bool shadows; } modes[] = {
+        {"bvh", true, true, false},
+        {"bvh-tris", true, false, false},
+        {"linear", false, true, false},
+        {"bvh-shadow", true, true, true}
+    };
+    int num_modes = sizeof(modes) / sizeof(modes[0]);
+    int depths[] = {1, 6};
+    for(int d = 0; d < 2; d++){
+        double rates[4];
+        for(int m = 0; m < num_modes; m++){
+            int rays, hits;
+            long long misses;
+            set_mode(modes[m].bvh, modes[m].records, modes[m].shadows);
+            rates[m] = trace_rays(cam, mesh, &light, 1, resolution, depths[d], &rays, &hits, &misses);
+            printf("%-10s %-6d %10d %10d %14.0f ", modes[m].name, depths[d], rays, hits, rates[m]);
+            if(misses >= 0) printf("%14.2f\n", (double)misses / rays);
+            else printf("%14s\n", "n/a");
+        }
+        printf("depth %d: records %.2fx faster than tris, bvh %.1fx faster than linear, shadows cost %.2fx\n",
+               depths[d], rates[0] / rates[1], rates[0] / rates[2], rates[0] / rates[3]);
+    }
+    set_mode(true, true, false);
+
+    delete_mesh(*mesh);
+    free(mesh);
+    return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file sphere_bench.c
+ * @brief Renders a cloud of sphere objects, walking the BVH over the objects against testing every
+ * object on every ray, with shadows on so that shadow rays go through the objects as well. Frames are
+ * rendered headless on the calling thread and compared pixel for pixel.
+ *
+ * Usage: sphere_bench [spheres] [resolution]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "FPToolkit.h"
+#include "M3d_matrix_tools.h"
+#include "raytrace.h"
+#include "camera.h"
+#include "bench_util.h"
+
+static double random_between(double low, double high){
+    return low + (high - low) * rand() / RAND_MAX;
+}
+
+static double render_frame(int* pixels, int resolution, Camera cam, RaytracedParametricObject3D* objs, int num_objs, PhongLight* light){
+    double start = now_seconds();
+    G_rgb(0, 0, 0);
+    G_clear();
+    raytrace_scene(resolution, resolution, cam, objs, num_objs, NULL, 0, true, light, 1, 2);
+    double elapsed = now_seconds() - start;
+    read_frame(pixels, resolution);
+    return elapsed;
+}
+
+int main(int argc, char** argv){
+    int num_spheres = argc > 1 ? atoi(argv[1]) : 10000;
+    int resolution = argc > 2 ? atoi(argv[2]) : 96;
+    G_choose_headless_display();
+    G_init_graphics(resolution, resolution);
+    set_raytrace_threads(1);
+    invert_shadows();
+
+    RaytracedParametricObject3D* spheres = (RaytracedParametricObject3D*)malloc(sizeof(RaytracedParametricObject3D) * num_spheres);
+    int* fast_frame = (int*)malloc(sizeof(int) * resolution * resolution);
+    int* slow_frame = (int*)malloc(sizeof(int) * resolution * resolution);
+    if(spheres == NULL || fast_frame == NULL || slow_frame == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for spheres\n");
+        exit(1);
+    }
+    // Scatter small stretched particles through a cube, sized so that they cover a fair share of the frame
+    double half_side = cbrt((double)num_spheres) * 0.5;
+    srand(1);
+    for(int i = 0; i < num_spheres; i++){
+        double size = random_between(0.05, 0.15);
+        int types[7] = {SX, SY, SZ, RY, TX, TY, TZ};
+        double params[7] = {
+            size * random_between(1, 2), size, size,
+            random_between(0, 180),
+            random_between(-half_side, half_side),
+            random_between(-half_side, half_side),
+            random_between(-half_side, half_side)
+        };
+        M3d_make_movement_sequence_matrix(spheres[i].transform, spheres[i].inverse, 7, types, params);
+
+        spheres[i].object_type = SPHERE;
+        spheres[i].f = NULL;
+        spheres[i].material = (PhongMaterial){
+            .base_color={random_between(0.2, 1), random_between(0.2, 1), random_between(0.2, 1)},
+            .diffuse={0.6, 0.6, 0.6},
+            .specular={WHITE},
+            .shininess=30
+        };
+        spheres[i].material.diffuse = spheres[i].material.base_color;
+        spheres[i].roughness = 0.7;
+    }
+
+    Camera cam = {
+        .eye={0, half_side * 0.5, -half_side * 3},
+        .coi={0, 0, 0},
+        .up={0, half_side * 0.5 + 1, -half_side * 3},
+        .half_fov_degrees=30,
+        .near_clip_plane=0.01,
+        .far_clip_plane=half_side * 10
+    };
+    make_camera_view_matrix(cam.view_matrix, cam.inverse_view_matrix, cam);
+    PhongLight light = {
+        .position={half_side * 2, half_side * 3, -half_side * 2},
+        .diffuse={WHITE},
+        .specular={WHITE}
+    };
+
+    double fast_time = render_frame(fast_frame, resolution, cam, spheres, num_spheres, &light);
+    invert_use_object_bvh();
+    double slow_time = render_frame(slow_frame, resolution, cam, spheres, num_spheres, &light);
+    invert_use_object_bvh();
+    int differing = 0;
+    for(int p = 0; p < resolution * resolution; p++) differing += fast_frame[p] != slow_frame[p];
+
+    printf("%d spheres, %dx%d, shadows on\n", num_spheres, resolution, resolution);
+    printf("%-16s %12s %10s\n", "mode", "ms/frame", "speedup");
+    printf("%-16s %12.2f %10s\n", "every object", slow_time * 1000, "1.00x");
+    printf("%-16s %12.2f %9.2fx\n", "object bvh", fast_time * 1000, slow_time / fast_time);
+    printf("pixels differing: %d\n", differing);
+
+    free(spheres);
+    free(fast_frame);
+    free(slow_frame);
+    return 0;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file tessellation_bench.c
+ * @brief Orbits the camera around two spheres and two tori drawn with the parametric rasterizer, with
+ * tessellations cached across frames and evaluated again every frame, both plotting one pixel per sample
+ * and as triangles. Prints the time of the first frame and the average of the rest, the surface function
+ * evaluations, and the pixels that differ between the cached and uncached frames. Frames are drawn
+ * headless in the LIT view mode.
+ *
+ * Usage: tessellation_bench [frames] [resolution]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "FPToolkit.h"
+#include "M3d_matrix_tools.h"
+#include "parametric.h"
+#include "camera.h"
+#include "bench_util.h"
+
+#define NUM_SHAPES 4
+
+int main(int argc, char** argv){
+    int num_frames = argc > 1 ? atoi(argv[1]) : 8;
+    int resolution = argc > 2 ? atoi(argv[2]) : 256;
+    int num_pixels = resolution * resolution;
+    G_choose_headless_display();
+    G_init_graphics(resolution, resolution);
+    TORUS_MAJOR_RADIUS = 0.35;
+    TORUS_MINOR_RADIUS = 0.15;
+
+    Camera start_cam = {
+        .eye={0, 1.5, -3.5},
+        .coi={0, -0.5, 0},
+        .up={0, 2.5, -3.5},
+        .half_fov_degrees=30,
+        .near_clip_plane=0.01,
+        .far_clip_plane=100
+    };
+    make_camera_view_matrix(start_cam.view_matrix, start_cam.inverse_view_matrix, start_cam);
+    PhongLight light = {
+        .position={3, 5, -4},
+        .diffuse={WHITE},
+        .specular={WHITE}
+    };
+    PhongMaterial shiny = {.base_color={0.8, 0.3, 0.3}, .diffuse={0.8, 0.3, 0.3}, .specular={WHITE}, .shininess=60};
+    ParametricObject3D shapes[NUM_SHAPES];
+    for(int s = 0; s < NUM_SHAPES; s++){
+        bool sphere = s % 2 == 0;
+        shapes[s] = (ParametricObject3D){
+            .f=sphere ? counted_sphere : counted_torus,
+            .u_start=0, .u_end=2 * M_PI,
+            .v_start=0, .v_end=sphere ? M_PI : 2 * M_PI,
+            .material=shiny
+        };
+        int types[2] = {SX, TX};
+        double params[2] = {1, -1.5 + s};
+        double inverse[4][4];
+        M3d_make_movement_sequence_matrix(shapes[s].transform, inverse, 2, types, params);
+    }
+
+    int* uncached = (int*)malloc(sizeof(int) * num_pixels * num_frames);
+    int* frame = (int*)malloc(sizeof(int) * num_pixels);
+    double (*z_buffer)[resolution] = malloc(sizeof(double) * num_pixels);
+    if(uncached == NULL || frame == NULL || z_buffer == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for frames\n");
+        exit(1);
+    }
+    // Each frame orbits the camera a little further around the shapes
+    double orbit[4][4], unused[4][4];
+    int orbit_types[1] = {RY};
+    double orbit_params[1] = {5};
+    M3d_make_movement_sequence_matrix(orbit, unused, 1, orbit_types, orbit_params);
+
+    printf("%dx%d, %d frames orbiting the camera\n", resolution, resolution, num_frames);
+    printf("%-12s %8s %-8s %14s %14s %14s %10s\n", "mode", "step", "cache", "first ms", "later ms", "evaluations", "differing");
+    double steps[2] = {0.01, 0.05};
+    for(int pass = 0; pass < 2; pass++){
+        bool triangles = pass == 1;
+        if(triangles) invert_rasterize_parametric_triangles();
+        for(int s = 0; s < NUM_SHAPES; s++){
+            shapes[s].u_step = steps[pass];
+            shapes[s].v_step = steps[pass];
+        }
+        for(int cached = 0; cached < 2; cached++){
+            if(USE_TESSELLATION_CACHE != (cached == 1)) invert_use_tessellation_cache();
+            clear_parametric_tessellations();
+            Camera cam = start_cam;
+            double first_time = 0, later_time = 0;
+            int differing = 0;
+            evaluations = 0;
+            for(int f = 0; f < num_frames; f++){
+                int* pixels = cached ? frame : uncached + (size_t)f * num_pixels;
+                double seconds = draw_parametric_frame(shapes, NUM_SHAPES, cam, &light, 1, LIT, resolution, z_buffer, pixels);
+                if(f == 0) first_time = seconds;
+                else later_time += seconds;
+                if(cached){
+                    for(int p = 0; p < num_pixels; p++) differing += frame[p] != uncached[(size_t)f * num_pixels + p];
+                }
+                transform_camera(&cam, orbit);
+            }
+            char differing_text[16] = "-";
+            if(cached) snprintf(differing_text, sizeof(differing_text), "%d", differing);
+            printf("%-12s %8.3f %-8s %14.2f %14.2f %14ld %10s\n", triangles ? "triangles" : "samples", steps[pass],
+                   cached ? "on" : "off", first_time * 1000, num_frames > 1 ? later_time * 1000 / (num_frames - 1) : 0,
+                   evaluations, differing_text);
+        }
+    }
+
+    free(uncached);
+    free(frame);
+    free(z_buffer);
+    return 0;
+}
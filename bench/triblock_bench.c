@@ -0,0 +1,128 @@
+/**
+ * @file triblock_bench.c
+ * @brief Measures closest hit queries against one mesh with the BVH leaves tested one triangle at a
+ * time against leaves packed into 8 and 16 wide triangle blocks, and checks every block hit against
+ * the scalar one. The rays start on a sphere around the mesh and aim at random points inside its
+ * bounding box, so they are as incoherent as reflection rays.
+ *
+ * Usage: triblock_bench [num_rays] [mesh.ply]
+ * Without a .ply file a finely tessellated sphere is generated instead.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "raytrace.h"
+#include "triblock.h"
+#include "mesh.h"
+#include "bench_mesh.h"
+#include "bench_util.h"
+
+// Each mode traces the rays over and over until it has been running for at least this long
+static const double TIME_BUDGET_SECONDS = 2.0;
+
+typedef struct {
+    bool hit;
+    int triangle;
+    double t;
+    Vector2 barycentric;
+} Hit;
+
+static double random_unit(unsigned int* state){
+    *state = *state * 1664525u + 1013904223u;
+    return (*state >> 8) / (double)(1 << 24);
+}
+
+static Vector3 random_in_box(unsigned int* state, Vector3 min, Vector3 max){
+    return (Vector3){
+        min.x + (max.x - min.x) * random_unit(state),
+        min.y + (max.y - min.y) * random_unit(state),
+        min.z + (max.z - min.z) * random_unit(state)
+    };
+}
+
+/**
+ * @brief Traces every ray until the time budget runs out, keeping the hits of the last pass
+ *
+ * @return double Rays per second
+ */
+static double trace_rays(Hit* hits, const Ray* rays, int num_rays, Mesh* mesh){
+    long traced = 0;
+    double start = now_seconds();
+    double elapsed;
+    do {
+        for(int i = 0; i < num_rays; i++){
+            Hit* hit = &hits[i];
+            hit->hit = raytrace_mesh(&hit->triangle, &hit->t, &hit->barycentric, INFINITY, rays[i], mesh);
+        }
+        traced += num_rays;
+        elapsed = now_seconds() - start;
+    } while(elapsed < TIME_BUDGET_SECONDS);
+    return traced / elapsed;
+}
+
+int main(int argc, char** argv){
+    int num_rays = argc > 1 ? atoi(argv[1]) : 100000;
+    Mesh* mesh = argc > 2 ? get_mesh(argv[2]) : make_sphere_mesh(300, 340);
+
+    Vector3 center = vec3_scale(vec3_add(mesh->bounding_box_min, mesh->bounding_box_max), 0.5);
+    double radius = vec3_distance(mesh->bounding_box_min, mesh->bounding_box_max) / 2;
+    Ray* rays = (Ray*)malloc(sizeof(Ray) * num_rays);
+    Hit* scalar_hits = (Hit*)malloc(sizeof(Hit) * num_rays);
+    Hit* block_hits = (Hit*)malloc(sizeof(Hit) * num_rays);
+    if(rays == NULL || scalar_hits == NULL || block_hits == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for rays\n");
+        exit(1);
+    }
+    unsigned int state = 12345;
+    for(int i = 0; i < num_rays; i++){
+        Vector3 direction;
+        do {
+            direction = random_in_box(&state, (Vector3){-1, -1, -1}, (Vector3){1, 1, 1});
+        } while(vec3_magnitude(direction) < 0.01 || vec3_magnitude(direction) > 1);
+        rays[i].origin = vec3_add(center, vec3_scale(vec3_normalized(direction), radius * 2));
+        rays[i].direction = vec3_sub(random_in_box(&state, mesh->bounding_box_min, mesh->bounding_box_max), rays[i].origin);
+    }
+
+    printf("%d triangles, %d rays, instruction set %s, margin %g\n", mesh->num_tris, num_rays, triangle_block_isa(), TRIANGLE_BLOCK_MARGIN);
+    printf("%-8s %12s %10s %8s %10s %12s %12s\n", "mode", "Mrays/s", "speedup", "blocks", "mismatches", "max t error", "max uv error");
+
+    invert_use_triangle_blocks();
+    double scalar_rate = trace_rays(scalar_hits, rays, num_rays, mesh);
+    invert_use_triangle_blocks();
+    printf("%-8s %12.2f %10s %8s %10s %12s %12s\n", "scalar", scalar_rate / 1e6, "1.00x", "-", "-", "-", "-");
+
+    int widths[] = {8, 16};
+    for(int w = 0; w < 2; w++){
+        set_triangle_block_width(widths[w]);
+        build_triangle_blocks(mesh);
+        double rate = trace_rays(block_hits, rays, num_rays, mesh);
+
+        // A mismatch is a ray that hit a different triangle, or hit where the other missed
+        int mismatches = 0;
+        double max_t_error = 0;
+        double max_uv_error = 0;
+        for(int i = 0; i < num_rays; i++){
+            Hit* a = &scalar_hits[i];
+            Hit* b = &block_hits[i];
+            if(a->hit != b->hit || (a->hit && a->triangle != b->triangle)){
+                mismatches++;
+                continue;
+            }
+            if(!a->hit) continue;
+            max_t_error = fmax(max_t_error, fabs(a->t - b->t));
+            max_uv_error = fmax(max_uv_error, fmax(fabs(a->barycentric.x - b->barycentric.x), fabs(a->barycentric.y - b->barycentric.y)));
+        }
+        char name[16];
+        snprintf(name, sizeof(name), "width %d", widths[w]);
+        printf("%-8s %12.2f %9.2fx %8d %10d %12g %12g\n", name, rate / 1e6, rate / scalar_rate,
+               mesh->tri_blocks.num_blocks, mismatches, max_t_error, max_uv_error);
+    }
+    set_triangle_block_width(0);
+
+    free(rays);
+    free(scalar_hits);
+    free(block_hits);
+    delete_mesh(*mesh);
+    free(mesh);
+    return 0;
+}
@@ -0,0 +1,122 @@
+/**
+ * @file water_bench.c
+ * @brief Animates a Gerstner water grid and measures the per frame cost of updating it with the BVH
+ * refit against rebuilding the BVH every frame, together with the cost of rendering each frame, so
+ * that both the update and the quality of the refit tree show up. Frames are rendered headless on the
+ * calling thread and compared pixel for pixel.
+ *
+ * Usage: water_bench [cells] [frames] [resolution]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "FPToolkit.h"
+#include "raytrace.h"
+#include "camera.h"
+#include "mesh.h"
+#include "gerstner.h"
+#include "bench_mesh.h"
+#include "bench_util.h"
+
+typedef struct {
+    double update_seconds;
+    double render_seconds;
+    int rebuilds;
+    double max_cost_ratio;
+} WaterRun;
+
+/**
+ * @brief Animates the water from its rest pose for a number of frames, rendering every frame
+ *
+ * @param last_frame Filled with the pixels of the final frame
+ */
+static WaterRun animate(Mesh* water, int frames, int resolution, Camera cam, PhongLight* light,
+                        GerstnerWave* waves, int num_waves, int* last_frame){
+    WaterRun run = {0, 0, 0, 1};
+    reset_water_simulation(water);
+    for(int f = 0; f < frames; f++){
+        double build_cost = water->bvh.build_cost;
+        double start = now_seconds();
+        apply_water_simulation(water, waves, num_waves, waves, num_waves, f * 0.1);
+        double updated = now_seconds();
+        G_rgb(0, 0, 0);
+        G_clear();
+        raytrace_scene(resolution, resolution, cam, NULL, 0, water, 1, false, light, 1, 2);
+        double rendered = now_seconds();
+
+        run.update_seconds += updated - start;
+        run.render_seconds += rendered - updated;
+        run.max_cost_ratio = fmax(run.max_cost_ratio, bvh_sah_cost(&water->bvh) / water->bvh.build_cost);
+        // Refits keep the cost the tree was built with
+        if(water->bvh.build_cost != build_cost) run.rebuilds++;
+    }
+    read_frame(last_frame, resolution);
+    return run;
+}
+
+int main(int argc, char** argv){
+    int cells = argc > 1 ? atoi(argv[1]) : 300;
+    int frames = argc > 2 ? atoi(argv[2]) : 30;
+    int resolution = argc > 3 ? atoi(argv[3]) : 128;
+    G_choose_headless_display();
+    G_init_graphics(resolution, resolution);
+    set_raytrace_threads(1);
+
+    Mesh* water = make_grid_mesh(cells, 10);
+    water->material = (PhongMaterial){
+        .base_color={0.1, 0.3, 0.6},
+        .diffuse={0.1, 0.3, 0.6},
+        .specular={WHITE},
+        .shininess=50
+    };
+    water->roughness = 0.2;
+    GerstnerWave waves[] = {
+        {4, 0.15, 1, {1, 0, 0}, 0.1},
+        {2.5, 0.08, 1.3, {0.6, 0, 0.8}, 0.2}
+    };
+    int num_waves = sizeof(waves) / sizeof(waves[0]);
+
+    Camera cam = {
+        .eye={0, 6, -14},
+        .coi={0, 0, 0},
+        .up={0, 7, -14},
+        .half_fov_degrees=30,
+        .near_clip_plane=0.01,
+        .far_clip_plane=100
+    };
+    make_camera_view_matrix(cam.view_matrix, cam.inverse_view_matrix, cam);
+    PhongLight light = {
+        .position={5, 10, -5},
+        .diffuse={WHITE},
+        .specular={WHITE}
+    };
+
+    int* refit_frame = (int*)malloc(sizeof(int) * resolution * resolution);
+    int* rebuild_frame = (int*)malloc(sizeof(int) * resolution * resolution);
+    if(refit_frame == NULL || rebuild_frame == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for frames\n");
+        exit(1);
+    }
+
+    WaterRun refit = animate(water, frames, resolution, cam, &light, waves, num_waves, refit_frame);
+    invert_use_bvh_refit();
+    WaterRun rebuild = animate(water, frames, resolution, cam, &light, waves, num_waves, rebuild_frame);
+    invert_use_bvh_refit();
+
+    int differing = 0;
+    for(int p = 0; p < resolution * resolution; p++) differing += refit_frame[p] != rebuild_frame[p];
+
+    printf("%d triangles, %d frames, %dx%d\n", water->num_tris, frames, resolution, resolution);
+    printf("%-8s %12s %12s %10s %16s\n", "mode", "update ms", "render ms", "rebuilds", "max cost ratio");
+    printf("%-8s %12.2f %12.2f %10d %16.3f\n", "refit", refit.update_seconds * 1000 / frames,
+           refit.render_seconds * 1000 / frames, refit.rebuilds, refit.max_cost_ratio);
+    printf("%-8s %12.2f %12.2f %10s %16s\n", "rebuild", rebuild.update_seconds * 1000 / frames,
+           rebuild.render_seconds * 1000 / frames, "every", "1.000");
+    printf("last frame pixels differing: %d\n", differing);
+
+    free(refit_frame);
+    free(rebuild_frame);
+    delete_mesh(*water);
+    free(water);
+    return 0;
+}
@@ -1,6 +1,17 @@
 #ifndef FPTOOLKIT_H
 #define FPTOOLKIT_H
 
+// Makes G_init_graphics draw into an in-memory buffer instead of an X window,
+// so nothing needs an X server. Call it BEFORE G_init_graphics.
+// Setting the FPT_HEADLESS environment variable does the same.
+int G_choose_headless_display();
+
+// Makes G_init_graphics draw into a client side image (in shared memory when
+// the X server allows it) that G_display_image sends all at once, instead of
+// one X request per pixel. Call it BEFORE G_init_graphics.
+// Setting the FPT_XIMAGE environment variable does the same.
+int G_choose_ximage_display();
+
 // Initializes the graphics system with the specified width and height.
 
 int G_init_graphics(double width, double height);
@@ -25,17 +36,23 @@ extern int (*G_circle)(double x, double y, double radius);
 
 extern int (*G_fill_circle)(double x, double y, double radius);
 
-int (* G_triangle) (double x0, double y0, double x1, double y1, double x2, double y2) ; 
+extern int (* G_triangle) (double x0, double y0, double x1, double y1, double x2, double y2) ; 
 
 extern int (*G_point)(double x, double y);
 
 // Saves the current image to a BMP file.
-extern int (*G_save_to_bmp_file)(char *filename);
+int G_save_to_bmp_file(char *filename);
+
+// Saves the current image to a PNG file. Returns 1 if successful, else 0.
+int G_save_to_png_file(char *filename);
+
+// Saves the current image to a binary PPM file. Returns 1 if successful, else 0.
+int G_save_to_ppm_file(char *filename);
 
 extern int (*G_save_image_to_file)(char *filename);
 
 // Draws a string at the specified location.
-int (*G_draw_string)(const void *text, double x, double y);
+extern int (*G_draw_string)(const void *text, double x, double y);
 
 /**
 int G_init_graphics(double width, double height);
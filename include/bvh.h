@@ -0,0 +1,117 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdbool.h>
+#include "vector.h"
+
+// The deepest a BVH will be built. Traversal stacks of this size can never overflow
+#define BVH_MAX_DEPTH 64
+
+/**
+ * @brief An axis aligned bounding box
+ */
+typedef struct {
+    Vector3 min;
+    Vector3 max;
+} AABB;
+
+/**
+ * @brief A single node of a bounding volume hierarchy.
+ *
+ * Interior nodes have a count of 0 and store the index of their left child in `left_or_first`.
+ * The right child is always stored directly after the left child.
+ * Leaves store the index of their first primitive (in `BVH.prim_indices`) in `left_or_first`.
+ */
+typedef struct {
+    AABB bounds;
+    int left_or_first;
+    int count;
+} BVHNode;
+
+/**
+ * @brief A bounding volume hierarchy over an arbitrary set of primitives.
+ * The root is always node 0. Leaves reference primitives through `prim_indices`.
+ */
+typedef struct {
+    int num_nodes;
+    BVHNode* nodes;
+    int num_prims;
+    int* prim_indices;
+    // The SAH cost (see bvh_sah_cost) of the tree as it was built, which refits are measured against
+    double build_cost;
+} BVH;
+
+extern const BVH NULL_BVH;
+
+/**
+ * @brief Builds a bounding volume hierarchy using the surface area heuristic
+ *
+ * @param bvh The BVH to build into. Any previous contents should already be deleted
+ * @param prim_bounds An array of bounding boxes, one per primitive
+ * @param prim_centroids An array of centroids, one per primitive
+ * @param num_prims The number of primitives
+ */
+void bvh_build(BVH* bvh, const AABB* prim_bounds, const Vector3* prim_centroids, int num_prims);
+
+/**
+ * @brief Recomputes the bounds of every node from the bottom up after the primitives moved.
+ * The tree keeps its structure, so it only stays fast while the primitives move coherently
+ *
+ * @param bvh The BVH to refit
+ * @param prim_bounds The new bounding boxes of the primitives, in the order they were built with
+ */
+void bvh_refit(BVH* bvh, const AABB* prim_bounds);
+
+/**
+ * @brief Estimates the cost of tracing a ray through a BVH with the surface area heuristic: the
+ * expected number of nodes visited and primitives tested by a ray that hits the root
+ *
+ * @param bvh The BVH to measure
+ * @return double The cost, or 0 for an empty BVH
+ */
+double bvh_sah_cost(const BVH* bvh);
+
+/**
+ * @brief Frees the nodes and primitive indices of a BVH
+ *
+ * @param bvh The BVH to be deleted
+ */
+void bvh_delete(BVH* bvh);
+
+/**
+ * @brief Grows a bounding box so that it contains a point
+ *
+ * @param box The box to grow
+ * @param point The point to include
+ */
+void aabb_grow_point(AABB* box, Vector3 point);
+
+/**
+ * @brief Grows a bounding box so that it contains another bounding box
+ *
+ * @param box The box to grow
+ * @param other The box to include
+ */
+void aabb_grow(AABB* box, AABB other);
+
+/**
+ * @brief Calculates the surface area of a bounding box
+ *
+ * @param box The box to measure
+ * @return double The surface area of the box, or 0 if the box is empty
+ */
+double aabb_surface_area(AABB box);
+
+/**
+ * @brief Tests a ray against a bounding box using the slab method
+ *
+ * @param box The box to test
+ * @param origin The origin of the ray
+ * @param inverse_direction The component-wise reciprocal of the ray direction
+ * @param max_t Intersections further along the ray than this are ignored
+ * @param t_enter_out If not NULL, set to the ray parameter where the ray enters the box
+ * @return true If the ray intersects the box between 0 and max_t
+ */
+bool aabb_ray_intersect(const AABB* box, Vector3 origin, Vector3 inverse_direction, double max_t, double* t_enter_out);
+
+#endif
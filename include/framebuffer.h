@@ -0,0 +1,141 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdbool.h>
+#include "colors.h"
+
+/**
+ * @brief An in-memory image that renderers can write to from any thread.
+ * Nothing is drawn until the framebuffer is presented to FPToolkit.
+ */
+typedef struct {
+    int width;
+    int height;
+    Color3* pixels;
+    // Pixels that were never written are left untouched when the framebuffer is presented
+    bool* written;
+} Framebuffer;
+
+/**
+ * @brief Allocates a new framebuffer with no pixels written
+ *
+ * @param width The width of the framebuffer in pixels
+ * @param height The height of the framebuffer in pixels
+ * @return Framebuffer The new framebuffer
+ */
+Framebuffer new_framebuffer(int width, int height);
+
+/**
+ * @brief Frees the memory of a framebuffer
+ *
+ * @param framebuffer The framebuffer to delete
+ */
+void delete_framebuffer(Framebuffer* framebuffer);
+
+/**
+ * @brief Marks every pixel of a framebuffer as not written
+ *
+ * @param framebuffer The framebuffer to clear
+ */
+void clear_framebuffer(Framebuffer* framebuffer);
+
+/**
+ * @brief Writes a color to a pixel of a framebuffer. Not bounds checked
+ *
+ * @param framebuffer The framebuffer to write to
+ * @param x The x coordinate of the pixel
+ * @param y The y coordinate of the pixel
+ * @param color The color to write
+ */
+void framebuffer_set_pixel(Framebuffer* framebuffer, int x, int y, Color3 color);
+
+/**
+ * @brief Draws every written pixel of a framebuffer with FPToolkit.
+ * Must be called from the thread that initialized the graphics.
+ *
+ * @param framebuffer The framebuffer to present
+ */
+void present_framebuffer(Framebuffer* framebuffer);
+
+/**
+ * @brief A floating point image that many samples per pixel are summed into, for progressive rendering.
+ * Each pixel keeps its own sum and counts, so passes do not need to sample every pixel equally
+ */
+typedef struct {
+    int width;
+    int height;
+    Color3* sums;
+    // Samples taken per pixel, and how many of them hit something
+    int* samples;
+    int* hits;
+    // The running mean and sum of squared deviations (Welford's method) of each pixel's sample luminance
+    double* luminance_means;
+    double* luminance_m2s;
+    // The color samples that hit nothing count as, so edges blend into it. Black unless set
+    Color3 background;
+    // Completed passes over the whole image
+    int passes;
+} AccumulationBuffer;
+
+/**
+ * @brief Allocates a new accumulation buffer with no samples
+ *
+ * @param width The width of the buffer in pixels
+ * @param height The height of the buffer in pixels
+ * @return AccumulationBuffer The new buffer
+ */
+AccumulationBuffer new_accumulation_buffer(int width, int height);
+
+/**
+ * @brief Frees the memory of an accumulation buffer
+ *
+ * @param accumulation The buffer to delete
+ */
+void delete_accumulation_buffer(AccumulationBuffer* accumulation);
+
+/**
+ * @brief Throws away every sample of an accumulation buffer, as when the camera or scene changes
+ *
+ * @param accumulation The buffer to clear
+ */
+void clear_accumulation_buffer(AccumulationBuffer* accumulation);
+
+/**
+ * @brief Adds one sample to a pixel of an accumulation buffer. Not bounds checked. Different threads
+ * may add to different pixels at the same time
+ *
+ * @param x The x coordinate of the pixel
+ * @param y The y coordinate of the pixel
+ * @param color The color of the sample, or NULL if it hit nothing
+ */
+void accumulate_sample(AccumulationBuffer* accumulation, int x, int y, const Color3* color);
+
+/**
+ * @brief Draws the average of every pixel of an accumulation buffer that any sample hit with FPToolkit.
+ * Pixels no sample hit are left untouched. Must be called from the thread that initialized the graphics.
+ *
+ * @param accumulation The buffer to present
+ */
+void present_accumulation_buffer(AccumulationBuffer* accumulation);
+
+/**
+ * @brief Draws an accumulation buffer that was traced at a lower resolution, filling a
+ * pixel_size x pixel_size block of the screen with each of its first ceil(width / pixel_size) x
+ * ceil(height / pixel_size) pixels. Blocks no sample hit are left untouched. Must be called from the
+ * thread that initialized the graphics.
+ *
+ * @param accumulation The buffer to present, as large as the screen
+ * @param pixel_size The screen pixels along each side of a traced pixel
+ */
+void present_accumulation_buffer_scaled(AccumulationBuffer* accumulation, int pixel_size);
+
+/**
+ * @brief Estimates how far the average of a pixel of an accumulation buffer may still be from the
+ * average of infinitely many samples: the standard error of the mean of its samples' luminance
+ *
+ * @param i The index of the pixel, y * width + x
+ * @return The standard error, or INFINITY with fewer than 2 samples
+ */
+double accumulation_pixel_error(const AccumulationBuffer* accumulation, int i);
+
+#endif
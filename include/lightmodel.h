@@ -1,6 +1,7 @@
 #ifndef LIGHTMODEL_H
 #define LIGHTMODEL_H
 
+#include <stdbool.h>
 #include "vector.h"
 #include "colors.h"
 #include "camera.h"
@@ -45,6 +46,32 @@ Color3 phong_lighting(Vector3 position, Vector3 normal, Camera cam, PhongMateria
 
 Color3 phong_lighting_eye(Vector3 position, Vector3 normal, Vector3 eye, PhongMaterial material, PhongLight* lights, int num_lights);
 
+/**
+ * @brief Decides whether a light reaches the point being lit, for example by tracing a shadow ray
+ * 
+ * @param context The context pointer given to phong_lighting_eye_visible
+ * @param light The light to test
+ * @return true if the light reaches the point
+ */
+typedef bool (*LightVisibility)(void* context, const PhongLight* light);
+
+/**
+ * @brief The same lighting as phong_lighting_eye, except that lights that don't reach the point only
+ * contribute ambient light. Visibility is only asked for lights that face the point
+ * 
+ * @param position The world space position of the point
+ * @param normal The world space normal vector of the point
+ * @param eye The world space position the point is seen from
+ * @param material The material of the point
+ * @param lights An array of PhongLights in world space to use for lighting calculations
+ * @param num_lights The number of PhongLights in the array
+ * @param is_visible Called to test each light, or NULL if every light is visible
+ * @param context Passed to is_visible
+ * @return Color3 The color of the point based on the phonglighting
+ */
+Color3 phong_lighting_eye_visible(Vector3 position, Vector3 normal, Vector3 eye, const PhongMaterial* material, PhongLight* lights, int num_lights,
+                                  LightVisibility is_visible, void* context);
+
 /**
  * @brief Draws a gizmo to display point lights in the scene
  * 
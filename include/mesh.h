@@ -1,7 +1,9 @@
 #ifndef MESH_H
 #define MESH_H
+#include <stdint.h>
 #include "vector.h"
 #include "lightmodel.h"
+#include "bvh.h"
 
 
 typedef struct {
@@ -19,8 +21,43 @@ typedef struct {
     Vector3 normal;
 } Triangle;
 
+/**
+ * @brief The part of every triangle that the ray/triangle test needs, precomputed and stored
+ * one component per array so that the triangles of a BVH leaf are read as runs of contiguous doubles.
+ * Entry i belongs to triangle i of the mesh.
+ */
+typedef struct {
+    double* v0_x;
+    double* v0_y;
+    double* v0_z;
+    double* edge_1_x;
+    double* edge_1_y;
+    double* edge_1_z;
+    double* edge_2_x;
+    double* edge_2_y;
+    double* edge_2_z;
+} TriangleRecords;
 
+/**
+ * @brief The mesh's BVH with every subtree of at most `width` triangles collapsed into a leaf, and
+ * the triangles of every leaf packed in single precision blocks of `width` for the wide triangle
+ * kernel (see triblock.h).
+ *
+ * Leaves store the index of their first block in `left_or_first` and their number of blocks in `count`.
+ * Block b holds 9 arrays of `width` floats (v0 x, y, z, edge_1 x, y, z, edge_2 x, y, z) starting at
+ * `data + 9 * width * b`, and the indices of its triangles at `triangles + width * b`, padded with -1.
+ */
 typedef struct {
+    int width;
+    int num_nodes;
+    BVHNode* nodes;
+    int num_blocks;
+    float* data;
+    int* triangles;
+} TriangleBlocks;
+
+
+typedef struct Mesh {
     bool hidden;
 
     int num_tris;
@@ -28,14 +65,46 @@ typedef struct {
     int num_vertices;
     Vertex* vertices;
 
+    // Index based copy of the geometry that the raytracer and the per-vertex updates work on.
+    // Triangle i is made of the vertices indices[3 * i], indices[3 * i + 1] and indices[3 * i + 2].
+    // Once these exist, `positions` is the current shape of the mesh and each vertex's
+    // `position` is only a copy kept up to date for code that still walks `tris`
+    uint32_t* indices;
+    Vector3* positions;
+    Vector3* normals;
+    Vector3* face_normals;
+    TriangleRecords tri_records;
+    // Per-vertex colors and texture coordinates from the .ply file, NULL when it has none
+    Color3* colors;
+    Vector2* uvs;
+
     Vector3 center;
     Vector3 scale;
 
     Vector3 bounding_box_max;
     Vector3 bounding_box_min;
 
+    // Indexes into `tris`. Built by get_mesh and rebuilt whenever vertices are moved
+    BVH bvh;
+    // Rebuilt along with the BVH
+    TriangleBlocks tri_blocks;
+    // Counts changes to the geometry, so that caches of what the mesh looked like can tell it moved even when
+    // its arrays and bounds stayed put. Bumped by compute_triangle_records, build_mesh_bvh, refit_mesh_bvh and
+    // whatever recomputes or flips the normals, so code that edits the arrays directly must call one of them
+    unsigned int generation;
+
+    // The mapped .gmesh file when the mesh was read from its cache, NULL otherwise. Arrays that
+    // point into it are copy on write and are never freed, only unmapped with the whole file
+    void* cache_mapping;
+    size_t cache_mapping_size;
+
+    // Where the raytracer places the mesh in the world. The vertices stay in object space until
+    // apply_mesh_transform bakes the transform into them
     double transform[4][4];
     double inverse_transform[4][4];
+    // The mesh an instance was made from by instance_mesh, NULL on meshes that own their geometry.
+    // An instance is traced with its source's current arrays, BVH and bounds, not its own copies of them
+    const struct Mesh* source;
 
     PhongMaterial material;
     double roughness;
@@ -43,14 +112,28 @@ typedef struct {
 } Mesh;
 
 /**
- * @brief Loads triangles from an ascii .ply file into a given mesh struct.
- * Assumes that the mesh is triangulated and that it has precomputed vertex normals only.
+ * @brief Loads triangles from a .ply file into a given mesh struct, filling its vertices, tris and
+ * index based arrays. The mesh must be triangulated.
+ * 
+ * The file is memory mapped. Ascii and binary (little or big endian) files may declare their vertex
+ * properties in any order and with any type. x, y and z are required. Normals (nx, ny, nz), colors
+ * (red, green, blue) and texture coordinates (u, v or s, t) are optional, and vertex normals are computed
+ * from the faces when the file has none. Ascii files are parsed in newline aligned chunks on the number
+ * of threads set with set_ply_load_threads.
  * 
  * @param mesh A pointer to the mesh to load the data into
  * @param filename The name of the file to be loaded
  */
 void load_mesh_from_ply(Mesh* mesh, char* filename);
 
+/**
+ * @brief Sets how many threads load_mesh_from_ply uses to parse ascii files. The result is the same
+ * for any number of threads
+ * 
+ * @param num_threads The number of threads to use. 0 uses every core (the default)
+ */
+void set_ply_load_threads(int num_threads);
+
 /**
  * @brief Frees all mesh vertices and faces from memory
  * 
@@ -100,11 +183,44 @@ void rotate_mesh_z_degrees(Mesh* mesh, double degrees);
 /**
  * @brief Applies a transform to a mesh
  * 
- * @param mesh the mesh to be transformed
-
+ * @param mesh the mesh to be transformed. Instances are left untouched, since their vertices are shared
  */
 void apply_mesh_transform(Mesh* mesh);
 
+/**
+ * @brief Checks whether a mesh's transform is anything other than the identity
+ */
+bool mesh_is_transformed(const Mesh* mesh);
+
+/**
+ * @brief Computes the world space bounding box of a mesh's bounding box under its transform
+ * 
+ * @param mesh The mesh
+ * @param bounds_out Set to the box
+ */
+void mesh_world_bounds(Mesh* mesh, AABB* bounds_out);
+
+/**
+ * @brief Makes an instance of a mesh: a mesh that is traced with the geometry, BVH and bounds of the
+ * original but is placed with its own transform (starting at the identity) and drawn with its own
+ * material and hidden flag. An instance costs the size of the Mesh struct, however large its mesh is.
+ * 
+ * The instance reads the original through its source pointer whenever it is traced, so moving the
+ * vertices of the original (with apply_water_simulation for example) and refitting or rebuilding its
+ * BVH moves every instance. Edit the original, never an instance. Deleting an instance frees nothing,
+ * and the original must stay at the same address and outlive all of its instances
+ * 
+ * @param mesh The mesh to instance. Instancing an instance instances its original
+ * @return Mesh The instance
+ */
+Mesh instance_mesh(const Mesh* mesh);
+
+/**
+ * @brief Gets the mesh whose geometry, BVH and bounds a mesh is traced with: the original of an
+ * instance, or the mesh itself
+ */
+const Mesh* mesh_geometry(const Mesh* mesh);
+
 /**
  * @brief Computes the bounding box for a given mesh
  * 
@@ -112,6 +228,54 @@ void apply_mesh_transform(Mesh* mesh);
  */
 void compute_mesh_bounds(Mesh* mesh);
 
+/**
+ * @brief Allocates and fills the index based arrays of a mesh (indices, positions, normals,
+ * face normals and triangle records) from its vertices and tris. get_mesh calls this, so it is only
+ * needed for meshes that are built by hand
+ * 
+ * @param mesh 
+ */
+void build_indexed_mesh(Mesh* mesh);
+
+/**
+ * @brief Allocates and fills the vertices and tris of a mesh from its index based arrays, the
+ * opposite of build_indexed_mesh. Every vertex's static position and normal start out as its current ones
+ * 
+ * @param mesh 
+ */
+void build_legacy_mesh(Mesh* mesh);
+
+/**
+ * @brief Recomputes the triangle records of a mesh from its positions
+ * 
+ * @param mesh 
+ */
+void compute_triangle_records(Mesh* mesh);
+
+/**
+ * @brief Copies the positions of a mesh back into its vertices after they were moved
+ * 
+ * @param mesh 
+ */
+void copy_positions_to_vertices(Mesh* mesh);
+
+/**
+ * @brief (Re)builds the bounding volume hierarchy over the triangles of a mesh
+ * 
+ * @param mesh 
+ */
+void build_mesh_bvh(Mesh* mesh);
+
+/**
+ * @brief Updates the bounding volume hierarchy of a mesh after its vertices moved without rebuilding it:
+ * the boxes are refit from the bottom up over the same tree. Falls back to a full rebuild when the refit
+ * tree's SAH cost has grown too far past the cost it was built with, or when the mesh has no BVH yet
+ * 
+ * @param mesh The mesh, with its positions and triangle records up to date
+ * @return true if the BVH was rebuilt instead of refit
+ */
+bool refit_mesh_bvh(Mesh* mesh);
+
 /**
  * @brief Computes the face normals for a given mesh
  * 
@@ -128,13 +292,25 @@ void compute_face_normals(Mesh* mesh);
 void print_mesh(Mesh mesh);
 
 /**
- * @brief Returns a pointer to a mesh loaded from a file
+ * @brief Returns a pointer to a mesh loaded from a file, with its face normals, bounds and BVH built.
+ * When the mesh cache is on, a .gmesh cache next to the .ply file is used if it is up to date and
+ * written otherwise (see meshcache.h)
  * 
  * @param filename 
  * @return Mesh* 
  */
 Mesh* get_mesh(char* filename);
 
+/**
+ * @brief Toggles whether get_mesh reads and writes .gmesh cache files. On by default
+ */
+void invert_use_mesh_cache();
+
+/**
+ * @brief Toggles whether refit_mesh_bvh refits the existing BVH or always rebuilds it. On by default
+ */
+void invert_use_bvh_refit();
+
 /**
  * @brief Draws a mesh wireframe to the screen
  * 
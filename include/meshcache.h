@@ -0,0 +1,50 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <stdbool.h>
+#include "mesh.h"
+
+// Bumped whenever the layout of a .gmesh file or of anything stored in it changes
+#define MESH_CACHE_VERSION 1
+
+/**
+ * @brief Gets the name of the cache file of a .ply file: its name with the .ply extension replaced
+ * by .gmesh, or with .gmesh appended if it has no .ply extension
+ *
+ * @param out Filled with the cache file's name
+ * @param out_size The size of `out` in bytes
+ * @param ply_filename The name of the .ply file
+ * @return true If the name fit in `out`
+ */
+bool mesh_cache_filename(char* out, size_t out_size, const char* ply_filename);
+
+/**
+ * @brief Loads a mesh from the cache file of a .ply file, if there is one and it is up to date.
+ *
+ * A cache is up to date when it has the current version, is newer than the .ply file and recorded the
+ * .ply file's size and modification time when it was written. The file is memory mapped copy on write
+ * and the index based arrays and BVH of the mesh point straight into it, so only the vertices and tris
+ * are built. The mesh is left as get_mesh leaves it, apart from its transforms.
+ *
+ * @param mesh The mesh to load into
+ * @param ply_filename The name of the .ply file
+ * @return true If the mesh was loaded. Missing, stale and damaged caches return false and leave the mesh untouched
+ */
+bool load_mesh_cache(Mesh* mesh, const char* ply_filename);
+
+/**
+ * @brief Writes the cache file of a .ply file for a mesh that was just loaded from it by get_mesh.
+ * The file is written under a temporary name and renamed into place, so a reader never sees half of it.
+ * Failing to write the cache prints a warning and is otherwise ignored
+ *
+ * @param mesh The mesh, with its face normals, bounds and BVH built
+ * @param ply_filename The name of the .ply file the mesh was loaded from
+ */
+void save_mesh_cache(const Mesh* mesh, const char* ply_filename);
+
+/**
+ * @brief Checks whether an array of a mesh lives in its cache file mapping rather than on the heap
+ */
+bool mesh_cache_contains(const Mesh* mesh, const void* array);
+
+#endif
@@ -33,6 +33,61 @@ typedef struct {
     PhongMaterial material;
 } ParametricObject3D;
 
+/**
+ * @brief Whether parametric objects are drawn as triangles instead of one pixel per sample. The u/v grid
+ * is tessellated into triangles that are scan converted with perspective correct interpolation and the
+ * z-test, so every covered pixel is shaded once and u_step and v_step only set how finely the surface
+ * is approximated, not whether it has holes. Off by default
+ */
+extern bool RASTERIZE_PARAMETRIC_TRIANGLES;
+void invert_rasterize_parametric_triangles();
+
+/**
+ * @brief Whether parametric objects drawn one pixel per sample choose their sampling from the view
+ * instead of u_step and v_step. The u/v domain starts as a coarse grid of patches that are halved
+ * until each covers about a pixel on screen, so distant objects take few samples and close ones get no
+ * holes. Patches out of the window are dropped. Has no effect on triangles. Off by default
+ */
+extern bool ADAPTIVE_PARAMETRIC_SAMPLING;
+void invert_adaptive_parametric_sampling();
+
+/**
+ * @brief Whether the object space points and uvs of parametric objects, and the points their normals are
+ * found from, are kept across frames. Tessellations are keyed on f, the u/v ranges and steps and the
+ * displacement texture and scale, so moving the camera or an object's transform reuses them. f is assumed
+ * to depend on u and v alone. On by default
+ */
+extern bool USE_TESSELLATION_CACHE;
+void invert_use_tessellation_cache();
+
+/**
+ * @brief Whether shading of parametric objects is deferred. A first pass depth tests every sample of every
+ * object given to one draw call and records the nearest one's depth, position, normal, u/v and object in
+ * a G-buffer, then a second pass shades each covered pixel once. Samples later hidden by nearer ones are
+ * never lit or textured, and the NORMAL, UV and Z_BUFF modes just read the G-buffer. The image is the
+ * same as with forward shading. Off by default
+ */
+extern bool DEFERRED_PARAMETRIC_SHADING;
+void invert_deferred_parametric_shading();
+
+/**
+ * @brief Sets how many threads draw parametric objects. With more than one thread the objects are
+ * tessellated and their samples or triangles binned into screen tiles in parallel, then each tile is
+ * depth tested and shaded by a single thread into a private framebuffer, which is drawn all at once when
+ * every tile is done. Tiles go through their primitives in the order they would be drawn serially, so
+ * the image and z-buffer are exactly the same. The surface functions are then called from several
+ * threads and must be safe to.
+ *
+ * @param num_threads The number of threads to use. 1 draws on the calling thread (the default) and 0 uses every core
+ */
+void set_parametric_threads(int num_threads);
+
+/**
+ * @brief Drops every cached tessellation. Call this after changing anything f reads besides u and v,
+ * like TORUS_MAJOR_RADIUS
+ */
+void clear_parametric_tessellations();
+
 /**
  * @brief Draws a parametric 3D object in the scene
  * 
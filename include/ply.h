@@ -0,0 +1,138 @@
+#ifndef PLY_H
+#define PLY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Limits on what a header may declare. Real files stay far below these
+#define PLY_MAX_ELEMENTS 16
+#define PLY_MAX_PROPERTIES 32
+#define PLY_MAX_NAME 32
+
+typedef enum {
+    PLY_ASCII,
+    PLY_BINARY_LITTLE_ENDIAN,
+    PLY_BINARY_BIG_ENDIAN
+} PlyFormat;
+
+/**
+ * @brief The scalar types a property can have. Both the old names (char, uchar, short, ushort, int,
+ * uint, float, double) and the sized names (int8 ... float64) are accepted
+ */
+typedef enum {
+    PLY_INT8,
+    PLY_UINT8,
+    PLY_INT16,
+    PLY_UINT16,
+    PLY_INT32,
+    PLY_UINT32,
+    PLY_FLOAT32,
+    PLY_FLOAT64
+} PlyType;
+
+/**
+ * @brief A single property of an element. A list property stores a count of type `count_type`
+ * followed by that many values of type `type`
+ */
+typedef struct {
+    char name[PLY_MAX_NAME];
+    bool is_list;
+    PlyType type;
+    PlyType count_type;
+} PlyProperty;
+
+typedef struct {
+    char name[PLY_MAX_NAME];
+    long count;
+    int num_properties;
+    PlyProperty properties[PLY_MAX_PROPERTIES];
+} PlyElement;
+
+/**
+ * @brief Everything declared by the header of a .ply file
+ */
+typedef struct {
+    PlyFormat format;
+    int num_elements;
+    PlyElement elements[PLY_MAX_ELEMENTS];
+    // Where the element data starts, counted from the first byte of the file
+    size_t data_offset;
+} PlyHeader;
+
+/**
+ * @brief Parses the header at the start of a .ply file. Exits with an error if the header is malformed
+ *
+ * @param header Filled with the parsed header
+ * @param data The contents of the file
+ * @param size The size of the file in bytes
+ * @param filename The name of the file, used in error messages
+ */
+void ply_parse_header(PlyHeader* header, const char* data, size_t size, const char* filename);
+
+/**
+ * @brief Finds an element by name
+ *
+ * @return int The index of the element in `header->elements`, or -1 if there is none
+ */
+int ply_find_element(const PlyHeader* header, const char* name);
+
+/**
+ * @brief Finds the first property of an element whose name matches any of the given names
+ *
+ * @param element The element to search
+ * @param names An array of names to try, in order of preference
+ * @param num_names The number of names
+ * @return int The index of the property in `element->properties`, or -1 if there is none
+ */
+int ply_find_property(const PlyElement* element, const char* const* names, int num_names);
+
+/**
+ * @brief Gets the size in bytes of a scalar type
+ */
+int ply_type_size(PlyType type);
+
+/**
+ * @brief Gets the size in bytes of one binary record of an element
+ *
+ * @return long The size of a record, or -1 if the element has list properties and its records vary in size
+ */
+long ply_record_size(const PlyElement* element);
+
+/**
+ * @brief Reads a binary scalar and converts it to a double
+ *
+ * @param p A pointer to the first byte of the value
+ * @param type The type of the value
+ * @param swap true if the value's byte order is the opposite of this machine's
+ */
+double ply_read_binary(const unsigned char* p, PlyType type, bool swap);
+
+/**
+ * @brief Steps past one binary record of an element
+ *
+ * @param p A pointer to the start of the record
+ * @param end A pointer one past the last byte of the file
+ * @param element The element the record belongs to
+ * @param swap true if the file's byte order is the opposite of this machine's
+ * @return const unsigned char* A pointer to the next record, or NULL if the record runs past the end of the file
+ */
+const unsigned char* ply_skip_binary_record(const unsigned char* p, const unsigned char* end, const PlyElement* element, bool swap);
+
+/**
+ * @brief Checks whether binary data in a given format needs its bytes swapped on this machine
+ */
+bool ply_needs_swap(PlyFormat format);
+
+/**
+ * @brief Parses the next number on a line of an ascii .ply file. The result is exactly what strtod
+ * would give, but numbers with at most 19 significant digits and small exponents (nearly every number
+ * in a .ply file) are converted without calling strtod
+ *
+ * @param p Where to start looking for the number. Spaces and tabs before it are skipped
+ * @param end A pointer one past the last byte of the file
+ * @param out Set to the value of the number
+ * @return const char* A pointer just past the number, or NULL if the line has no more numbers
+ */
+const char* ply_parse_ascii_number(const char* p, const char* end, double* out);
+
+#endif
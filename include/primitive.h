@@ -0,0 +1,30 @@
+#ifndef PRIMITIVE_H
+#define PRIMITIVE_H
+
+#include <stdbool.h>
+#include "vector.h"
+#include "bvh.h"
+#include "raytrace.h"
+
+/**
+ * @brief Intersects an object space ray with one of the analytic shapes of enum RaytracedObjectType
+ *
+ * @param t_out Set to the ray parameter of the nearest intersection in front of the ray's origin
+ * @param normal_out If not NULL, set to the object space normal at that intersection, not normalized.
+ * Closed shapes get their outward normal and open surfaces the side facing the ray
+ * @param ray The ray in the shape's object space. Its direction does not need to be normalized
+ * @param type The shape
+ * @return true if the shape is hit in front of the ray's origin
+ */
+bool intersect_primitive(double* t_out, Vector3* normal_out, Ray ray, enum RaytracedObjectType type);
+
+/**
+ * @brief Gets the object space bounding box of a shape
+ *
+ * @param type The shape
+ * @param bounds_out Set to the bounding box if the shape has one
+ * @return false if the shape is unbounded, like the plane
+ */
+bool primitive_bounds(enum RaytracedObjectType type, AABB* bounds_out);
+
+#endif
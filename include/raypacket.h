@@ -0,0 +1,77 @@
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "vector.h"
+#include "mesh.h"
+
+// The number of rays traced together. Packets cover 4x4 pixel blocks
+#define RAY_PACKET_SIZE 16
+#define RAY_PACKET_SIDE 4
+
+/**
+ * @brief A packet of rays, stored one component per array so that consecutive rays load
+ * straight into vector registers
+ */
+typedef struct {
+    double origin_x[RAY_PACKET_SIZE];
+    double origin_y[RAY_PACKET_SIZE];
+    double origin_z[RAY_PACKET_SIZE];
+    double direction_x[RAY_PACKET_SIZE];
+    double direction_y[RAY_PACKET_SIZE];
+    double direction_z[RAY_PACKET_SIZE];
+    double inverse_direction_x[RAY_PACKET_SIZE];
+    double inverse_direction_y[RAY_PACKET_SIZE];
+    double inverse_direction_z[RAY_PACKET_SIZE];
+} RayPacket;
+
+/**
+ * @brief The closest triangle hit by every ray of a packet so far
+ */
+typedef struct {
+    // Set to INFINITY (or another upper bound) before the first mesh is intersected
+    double t[RAY_PACKET_SIZE];
+    double u[RAY_PACKET_SIZE];
+    double v[RAY_PACKET_SIZE];
+    int triangle[RAY_PACKET_SIZE];
+} PacketHits;
+
+/**
+ * @brief Stores a ray in one lane of a packet
+ *
+ * @param packet The packet to write to
+ * @param lane The index of the ray in the packet
+ * @param origin The origin of the ray
+ * @param direction The direction of the ray. Does not need to be normalized
+ */
+void ray_packet_set(RayPacket* packet, int lane, Vector3 origin, Vector3 direction);
+
+/**
+ * @brief Intersects every active ray of a packet with a mesh by walking the mesh's BVH once for the
+ * whole packet, testing triangles against several rays at a time with the vector instructions chosen
+ * at runtime. The hits are exactly the ones the scalar BVH walk over the triangle records finds.
+ *
+ * @param hits The closest hits so far. Rays that hit a triangle closer than their current t are updated
+ * @param packet The rays
+ * @param mesh The mesh, which must have a BVH
+ * @param active One bit per ray of the packet. Rays without their bit set are ignored
+ * @return uint32_t One bit per ray whose closest hit is now on this mesh
+ */
+uint32_t packet_intersect_mesh(PacketHits* hits, const RayPacket* packet, const Mesh* mesh, uint32_t active);
+
+/**
+ * @brief Gets the name of the instruction set packets are traced with: "avx512", "avx2" or "sse2" on
+ * x86, "generic" elsewhere. The best one the CPU supports is chosen the first time it is needed
+ */
+const char* ray_packet_isa();
+
+/**
+ * @brief Forces packets to be traced with a given instruction set, for benchmarking
+ *
+ * @param name The name of the instruction set, as returned by ray_packet_isa
+ * @return true if the instruction set is built in and supported by this CPU
+ */
+bool set_ray_packet_isa(const char* name);
+
+#endif
@@ -5,11 +5,32 @@
 #include "colors.h"
 #include "lightmodel.h"
 #include "mesh.h"
+#include "framebuffer.h"
 
+/**
+ * @brief The shapes a RaytracedParametricObject3D can be, each intersected in closed form in object
+ * space and placed by the object's transform. Open surfaces are two sided
+ */
 enum RaytracedObjectType {
-    SPHERE
+    // The unit sphere
+    SPHERE,
+    // The infinite y = 0 plane of param_plane
+    PLANE,
+    // The cube from -1 to 1 on every axis
+    BOX,
+    // The open radius 1 tube of param_cylinder around the z axis, from z = -1 to 1
+    CYLINDER,
+    // The open cone around the z axis with a radius 1 base at z = -1 and its apex at z = 1
+    CONE,
+    // The radius 1 disk in the z = 0 plane
+    DISK,
+    // The torus of param_torus around the z axis, with TORUS_MAJOR_RADIUS and TORUS_MINOR_RADIUS
+    TORUS
 };
 
+// The most hits a single primary ray can shade
+#define RAYTRACE_MAX_DEPTH 64
+
 typedef struct {
     Vector3 origin;
     Vector3 direction;
@@ -38,13 +59,254 @@ void raytrace_scene(int width, int height, Camera cam,
                     PhongLight* lights, int num_lights, 
                     int numBounces);
 
+/**
+ * @brief Adds one sample per pixel of a scene to an accumulation buffer without drawing anything.
+ * Each pass samples a different point of every pixel, chosen by the buffer's pass count along a low
+ * discrepancy sequence, so presenting the buffer after many passes gives an antialiased image. The first
+ * pass samples the same points as raytrace_scene
+ *
+ * @param accumulation The buffer to add to, whose size is the size of the frame
+ */
+void raytrace_scene_pass(AccumulationBuffer* accumulation, Camera cam,
+                         RaytracedParametricObject3D* objs, int num_objs,
+                         Mesh* meshes, int num_meshes, bool skipMeshes,
+                         PhongLight* lights, int num_lights,
+                         int numBounces);
+
+/**
+ * @brief Renders a scene progressively: passes of raytrace_scene_pass are accumulated and the average
+ * is drawn and displayed after every pass, so a usable image shows up after the first pass and keeps
+ * converging until a budget runs out. Samples that hit nothing blend edges towards black
+ *
+ * @param max_samples Stop after this many samples per pixel, or 0 for no limit
+ * @param max_seconds Stop after the pass that runs past this many seconds, or 0 for no limit.
+ * With neither limit a single pass is traced
+ * @return The number of samples per pixel taken
+ */
+int raytrace_scene_progressive(int width, int height, Camera cam,
+                               RaytracedParametricObject3D* objs, int num_objs,
+                               Mesh* meshes, int num_meshes, bool skipMeshes,
+                               PhongLight* lights, int num_lights,
+                               int numBounces, int max_samples, double max_seconds);
+
+/**
+ * @brief Renders a scene with adaptive supersampling and draws it. Every pixel first gets min_samples
+ * samples, then passes only trace the pixels whose estimated error is above max_error, and their
+ * neighbours, until none are left or max_samples is reached. The error of a pixel is the standard error
+ * of the mean luminance of its samples, so flat backgrounds and smooth shading settle after the first
+ * samples while edges, reflections and highlights get the rest. Samples that hit nothing count as black
+ *
+ * @param min_samples The samples every pixel gets, at least 2
+ * @param max_samples The most samples any pixel gets
+ * @param max_error The standard error, in luminance from 0 to 1, that a pixel stops at
+ * @return The average number of samples per pixel taken
+ */
+double raytrace_scene_adaptive(int width, int height, Camera cam,
+                               RaytracedParametricObject3D* objs, int num_objs,
+                               Mesh* meshes, int num_meshes, bool skipMeshes,
+                               PhongLight* lights, int num_lights,
+                               int numBounces, int min_samples, int max_samples, double max_error);
+
+// The number of recent frame times an interactive render keeps to pick the quality of its next preview
+#define INTERACTIVE_HISTORY 8
+
+/**
+ * @brief The state an interactive render keeps from frame to frame. While the camera moves, every
+ * frame is a preview traced at a lower resolution and bounce count, picked from the measured cost of
+ * recent frames so that it fits the target frame time. Once the camera stops, the resolution is doubled
+ * every frame, then the bounce count is raised to the full count, and then samples are accumulated.
+ * Made by new_interactive_render and freed with delete_interactive_render
+ */
+typedef struct {
+    int width;
+    int height;
+    double target_seconds;
+    int max_samples;
+    // Recent seconds per traced pixel per bounce, in a ring
+    double costs[INTERACTIVE_HISTORY];
+    int num_costs;
+    int next_cost;
+    Camera last_camera;
+    bool has_frame;
+    // How the current image was traced: each traced pixel covers pixel_size x pixel_size screen pixels
+    int pixel_size;
+    int bounces;
+    AccumulationBuffer accumulation;
+} InteractiveRender;
+
+/**
+ * @brief Sets up an interactive render of a frame
+ *
+ * @param target_seconds The time each frame should take
+ * @param max_samples The samples per pixel the image stops refining at once the camera is still
+ */
+InteractiveRender new_interactive_render(int width, int height, double target_seconds, int max_samples);
+
+/**
+ * @brief Frees the memory of an interactive render
+ */
+void delete_interactive_render(InteractiveRender* render);
+
+/**
+ * @brief Makes the next frame of an interactive render a preview even if the camera did not move,
+ * for when the scene itself changed
+ */
+void restart_interactive_render(InteractiveRender* render);
+
+/**
+ * @brief Traces and draws the next frame of an interactive render. The whole frame is cleared to black
+ * and redrawn; the caller displays it
+ *
+ * @param cam The camera, compared with the last frame's to tell whether it moved
+ * @param numBounces The bounce count of the refined image, or 0 for MAX_BOUNCES
+ * @return false if the image was already fully refined and nothing was drawn
+ */
+bool raytrace_scene_interactive(InteractiveRender* render, Camera cam,
+                                RaytracedParametricObject3D* objs, int num_objs,
+                                Mesh* meshes, int num_meshes, bool skipMeshes,
+                                PhongLight* lights, int num_lights,
+                                int numBounces);
+
+/**
+ * @brief What a pixel of a HitCache saw when it was last traced
+ */
+typedef struct {
+    // The primary hit: the index of the mesh or object hit, and -1 for the other, or for both on a miss
+    int mesh;
+    int object;
+    int triangle;
+    double t;
+    Vector2 surface_coords;
+    Vector3 obj_space_normal;
+    // The surfaces hit along the path, whose locations are kept in the cache's path_vertices
+    int path_length;
+    // Whether the last ray of the path hit nothing, and its direction if so
+    bool escaped;
+    Vector3 escape_direction;
+    Color3 color;
+    bool drawn;
+} CachedPixel;
+
+/**
+ * @brief The hits and colors of the last frame rendered with raytrace_scene_cached, and the scene
+ * they were traced from. Made by new_hit_cache and freed with delete_hit_cache
+ */
+typedef struct {
+    int width;
+    int height;
+    CachedPixel* pixels;
+    // depth vertices per pixel
+    Vector3* path_vertices;
+    int depth;
+    // What each pixel needs this frame, one of the modes in raytrace.c
+    unsigned char* modes;
+    bool valid;
+    // Copies of the camera, objects, meshes, lights and switches the cache was traced with
+    Camera camera;
+    RaytracedParametricObject3D* objs;
+    int num_objs;
+    Mesh* meshes;
+    int num_meshes;
+    PhongLight* lights;
+    int num_lights;
+    int toggles;
+    double torus_major_radius;
+    double torus_minor_radius;
+} HitCache;
+
+/**
+ * @brief Sets up an empty hit cache for frames of a size
+ */
+HitCache new_hit_cache(int width, int height);
+
+/**
+ * @brief Frees the memory of a hit cache
+ */
+void delete_hit_cache(HitCache* cache);
+
+/**
+ * @brief Makes the next frame rendered with a hit cache trace every pixel again, for changes the cache
+ * cannot see, such as a mesh's arrays edited without calling anything that bumps its generation
+ */
+void invalidate_hit_cache(HitCache* cache);
+
+/**
+ * @brief Renders a scene like raytrace_scene, reusing what the last frame rendered with the same cache
+ * found. A new camera traces everything. Otherwise the primary hits are kept, and:
+ * - when the lights or the shading switches changed, every pixel is shaded again from its primary hit
+ * - when some objects or meshes moved or changed, only the pixels whose primary, reflected or shadow
+ *   rays pass through the old or new bounds of one of them are traced again, from the primary hit if
+ *   the primary ray is clear of them. Changing an unbounded object traces everything
+ * - when nothing changed, the last frame is drawn again
+ *
+ * @param cache The cache, whose size is the size of the frame
+ * @return The number of pixels traced or shaded again
+ */
+int raytrace_scene_cached(HitCache* cache, Camera cam,
+                          RaytracedParametricObject3D* objs, int num_objs,
+                          Mesh* meshes, int num_meshes, bool skipMeshes,
+                          PhongLight* lights, int num_lights,
+                          int numBounces);
+
+/**
+ * @brief Sets how many threads raytrace_scene uses. With more than one thread the frame is
+ * split into tiles that are traced on a work stealing thread pool into a private framebuffer,
+ * which is drawn all at once when every tile is done.
+ * 
+ * @param num_threads The number of threads to use. 1 traces on the calling thread (the default) and 0 uses every core
+ */
+void set_raytrace_threads(int num_threads);
+
 
 
+/**
+ * @brief Traces a ray and the chain of reflections after it. The bounces run in a loop rather than
+ * recursing: every hit is shaded on the way out and the colors are blended from the deepest hit back.
+ * 
+ * @param out Set to the location, normal and color of the first hit. If NULL, the ray is only tested for any hit at all
+ * @param depth The number of hits to shade, at most RAYTRACE_MAX_DEPTH
+ * @return true if the ray hit anything
+ */
 bool raytrace(RayHitInfo* out, Ray ray, int depth, 
                 RaytracedParametricObject3D* objs, int num_objs, 
                 Mesh* meshes, int num_meshes, bool skipMeshes,
                 PhongLight* lights, int num_lights);
 
+/**
+ * @brief Checks whether anything blocks a ray between its origin and max_t. Stops at the first
+ * intersection found instead of searching for the closest one, which makes it the query for shadow rays
+ * 
+ * @param ray The ray to test. Its direction does not need to be normalized
+ * @param max_t Intersections at or beyond this ray parameter are ignored
+ * @return true if the ray is blocked
+ */
+bool raytrace_occluded(Ray ray, double max_t,
+                       RaytracedParametricObject3D* objs, int num_objs,
+                       Mesh* meshes, int num_meshes);
+
+/**
+ * @brief Finds the closest triangle of a single mesh hit by a ray, with whichever of the BVH,
+ * triangle records and triangle blocks are switched on. Ignores the mesh's hidden flag and bounding box
+ * 
+ * @param tri_out Set to the index of the closest triangle if one was hit
+ * @param t_out Set to the ray parameter of the closest hit, or closest_t if nothing closer was hit
+ * @param barycentric_out If not NULL, set to the barycentric coordinates of the closest hit
+ * @param closest_t Only triangles hit before this ray parameter count
+ * @return true if a triangle closer than closest_t was hit
+ */
+bool raytrace_mesh(int* tri_out, double* t_out, Vector2* barycentric_out, double closest_t, Ray ray, const Mesh* mesh);
+
+/**
+ * @brief The ray-triangle test used by every mesh intersection, reading the precomputed vertex and edges
+ * of triangle i from a mesh's triangle records
+ * 
+ * @param t_out If not NULL, set to the ray parameter of the hit
+ * @param barycentric_out If not NULL, set to the barycentric coordinates of the hit
+ * @param closest_t Only hits before this ray parameter count
+ * @return true if the triangle is hit between EPSILON and closest_t
+ */
+bool intersect_triangle_record(double* t_out, Vector2* barycentric_out, double closest_t, Ray ray, const TriangleRecords* records, int i);
+
 /**
  * @brief exactly what you think
 */
@@ -52,4 +314,36 @@ void invert_show_world_direction();
 void invert_show_triangle_normals();
 void invert_show_world_direction_misses();
 void invert_smooth_lighting_normals();
+/**
+ * @brief Switches mesh intersection between the BVH and testing every triangle
+*/
+void invert_use_mesh_bvh();
+/**
+ * @brief Switches triangle tests between the packed per-triangle records and the vertex pointers of `tris`
+*/
+void invert_use_triangle_records();
+/**
+ * @brief Switches shadows on and off. With shadows on, every light that faces a hit is tested with a shadow ray
+*/
+void invert_shadows();
+/**
+ * @brief Switches primary rays between being traced in packets with vector instructions (see raypacket.h)
+ * and one at a time. Packets are only used together with the mesh BVH and the triangle records
+*/
+void invert_use_ray_packets();
+/**
+ * @brief Switches the mesh BVH walk between testing its leaves one triangle at a time and testing blocks
+ * of 8 or 16 triangles per instruction (see triblock.h). Blocks are only used together with the triangle records
+*/
+void invert_use_triangle_blocks();
+/**
+ * @brief Switches raytrace_scene between walking a top level BVH over the world space bounds of its
+ * meshes and testing every mesh in turn. On by default
+*/
+void invert_use_instance_bvh();
+/**
+ * @brief Switches raytrace_scene between walking a BVH over the world space bounds of its parametric
+ * objects and testing every object on every ray. On by default
+*/
+void invert_use_object_bvh();
 #endif
\ No newline at end of file
@@ -0,0 +1,57 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+/**
+ * @brief A function run once per task by a thread pool
+ *
+ * @param context The context pointer given to threadpool_run
+ * @param task The index of the task to run, from 0 to num_tasks - 1
+ * @param thread The index of the thread running the task, from 0 to num_threads - 1.
+ * Useful for indexing per-thread scratch memory
+ */
+typedef void (*ThreadPoolTask)(void* context, int task, int thread);
+
+/**
+ * @brief A pool of worker threads. Every thread owns a queue of task indices and
+ * steals half of another thread's remaining tasks when its own queue runs dry,
+ * so uneven tasks still keep every thread busy.
+ */
+typedef struct ThreadPool ThreadPool;
+
+/**
+ * @brief Creates a new thread pool
+ *
+ * @param num_threads The total number of threads that run tasks, including the calling thread.
+ * If less than 1 the number of online processors is used
+ * @return ThreadPool* The new pool
+ */
+ThreadPool* threadpool_create(int num_threads);
+
+/**
+ * @brief Runs tasks 0 to num_tasks - 1 on the pool and waits for all of them to finish.
+ * The calling thread works on tasks too. Tasks start out split into contiguous ranges,
+ * one per thread, so neighbouring tasks tend to run on the same thread.
+ *
+ * @param pool The pool to run the tasks on
+ * @param num_tasks The number of tasks
+ * @param task The function to run for every task
+ * @param context A pointer passed to every task
+ */
+void threadpool_run(ThreadPool* pool, int num_tasks, ThreadPoolTask task, void* context);
+
+/**
+ * @brief Gets the number of threads that run tasks in a pool
+ *
+ * @param pool The pool
+ * @return int The number of threads including the calling thread
+ */
+int threadpool_num_threads(ThreadPool* pool);
+
+/**
+ * @brief Stops and joins all of the worker threads and frees the pool
+ *
+ * @param pool The pool to delete
+ */
+void threadpool_delete(ThreadPool* pool);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef TRIBLOCK_H
+#define TRIBLOCK_H
+
+#include <stdbool.h>
+#include "vector.h"
+#include "mesh.h"
+#include "raytrace.h"
+
+// The widths blocks can be built with: one AVX2 register or one AVX-512 register of floats
+#define TRIANGLE_BLOCK_MAX_WIDTH 16
+
+/**
+ * @brief How far outside a triangle (in barycentric coordinates), and how far past the closest hit
+ * (relative to its t), the single precision test still hands a triangle to the double precision test.
+ *
+ * The hits found through the blocks are the hits of the scalar test as long as single precision
+ * rounding stays under this margin, which holds while the ray's origin is less than a few thousand
+ * triangle widths from the triangle. Further away, a ray passing within about this fraction of a
+ * triangle's size from one of its edges may miss it. A ray through a shared edge or vertex may also
+ * report the other triangle of a tie, since the blocks are visited in a different order.
+ */
+#define TRIANGLE_BLOCK_MARGIN 0.001f
+
+extern const TriangleBlocks NULL_TRIANGLE_BLOCKS;
+
+/**
+ * @brief Packs a mesh's triangles into blocks along its BVH, replacing any blocks it had.
+ * Needs the mesh's triangle records and BVH. Called by build_mesh_bvh
+ *
+ * @param mesh The mesh
+ */
+void build_triangle_blocks(Mesh* mesh);
+
+/**
+ * @brief Updates a mesh's triangle blocks after its vertices moved, keeping the tree they were built
+ * with. Called by refit_mesh_bvh
+ *
+ * @param mesh The mesh, with its triangle records up to date
+ * @param prim_bounds The new bounding box of every triangle of the mesh
+ */
+void refit_triangle_blocks(Mesh* mesh, const AABB* prim_bounds);
+
+/**
+ * @brief Frees the nodes and blocks of a set of triangle blocks
+ *
+ * @param blocks The blocks to delete
+ */
+void delete_triangle_blocks(TriangleBlocks* blocks);
+
+/**
+ * @brief Sets how many triangles go in a block built from now on
+ *
+ * @param width 8, 16, or 0 to pick 16 on CPUs with AVX-512 and 8 otherwise (the default)
+ */
+void set_triangle_block_width(int width);
+
+/**
+ * @brief Gets the width blocks are currently built with
+ */
+int triangle_block_width();
+
+/**
+ * @brief Gets the name of the instruction set blocks are tested with: "avx512", "avx2" or "sse2" on
+ * x86, "generic" elsewhere. The best one the CPU supports is chosen the first time it is needed
+ */
+const char* triangle_block_isa();
+
+/**
+ * @brief Finds the closest triangle of a mesh hit by a ray by walking the mesh's triangle blocks.
+ * Every block is tested in single precision against one ray at a time and the triangles that pass are
+ * confirmed with the double precision test, so the hits match the scalar BVH walk within TRIANGLE_BLOCK_MARGIN
+ *
+ * @param tri_out Set to the index of the closest triangle if one was hit
+ * @param t_out Set to the ray parameter of the closest hit, or closest_t if nothing closer was hit
+ * @param barycentric_out If not NULL, set to the barycentric coordinates of the closest hit
+ * @param closest_t Only triangles hit before this ray parameter count
+ * @param ray The ray
+ * @param mesh The mesh, which must have triangle blocks
+ * @return true if a triangle closer than closest_t was hit
+ */
+bool triangle_blocks_intersect(int* tri_out, double* t_out, Vector2* barycentric_out, double closest_t, Ray ray, const Mesh* mesh);
+
+/**
+ * @brief Checks whether any triangle of a mesh blocks a ray before max_t, using the triangle blocks
+ *
+ * @param max_t Hits at or beyond this ray parameter are ignored
+ * @param ray The ray
+ * @param mesh The mesh, which must have triangle blocks
+ * @return true if the ray is blocked
+ */
+bool triangle_blocks_occluded(double max_t, Ray ray, const Mesh* mesh);
+
+#endif
@@ -1,4 +1,4 @@
-// VERSION 104
+// VERSION 105
 /*
     FPToolkit.c : A simple set of graphical tools.
     Copyright (C) 2018  Ely
@@ -80,6 +80,31 @@ an int if the function was declared to do so
 */
 
 
+/* Version 105 :
+  A headless display that draws into an in-memory
+  buffer and never needs an X server :
+
+  int G_choose_headless_display()
+  // make this call BEFORE G_init_graphics,
+  // or set the environment variable FPT_HEADLESS
+
+  An X display that draws into a client side image
+  (in shared memory when possible) and sends the whole
+  image to the X server with one request per G_display_image :
+
+  int G_choose_ximage_display()
+  // make this call BEFORE G_init_graphics,
+  // or set the environment variable FPT_XIMAGE
+  // link with -lXext
+
+  and fast ways to save the image with any display :
+
+  int G_save_to_png_file (char *fname)
+  int G_save_to_ppm_file (char *fname)
+  // return 0 if failure, else return 1
+*/
+
+
 					    
 
 #ifndef FPT876PBNM3521
@@ -93,6 +118,7 @@ an int if the function was declared to do so
 #include <time.h> // for the get_time stuff
 #include <sys/time.h> 
 #include <string.h> // for strlen
+#include <png.h> // for G_save_to_png_file
 
 
 
@@ -106,6 +132,9 @@ an int if the function was declared to do so
 #include <X11/Xlib.h>
 #include <X11/keysym.h> 
 #include <X11/Xutil.h>// for XComposeStatus
+#include <X11/extensions/XShm.h> // for the XImage display
+#include <sys/ipc.h>
+#include <sys/shm.h>
 
 int Set_Color_Rgb_X (int r, int g, int b) ;
 
@@ -156,6 +185,33 @@ int G_choose_repl_display()
 }
 */
 
+
+int G_choose_headless_display()
+// for those who want to render without an X server,
+// e.g. batch renders on a machine with no display.
+// Drawing goes into an in-memory buffer that can be
+// written out with G_save_to_png_file or G_save_to_ppm_file.
+// make this call BEFORE G_init_graphics
+// (setting the environment variable FPT_HEADLESS does the same)
+{
+  Display_Code = 102 ;
+  return 1 ;
+}
+
+
+int G_choose_ximage_display()
+// for those who want a faster X window.
+// Drawing goes into a client side image (in shared memory
+// when the X server allows it) and G_display_image sends
+// the whole image at once, rather than one request per pixel.
+// Text still works but is slow, so keep it out of tight loops.
+// make this call BEFORE G_init_graphics
+// (setting the environment variable FPT_XIMAGE does the same)
+{
+  Display_Code = 103 ;
+  return 1 ;
+}
+
 //////////////////////////////////////////////////////////////
 
 
@@ -1828,225 +1884,1007 @@ XImagePointer Get_ximage_of_display()
 
 
 //====================================================================
-// G stuff :
+// Buffer stuff :
+//
+// A software backend that draws into an in-memory buffer of
+// 32 bit 0x00RRGGBB pixels instead of asking the X server to do it.
+// Rows are stored top down, just like an XImage, so row
+// Xx_Pix_height - 1 - y holds the pixels with y coordinate y.
+// Used by the headless display, which never opens an X display.
 
 
 
-/////////////////////////////////////////////////////////////////////
-// the G_ routines are graphics related and should
-// not be called unless G_init_graphics has been called first
-/////////////////////////////////////////////////////////////////////
-// Xx following are merely pointers
-// which are initialized by G_Init
-// Xx actual space for the pointers is declared here
-// Xx header file has these pointers declared as "extern"
-/////////////////////////////////////////////////////////////////////
+static unsigned int *Bb_Pixels = NULL ;
+static int Bb_Stride ; // pixels from the start of one row to the next
 
-int (* G_close) () ;
-// terminate the graphics
 
+static unsigned int *Bb_Pixel_Address (int x, int y)
+{
+  return Bb_Pixels + (long)(Xx_Pix_height - 1 - y) * Bb_Stride + x ;
+}
 
-int (* G_display_image) () ;
-// make drawing visible if it already isn't
-// in some environments, this might not do anything
-// in others it might copy a buffer and/or do other
-// synchronizing tasks
 
 
-int (* Gi_events) (int *d) ;
+int Set_Color_Rgb_B (int r, int g, int b)
+{
+  if (r < 0) r = 0 ; else if (r > 255) r = 255 ;
+  if (g < 0) g = 0 ; else if (g > 255) g = 255 ;
+  if (b < 0) b = 0 ; else if (b > 255) b = 255 ;
 
-int (* G_events) (double *d) ;
+  Current_Red_Int   = r ;
+  Current_Green_Int = g ;
+  Current_Blue_Int  = b ;
+  Current_Color_Pixel = (r << 16) | (g  << 8) | (b) ;
 
+  return 1 ;
+}
 
 
-// int (* G_resize_window) (int request[2], int actual[2]) ;
-// request[0] = desired width
-// request[1] = desired heigth
-// actual[0] = width you actually got
-// actual[1] = height you actuall got
-// added jan 23, 2014
-// removed July 28, 2022 seemed unused and underlying
-// X subroutine was problematic under some versions of the server
 
+int Set_Color_Rgb_DB (double dr, double dg, double db)
+{
+  int r,g,b ;
 
-int (* G_change_pen_dimensions) (double w, double h) ;
-// return 0 if illegal w,h specified, otherwise 1
+  if (dr < 0.0) dr = 0.0 ; else if (dr > 1.0) dr = 1.0 ;
+  if (dg < 0.0) dg = 0.0 ; else if (dg > 1.0) dg = 1.0 ;
+  if (db < 0.0) db = 0.0 ; else if (db > 1.0) db = 1.0 ;
 
+  r = (int)(256*dr) ;
+  g = (int)(256*dg) ;
+  b = (int)(256*db) ;
 
-int (* Gi_get_current_window_dimensions) (int *dimentsions) ;
-// return 1 if successful
-// needs to be passed an array of two ints
+  Set_Color_Rgb_B (r,g,b) ;
 
+  return 1 ;
+}
 
-int (* G_get_current_window_dimensions) (double *dimentsions) ;
-// return 1 if successful
-// needs to be passed an array of two doubles
 
 
-int (* Gi_rgb) (int r, int g, int b) ;
-// assumes r,g,b are ints in [0,255]
+int Clear_Buffer_B ()
+{
+  int x,y ;
+  for (y = 0 ; y < Xx_Pix_height ; y++) {
+    unsigned int *row = Bb_Pixels + (long)y * Bb_Stride ;
+    for (x = 0 ; x < Xx_Pix_width ; x++) {
+      row[x] = Current_Color_Pixel ;
+    }
+  }
+  Last_Clear_Buffer_Pixel = Current_Color_Pixel ;
 
-int (* G_rgb) (double r, double g, double b) ;
-// assumes r,g,b are doubles in [0, 1]
+  return 1 ;
+}
 
 
-/////////////////////////////////////////////////////////////////////
-// Xx next batch are based on the ability to repeatedly
-//  plot a single pixel
-/////////////////////////////////////////////////////////////////////
 
-int (* G_pixel) (double x, double y) ;
-// return 1 always
-// This is not guaranteed to be safe
+int Point_B (double Dx, double Dy)
+// This is not guaranteed to be safe, just like Point_X
+{
+  *Bb_Pixel_Address ((int)Dx, (int)Dy) = Current_Color_Pixel ;
+  return 1 ;
+}
 
 
-int (* G_point) (double x, double y) ;
-// return 1 always
-// This is SAFE.
-// Draws a thick point whose dimensions are controlled by
-// int G_change_pen_dimensions (double w, double h).
 
-int (* G_circle) (double a, double b, double r) ;
-// always return 1
-// capable of drawing a circle with thick outline
+int Safe_Point_B (double Dx, double Dy)
+{
+  int x = (int)Dx ;
+  int y = (int)Dy ;
 
-int (* G_unclipped_line) (double ixs, double iys, double ixe, double iye) ;
-// return 1 always
-// This is SAFE.
-// Capable of drawing a thick line.
-// This is safe because it depends on G_point (which is SAFE)
-// but because it is unclipped, this code could waste a great
-// deal of time trying to plot lots of points outside the window.
+  if ((x < 0) || (y < 0) || (x >= Xx_Pix_width) || (y >= Xx_Pix_height)) {return 0 ;}
+  *Bb_Pixel_Address (x, y) = Current_Color_Pixel ;
+  return 1 ;
+}
 
 
-int (* G_line) (double ixs, double iys, double ixe, double iye) ;
-// return 0 if line clipped away entirely, else return 1
-// This is SAFE.
-// Capable of drawing a thick line.
-// This also clips
-// Note that the clipping occurs only for a thin, "perfect"
-// line, not for a possibly thick line, but the safety feature
-// of G_point that will actually plot a thick point, keeps the
-// entire code safe.
 
+static void Bresenham_B (int xs, int ys, int xe, int ye)
+// every point is drawn with Safe_Point_B
+{
+  int dx = abs(xe - xs) ;
+  int dy = -abs(ye - ys) ;
+  int sx = xs < xe ? 1 : -1 ;
+  int sy = ys < ye ? 1 : -1 ;
+  int e = dx + dy ;
+  int e2 ;
 
-int (* Gi_polygon) (int *x, int *y, int numpts) ; 
-// return 1 always
-// capable of drawing a polygon with thick outline
+  while (1) {
+    Safe_Point_B (xs, ys) ;
+    if ((xs == xe) && (ys == ye)) break ;
+    e2 = 2*e ;
+    if (e2 >= dy) { e += dy ; xs += sx ; }
+    if (e2 <= dx) { e += dx ; ys += sy ; }
+  }
+}
 
-int (* G_polygon) (double *x, double *y, double numpts) ;
-// provided as an alternative for passing arrays of doubles
-// return 1 always
-// capable of drawing a polygon with thick outline
 
 
-int (* G_triangle) (double x0, double y0, double x1, double y1, double x2, double y2) ; 
-// return value it inherits from G_polygon
-// capable of drawing a triangle with thick outline
+int Line_B (double Dxs, double Dys, double Dxe, double Dye)
+{
+  Bresenham_B ((int)Dxs, (int)Dys, (int)Dxe, (int)Dye) ;
+  return 1 ;
+}
 
 
-int (* G_rectangle) (double xleft, double yleft, double width, double height) ; 
-// return value it inherits from G_polygon
-// capable of drawing a rectangle with thick outline
 
+int Safe_Line_B (double Dxs, double Dys, double Dxe, double Dye)
+// return 0 if line clipped away entirely, else return 1
+// Clips with Liang-Barsky first so that long offscreen lines are cheap
+{
+  double xs = (int)Dxs ;
+  double ys = (int)Dys ;
+  double xe = (int)Dxe ;
+  double ye = (int)Dye ;
+  double dx = xe - xs ;
+  double dy = ye - ys ;
+  double t0 = 0.0, t1 = 1.0 ;
+  double p[4], q[4], r ;
+  int k ;
+
+  p[0] = -dx ; q[0] = xs ;
+  p[1] =  dx ; q[1] = (Xx_Pix_width - 1) - xs ;
+  p[2] = -dy ; q[2] = ys ;
+  p[3] =  dy ; q[3] = (Xx_Pix_height - 1) - ys ;
+
+  for (k = 0 ; k < 4 ; k++) {
+    if (p[k] == 0) {
+      if (q[k] < 0) return 0 ;
+    } else {
+      r = q[k] / p[k] ;
+      if (p[k] < 0) { if (r > t1) return 0 ; if (r > t0) t0 = r ; }
+      else          { if (r < t0) return 0 ; if (r < t1) t1 = r ; }
+    }
+  }
 
+  Bresenham_B ((int)(xs + t0*dx), (int)(ys + t0*dy),
+               (int)(xs + t1*dx), (int)(ys + t1*dy)) ;
+  return 1 ;
+}
 
-/////////////////////////////////////////////////////////////////////
-// This batch are based on the ability to repeatedly
-// draw single pixel horizontal lines
-/////////////////////////////////////////////////////////////////////
 
 
-int (* G_single_pixel_horizontal_line) (double x0, double x1, double y) ;
-// return 1 always
-// This is not guaranteed to be safe
+int Horizontal_Single_Pixel_Line_B (double Dx0, double Dx1, double Dy)
+{
+   int x0 = (int)Dx0 ;
+   int x1 = (int)Dx1 ;
+   int y = (int)Dy ;
+   int t, x ;
+   unsigned int *row ;
 
+   if (y < 0) return 0 ;
+   if (y >= Xx_Pix_height) return 0 ;
+   if (x0 > x1) { t = x1 ; x1 = x0 ; x0 = t ; }
+   if (x1 < 0) return 0 ;
+   if (x0 >= Xx_Pix_width) return 0 ;
+   if (x0 < 0) x0 = 0 ;
+   if (x1 >= Xx_Pix_width) x1 = Xx_Pix_width - 1 ;
 
-int (* G_clear) () ; 
-// return 1 always
+   row = Bb_Pixel_Address (0, y) ;
+   for (x = x0 ; x <= x1 ; x++) {
+     row[x] = Current_Color_Pixel ;
+   }
 
+   return 1 ;
+}
 
-int (* G_fill_circle) (double a, double b, double r) ;
-// always return 1
 
 
-int (* G_unclipped_fill_polygon) (double *xx, double *yy, double n) ;
-// return 0 if size needs to be truncated (unusual), else 1 
-// This is SAFE
+int Rectangle_B (double Dxlow, double Dylow, double Dwidth, double Dheight)
+{
+  int xlow = (int)Dxlow ;
+  int ylow = (int)Dylow ;
+  int width = (int)Dwidth ;
+  int height = (int)Dheight ;
 
+  Safe_Line_B (xlow, ylow, xlow + width, ylow) ;
+  Safe_Line_B (xlow + width, ylow, xlow + width, ylow + height) ;
+  Safe_Line_B (xlow + width, ylow + height, xlow, ylow + height) ;
+  Safe_Line_B (xlow, ylow + height, xlow, ylow) ;
 
-int (* Gi_fill_polygon) (int *xx, int *yy, int n) ;
-// return 0 if size needs to be truncated (unusual), 
-// or if clipping is used,  otherwise return 1
-// This is SAFE
-// AND it clips
+  return 1 ;
+}
 
 
-int (* G_fill_polygon) (double *xx, double *yy, double n) ;
-// provided as an alternative for passing arrays of doubles
-// return 0 if size needs to be truncated (unusual), 
-// or if clipping is used,  otherwise return 1
-// This is SAFE
-// AND it clips
 
+int Fill_Rectangle_B (double Dxlow, double Dylow, double Dwidth, double Dheight)
+{
+  int xlow = (int)Dxlow ;
+  int ylow = (int)Dylow ;
+  int width = (int)Dwidth ;
+  int height = (int)Dheight ;
+  int y ;
 
-int (* G_fill_triangle) (double x0, double y0, double x1, double y1, double x2, double y2) ; 
-// return value it inherits from G_fill_polygon
+  if (width <= 0) return 1 ;
+  for (y = ylow ; y < ylow + height ; y++) {
+    Horizontal_Single_Pixel_Line_B (xlow, xlow + width - 1, y) ;
+  }
 
+  return 1 ;
+}
 
-int (* G_fill_rectangle) (double xleft, double yleft, double width, double height) ;
-// return value it inherits from G_fill_polygon
 
 
-int (* G_font_pixel_height) () ;
-// return the font height in pixels
+int Polygon_DB (double *x, double *y, double Dnpts)
+{
+  int npts = (int)Dnpts ;
+  int k ;
 
+  if (npts <= 0) return 0 ;
 
+  for (k = 0 ; k < npts ; k++) {
+    Safe_Line_B (x[k], y[k], x[(k+1) % npts], y[(k+1) % npts]) ;
+  }
 
+  return 1 ;
+}
 
 
 
-// the void * pointers below allow for passing in 
-// either an array of characters (usual usage)
-// but also, perhaps, an double array of packed 
-// characters
+int Polygon_B (int *x, int *y, int npts)
+{
+  int k ;
 
-int (* G_string_pixel_width) (const void *s) ;
-// return the length in pixles of the string s
+  if (npts <= 0) return 0 ;
 
-int (* G_draw_string) (const void *one_line_of_text, double LLx, double LLy) ;
-// draw a single line of text beginning at (LLx,LLy) which specifies
-// the coordinates of the lower left corner of the bounding box
-// of the text
+  for (k = 0 ; k < npts ; k++) {
+    Safe_Line_B (x[k], y[k], x[(k+1) % npts], y[(k+1) % npts]) ;
+  }
 
+  return 1 ;
+}
 
-int (* G_draw_text) (
-               int num_lines_of_text,
-               const void  *lines_of_text, // an array of pointers
-               double startx, 
-               double starty,
-               double height,
-               double x_over_y_ratio,
-               double extra_space_between_letters_fraction,
-               double extra_space_between_lines_fraction) ;
 
 
-int (* G_save_image_to_file) (const void *filename) ;
-// return 1 if successful, else 0
+int Fill_Polygon_DB (double *x, double *y, double Dnpts)
+// Even-odd scanline fill, the same rule XFillPolygon uses by default
+{
+  int npts = (int)Dnpts ;
+  double xcross[1000] ;
+  int ix[1000], iy[1000] ;
+  int k, j, n, ymin, ymax, yscan, i0, i1 ;
+  double t ;
+
+  if (npts <= 0) return 0 ;
+
+  if (npts > 1000) {
+    printf("\nFill_Polygon_DB has been asked to deal with %d points.\n",
+           npts) ;
+    printf("Points past first 1000 ignored.\n") ;
+    npts = 1000 ;
+  }
 
-int (* G_get_image_from_file) (const void *filename, double x, double y) ;
-// return 1 if successful, else 0
+  for (k = 0 ; k < npts ; k++) {
+    ix[k] = (int)x[k] ;
+    iy[k] = (int)y[k] ;
+  }
 
+  ymin = ymax = iy[0] ;
+  for (k = 1 ; k < npts ; k++) {
+    if (iy[k] < ymin) ymin = iy[k] ;
+    if (iy[k] > ymax) ymax = iy[k] ;
+  }
+  if (ymin < 0) ymin = 0 ;
+  if (ymax >= Xx_Pix_height) ymax = Xx_Pix_height - 1 ;
+
+  for (yscan = ymin ; yscan <= ymax ; yscan++) {
+    n = 0 ;
+    for (k = 0 ; k < npts ; k++) {
+      j = (k+1) % npts ;
+      // half open so a vertex shared by two edges is only counted once
+      if ((iy[k] <= yscan && yscan < iy[j]) || (iy[j] <= yscan && yscan < iy[k])) {
+        xcross[n++] = ix[k] + (double)(yscan - iy[k]) * (ix[j] - ix[k]) / (iy[j] - iy[k]) ;
+      }
+    }
 
+    // insertion sort, n is tiny
+    for (k = 1 ; k < n ; k++) {
+      t = xcross[k] ;
+      for (j = k - 1 ; j >= 0 && xcross[j] > t ; j--) xcross[j+1] = xcross[j] ;
+      xcross[j+1] = t ;
+    }
 
-int (* G_get_pixel) (double x, double y) ;
-// return the 32 bit pixel value...assumes x,y are legal
-// i.e. it is NOT safe
+    for (k = 0 ; k + 1 < n ; k += 2) {
+      i0 = (int)ceil(xcross[k]) ;
+      i1 = (int)floor(xcross[k+1]) ;
+      if (i0 <= i1) Horizontal_Single_Pixel_Line_B (i0, i1, yscan) ;
+    }
+  }
 
-int (* G_get_pixel_SAFE) (double x, double y, int pixel[1]) ;
-// return 1 if successful, else 0
+  return 1 ;
+}
 
-int (* G_convert_pixel_to_rgbI) (int pixel, int rgbI[3]) ;
+
+
+int Fill_Polygon_B (int *x, int *y, int npts)
+{
+  double xx[1000], yy[1000] ;
+  int k ;
+
+  if (npts > 1000) npts = 1000 ;
+  for (k = 0 ; k < npts ; k++) { xx[k] = x[k] ; yy[k] = y[k] ; }
+
+  return Fill_Polygon_DB (xx, yy, npts) ;
+}
+
+
+
+int Triangle_B (double Dx1, double Dy1,
+                double Dx2, double Dy2,
+                double Dx3, double Dy3)
+{
+  double x[3], y[3] ;
+  x[0] = Dx1 ; y[0] = Dy1 ;
+  x[1] = Dx2 ; y[1] = Dy2 ;
+  x[2] = Dx3 ; y[2] = Dy3 ;
+  return Polygon_DB (x, y, 3) ;
+}
+
+
+
+int Fill_Triangle_B (double Dx1, double Dy1,
+                     double Dx2, double Dy2,
+                     double Dx3, double Dy3)
+{
+  double x[3], y[3] ;
+  x[0] = Dx1 ; y[0] = Dy1 ;
+  x[1] = Dx2 ; y[1] = Dy2 ;
+  x[2] = Dx3 ; y[2] = Dy3 ;
+  return Fill_Polygon_DB (x, y, 3) ;
+}
+
+
+
+int Circle_B (double Da, double Db, double Dr)
+{
+ int a = (int)Da ;
+ int b = (int)Db ;
+ int r = (int)Dr ;
+
+ int x,y,e,e1,e2 ;
+
+ x = r ;
+ y = 0 ;
+ e = 0;
+
+ while (x >= y) {
+
+       Safe_Point_B( a+x,b+y) ;   Safe_Point_B( a-x,b+y) ;
+       Safe_Point_B( a+x,b-y) ;   Safe_Point_B( a-x,b-y) ;
+
+       Safe_Point_B( a+y,b+x) ;   Safe_Point_B( a-y,b+x) ;
+       Safe_Point_B( a+y,b-x) ;   Safe_Point_B( a-y,b-x) ;
+
+       e1 =  e + y + y + 1 ;
+       e2 = e1 - x - x + 1 ;
+       y  =  y + 1 ;
+
+       if ( abs(e2) < abs(e1) ) {
+              x = x - 1 ;
+              e = e2 ;
+       } else e = e1 ;
+
+     }
+
+  return 1 ;
+}
+
+
+
+int Fill_Circle_B (double Da, double Db, double Dr)
+{
+ int a = (int)Da ;
+ int b = (int)Db ;
+ int r = (int)Dr ;
+
+ int x,y,e,e1,e2 ;
+
+ x = r ;
+ y = 0 ;
+ e = 0;
+
+ while (x >= y) {
+
+       Horizontal_Single_Pixel_Line_B (a-x, a+x, b+y) ;
+       Horizontal_Single_Pixel_Line_B (a-x, a+x, b-y) ;
+
+       Horizontal_Single_Pixel_Line_B (a-y, a+y, b+x) ;
+       Horizontal_Single_Pixel_Line_B (a-y, a+y, b-x) ;
+
+       e1 =  e + y + y + 1 ;
+       e2 = e1 - x - x + 1 ;
+       y  =  y + 1 ;
+
+       if ( abs(e2) < abs(e1) ) {
+              x = x - 1 ;
+              e = e2 ;
+       } else e = e1 ;
+
+     }
+
+  return 1 ;
+}
+
+
+
+int Get_Pixel_B (double Dx, double Dy)
+// return the 32 bit pixel value...assumes x,y are legal
+// i.e. it is NOT safe
+{
+  return *Bb_Pixel_Address ((int)Dx, (int)Dy) ;
+}
+
+
+
+int Get_Pixel_SAFE_B (double Dx, double Dy, int pixel[1])
+// return 1 if successful, else 0
+{
+  int x = (int)Dx ;
+  int y = (int)Dy ;
+
+  if ((x < 0) || (x >= Xx_Pix_width) || (y < 0) || (y >= Xx_Pix_height))
+    return 0 ;
+
+  pixel[0] = *Bb_Pixel_Address (x, y) ;
+  return 1 ;
+}
+
+
+
+//////////////////////////////////////////////////////////////
+// Headless display : the buffer backend with no X server at all
+
+
+// The headless display has no fonts, so text is measured as if
+// it were drawn in the 10x20 font X uses, but nothing is drawn.
+
+int Font_Pixel_Height_H ()
+{
+  return 20 ;
+}
+
+
+int String_Pixel_Width_H (const void *s)
+{
+  return 10 * strlen((const char *)s) ;
+}
+
+
+int Draw_String_H (const void *s, double Dx, double Dy)
+{
+  return 0 ;
+}
+
+
+int Get_Events_H (int *d)
+// There is never anything to report, just like an empty X event queue
+{
+  d[0] = 0 ;
+  d[1] = 0 ;
+  return -3000 ;
+}
+
+
+int Get_Events_DH (double *d)
+{
+  d[0] = 0 ;
+  d[1] = 0 ;
+  return -3000 ;
+}
+
+
+int Copy_Buffer_And_Flush_H ()
+// the buffer IS the image, there is nowhere to copy it to
+{
+  return 1 ;
+}
+
+
+int Save_Image_To_File_H (const void *filename)
+{
+  printf("Save_Image_To_File_H : xwd files need X, use G_save_to_png_file\n") ;
+  return 0 ;
+}
+
+
+int Get_Image_From_File_H (const void *filename, double Dx, double Dy)
+{
+  printf("Get_Image_From_File_H : xwd files need X\n") ;
+  return 0 ;
+}
+
+
+int Init_H (double Dswidth, double Dsheight)
+{
+    Xx_Pix_width = (int)Dswidth ;
+    Xx_Pix_height = (int)Dsheight ;
+    Xx_Win_width = Xx_Pix_width ;
+    Xx_Win_height = Xx_Pix_height ;
+
+    Bb_Stride = Xx_Pix_width ;
+    Bb_Pixels = (unsigned int *)malloc(sizeof(unsigned int) * Xx_Pix_width * Xx_Pix_height) ;
+    if (Bb_Pixels == NULL) {
+        printf("Unable to allocate the headless framebuffer ... exiting.\n") ;
+        exit(0) ;
+    }
+
+    // most people expect a white piece of paper
+    // with a black pencil
+    Set_Color_Rgb_B (255,255,255) ;
+    Clear_Buffer_B() ;
+    Set_Color_Rgb_B (0,0,0) ;
+    return 1 ;
+}
+
+
+int Close_Down_H ()
+{
+    free(Bb_Pixels) ;
+    Bb_Pixels = NULL ;
+    return 1 ;
+}
+
+
+
+
+//====================================================================
+// XImage stuff :
+//
+// The buffer backend drawing straight into a client side XImage,
+// in shared memory when the MIT-SHM extension is available.
+// Nothing reaches the X server until G_display_image, which
+// sends the whole image with one XPutImage (or XShmPutImage).
+
+
+
+static XImage *XxImage = NULL ;
+static int XxImage_Uses_Shm = 0 ;
+static XShmSegmentInfo XxShmInfo ;
+static int XxShm_Failed ;
+
+
+static int Shm_Error_Handler_I (Display *d, XErrorEvent *e)
+// XShmAttach fails this way on a remote display
+{
+  XxShm_Failed = 1 ;
+  return 0 ;
+}
+
+
+
+static XImage *Create_Shm_Image_I ()
+{
+  XImage *pxim ;
+  int (*old_handler)(Display *, XErrorEvent *) ;
+
+  if (!XShmQueryExtension(XxDisplay)) return NULL ;
+
+  pxim = XShmCreateImage (XxDisplay, DefaultVisual(XxDisplay, XxScreenNumber),
+                          XxDepth, ZPixmap, NULL, &XxShmInfo,
+                          Xx_Pix_width, Xx_Pix_height) ;
+  if (pxim == NULL) return NULL ;
+
+  XxShmInfo.shmid = shmget (IPC_PRIVATE, pxim->bytes_per_line * pxim->height,
+                            IPC_CREAT | 0600) ;
+  if (XxShmInfo.shmid < 0) {
+    XDestroyImage(pxim) ;
+    return NULL ;
+  }
+
+  XxShmInfo.shmaddr = pxim->data = (char *)shmat (XxShmInfo.shmid, NULL, 0) ;
+  XxShmInfo.readOnly = False ;
+  if (XxShmInfo.shmaddr == (char *)-1) {
+    shmctl (XxShmInfo.shmid, IPC_RMID, NULL) ;
+    pxim->data = NULL ;
+    XDestroyImage(pxim) ;
+    return NULL ;
+  }
+
+  XxShm_Failed = 0 ;
+  old_handler = XSetErrorHandler (Shm_Error_Handler_I) ;
+  XShmAttach (XxDisplay, &XxShmInfo) ;
+  XSync (XxDisplay, False) ;
+  XSetErrorHandler (old_handler) ;
+
+  // the segment goes away by itself once both sides have detached
+  shmctl (XxShmInfo.shmid, IPC_RMID, NULL) ;
+
+  if (XxShm_Failed) {
+    shmdt (XxShmInfo.shmaddr) ;
+    pxim->data = NULL ;
+    XDestroyImage(pxim) ;
+    return NULL ;
+  }
+
+  return pxim ;
+}
+
+
+
+static XImage *Create_Plain_Image_I ()
+{
+  XImage *pxim ;
+  char *data ;
+
+  data = (char *)malloc(4 * Xx_Pix_width * Xx_Pix_height) ;
+  if (data == NULL) return NULL ;
+
+  pxim = XCreateImage (XxDisplay, DefaultVisual(XxDisplay, XxScreenNumber),
+                       XxDepth, ZPixmap, 0, data,
+                       Xx_Pix_width, Xx_Pix_height, 32, 0) ;
+  if (pxim == NULL) free(data) ;
+
+  return pxim ;
+}
+
+
+
+static void Destroy_Image_I ()
+{
+  if (XxImage == NULL) return ;
+
+  if (XxImage_Uses_Shm) {
+    XShmDetach (XxDisplay, &XxShmInfo) ;
+    XSync (XxDisplay, False) ;
+    shmdt (XxShmInfo.shmaddr) ;
+    XxImage->data = NULL ; // not ours to free
+  }
+  XDestroyImage(XxImage) ; // frees the data of a plain image
+
+  XxImage = NULL ;
+  XxImage_Uses_Shm = 0 ;
+  Bb_Pixels = NULL ;
+}
+
+
+
+int Init_Image_I ()
+// call after Init_X
+// return 1 if the image could be made, else 0
+// and the caller should just keep drawing with X
+{
+  unsigned int one = 1 ;
+
+  XxImage_Uses_Shm = 1 ;
+  XxImage = Create_Shm_Image_I () ;
+  if (XxImage == NULL) {
+    XxImage_Uses_Shm = 0 ;
+    XxImage = Create_Plain_Image_I () ;
+  }
+  if (XxImage == NULL) {
+    printf("Unable to create an XImage ... drawing with X instead.\n") ;
+    return 0 ;
+  }
+
+  // the buffer backend writes native 0x00RRGGBB ints
+  if ((XxImage->bits_per_pixel != 32) ||
+      (XxImage->red_mask != 0xff0000) ||
+      (XxImage->green_mask != 0xff00) ||
+      (XxImage->blue_mask != 0xff) ||
+      (XxImage->byte_order != ((*(unsigned char *)&one == 1) ? LSBFirst : MSBFirst))) {
+    printf("XImage pixel layout not supported ... drawing with X instead.\n") ;
+    Destroy_Image_I () ;
+    return 0 ;
+  }
+
+  Bb_Pixels = (unsigned int *)XxImage->data ;
+  Bb_Stride = XxImage->bytes_per_line / 4 ;
+
+  // most people expect a white piece of paper
+  // with a black pencil
+  Set_Color_Rgb_B (255,255,255) ;
+  Clear_Buffer_B() ;
+  Set_Color_Rgb_B (0,0,0) ;
+  return 1 ;
+}
+
+
+
+static void Push_Image_I ()
+// the back buffer pixmap catches up with the image
+{
+  if (XxImage_Uses_Shm) {
+    XShmPutImage (XxDisplay, XxPixmap, XxPixmapContext, XxImage,
+                  0,0, 0,0, Xx_Pix_width, Xx_Pix_height, False) ;
+  } else {
+    XPutImage (XxDisplay, XxPixmap, XxPixmapContext, XxImage,
+               0,0, 0,0, Xx_Pix_width, Xx_Pix_height) ;
+  }
+}
+
+
+
+static void Pull_Image_I ()
+// the image catches up with the back buffer pixmap
+{
+  if (XxImage_Uses_Shm) {
+    XShmGetImage (XxDisplay, XxPixmap, XxImage, 0,0, AllPlanes) ;
+  } else {
+    XGetSubImage (XxDisplay, XxPixmap, 0,0, Xx_Pix_width, Xx_Pix_height,
+                  AllPlanes, ZPixmap, XxImage, 0,0) ;
+  }
+}
+
+
+
+int Copy_Image_And_Flush_I ()
+{
+  Push_Image_I () ;
+  Copy_Buffer_X () ;
+
+  // wait for the server, it may still be reading the
+  // shared memory that we are about to draw into again
+  XSync (XxDisplay, False) ;
+
+  return 1 ;
+}
+
+
+
+int Draw_String_I (const void *s, double Dx, double Dy)
+// Text is still drawn by X, which costs a round trip
+// of the whole image, so keep it out of tight loops
+{
+  int r ;
+
+  Push_Image_I () ;
+  XSetForeground(XxDisplay, XxPixmapContext, Current_Color_Pixel) ;
+  r = Draw_String_X (s, Dx, Dy) ;
+  Pull_Image_I () ;
+
+  return r ;
+}
+
+
+
+int Save_Image_To_File_I (const void *filename)
+{
+  Push_Image_I () ;
+  return Save_Image_To_File_X (filename) ;
+}
+
+
+
+int Get_Image_From_File_I (const void *filename, double Dx, double Dy)
+{
+  int r ;
+
+  Push_Image_I () ;
+  r = Get_Image_From_File_X (filename, Dx, Dy) ;
+  Pull_Image_I () ;
+
+  return r ;
+}
+
+
+
+int Close_Down_I ()
+{
+  Destroy_Image_I () ;
+  return Close_Down_X () ;
+}
+
+
+
+
+//====================================================================
+// G stuff :
+
+
+
+/////////////////////////////////////////////////////////////////////
+// the G_ routines are graphics related and should
+// not be called unless G_init_graphics has been called first
+/////////////////////////////////////////////////////////////////////
+// Xx following are merely pointers
+// which are initialized by G_Init
+// Xx actual space for the pointers is declared here
+// Xx header file has these pointers declared as "extern"
+/////////////////////////////////////////////////////////////////////
+
+int (* G_close) () ;
+// terminate the graphics
+
+
+int (* G_display_image) () ;
+// make drawing visible if it already isn't
+// in some environments, this might not do anything
+// in others it might copy a buffer and/or do other
+// synchronizing tasks
+
+
+int (* Gi_events) (int *d) ;
+
+int (* G_events) (double *d) ;
+
+
+
+// int (* G_resize_window) (int request[2], int actual[2]) ;
+// request[0] = desired width
+// request[1] = desired heigth
+// actual[0] = width you actually got
+// actual[1] = height you actuall got
+// added jan 23, 2014
+// removed July 28, 2022 seemed unused and underlying
+// X subroutine was problematic under some versions of the server
+
+
+int (* G_change_pen_dimensions) (double w, double h) ;
+// return 0 if illegal w,h specified, otherwise 1
+
+
+int (* Gi_get_current_window_dimensions) (int *dimentsions) ;
+// return 1 if successful
+// needs to be passed an array of two ints
+
+
+int (* G_get_current_window_dimensions) (double *dimentsions) ;
+// return 1 if successful
+// needs to be passed an array of two doubles
+
+
+int (* Gi_rgb) (int r, int g, int b) ;
+// assumes r,g,b are ints in [0,255]
+
+int (* G_rgb) (double r, double g, double b) ;
+// assumes r,g,b are doubles in [0, 1]
+
+
+/////////////////////////////////////////////////////////////////////
+// Xx next batch are based on the ability to repeatedly
+//  plot a single pixel
+/////////////////////////////////////////////////////////////////////
+
+int (* G_pixel) (double x, double y) ;
+// return 1 always
+// This is not guaranteed to be safe
+
+
+int (* G_point) (double x, double y) ;
+// return 1 always
+// This is SAFE.
+// Draws a thick point whose dimensions are controlled by
+// int G_change_pen_dimensions (double w, double h).
+
+int (* G_circle) (double a, double b, double r) ;
+// always return 1
+// capable of drawing a circle with thick outline
+
+int (* G_unclipped_line) (double ixs, double iys, double ixe, double iye) ;
+// return 1 always
+// This is SAFE.
+// Capable of drawing a thick line.
+// This is safe because it depends on G_point (which is SAFE)
+// but because it is unclipped, this code could waste a great
+// deal of time trying to plot lots of points outside the window.
+
+
+int (* G_line) (double ixs, double iys, double ixe, double iye) ;
+// return 0 if line clipped away entirely, else return 1
+// This is SAFE.
+// Capable of drawing a thick line.
+// This also clips
+// Note that the clipping occurs only for a thin, "perfect"
+// line, not for a possibly thick line, but the safety feature
+// of G_point that will actually plot a thick point, keeps the
+// entire code safe.
+
+
+int (* Gi_polygon) (int *x, int *y, int numpts) ; 
+// return 1 always
+// capable of drawing a polygon with thick outline
+
+int (* G_polygon) (double *x, double *y, double numpts) ;
+// provided as an alternative for passing arrays of doubles
+// return 1 always
+// capable of drawing a polygon with thick outline
+
+
+int (* G_triangle) (double x0, double y0, double x1, double y1, double x2, double y2) ; 
+// return value it inherits from G_polygon
+// capable of drawing a triangle with thick outline
+
+
+int (* G_rectangle) (double xleft, double yleft, double width, double height) ; 
+// return value it inherits from G_polygon
+// capable of drawing a rectangle with thick outline
+
+
+
+/////////////////////////////////////////////////////////////////////
+// This batch are based on the ability to repeatedly
+// draw single pixel horizontal lines
+/////////////////////////////////////////////////////////////////////
+
+
+int (* G_single_pixel_horizontal_line) (double x0, double x1, double y) ;
+// return 1 always
+// This is not guaranteed to be safe
+
+
+int (* G_clear) () ; 
+// return 1 always
+
+
+int (* G_fill_circle) (double a, double b, double r) ;
+// always return 1
+
+
+int (* G_unclipped_fill_polygon) (double *xx, double *yy, double n) ;
+// return 0 if size needs to be truncated (unusual), else 1 
+// This is SAFE
+
+
+int (* Gi_fill_polygon) (int *xx, int *yy, int n) ;
+// return 0 if size needs to be truncated (unusual), 
+// or if clipping is used,  otherwise return 1
+// This is SAFE
+// AND it clips
+
+
+int (* G_fill_polygon) (double *xx, double *yy, double n) ;
+// provided as an alternative for passing arrays of doubles
+// return 0 if size needs to be truncated (unusual), 
+// or if clipping is used,  otherwise return 1
+// This is SAFE
+// AND it clips
+
+
+int (* G_fill_triangle) (double x0, double y0, double x1, double y1, double x2, double y2) ; 
+// return value it inherits from G_fill_polygon
+
+
+int (* G_fill_rectangle) (double xleft, double yleft, double width, double height) ;
+// return value it inherits from G_fill_polygon
+
+
+int (* G_font_pixel_height) () ;
+// return the font height in pixels
+
+
+
+
+
+
+// the void * pointers below allow for passing in 
+// either an array of characters (usual usage)
+// but also, perhaps, an double array of packed 
+// characters
+
+int (* G_string_pixel_width) (const void *s) ;
+// return the length in pixles of the string s
+
+int (* G_draw_string) (const void *one_line_of_text, double LLx, double LLy) ;
+// draw a single line of text beginning at (LLx,LLy) which specifies
+// the coordinates of the lower left corner of the bounding box
+// of the text
+
+
+int (* G_draw_text) (
+               int num_lines_of_text,
+               const void  *lines_of_text, // an array of pointers
+               double startx, 
+               double starty,
+               double height,
+               double x_over_y_ratio,
+               double extra_space_between_letters_fraction,
+               double extra_space_between_lines_fraction) ;
+
+
+int (* G_save_image_to_file) (const void *filename) ;
+// return 1 if successful, else 0
+
+int (* G_get_image_from_file) (const void *filename, double x, double y) ;
+// return 1 if successful, else 0
+
+
+
+int (* G_get_pixel) (double x, double y) ;
+// return the 32 bit pixel value...assumes x,y are legal
+// i.e. it is NOT safe
+
+int (* G_get_pixel_SAFE) (double x, double y, int pixel[1]) ;
+// return 1 if successful, else 0
+
+int (* G_convert_pixel_to_rgbI) (int pixel, int rgbI[3]) ;
 // rgbI[] values in 0-255
 // return 1 if successful, else 0
 
@@ -2147,8 +2985,137 @@ int  G_init_graphics (double w, double h)
 
  G_convert_rgbI_to_rgb = Convert_rgbI_To_rgb_X ;
 
+ if (getenv("FPT_HEADLESS") != NULL) { Display_Code = 102 ; }
+
+ if (Display_Code == 102) {
+   // headless : the same drawing, but into the in-memory buffer
+   // and never touching X
+
+   G_close = Close_Down_H ;
+
+   G_display_image = Copy_Buffer_And_Flush_H ;
+
+   Gi_events = Get_Events_H ;
+
+   G_events = Get_Events_DH ;
+
+   Gi_rgb = Set_Color_Rgb_B ;
+
+   G_rgb = Set_Color_Rgb_DB ;
+
+   G_pixel = Point_B ;
+
+   G_point = Safe_Point_B ;
+
+   G_circle = Circle_B ;
+
+   G_unclipped_line = Line_B ;
+
+   G_line = Safe_Line_B ;
+
+   Gi_polygon = Polygon_B ;
+
+   G_polygon = Polygon_DB ;
+
+   G_triangle = Triangle_B ;
+
+   G_rectangle = Rectangle_B ;
+
+   G_single_pixel_horizontal_line = Horizontal_Single_Pixel_Line_B ;
+
+   G_clear = Clear_Buffer_B ;
+
+   G_fill_circle = Fill_Circle_B ;
+
+   G_unclipped_fill_polygon = Fill_Polygon_DB ;
+
+   Gi_fill_polygon = Fill_Polygon_B ;
+
+   G_fill_polygon = Fill_Polygon_DB ;
+
+   G_fill_triangle = Fill_Triangle_B ;
+
+   G_fill_rectangle = Fill_Rectangle_B ;
+
+   G_font_pixel_height = Font_Pixel_Height_H ;
+
+   G_string_pixel_width = String_Pixel_Width_H ;
+
+   G_draw_string = Draw_String_H ;
+
+   G_save_image_to_file = Save_Image_To_File_H ;
+
+   G_get_image_from_file = Get_Image_From_File_H ;
+
+   G_get_pixel = Get_Pixel_B ;
+
+   G_get_pixel_SAFE = Get_Pixel_SAFE_B ;
+
+   s = Init_H(w,h) ;
+
+   return s ;
+ }
+
  s = Init_X(w,h) ;
 
+ if (getenv("FPT_XIMAGE") != NULL) { Display_Code = 103 ; }
+
+ if ((s == 1) && (Display_Code == 103) && Init_Image_I()) {
+   // the X window, but the drawing goes into the image
+
+   G_close = Close_Down_I ;
+
+   G_display_image = Copy_Image_And_Flush_I ;
+
+   Gi_rgb = Set_Color_Rgb_B ;
+
+   G_rgb = Set_Color_Rgb_DB ;
+
+   G_pixel = Point_B ;
+
+   G_point = Safe_Point_B ;
+
+   G_circle = Circle_B ;
+
+   G_unclipped_line = Line_B ;
+
+   G_line = Safe_Line_B ;
+
+   Gi_polygon = Polygon_B ;
+
+   G_polygon = Polygon_DB ;
+
+   G_triangle = Triangle_B ;
+
+   G_rectangle = Rectangle_B ;
+
+   G_single_pixel_horizontal_line = Horizontal_Single_Pixel_Line_B ;
+
+   G_clear = Clear_Buffer_B ;
+
+   G_fill_circle = Fill_Circle_B ;
+
+   G_unclipped_fill_polygon = Fill_Polygon_DB ;
+
+   Gi_fill_polygon = Fill_Polygon_B ;
+
+   G_fill_polygon = Fill_Polygon_DB ;
+
+   G_fill_triangle = Fill_Triangle_B ;
+
+   G_fill_rectangle = Fill_Rectangle_B ;
+
+   G_draw_string = Draw_String_I ;
+
+   G_save_image_to_file = Save_Image_To_File_I ;
+
+   G_get_image_from_file = Get_Image_From_File_I ;
+
+   G_get_pixel = Get_Pixel_B ;
+
+   G_get_pixel_SAFE = Get_Pixel_SAFE_B ;
+ }
+
  return s ;
 }
 
@@ -2167,6 +3134,11 @@ int Gi_wait_click(int p[2])
   int sig ;
 
   G_display_image();  
+  if (Display_Code == 102) {
+    // nobody is there to click, so don't wait forever
+    p[0] = 0 ; p[1] = 0 ;
+    return -3 ;
+  }
   do {
     sig = Gi_events(p) ;
   }  while (sig != -3) ;
@@ -2191,11 +3163,13 @@ int G_wait_click(double p[2])
 
 
 int G_wait_key()
+// a headless display returns -1 immediately since no key will ever come
 {
   int p[2] ;
   int sig ;
 
   G_display_image();  
+  if (Display_Code == 102) return -1 ;
   do {
     sig = Gi_events(p) ;
   }  while (sig < 0) ;
@@ -2516,17 +3490,95 @@ int pixel_to_byte_rgb (int pix, char Brgb[3])
 
 
 
-int G_save_to_bmp_file (char *fname)
-// return 1 if successful, otherwise return 0 
-// (probably because the file could not be opened)
+static unsigned int *Get_Frame_Pixels (int *stride)
+// Returns the current image as 0x00RRGGBB pixels, rows top down,
+// with *stride pixels from the start of one row to the next.
+// Give the result back with Release_Frame_Pixels.
+// Returns NULL on failure.
 {
+  unsigned int *pixels ;
+  XImage *pxim ;
+  int x,y ;
+
+  if (Bb_Pixels != NULL) {
+    // the buffer already is the image
+    *stride = Bb_Stride ;
+    return Bb_Pixels ;
+  }
+
+  *stride = Xx_Pix_width ;
 
   //==================================  
   // X11 stuff
-  XImage *pxim ;
+  // one round trip for the whole image
   pxim = XGetImage (XxDisplay, XxDrawable, 0,0, Xx_Pix_width, Xx_Pix_height,
                       AllPlanes, ZPixmap) ;
-  //==================================
+  if (pxim == NULL) return NULL ;
+
+  pixels = (unsigned int *)malloc(sizeof(unsigned int) * Xx_Pix_width * Xx_Pix_height) ;
+  if (pixels == NULL) {
+    XDestroyImage(pxim) ;
+    return NULL ;
+  }
+
+  if ((pxim->bits_per_pixel == 32) && (pxim->byte_order == LSBFirst) &&
+      (pxim->red_mask == 0xff0000) && (pxim->green_mask == 0xff00) &&
+      (pxim->blue_mask == 0xff)) {
+    // the common TrueColor layout is already what we want
+    for (y = 0 ; y < Xx_Pix_height ; y++) {
+      memcpy(pixels + (long)y * Xx_Pix_width,
+             pxim->data + (long)y * pxim->bytes_per_line,
+             sizeof(unsigned int) * Xx_Pix_width) ;
+    }
+  } else {
+    for (y = 0 ; y < Xx_Pix_height ; y++) {
+      for (x = 0 ; x < Xx_Pix_width ; x++) {
+        pixels[(long)y * Xx_Pix_width + x] = XGetPixel(pxim, x, y) ;
+      }
+    }
+  }
+
+  XDestroyImage(pxim) ; // lack of this was causing mem leaks when
+  // many images were being saved for movies
+  //==================================  
+
+  return pixels ;
+}
+
+
+
+static void Release_Frame_Pixels (unsigned int *pixels)
+{
+  if (pixels != Bb_Pixels) free(pixels) ;
+}
+
+
+
+static void Frame_Row_To_Rgb (unsigned int *row, unsigned char *rgb)
+// converts one row of 0x00RRGGBB pixels to 3 bytes per pixel
+{
+  int x ;
+  for (x = 0 ; x < Xx_Pix_width ; x++) {
+    rgb[3*x    ] = (row[x] >> 16) & 0xff ;
+    rgb[3*x + 1] = (row[x] >>  8) & 0xff ;
+    rgb[3*x + 2] = (row[x]      ) & 0xff ;
+  }
+}
+
+
+
+int G_save_to_bmp_file (char *fname)
+// return 1 if successful, otherwise return 0 
+// (probably because the file could not be opened)
+{
+
+  unsigned int *pixels ;
+  int stride ;
+  pixels = Get_Frame_Pixels(&stride) ;
+  if (pixels == NULL) {
+    printf("G_save_to_bmp_file : can't read the image\n") ;
+    return 0 ;
+  }
 
 
   FILE *f ;
@@ -2535,6 +3587,7 @@ int G_save_to_bmp_file (char *fname)
   f = fopen(fname,"w") ;
   if (f == NULL) {
     printf("G_save_to_bmp_file : can't open file %s\n",fname) ;
+    Release_Frame_Pixels(pixels) ;
     return 0 ;
   }
 
@@ -2578,7 +3631,7 @@ int G_save_to_bmp_file (char *fname)
       
       // pix = G_get_pixel(x,y) ;
       // pixel_to_byte_rgb(pix, Brgb) ;
-      p = XGetPixel(pxim,x, Xx_Pix_height - 1 - y) ; // X11 stuff
+      p = pixels[(long)(Xx_Pix_height - 1 - y) * stride + x] ;
       pixel_to_byte_rgb(p, Brgb) ;
       
 
@@ -2596,12 +3649,7 @@ int G_save_to_bmp_file (char *fname)
 
   fclose(f) ;
 
-
-  //==================================  
-  // X11 stuff
-  XDestroyImage(pxim) ; // lack of this was causing mem leaks when
-  // many images were being saved for movies
-  //==================================  
+  Release_Frame_Pixels(pixels) ;
   
   return 1 ;
 
@@ -2610,6 +3658,129 @@ int G_save_to_bmp_file (char *fname)
 
 
 
+int G_save_to_ppm_file (char *fname)
+// binary (P6) ppm, which nearly everything can read
+// return 1 if successful, otherwise return 0 
+{
+  unsigned int *pixels ;
+  unsigned char *rgb ;
+  FILE *f ;
+  int y, ok, stride ;
+
+  pixels = Get_Frame_Pixels(&stride) ;
+  if (pixels == NULL) {
+    printf("G_save_to_ppm_file : can't read the image\n") ;
+    return 0 ;
+  }
+
+  f = fopen(fname,"wb") ;
+  if (f == NULL) {
+    printf("G_save_to_ppm_file : can't open file %s\n",fname) ;
+    Release_Frame_Pixels(pixels) ;
+    return 0 ;
+  }
+
+  rgb = (unsigned char *)malloc(3 * Xx_Pix_width * Xx_Pix_height) ;
+  if (rgb == NULL) {
+    printf("G_save_to_ppm_file : out of memory\n") ;
+    fclose(f) ;
+    Release_Frame_Pixels(pixels) ;
+    return 0 ;
+  }
+
+  for (y = 0 ; y < Xx_Pix_height ; y++) {
+    Frame_Row_To_Rgb (pixels + (long)y * stride, rgb + 3L * y * Xx_Pix_width) ;
+  }
+
+  // a single write for the whole image
+  fprintf(f, "P6\n%d %d\n255\n", Xx_Pix_width, Xx_Pix_height) ;
+  ok = fwrite(rgb, 3 * Xx_Pix_width, Xx_Pix_height, f) == Xx_Pix_height ;
+  if (fclose(f) != 0) ok = 0 ;
+
+  free(rgb) ;
+  Release_Frame_Pixels(pixels) ;
+
+  if (!ok) {
+    printf("G_save_to_ppm_file : error writing %s\n",fname) ;
+    return 0 ;
+  }
+  return 1 ;
+}
+
+
+
+
+int G_save_to_png_file (char *fname)
+// return 1 if successful, otherwise return 0 
+// Favors speed over file size : fastest zlib level and the cheap
+// "sub" filter, which still compresses rendered images well.
+{
+  unsigned int *pixels ;
+  unsigned char *rgb = NULL ;
+  png_structp png ;
+  png_infop info ;
+  FILE *f ;
+  int y, stride ;
+
+  pixels = Get_Frame_Pixels(&stride) ;
+  if (pixels == NULL) {
+    printf("G_save_to_png_file : can't read the image\n") ;
+    return 0 ;
+  }
+
+  f = fopen(fname,"wb") ;
+  if (f == NULL) {
+    printf("G_save_to_png_file : can't open file %s\n",fname) ;
+    Release_Frame_Pixels(pixels) ;
+    return 0 ;
+  }
+
+  png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL) ;
+  info = (png == NULL) ? NULL : png_create_info_struct(png) ;
+  rgb = (unsigned char *)malloc(3 * Xx_Pix_width) ;
+  if ((info == NULL) || (rgb == NULL)) {
+    printf("G_save_to_png_file : out of memory\n") ;
+    goto PNG_ERROR ;
+  }
+
+  if (setjmp(png_jmpbuf(png))) {
+    printf("G_save_to_png_file : error writing %s\n",fname) ;
+    goto PNG_ERROR ;
+  }
+
+  png_init_io(png, f) ;
+  png_set_IHDR(png, info, Xx_Pix_width, Xx_Pix_height, 8, PNG_COLOR_TYPE_RGB,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT) ;
+  png_set_compression_level(png, 1) ;
+  png_set_filter(png, PNG_FILTER_TYPE_BASE, PNG_FILTER_SUB) ;
+  png_write_info(png, info) ;
+
+  for (y = 0 ; y < Xx_Pix_height ; y++) {
+    Frame_Row_To_Rgb (pixels + (long)y * stride, rgb) ;
+    png_write_row(png, rgb) ;
+  }
+
+  png_write_end(png, NULL) ;
+  png_destroy_write_struct(&png, &info) ;
+  free(rgb) ;
+  Release_Frame_Pixels(pixels) ;
+  if (fclose(f) != 0) {
+    printf("G_save_to_png_file : error writing %s\n",fname) ;
+    return 0 ;
+  }
+  return 1 ;
+
+ PNG_ERROR:
+  png_destroy_write_struct(&png, &info) ;
+  free(rgb) ;
+  Release_Frame_Pixels(pixels) ;
+  fclose(f) ;
+  return 0 ;
+}
+
+
+
+
 
 
 
@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "bvh.h"
+
+#define SAH_BINS 16
+#define MAX_LEAF_PRIMS 8
+
+static const double TRAVERSAL_COST = 1.0;
+static const double INTERSECTION_COST = 1.0;
+
+const BVH NULL_BVH = {0, NULL, 0, NULL, 0};
+
+static const AABB EMPTY_AABB = {
+    {INFINITY, INFINITY, INFINITY},
+    {-INFINITY, -INFINITY, -INFINITY}
+};
+
+void aabb_grow_point(AABB* box, Vector3 point){
+    if(point.x < box->min.x) box->min.x = point.x;
+    if(point.y < box->min.y) box->min.y = point.y;
+    if(point.z < box->min.z) box->min.z = point.z;
+
+    if(point.x > box->max.x) box->max.x = point.x;
+    if(point.y > box->max.y) box->max.y = point.y;
+    if(point.z > box->max.z) box->max.z = point.z;
+}
+
+void aabb_grow(AABB* box, AABB other){
+    aabb_grow_point(box, other.min);
+    aabb_grow_point(box, other.max);
+}
+
+double aabb_surface_area(AABB box){
+    Vector3 extent = vec3_sub(box.max, box.min);
+    if(extent.x < 0 || extent.y < 0 || extent.z < 0) return 0;
+    return 2 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+/**
+ * @brief Narrows where a ray is inside a box to where it is between one of the box's pairs of slabs.
+ * A ray parallel to the slabs has an infinite inverse direction, so its t are NaN if it starts on one of
+ * their planes. It is between them everywhere or nowhere, depending on where it starts
+ *
+ * @return false if the ray is parallel to the slabs and outside of them
+ */
+static inline bool clip_to_slabs(double min, double max, double origin, double inverse_direction, double* t_enter, double* t_exit){
+    if(isinf(inverse_direction)) return origin >= min && origin <= max;
+    double t1 = (min - origin) * inverse_direction;
+    double t2 = (max - origin) * inverse_direction;
+    *t_enter = fmax(*t_enter, fmin(t1, t2));
+    *t_exit = fmin(*t_exit, fmax(t1, t2));
+    return true;
+}
+
+bool aabb_ray_intersect(const AABB* box, Vector3 origin, Vector3 inverse_direction, double max_t, double* t_enter_out){
+    double t_enter = -INFINITY;
+    double t_exit = INFINITY;
+    if(!clip_to_slabs(box->min.x, box->max.x, origin.x, inverse_direction.x, &t_enter, &t_exit)) return false;
+    if(!clip_to_slabs(box->min.y, box->max.y, origin.y, inverse_direction.y, &t_enter, &t_exit)) return false;
+    if(!clip_to_slabs(box->min.z, box->max.z, origin.z, inverse_direction.z, &t_enter, &t_exit)) return false;
+
+    if(t_enter > t_exit || t_exit < 0 || t_enter > max_t) return false;
+    if(t_enter_out != NULL) *t_enter_out = t_enter;
+    return true;
+}
+
+static double axis_of(Vector3 v, int axis){
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+typedef struct {
+    AABB bounds;
+    int count;
+} SAHBin;
+
+/**
+ * @brief Finds the cheapest binned SAH split for a range of primitives
+ *
+ * @return double The cost of the best split, or INFINITY if the centroids can't be split
+ */
+static double find_best_split(const int* indices, int count,
+                              const AABB* prim_bounds, const Vector3* prim_centroids,
+                              AABB centroid_bounds, int* axis_out, double* position_out){
+    double best_cost = INFINITY;
+    for(int axis = 0; axis < 3; axis++){
+        double axis_min = axis_of(centroid_bounds.min, axis);
+        double axis_max = axis_of(centroid_bounds.max, axis);
+        if(axis_max <= axis_min) continue;
+
+        SAHBin bins[SAH_BINS];
+        for(int b = 0; b < SAH_BINS; b++){
+            bins[b].bounds = EMPTY_AABB;
+            bins[b].count = 0;
+        }
+
+        double scale = SAH_BINS / (axis_max - axis_min);
+        for(int i = 0; i < count; i++){
+            int prim = indices[i];
+            int b = (int)((axis_of(prim_centroids[prim], axis) - axis_min) * scale);
+            if(b >= SAH_BINS) b = SAH_BINS - 1;
+            bins[b].count++;
+            aabb_grow(&bins[b].bounds, prim_bounds[prim]);
+        }
+
+        // Sweep from the right to get the cost of every right hand side, then from the left
+        double right_area[SAH_BINS];
+        int right_count[SAH_BINS];
+        AABB right_box = EMPTY_AABB;
+        int right_sum = 0;
+        for(int b = SAH_BINS - 1; b > 0; b--){
+            right_sum += bins[b].count;
+            aabb_grow(&right_box, bins[b].bounds);
+            right_count[b] = right_sum;
+            right_area[b] = aabb_surface_area(right_box);
+        }
+
+        AABB left_box = EMPTY_AABB;
+        int left_sum = 0;
+        for(int b = 0; b < SAH_BINS - 1; b++){
+            left_sum += bins[b].count;
+            aabb_grow(&left_box, bins[b].bounds);
+            if(left_sum == 0 || right_count[b + 1] == 0) continue;
+            double cost = left_sum * aabb_surface_area(left_box) + right_count[b + 1] * right_area[b + 1];
+            if(cost < best_cost){
+                best_cost = cost;
+                *axis_out = axis;
+                *position_out = axis_min + (b + 1) / scale;
+            }
+        }
+    }
+    return best_cost;
+}
+
+void bvh_build(BVH* bvh, const AABB* prim_bounds, const Vector3* prim_centroids, int num_prims){
+    *bvh = NULL_BVH;
+    if(num_prims <= 0) return;
+
+    bvh->num_prims = num_prims;
+    bvh->prim_indices = (int*)malloc(sizeof(int) * num_prims);
+    bvh->nodes = (BVHNode*)malloc(sizeof(BVHNode) * (2 * num_prims - 1));
+    if(bvh->prim_indices == NULL || bvh->nodes == NULL) goto MEM_ERROR;
+    for(int i = 0; i < num_prims; i++) bvh->prim_indices[i] = i;
+
+    bvh->nodes[0].left_or_first = 0;
+    bvh->nodes[0].count = num_prims;
+    bvh->num_nodes = 1;
+
+    // Each level of the tree adds at most one entry to the stack
+    int stack[BVH_MAX_DEPTH + 1];
+    int depths[BVH_MAX_DEPTH + 1];
+    int stack_size = 0;
+    stack[stack_size] = 0;
+    depths[stack_size++] = 0;
+
+    while(stack_size > 0){
+        stack_size--;
+        BVHNode* node = &bvh->nodes[stack[stack_size]];
+        int depth = depths[stack_size];
+        int first = node->left_or_first;
+        int count = node->count;
+        int* indices = bvh->prim_indices + first;
+
+        AABB bounds = EMPTY_AABB;
+        AABB centroid_bounds = EMPTY_AABB;
+        for(int i = 0; i < count; i++){
+            aabb_grow(&bounds, prim_bounds[indices[i]]);
+            aabb_grow_point(&centroid_bounds, prim_centroids[indices[i]]);
+        }
+        node->bounds = bounds;
+        if(count <= 2 || depth >= BVH_MAX_DEPTH) continue;
+
+        int axis = 0;
+        double split = 0;
+        double split_cost = find_best_split(indices, count, prim_bounds, prim_centroids, centroid_bounds, &axis, &split);
+        double leaf_cost = count * INTERSECTION_COST;
+        split_cost = TRAVERSAL_COST + INTERSECTION_COST * split_cost / aabb_surface_area(bounds);
+
+        int mid;
+        if(split_cost < leaf_cost || count > MAX_LEAF_PRIMS){
+            if(isinf(split_cost)){
+                // Every centroid is in the same place so just split the range in half
+                mid = count / 2;
+            }
+            else {
+                int i = 0;
+                int j = count - 1;
+                while(i <= j){
+                    if(axis_of(prim_centroids[indices[i]], axis) < split) i++;
+                    else {
+                        int temp = indices[i];
+                        indices[i] = indices[j];
+                        indices[j--] = temp;
+                    }
+                }
+                mid = i;
+                if(mid == 0 || mid == count) mid = count / 2;
+            }
+        }
+        else continue;
+
+        int left = bvh->num_nodes;
+        bvh->num_nodes += 2;
+        bvh->nodes[left].left_or_first = first;
+        bvh->nodes[left].count = mid;
+        bvh->nodes[left + 1].left_or_first = first + mid;
+        bvh->nodes[left + 1].count = count - mid;
+        node->left_or_first = left;
+        node->count = 0;
+
+        stack[stack_size] = left + 1;
+        depths[stack_size++] = depth + 1;
+        stack[stack_size] = left;
+        depths[stack_size++] = depth + 1;
+    }
+    bvh->build_cost = bvh_sah_cost(bvh);
+    return;
+    MEM_ERROR:
+    fprintf(stderr, "Failed to allocate sufficient memory for BVH\n");
+    exit(1);
+}
+
+void bvh_refit(BVH* bvh, const AABB* prim_bounds){
+    // Children are always stored after their parent, so walking backwards visits them first
+    for(int n = bvh->num_nodes - 1; n >= 0; n--){
+        BVHNode* node = &bvh->nodes[n];
+        AABB bounds = EMPTY_AABB;
+        if(node->count > 0){
+            for(int i = node->left_or_first; i < node->left_or_first + node->count; i++){
+                aabb_grow(&bounds, prim_bounds[bvh->prim_indices[i]]);
+            }
+        }
+        else {
+            aabb_grow(&bounds, bvh->nodes[node->left_or_first].bounds);
+            aabb_grow(&bounds, bvh->nodes[node->left_or_first + 1].bounds);
+        }
+        node->bounds = bounds;
+    }
+}
+
+double bvh_sah_cost(const BVH* bvh){
+    if(bvh->num_nodes == 0) return 0;
+    double root_area = aabb_surface_area(bvh->nodes[0].bounds);
+    // A root with no area (a single point) is hit by nothing, but every ray that hits it tests everything
+    if(root_area <= 0) return bvh->num_prims * INTERSECTION_COST;
+
+    double cost = 0;
+    for(int n = 0; n < bvh->num_nodes; n++){
+        const BVHNode* node = &bvh->nodes[n];
+        double area = aabb_surface_area(node->bounds);
+        cost += (node->count > 0 ? node->count * INTERSECTION_COST : TRAVERSAL_COST) * area / root_area;
+    }
+    return cost;
+}
+
+void bvh_delete(BVH* bvh){
+    free(bvh->nodes);
+    free(bvh->prim_indices);
+    *bvh = NULL_BVH;
+}
@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "framebuffer.h"
+#include "FPToolkit.h"
+
+Framebuffer new_framebuffer(int width, int height){
+    Framebuffer result;
+    result.width = width;
+    result.height = height;
+    result.pixels = (Color3*)malloc(sizeof(Color3) * width * height);
+    result.written = (bool*)calloc(width * height, sizeof(bool));
+    if(result.pixels == NULL || result.written == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for framebuffer\n");
+        exit(1);
+    }
+    return result;
+}
+
+void delete_framebuffer(Framebuffer* framebuffer){
+    free(framebuffer->pixels);
+    framebuffer->pixels = NULL;
+    free(framebuffer->written);
+    framebuffer->written = NULL;
+}
+
+void clear_framebuffer(Framebuffer* framebuffer){
+    memset(framebuffer->written, 0, sizeof(bool) * framebuffer->width * framebuffer->height);
+}
+
+void framebuffer_set_pixel(Framebuffer* framebuffer, int x, int y, Color3 color){
+    int i = y * framebuffer->width + x;
+    framebuffer->pixels[i] = color;
+    framebuffer->written[i] = true;
+}
+
+void present_framebuffer(Framebuffer* framebuffer){
+    for(int y = 0; y < framebuffer->height; y++){
+        for(int x = 0; x < framebuffer->width; x++){
+            int i = y * framebuffer->width + x;
+            if(!framebuffer->written[i]) continue;
+            G_rgb(SPREAD_COL3(framebuffer->pixels[i]));
+            G_pixel(x, y);
+        }
+    }
+}
+
+AccumulationBuffer new_accumulation_buffer(int width, int height){
+    AccumulationBuffer result;
+    result.width = width;
+    result.height = height;
+    result.sums = (Color3*)calloc(width * height, sizeof(Color3));
+    result.samples = (int*)calloc(width * height, sizeof(int));
+    result.hits = (int*)calloc(width * height, sizeof(int));
+    result.luminance_means = (double*)calloc(width * height, sizeof(double));
+    result.luminance_m2s = (double*)calloc(width * height, sizeof(double));
+    if(result.sums == NULL || result.samples == NULL || result.hits == NULL ||
+       result.luminance_means == NULL || result.luminance_m2s == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for accumulation buffer\n");
+        exit(1);
+    }
+    result.background = (Color3){BLACK};
+    result.passes = 0;
+    return result;
+}
+
+void delete_accumulation_buffer(AccumulationBuffer* accumulation){
+    free(accumulation->sums);
+    accumulation->sums = NULL;
+    free(accumulation->samples);
+    accumulation->samples = NULL;
+    free(accumulation->hits);
+    accumulation->hits = NULL;
+    free(accumulation->luminance_means);
+    accumulation->luminance_means = NULL;
+    free(accumulation->luminance_m2s);
+    accumulation->luminance_m2s = NULL;
+}
+
+void clear_accumulation_buffer(AccumulationBuffer* accumulation){
+    int num_pixels = accumulation->width * accumulation->height;
+    memset(accumulation->sums, 0, sizeof(Color3) * num_pixels);
+    memset(accumulation->samples, 0, sizeof(int) * num_pixels);
+    memset(accumulation->hits, 0, sizeof(int) * num_pixels);
+    memset(accumulation->luminance_means, 0, sizeof(double) * num_pixels);
+    memset(accumulation->luminance_m2s, 0, sizeof(double) * num_pixels);
+    accumulation->passes = 0;
+}
+
+void accumulate_sample(AccumulationBuffer* accumulation, int x, int y, const Color3* color){
+    int i = y * accumulation->width + x;
+    accumulation->samples[i]++;
+    // Misses show the background, so they count towards the pixel's spread as the background
+    Color3 sample = color != NULL ? *color : accumulation->background;
+    double luminance = 0.2126 * sample.r + 0.7152 * sample.g + 0.0722 * sample.b;
+    double delta = luminance - accumulation->luminance_means[i];
+    accumulation->luminance_means[i] += delta / accumulation->samples[i];
+    accumulation->luminance_m2s[i] += delta * (luminance - accumulation->luminance_means[i]);
+    if(color == NULL) return;
+    accumulation->hits[i]++;
+    accumulation->sums[i] = vec3_add(accumulation->sums[i], *color);
+}
+
+/**
+ * @brief Gets the average of a pixel of an accumulation buffer, blending its misses into the background
+ *
+ * @return false if no sample of the pixel hit anything
+ */
+static bool accumulated_color(Color3* color_out, const AccumulationBuffer* accumulation, int i){
+    if(accumulation->hits[i] == 0) return false;
+    int misses = accumulation->samples[i] - accumulation->hits[i];
+    Color3 sum = vec3_add(accumulation->sums[i], vec3_scale(accumulation->background, misses));
+    *color_out = vec3_scale(sum, 1.0 / accumulation->samples[i]);
+    return true;
+}
+
+void present_accumulation_buffer(AccumulationBuffer* accumulation){
+    for(int y = 0; y < accumulation->height; y++){
+        for(int x = 0; x < accumulation->width; x++){
+            Color3 color;
+            if(!accumulated_color(&color, accumulation, y * accumulation->width + x)) continue;
+            G_rgb(SPREAD_COL3(color));
+            G_pixel(x, y);
+        }
+    }
+}
+
+void present_accumulation_buffer_scaled(AccumulationBuffer* accumulation, int pixel_size){
+    if(pixel_size <= 1){
+        present_accumulation_buffer(accumulation);
+        return;
+    }
+    int width = (accumulation->width + pixel_size - 1) / pixel_size;
+    int height = (accumulation->height + pixel_size - 1) / pixel_size;
+    for(int y = 0; y < height; y++){
+        for(int x = 0; x < width; x++){
+            Color3 color;
+            if(!accumulated_color(&color, accumulation, y * accumulation->width + x)) continue;
+            G_rgb(SPREAD_COL3(color));
+            for(int sy = y * pixel_size; sy < (y + 1) * pixel_size && sy < accumulation->height; sy++){
+                for(int sx = x * pixel_size; sx < (x + 1) * pixel_size && sx < accumulation->width; sx++) G_pixel(sx, sy);
+            }
+        }
+    }
+}
+
+double accumulation_pixel_error(const AccumulationBuffer* accumulation, int i){
+    int samples = accumulation->samples[i];
+    if(samples < 2) return INFINITY;
+    double variance = accumulation->luminance_m2s[i] / (samples - 1);
+    return sqrt(variance / samples);
+}
@@ -19,7 +19,9 @@ void apply_water_simulation(Mesh* mesh,
     // random_phase_shift += 0.1 * rand_double(-1.0, 1.0);
 
     for (int i = 0; i < mesh->num_vertices; i++) {
+        // Only the rest pose is read from the vertex, the current shape lives in mesh->positions
         Vertex* v = &mesh->vertices[i];
+        Vector3 position = mesh->positions[i];
 
         // Compute the height of the water surface at the vertex position
         double height = 0.0;
@@ -29,8 +31,8 @@ void apply_water_simulation(Mesh* mesh,
             GerstnerWave* w = &waves_x[j];
             double wi = 2.0 * M_PI / w->wavelength;
             double phase = wi * (w->speed * t );
-            height += w->amplitude * (cos(wi * (v->position.x * w->direction.x + v->position.z * w->direction.z) + phase) +
-                                     w->steepness * (v->position.x * w->direction.x + v->position.z * w->direction.z) * sin(wi * (v->position.x * w->direction.x + v->position.z * w->direction.z) + phase));
+            height += w->amplitude * (cos(wi * (position.x * w->direction.x + position.z * w->direction.z) + phase) +
+                                     w->steepness * (position.x * w->direction.x + position.z * w->direction.z) * sin(wi * (position.x * w->direction.x + position.z * w->direction.z) + phase));
         }
 
         // Add waves in the z direction
@@ -38,8 +40,8 @@ void apply_water_simulation(Mesh* mesh,
             GerstnerWave* w = &waves_z[j];
             double wi = 2.0 * M_PI / w->wavelength;
             double phase = wi * (w->speed * t );
-            height += w->amplitude * (cos(wi * (v->position.x * w->direction.x + v->position.z * w->direction.z) + phase) +
-                                     w->steepness * (v->position.x * w->direction.x + v->position.z * w->direction.z) * sin(wi * (v->position.x * w->direction.x + v->position.z * w->direction.z) + phase));
+            height += w->amplitude * (cos(wi * (position.x * w->direction.x + position.z * w->direction.z) + phase) +
+                                     w->steepness * (position.x * w->direction.x + position.z * w->direction.z) * sin(wi * (position.x * w->direction.x + position.z * w->direction.z) + phase));
         }
 
         // Compute the partial derivatives of the water surface
@@ -50,8 +52,8 @@ void apply_water_simulation(Mesh* mesh,
             GerstnerWave* w = &waves_x[j];
             double wi = 2.0 * M_PI / w->wavelength;
             double phase = wi * (w->speed * t );
-            dHdx += -wi * w->direction.x * (w->amplitude * sin(wi * (v->position.x * w->direction.x + v->position.z * w->direction.z) + phase) +
-                                           w->steepness * (v->position.x * w->direction.x + v->position.z * w->direction.z) * cos(wi * (v->position.x * w->direction.x + v->position.z * w->direction.z) + phase));
+            dHdx += -wi * w->direction.x * (w->amplitude * sin(wi * (position.x * w->direction.x + position.z * w->direction.z) + phase) +
+                                           w->steepness * (position.x * w->direction.x + position.z * w->direction.z) * cos(wi * (position.x * w->direction.x + position.z * w->direction.z) + phase));
         }
 
         // Compute the partial derivatives for the z-direction waves
@@ -59,8 +61,8 @@ void apply_water_simulation(Mesh* mesh,
             GerstnerWave* w = &waves_z[j];
             double wi = 2.0 * M_PI / w->wavelength;
             double phase = wi * (w->speed * t );
-            dHdy += -wi * w->direction.z * (w->amplitude * sin(wi * (v->position.x * w->direction.x + v->position.z * w->direction.z) + phase) +
-                                           w->steepness * (v->position.x * w->direction.x + v->position.z * w->direction.z) * cos(wi * (v->position.x * w->direction.x + v->position.z * w->direction.z) + phase));
+            dHdy += -wi * w->direction.z * (w->amplitude * sin(wi * (position.x * w->direction.x + position.z * w->direction.z) + phase) +
+                                           w->steepness * (position.x * w->direction.x + position.z * w->direction.z) * cos(wi * (position.x * w->direction.x + position.z * w->direction.z) + phase));
         }
 
         dHdt = 0.0;
@@ -68,13 +70,13 @@ void apply_water_simulation(Mesh* mesh,
             GerstnerWave* w = &waves_x[j];
             double wi = 2.0 * M_PI / w->wavelength;
             double phase = wi * (w->speed * t );
-            dHdt += -wi * w->speed * w->amplitude * sin(wi * (v->position.x * w->direction.x + v->position.z * w->direction.z) + phase);
+            dHdt += -wi * w->speed * w->amplitude * sin(wi * (position.x * w->direction.x + position.z * w->direction.z) + phase);
         }
         for (int j = 0; j < num_waves_z; j++) {
             GerstnerWave* w = &waves_z[j];
             double wi = 2.0 * M_PI / w->wavelength;
             double phase = wi * (w->speed * t );
-            dHdt += -wi * w->speed * w->amplitude * sin(wi * (v->position.x * w->direction.x + v->position.z * w->direction.z) + phase);
+            dHdt += -wi * w->speed * w->amplitude * sin(wi * (position.x * w->direction.x + position.z * w->direction.z) + phase);
         }
 
         // Compute the binormal, tangent, and normal vectors
@@ -83,19 +85,29 @@ void apply_water_simulation(Mesh* mesh,
         Vector3 normal = vec3_normalized(vec3_cross_prod(binormal, tangent));
 
         // Update the vertex position along the normal vector
-        v->position = vec3_add(v->position_static, vec3_scale(v->normal_static, height));
+        mesh->positions[i] = vec3_add(v->position_static, vec3_scale(v->normal_static, height));
     }
 
     // Update the mesh normals
     compute_plane_normals(mesh);
     // compute_face_normals(mesh);
 
+    // The vertices moved so the triangle records, bounds and BVH are stale. The waves only move
+    // vertices up and down, so refitting the BVH keeps it nearly as good as a rebuilt one
+    compute_triangle_records(mesh);
+    copy_positions_to_vertices(mesh);
+    compute_mesh_bounds(mesh);
+    refit_mesh_bvh(mesh);
+
 }
 
 void reset_water_simulation(Mesh* mesh) {
     for (int i = 0; i < mesh->num_vertices; i++) {
-        Vertex* v = &mesh->vertices[i];
-        v->position = v->position_static;
+        mesh->positions[i] = mesh->vertices[i].position_static;
     }
+    copy_positions_to_vertices(mesh);
     compute_face_normals(mesh);
+    compute_triangle_records(mesh);
+    compute_mesh_bounds(mesh);
+    refit_mesh_bvh(mesh);
 }
\ No newline at end of file
@@ -6,165 +6,608 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "mesh.h"
+#include "ply.h"
+#include "meshcache.h"
+#include "triblock.h"
 #include "FPToolkit.h"
 #include "colors.h"
 #include "M3d_matrix_tools.h"
 #include "trig.h"
 #include "matrix.h"
+#include "threadpool.h"
 
-const int BUFFER_SIZE = 256;
+static void allocate_indexed_mesh(Mesh* mesh);
 
-void trim_trailing_whitespace(char *str) {
-    int i;
+// Ascii files are split into chunks of about this many bytes, which are parsed in parallel
+#define PLY_CHUNK_BYTES (1 << 20)
 
-    // Null check
-    if (str == NULL) {
-        return;
+// 0 parses ascii .ply files on every core
+int PLY_LOAD_THREADS = 0;
+
+void set_ply_load_threads(int num_threads){ PLY_LOAD_THREADS = num_threads; }
+
+bool USE_MESH_CACHE = true;
+
+void invert_use_mesh_cache(){ USE_MESH_CACHE = !USE_MESH_CACHE; }
+
+// A refitted BVH is rebuilt once its SAH cost grows past this multiple of its cost when it was built
+#define BVH_REFIT_MAX_COST_RATIO 1.5
+
+bool USE_BVH_REFIT = true;
+
+void invert_use_bvh_refit(){ USE_BVH_REFIT = !USE_BVH_REFIT; }
+
+/**
+ * @brief Reads a binary scalar, with the common case of a float in the machine's own byte order inlined
+ */
+static inline double read_ply_value(const unsigned char* p, PlyType type, bool swap){
+    if(type == PLY_FLOAT32 && !swap){
+        float value;
+        memcpy(&value, p, sizeof(float));
+        return value;
+    }
+    return ply_read_binary(p, type, swap);
+}
+
+/**
+ * @brief Where one of the vertex properties that the mesh uses is found in a vertex record.
+ * An index of -1 means the file doesn't have that property
+ */
+typedef struct {
+    int index;
+    int offset;
+    PlyType type;
+} VertexField;
+
+/**
+ * @brief Where every vertex property that the mesh uses is found in a vertex record
+ */
+typedef struct {
+    VertexField x, y, z;
+    VertexField nx, ny, nz;
+    VertexField red, green, blue;
+    VertexField u, v;
+    bool has_normals;
+    bool has_colors;
+    bool has_uvs;
+} VertexLayout;
+
+static VertexField find_vertex_field(const PlyElement* element, const char* const* names, int num_names){
+    VertexField field = {-1, -1, PLY_FLOAT32};
+    int property = ply_find_property(element, names, num_names);
+    if(property < 0) return field;
+    field.index = property;
+    field.offset = 0;
+    for(int i = 0; i < property; i++) field.offset += ply_type_size(element->properties[i].type);
+    field.type = element->properties[property].type;
+    return field;
+}
+
+static void find_vertex_layout(VertexLayout* layout, const PlyElement* element, const char* filename){
+    static const char* const X_NAMES[] = {"x"}, * const Y_NAMES[] = {"y"}, * const Z_NAMES[] = {"z"};
+    static const char* const NX_NAMES[] = {"nx"}, * const NY_NAMES[] = {"ny"}, * const NZ_NAMES[] = {"nz"};
+    static const char* const RED_NAMES[] = {"red", "r", "diffuse_red"};
+    static const char* const GREEN_NAMES[] = {"green", "g", "diffuse_green"};
+    static const char* const BLUE_NAMES[] = {"blue", "b", "diffuse_blue"};
+    static const char* const U_NAMES[] = {"u", "s", "texture_u", "texture_s"};
+    static const char* const V_NAMES[] = {"v", "t", "texture_v", "texture_t"};
+
+    if(ply_record_size(element) < 0){
+        fprintf(stderr, "List properties on vertices are not supported in '%s'\n", filename);
+        exit(1);
+    }
+    layout->x = find_vertex_field(element, X_NAMES, 1);
+    layout->y = find_vertex_field(element, Y_NAMES, 1);
+    layout->z = find_vertex_field(element, Z_NAMES, 1);
+    layout->nx = find_vertex_field(element, NX_NAMES, 1);
+    layout->ny = find_vertex_field(element, NY_NAMES, 1);
+    layout->nz = find_vertex_field(element, NZ_NAMES, 1);
+    layout->red = find_vertex_field(element, RED_NAMES, 3);
+    layout->green = find_vertex_field(element, GREEN_NAMES, 3);
+    layout->blue = find_vertex_field(element, BLUE_NAMES, 3);
+    layout->u = find_vertex_field(element, U_NAMES, 4);
+    layout->v = find_vertex_field(element, V_NAMES, 4);
+    if(layout->x.index < 0 || layout->y.index < 0 || layout->z.index < 0){
+        fprintf(stderr, "Vertices in '%s' have no x, y and z\n", filename);
+        exit(1);
     }
+    layout->has_normals = layout->nx.index >= 0 && layout->ny.index >= 0 && layout->nz.index >= 0;
+    layout->has_colors = layout->red.index >= 0 && layout->green.index >= 0 && layout->blue.index >= 0;
+    layout->has_uvs = layout->u.index >= 0 && layout->v.index >= 0;
+}
 
-    i = strlen(str) - 1;
-    while (i >= 0 && isspace((unsigned char)str[i])) {
-        str[i] = '\0';
-        i--;
+/**
+ * @brief Converts a color channel to the 0 to 1 range. Integer channels use the full range of their type
+ */
+static double color_channel(double value, PlyType type){
+    switch(type){
+        case PLY_UINT8: return value / 255.0;
+        case PLY_UINT16: return value / 65535.0;
+        case PLY_FLOAT32: case PLY_FLOAT64: return value;
+        default: return value / 255.0;
     }
 }
 
-//TODO: It would be nice if this was more versatile. Right now it requires that the .ply file has the vertex positions followed by the vertex normals. It would be ideal if it could work without vertex normals or be in a different order or whatnot
-void load_mesh_from_ply(Mesh* mesh, char* filename){
-    // Read until element
-
-    // Record element number and type
-    // check if there are normals or assert there are
-    // repeat until end_header
-    // malloc space for vertices and tris
-    // Read in points
-    mesh->num_vertices = -1;
-    mesh->num_tris = -1;
-    char line[BUFFER_SIZE];
-    char *token;
-
-    FILE* f = fopen(filename, "r");
-    if(f == NULL){
-        fprintf(stderr, "No such file '%s'\n", filename);
+/**
+ * @brief Sizes a mesh for the vertex and face elements of a .ply header and allocates all of its arrays
+ */
+static void allocate_ply_mesh(Mesh* mesh, const PlyHeader* header, const VertexLayout* layout, int vertex_element, int face_element, const char* filename){
+    if(header->elements[vertex_element].count > INT32_MAX || header->elements[face_element].count > INT32_MAX / 3){
+        fprintf(stderr, "'%s' is too large\n", filename);
         exit(1);
     }
-    fgets(line, BUFFER_SIZE, f);
-    trim_trailing_whitespace(line);
-    assert(!strcmp(line, "ply"));
-    while(fgets(line, BUFFER_SIZE, f) && (mesh->num_vertices ==  -1 || mesh->num_tris == -1)){
-        token = strtok(line, " ");
-        // Find the number of faces and vertices
-        
-        if(strcmp(token, "element")) continue;
-        else{
-            char* element_type = strtok(NULL, " ");
-            int element_num = atoi(strtok(NULL, " "));
-            if(!strcmp(element_type, "vertex")){
-                mesh->num_vertices = element_num;
+    mesh->num_vertices = (int)header->elements[vertex_element].count;
+    mesh->num_tris = (int)header->elements[face_element].count;
+    allocate_indexed_mesh(mesh);
+
+    mesh->colors = NULL;
+    mesh->uvs = NULL;
+    if(layout->has_colors){
+        mesh->colors = (Color3*)malloc(sizeof(Color3) * mesh->num_vertices);
+        if(mesh->colors == NULL) goto MEM_ERROR;
+    }
+    if(layout->has_uvs){
+        mesh->uvs = (Vector2*)malloc(sizeof(Vector2) * mesh->num_vertices);
+        if(mesh->uvs == NULL) goto MEM_ERROR;
+    }
+    return;
+    MEM_ERROR:
+    fprintf(stderr, "Failed to allocate sufficient memory for mesh\n");
+    exit(1);
+}
+
+/**
+ * @brief Sets every vertex normal to the area weighted average of the normals of the faces around it
+ */
+static void compute_vertex_normals(Mesh* mesh){
+    for(int i = 0; i < mesh->num_vertices; i++) mesh->normals[i] = VEC3_ZERO;
+    for(int i = 0; i < mesh->num_tris; i++){
+        uint32_t* tri = &mesh->indices[3 * i];
+        Vector3 a = mesh->positions[tri[0]];
+        // The cross product's length is twice the triangle's area
+        Vector3 normal = vec3_cross_prod(vec3_sub(mesh->positions[tri[1]], a), vec3_sub(mesh->positions[tri[2]], a));
+        for(int k = 0; k < 3; k++) mesh->normals[tri[k]] = vec3_add(mesh->normals[tri[k]], normal);
+    }
+    for(int i = 0; i < mesh->num_vertices; i++){
+        if(vec3_dot_prod(mesh->normals[i], mesh->normals[i]) > 0) vec3_normalize(&mesh->normals[i]);
+    }
+}
+
+/**
+ * @brief Checks the indices of a freshly loaded mesh and fills in everything that is derived from its
+ * positions, normals and indices
+ */
+static void finish_ply_mesh(Mesh* mesh, bool has_normals, const char* filename){
+    for(int i = 0; i < 3 * mesh->num_tris; i++){
+        if(mesh->indices[i] >= (uint32_t)mesh->num_vertices){
+            fprintf(stderr, "'%s' has a face with vertex index %u, but only %d vertices\n", filename, mesh->indices[i], mesh->num_vertices);
+            exit(1);
+        }
+    }
+    if(!has_normals) compute_vertex_normals(mesh);
+    build_legacy_mesh(mesh);
+    compute_triangle_records(mesh);
+}
+
+static const char* const VERTEX_INDICES_NAMES[] = {"vertex_indices", "vertex_index"};
+
+/**
+ * @brief Finds the list of vertex indices among the properties of the face element
+ */
+static int find_face_indices(const PlyElement* element, const char* filename){
+    int list = ply_find_property(element, VERTEX_INDICES_NAMES, 2);
+    if(list < 0 || !element->properties[list].is_list){
+        fprintf(stderr, "Faces in '%s' have no vertex_indices list\n", filename);
+        exit(1);
+    }
+    return list;
+}
+
+static const unsigned char* read_binary_vertices(Mesh* mesh, const VertexLayout* layout, const PlyElement* element, const unsigned char* p, const unsigned char* end, bool swap, const char* filename){
+    long stride = ply_record_size(element);
+    if((end - p) / (stride > 0 ? stride : 1) < element->count){
+        fprintf(stderr, "'%s' ends in the middle of its vertices\n", filename);
+        exit(1);
+    }
+
+    for(int i = 0; i < mesh->num_vertices; i++){
+        const unsigned char* record = p + i * stride;
+        mesh->positions[i] = (Vector3){
+            read_ply_value(record + layout->x.offset, layout->x.type, swap),
+            read_ply_value(record + layout->y.offset, layout->y.type, swap),
+            read_ply_value(record + layout->z.offset, layout->z.type, swap)
+        };
+        if(layout->has_normals){
+            mesh->normals[i] = (Vector3){
+                read_ply_value(record + layout->nx.offset, layout->nx.type, swap),
+                read_ply_value(record + layout->ny.offset, layout->ny.type, swap),
+                read_ply_value(record + layout->nz.offset, layout->nz.type, swap)
+            };
+        }
+        if(layout->has_colors){
+            mesh->colors[i] = (Color3){
+                color_channel(read_ply_value(record + layout->red.offset, layout->red.type, swap), layout->red.type),
+                color_channel(read_ply_value(record + layout->green.offset, layout->green.type, swap), layout->green.type),
+                color_channel(read_ply_value(record + layout->blue.offset, layout->blue.type, swap), layout->blue.type)
+            };
+        }
+        if(layout->has_uvs){
+            mesh->uvs[i] = (Vector2){
+                read_ply_value(record + layout->u.offset, layout->u.type, swap),
+                read_ply_value(record + layout->v.offset, layout->v.type, swap)
+            };
+        }
+    }
+    return p + element->count * stride;
+}
+
+static const unsigned char* read_binary_faces(Mesh* mesh, const PlyElement* element, const unsigned char* p, const unsigned char* end, bool swap, const char* filename){
+    int list = find_face_indices(element, filename);
+    const PlyProperty* indices = &element->properties[list];
+    int count_size = ply_type_size(indices->count_type);
+    int index_size = ply_type_size(indices->type);
+
+    // The usual layout is nothing but a uchar 3 and three ints, which can be copied straight into the index buffer
+    if(element->num_properties == 1 && !swap && count_size == 1 &&
+       (indices->type == PLY_INT32 || indices->type == PLY_UINT32)){
+        if((end - p) / (1 + 3 * 4) < element->count) goto TRUNCATED;
+        for(long i = 0; i < element->count; i++){
+            if(p[0] != 3) goto NOT_TRIANGLE;
+            memcpy(&mesh->indices[3 * i], p + 1, 3 * sizeof(uint32_t));
+            p += 1 + 3 * sizeof(uint32_t);
+        }
+        return p;
+    }
+
+    for(long i = 0; i < element->count; i++){
+        for(int j = 0; j < element->num_properties; j++){
+            const PlyProperty* property = &element->properties[j];
+            if(j != list){
+                PlyElement single = {.num_properties = 1, .properties = {*property}};
+                p = ply_skip_binary_record(p, end, &single, swap);
+                if(p == NULL) goto TRUNCATED;
+                continue;
             }
-            else if(!strcmp(element_type, "face")){
-                mesh->num_tris = element_num;
+            if(end - p < count_size + 3 * index_size) goto TRUNCATED;
+            if(read_ply_value(p, indices->count_type, swap) != 3) goto NOT_TRIANGLE;
+            p += count_size;
+            for(int k = 0; k < 3; k++){
+                mesh->indices[3 * i + k] = (uint32_t)read_ply_value(p, indices->type, swap);
+                p += index_size;
             }
-            else {
-                fprintf(stderr, "Unknown element type '%s'\n", element_type);
-                exit(1);
+        }
+    }
+    return p;
+    TRUNCATED:
+    fprintf(stderr, "'%s' ends in the middle of its faces\n", filename);
+    exit(1);
+    NOT_TRIANGLE:
+    fprintf(stderr, "faces must be triangles\n");
+    exit(1);
+}
+
+static void load_binary_ply(Mesh* mesh, const PlyHeader* header, int vertex_element, int face_element, const unsigned char* data, size_t size, const char* filename){
+    bool swap = ply_needs_swap(header->format);
+    VertexLayout layout;
+    find_vertex_layout(&layout, &header->elements[vertex_element], filename);
+    allocate_ply_mesh(mesh, header, &layout, vertex_element, face_element, filename);
+
+    const unsigned char* p = data + header->data_offset;
+    const unsigned char* end = data + size;
+    for(int e = 0; e < header->num_elements; e++){
+        const PlyElement* element = &header->elements[e];
+        if(e == vertex_element){
+            p = read_binary_vertices(mesh, &layout, element, p, end, swap, filename);
+        }
+        else if(e == face_element){
+            p = read_binary_faces(mesh, element, p, end, swap, filename);
+        }
+        else {
+            // Elements the mesh doesn't use are skipped
+            for(long i = 0; i < element->count; i++){
+                p = ply_skip_binary_record(p, end, element, swap);
+                if(p == NULL){
+                    fprintf(stderr, "'%s' ends in the middle of its %s elements\n", filename, element->name);
+                    exit(1);
+                }
             }
         }
     }
+    finish_ply_mesh(mesh, layout.has_normals, filename);
+}
 
-    // Face num and vertex num have been recorded
-    mesh->num_tris = mesh->num_tris;
-    mesh->num_vertices = mesh->num_vertices; 
-    mesh->vertices = (Vertex*)malloc(sizeof(Vertex) * mesh->num_vertices);
-    if(mesh->vertices == NULL) goto MEM_ERROR;
-    mesh->tris = (Triangle*)malloc(sizeof(Triangle) * mesh->num_tris);
-    if(mesh->tris == NULL) goto MEM_ERROR;
-
-    while(fgets(line, BUFFER_SIZE, f)){
-        token = strtok(line, " ");
-        trim_trailing_whitespace(token);
-        if(!strcmp(token, "end_header")) break;
-    }
-    // printf("End header\n");
-    // Now we read values
-    int i = 0;
-    while(i < mesh->num_vertices && fgets(line, BUFFER_SIZE, f)){
-        // Read positions
-        token = strtok(line, "\n\r\t ");
-        if(!strcmp(token, "comment")) continue;
-        mesh->vertices[i].position.x = strtod(token, NULL);
-        mesh->vertices[i].position_static.x = mesh->vertices[i].position.x;
-        token = strtok(NULL, "\n\r\t ");
-        mesh->vertices[i].position.y = strtod(token, NULL);
-        mesh->vertices[i].position_static.y = mesh->vertices[i].position.y;
-        token = strtok(NULL, "\n\r\t ");
-        mesh->vertices[i].position.z = strtod(token, NULL);
-        mesh->vertices[i].position_static.z = mesh->vertices[i].position.z;
-        
-        //Read normals
-        token = strtok(NULL, "\n\r\t ");
-        mesh->vertices[i].normal.x = strtod(token, NULL);
-        mesh->vertices[i].normal_static.x = mesh->vertices[i].normal.x;
-        token = strtok(NULL, "\n\r\t ");
-        mesh->vertices[i].normal.y = strtod(token, NULL);
-        mesh->vertices[i].normal_static.y = mesh->vertices[i].normal.y;
-        token = strtok(NULL, "\n\r\t ");
-        mesh->vertices[i].normal.z = strtod(token, NULL);
-        mesh->vertices[i].normal_static.z = mesh->vertices[i].normal.z;
-        i++;
-    }
-    i = 0;
-    while(i < mesh->num_tris && fgets(line, BUFFER_SIZE, f)){
-
-        token = strtok(line, "\n\r\t ");
-        if(!strcmp(token, "comment")) continue;
-        if(atoi(token) != 3){
-            fprintf(stderr, "faces must be triangles\n");
+/**
+ * @brief Everything needed to parse the chunks of an ascii .ply file, shared by every chunk
+ */
+typedef struct {
+    Mesh* mesh;
+    const PlyHeader* header;
+    const VertexLayout* layout;
+    int vertex_element;
+    int face_element;
+    int face_indices;
+    // The index of the first record of every element, and the total number of records at the end
+    long element_first_record[PLY_MAX_ELEMENTS + 1];
+    int num_chunks;
+    // Chunk i is the lines from chunk_starts[i] up to chunk_starts[i + 1]
+    const char** chunk_starts;
+    // First the number of records in each chunk, then the index of the first record in each chunk
+    long* chunk_records;
+    const char* end;
+    const char* filename;
+} AsciiPlyJob;
+
+static inline const char* next_line_start(const char* p, const char* end){
+    const char* newline = (const char*)memchr(p, '\n', end - p);
+    return newline == NULL ? end : newline + 1;
+}
+
+/**
+ * @brief Checks whether a line holds a record. Blank lines and lines starting with "comment" don't
+ */
+static inline bool is_record_line(const char* p, const char* end){
+    while(p < end && (*p == ' ' || *p == '\t')) p++;
+    if(p >= end || *p == '\n' || *p == '\r') return false;
+    if(end - p >= 7 && !memcmp(p, "comment", 7)){
+        if(end - p == 7 || p[7] == ' ' || p[7] == '\t' || p[7] == '\n' || p[7] == '\r') return false;
+    }
+    return true;
+}
+
+static void count_ascii_chunk(void* context, int chunk, int thread){
+    AsciiPlyJob* job = (AsciiPlyJob*)context;
+    const char* end = job->chunk_starts[chunk + 1];
+    long records = 0;
+    for(const char* p = job->chunk_starts[chunk]; p < end; p = next_line_start(p, end)){
+        if(is_record_line(p, end)) records++;
+    }
+    job->chunk_records[chunk] = records;
+}
+
+static void parse_ascii_vertex(AsciiPlyJob* job, const PlyElement* element, int i, const char* p){
+    Mesh* mesh = job->mesh;
+    const VertexLayout* layout = job->layout;
+    double values[PLY_MAX_PROPERTIES];
+    for(int k = 0; k < element->num_properties; k++){
+        p = ply_parse_ascii_number(p, job->end, &values[k]);
+        if(p == NULL){
+            fprintf(stderr, "Vertex %d in '%s' has too few values\n", i, job->filename);
             exit(1);
         }
-        token = strtok(NULL, "\n\r\t ");
-        mesh->tris[i].a = mesh->vertices + atoi(token);
-        token = strtok(NULL, "\n\r\t ");
-        mesh->tris[i].b = mesh->vertices + atoi(token);
-        token = strtok(NULL, "\n\r\t ");
-        mesh->tris[i].c = mesh->vertices + atoi(token);
-        i++;
     }
 
+    mesh->positions[i] = (Vector3){values[layout->x.index], values[layout->y.index], values[layout->z.index]};
+    if(layout->has_normals){
+        mesh->normals[i] = (Vector3){values[layout->nx.index], values[layout->ny.index], values[layout->nz.index]};
+    }
+    if(layout->has_colors){
+        mesh->colors[i] = (Color3){
+            color_channel(values[layout->red.index], layout->red.type),
+            color_channel(values[layout->green.index], layout->green.type),
+            color_channel(values[layout->blue.index], layout->blue.type)
+        };
+    }
+    if(layout->has_uvs){
+        mesh->uvs[i] = (Vector2){values[layout->u.index], values[layout->v.index]};
+    }
+}
 
-    fclose(f);
+static void parse_ascii_face(AsciiPlyJob* job, const PlyElement* element, int i, const char* p){
+    double value;
+    for(int k = 0; k < element->num_properties; k++){
+        p = ply_parse_ascii_number(p, job->end, &value);
+        if(p == NULL) goto TOO_FEW;
+        if(!element->properties[k].is_list) continue;
+
+        int count = (int)value;
+        if(k == job->face_indices){
+            if(count != 3){
+                fprintf(stderr, "faces must be triangles\n");
+                exit(1);
+            }
+            for(int j = 0; j < 3; j++){
+                p = ply_parse_ascii_number(p, job->end, &value);
+                if(p == NULL) goto TOO_FEW;
+                job->mesh->indices[3 * i + j] = (uint32_t)(long)value;
+            }
+        }
+        else {
+            for(int j = 0; j < count; j++){
+                p = ply_parse_ascii_number(p, job->end, &value);
+                if(p == NULL) goto TOO_FEW;
+            }
+        }
+    }
+    return;
+    TOO_FEW:
+    fprintf(stderr, "Face %d in '%s' has too few values\n", i, job->filename);
+    exit(1);
+}
+
+static void parse_ascii_chunk(void* context, int chunk, int thread){
+    AsciiPlyJob* job = (AsciiPlyJob*)context;
+    const char* end = job->chunk_starts[chunk + 1];
+    long record = job->chunk_records[chunk];
+    int element = 0;
+
+    for(const char* p = job->chunk_starts[chunk]; p < end; p = next_line_start(p, end)){
+        if(!is_record_line(p, end)) continue;
+        while(element < job->header->num_elements && record >= job->element_first_record[element + 1]) element++;
+        if(element == job->header->num_elements) return; // anything after the last element is ignored
+
+        long i = record - job->element_first_record[element];
+        if(element == job->vertex_element){
+            parse_ascii_vertex(job, &job->header->elements[element], (int)i, p);
+        }
+        else if(element == job->face_element){
+            parse_ascii_face(job, &job->header->elements[element], (int)i, p);
+        }
+        record++;
+    }
+}
+
+/**
+ * @brief Loads an ascii .ply file. The file is split into newline aligned chunks. The records in every
+ * chunk are counted in parallel, which tells every chunk which records it holds, and then the chunks
+ * are parsed in parallel straight into the mesh
+ */
+static void load_ascii_ply(Mesh* mesh, const PlyHeader* header, int vertex_element, int face_element, const char* data, size_t size, const char* filename){
+    VertexLayout layout;
+    find_vertex_layout(&layout, &header->elements[vertex_element], filename);
+    allocate_ply_mesh(mesh, header, &layout, vertex_element, face_element, filename);
+
+    AsciiPlyJob job = {
+        .mesh=mesh,
+        .header=header,
+        .layout=&layout,
+        .vertex_element=vertex_element,
+        .face_element=face_element,
+        .face_indices=find_face_indices(&header->elements[face_element], filename),
+        .end=data + size,
+        .filename=filename
+    };
+    job.element_first_record[0] = 0;
+    for(int e = 0; e < header->num_elements; e++){
+        job.element_first_record[e + 1] = job.element_first_record[e] + header->elements[e].count;
+    }
+
+    const char* start = data + header->data_offset;
+    size_t data_size = size - header->data_offset;
+    job.num_chunks = (int)((data_size + PLY_CHUNK_BYTES - 1) / PLY_CHUNK_BYTES);
+    if(job.num_chunks < 1) job.num_chunks = 1;
+    job.chunk_starts = (const char**)malloc(sizeof(const char*) * (job.num_chunks + 1));
+    job.chunk_records = (long*)malloc(sizeof(long) * job.num_chunks);
+    if(job.chunk_starts == NULL || job.chunk_records == NULL) goto MEM_ERROR;
+
+    // Every chunk but the first starts on the line after its nominal start
+    job.chunk_starts[0] = start;
+    for(int i = 1; i < job.num_chunks; i++){
+        const char* nominal = start + (size_t)i * PLY_CHUNK_BYTES;
+        if(nominal < job.chunk_starts[i - 1]) nominal = job.chunk_starts[i - 1];
+        job.chunk_starts[i] = nominal == start ? start : next_line_start(nominal - 1, job.end);
+    }
+    job.chunk_starts[job.num_chunks] = job.end;
+
+    ThreadPool* pool = threadpool_create(PLY_LOAD_THREADS);
+    threadpool_run(pool, job.num_chunks, count_ascii_chunk, &job);
+
+    long total_records = 0;
+    for(int i = 0; i < job.num_chunks; i++){
+        long records = job.chunk_records[i];
+        job.chunk_records[i] = total_records;
+        total_records += records;
+    }
+    if(total_records < job.element_first_record[face_element + 1] ||
+       total_records < job.element_first_record[vertex_element + 1]){
+        fprintf(stderr, "'%s' ends before all of its vertices and faces\n", filename);
+        exit(1);
+    }
+
+    threadpool_run(pool, job.num_chunks, parse_ascii_chunk, &job);
+    threadpool_delete(pool);
+    free(job.chunk_starts);
+    free(job.chunk_records);
+
+    finish_ply_mesh(mesh, layout.has_normals, filename);
     return;
     MEM_ERROR:
     fprintf(stderr, "Failed to allocate sufficient memory for mesh\n");
     exit(1);
-};
+}
+
+void load_mesh_from_ply(Mesh* mesh, char* filename){
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0){
+        fprintf(stderr, "No such file '%s'\n", filename);
+        exit(1);
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size == 0){
+        fprintf(stderr, "Failed to read '%s'\n", filename);
+        exit(1);
+    }
+    size_t size = (size_t)info.st_size;
+    unsigned char* data = (unsigned char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED){
+        fprintf(stderr, "Failed to map '%s'\n", filename);
+        exit(1);
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    PlyHeader header;
+    ply_parse_header(&header, (const char*)data, size, filename);
+    int vertex_element = ply_find_element(&header, "vertex");
+    int face_element = ply_find_element(&header, "face");
+    if(vertex_element < 0 || face_element < 0){
+        fprintf(stderr, "'%s' needs both vertex and face elements\n", filename);
+        exit(1);
+    }
+
+    if(header.format == PLY_ASCII){
+        load_ascii_ply(mesh, &header, vertex_element, face_element, (const char*)data, size, filename);
+    }
+    else {
+        load_binary_ply(mesh, &header, vertex_element, face_element, data, size, filename);
+    }
+    munmap(data, size);
+}
+
+/**
+ * @brief Frees one of the arrays of a mesh unless it lives in the mesh's cache file mapping
+ */
+static void free_mesh_array(const Mesh* mesh, void* array){
+    if(!mesh_cache_contains(mesh, array)) free(array);
+}
 
 void delete_mesh(Mesh mesh){
+    // Everything an instance points to belongs to the mesh it was made from
+    if(mesh.source != NULL) return;
+    if(mesh_cache_contains(&mesh, mesh.bvh.nodes)) mesh.bvh = NULL_BVH;
+    bvh_delete(&mesh.bvh);
+    free_mesh_array(&mesh, mesh.indices);
+    free_mesh_array(&mesh, mesh.positions);
+    free_mesh_array(&mesh, mesh.normals);
+    free_mesh_array(&mesh, mesh.face_normals);
+    free_mesh_array(&mesh, mesh.colors);
+    free_mesh_array(&mesh, mesh.uvs);
+    // every record array lives in the block that starts at v0_x
+    free_mesh_array(&mesh, mesh.tri_records.v0_x);
+    if(mesh.cache_mapping != NULL) munmap(mesh.cache_mapping, mesh.cache_mapping_size);
+    delete_triangle_blocks(&mesh.tri_blocks);
     free(mesh.vertices);
     mesh.vertices = NULL;
     free(mesh.tris);
     mesh.tris = NULL;
 }
 
+/**
+ * @brief Appends a transform and its inverse to the transform of a mesh, so that it applies after everything before it
+ */
+static void append_mesh_transform(Mesh* mesh, double transform[4][4], double inverse[4][4]){
+    M3d_mat_mult(mesh->transform, transform, mesh->transform);
+    M3d_mat_mult(mesh->inverse_transform, mesh->inverse_transform, inverse);
+}
+
 void translate_mesh(Mesh* mesh, Vector3 translation){
     double transform[4][4];
     double inverse[4][4];
     M3d_make_translation(transform, SPREAD_VEC3(translation));
     M3d_make_translation(inverse, SPREAD_VEC3(vec3_scale(translation, -1)));
-
-    M3d_mat_mult(mesh->transform, transform, mesh->transform);
-    M3d_mat_mult(mesh->inverse_transform, inverse, mesh->inverse_transform);
+    append_mesh_transform(mesh, transform, inverse);
 }
 
 void scale_mesh(Mesh* mesh, Vector3 scale){
     double transform[4][4];
     double inverse[4][4];
     M3d_make_scaling(transform, SPREAD_VEC3(scale));
-    M3d_make_scaling(transform, SPREAD_VEC3(vec3_scale(scale, -1)));
-
-    M3d_mat_mult(mesh->transform, transform, mesh->transform);
-    M3d_mat_mult(mesh->transform, transform, mesh->transform);
+    M3d_make_scaling(inverse, 1 / scale.x, 1 / scale.y, 1 / scale.z);
+    append_mesh_transform(mesh, transform, inverse);
 }
 
 void rotate_mesh_x_degrees(Mesh* mesh, double degrees){
@@ -172,11 +615,9 @@ void rotate_mesh_x_degrees(Mesh* mesh, double degrees){
     double inverse[4][4];
     double rads = to_radians(degrees);
 
-    M3d_make_x_rotation_cs(transform, cos(degrees), sin(degrees));
-    M3d_make_x_rotation_cs(transform, cos(degrees), -sin(degrees));
-
-    M3d_mat_mult(mesh->transform, transform, mesh->transform);
-    M3d_mat_mult(mesh->inverse_transform, inverse, mesh->inverse_transform);
+    M3d_make_x_rotation_cs(transform, cos(rads), sin(rads));
+    M3d_make_x_rotation_cs(inverse, cos(rads), -sin(rads));
+    append_mesh_transform(mesh, transform, inverse);
 }
 
 void rotate_mesh_y_degrees(Mesh* mesh, double degrees){
@@ -184,11 +625,9 @@ void rotate_mesh_y_degrees(Mesh* mesh, double degrees){
     double inverse[4][4];
     double rads = to_radians(degrees);
 
-    M3d_make_y_rotation_cs(transform, cos(degrees), sin(degrees));
-    M3d_make_y_rotation_cs(transform, cos(degrees), -sin(degrees));
-
-    M3d_mat_mult(mesh->transform, transform, mesh->transform);
-    M3d_mat_mult(mesh->inverse_transform, inverse, mesh->inverse_transform);
+    M3d_make_y_rotation_cs(transform, cos(rads), sin(rads));
+    M3d_make_y_rotation_cs(inverse, cos(rads), -sin(rads));
+    append_mesh_transform(mesh, transform, inverse);
 }
 
 void rotate_mesh_z_degrees(Mesh* mesh, double degrees){
@@ -196,11 +635,46 @@ void rotate_mesh_z_degrees(Mesh* mesh, double degrees){
     double inverse[4][4];
     double rads = to_radians(degrees);
 
-    M3d_make_z_rotation_cs(transform, cos(degrees), sin(degrees));
-    M3d_make_z_rotation_cs(transform, cos(degrees), -sin(degrees));
+    M3d_make_z_rotation_cs(transform, cos(rads), sin(rads));
+    M3d_make_z_rotation_cs(inverse, cos(rads), -sin(rads));
+    append_mesh_transform(mesh, transform, inverse);
+}
 
-    M3d_mat_mult(mesh->transform, transform, mesh->transform);
-    M3d_mat_mult(mesh->inverse_transform, inverse, mesh->inverse_transform);
+bool mesh_is_transformed(const Mesh* mesh){
+    for(int r = 0; r < 4; r++){
+        for(int c = 0; c < 4; c++){
+            if(mesh->transform[r][c] != (r == c ? 1 : 0)) return true;
+        }
+    }
+    return false;
+}
+
+void mesh_world_bounds(Mesh* mesh, AABB* bounds_out){
+    Vector3 min = mesh_geometry(mesh)->bounding_box_min;
+    Vector3 max = mesh_geometry(mesh)->bounding_box_max;
+    bounds_out->min = (Vector3){INFINITY, INFINITY, INFINITY};
+    bounds_out->max = (Vector3){-INFINITY, -INFINITY, -INFINITY};
+    for(int corner = 0; corner < 8; corner++){
+        Vector3 point = {
+            corner & 1 ? max.x : min.x,
+            corner & 2 ? max.y : min.y,
+            corner & 4 ? max.z : min.z
+        };
+        aabb_grow_point(bounds_out, mat4_mult_point(point, mesh->transform));
+    }
+}
+
+Mesh instance_mesh(const Mesh* mesh){
+    Mesh instance = *mesh;
+    instance.source = mesh_geometry(mesh);
+    M3d_make_identity(instance.transform);
+    M3d_make_identity(instance.inverse_transform);
+    instance.hidden = false;
+    return instance;
+}
+
+const Mesh* mesh_geometry(const Mesh* mesh){
+    return mesh->source != NULL ? mesh->source : mesh;
 }
 
 /**
@@ -213,7 +687,7 @@ void compute_mesh_bounds(Mesh* mesh){
     Vector3 max = {-INFINITY, -INFINITY, -INFINITY};
 
     for(int i = 0; i < mesh->num_vertices; i++){
-        Vector3 position = mesh->vertices[i].position;
+        Vector3 position = mesh->positions[i];
         
         if(position.x < min.x) min.x = position.x;
         if(position.y < min.y) min.y = position.y;
@@ -236,41 +710,228 @@ void compute_mesh_bounds(Mesh* mesh){
  * @param transform The 4x4 transformation matrix to apply.
  */
 void apply_mesh_transform(Mesh* mesh) {
-    if(mesh == NULL) return;
+    // An instance's vertices are shared with every other instance of its mesh
+    if(mesh == NULL || mesh->source != NULL) return;
+    double (*inverse)[4] = mesh->inverse_transform;
     for (int i = 0; i < mesh->num_vertices; i++) {
-            mesh->vertices[i].position = mat4_mult_point(mesh->vertices[i].position, mesh ->transform);
+            mesh->positions[i] = mat4_mult_point(mesh->positions[i], mesh ->transform);
+            // Normals go through the transpose of the inverse so they stay perpendicular under scaling
+            Vector3 n = mesh->normals[i];
+            mesh->normals[i] = vec3_normalized((Vector3){
+                n.x * inverse[0][0] + n.y * inverse[1][0] + n.z * inverse[2][0],
+                n.x * inverse[0][1] + n.y * inverse[1][1] + n.z * inverse[2][1],
+                n.x * inverse[0][2] + n.y * inverse[1][2] + n.z * inverse[2][2]
+            });
+            mesh->vertices[i].normal = mesh->normals[i];
     }
+    copy_positions_to_vertices(mesh);
     //reset the transformation matrix
     M3d_make_identity(mesh->transform);
     //reset the inverse transformation matrix
     M3d_make_identity(mesh->inverse_transform);
 
-    //recompute normals and bounds
+    //recompute normals, triangle records, bounds and the BVH
     compute_face_normals(mesh);
+    compute_triangle_records(mesh);
     compute_mesh_bounds(mesh);
+    refit_mesh_bvh(mesh);
 }
-void compute_plane_normals(Mesh* plane){
-    for(int i = 0; i < plane->num_tris; i++){
-        Triangle tri = plane->tris[i];
-        Vector3 edge_1 = vec3_sub(tri.b->position, tri.a->position);
-        Vector3 edge_2 = vec3_sub(tri.c->position, tri.a->position);
 
-        plane->tris[i].normal = vec3_scale(vec3_normalized(vec3_cross_prod(edge_1, edge_2)), -1);
+/**
+ * @brief Computes the bounding box of every triangle of a mesh, and its centroid unless centroids is NULL
+ */
+static void compute_triangle_bounds(const Mesh* mesh, AABB* bounds, Vector3* centroids){
+    for(int i = 0; i < mesh->num_tris; i++){
+        Vector3 a = mesh->positions[mesh->indices[3 * i]];
+        Vector3 b = mesh->positions[mesh->indices[3 * i + 1]];
+        Vector3 c = mesh->positions[mesh->indices[3 * i + 2]];
+        bounds[i].min = a;
+        bounds[i].max = a;
+        aabb_grow_point(&bounds[i], b);
+        aabb_grow_point(&bounds[i], c);
+        if(centroids != NULL) centroids[i] = vec3_scale(vec3_add(vec3_add(a, b), c), 1.0 / 3);
     }
 }
-void compute_face_normals(Mesh* mesh){
+
+void build_mesh_bvh(Mesh* mesh){
+    // A BVH read from the cache file is left in the mapping and simply replaced
+    if(mesh_cache_contains(mesh, mesh->bvh.nodes)) mesh->bvh = NULL_BVH;
+    bvh_delete(&mesh->bvh);
+    delete_triangle_blocks(&mesh->tri_blocks);
+    mesh->generation++;
+    if(mesh->num_tris <= 0) return;
+
+    AABB* bounds = (AABB*)malloc(sizeof(AABB) * mesh->num_tris);
+    Vector3* centroids = (Vector3*)malloc(sizeof(Vector3) * mesh->num_tris);
+    if(bounds == NULL || centroids == NULL) goto MEM_ERROR;
+
+    compute_triangle_bounds(mesh, bounds, centroids);
+    bvh_build(&mesh->bvh, bounds, centroids, mesh->num_tris);
+    build_triangle_blocks(mesh);
+
+    free(bounds);
+    free(centroids);
+    return;
+    MEM_ERROR:
+    fprintf(stderr, "Failed to allocate sufficient memory for mesh BVH\n");
+    exit(1);
+}
+
+bool refit_mesh_bvh(Mesh* mesh){
+    if(!USE_BVH_REFIT || mesh->bvh.num_nodes == 0 || mesh->bvh.num_prims != mesh->num_tris){
+        build_mesh_bvh(mesh);
+        return true;
+    }
+
+    AABB* bounds = (AABB*)malloc(sizeof(AABB) * mesh->num_tris);
+    if(bounds == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for mesh BVH\n");
+        exit(1);
+    }
+    compute_triangle_bounds(mesh, bounds, NULL);
+    bvh_refit(&mesh->bvh, bounds);
+    mesh->generation++;
+    bool rebuild = bvh_sah_cost(&mesh->bvh) > BVH_REFIT_MAX_COST_RATIO * mesh->bvh.build_cost;
+    if(!rebuild) refit_triangle_blocks(mesh, bounds);
+    free(bounds);
+
+    if(rebuild) build_mesh_bvh(mesh);
+    return rebuild;
+}
+/**
+ * @brief Allocates the index based arrays of a mesh for its current number of vertices and triangles
+ */
+static void allocate_indexed_mesh(Mesh* mesh){
+    int num_tris = mesh->num_tris;
+    int num_vertices = mesh->num_vertices;
+    mesh->indices = (uint32_t*)malloc(sizeof(uint32_t) * 3 * num_tris);
+    mesh->positions = (Vector3*)malloc(sizeof(Vector3) * num_vertices);
+    mesh->normals = (Vector3*)malloc(sizeof(Vector3) * num_vertices);
+    mesh->face_normals = (Vector3*)malloc(sizeof(Vector3) * num_tris);
+    double* records = (double*)malloc(sizeof(double) * 9 * num_tris);
+    if(mesh->indices == NULL || mesh->positions == NULL || mesh->normals == NULL ||
+       mesh->face_normals == NULL || records == NULL) goto MEM_ERROR;
+
+    mesh->tri_records.v0_x = records;
+    mesh->tri_records.v0_y = records + num_tris;
+    mesh->tri_records.v0_z = records + 2 * num_tris;
+    mesh->tri_records.edge_1_x = records + 3 * num_tris;
+    mesh->tri_records.edge_1_y = records + 4 * num_tris;
+    mesh->tri_records.edge_1_z = records + 5 * num_tris;
+    mesh->tri_records.edge_2_x = records + 6 * num_tris;
+    mesh->tri_records.edge_2_y = records + 7 * num_tris;
+    mesh->tri_records.edge_2_z = records + 8 * num_tris;
+    mesh->cache_mapping = NULL;
+    mesh->cache_mapping_size = 0;
+    mesh->tri_blocks = NULL_TRIANGLE_BLOCKS;
+    mesh->source = NULL;
+    mesh->generation = 0;
+    return;
+    MEM_ERROR:
+    fprintf(stderr, "Failed to allocate sufficient memory for mesh\n");
+    exit(1);
+}
+
+void build_indexed_mesh(Mesh* mesh){
+    int num_tris = mesh->num_tris;
+    int num_vertices = mesh->num_vertices;
+    allocate_indexed_mesh(mesh);
+    // Only the .ply loader knows about colors and texture coordinates
+    mesh->colors = NULL;
+    mesh->uvs = NULL;
+
+    for(int i = 0; i < num_vertices; i++){
+        mesh->positions[i] = mesh->vertices[i].position;
+        mesh->normals[i] = mesh->vertices[i].normal;
+    }
+    for(int i = 0; i < num_tris; i++){
+        mesh->indices[3 * i] = (uint32_t)(mesh->tris[i].a - mesh->vertices);
+        mesh->indices[3 * i + 1] = (uint32_t)(mesh->tris[i].b - mesh->vertices);
+        mesh->indices[3 * i + 2] = (uint32_t)(mesh->tris[i].c - mesh->vertices);
+        mesh->face_normals[i] = mesh->tris[i].normal;
+    }
+    compute_triangle_records(mesh);
+}
+
+void build_legacy_mesh(Mesh* mesh){
+    mesh->vertices = (Vertex*)malloc(sizeof(Vertex) * mesh->num_vertices);
+    mesh->tris = (Triangle*)malloc(sizeof(Triangle) * mesh->num_tris);
+    if(mesh->vertices == NULL || mesh->tris == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for mesh\n");
+        exit(1);
+    }
+
+    for(int i = 0; i < mesh->num_vertices; i++){
+        mesh->vertices[i].position = mesh->positions[i];
+        mesh->vertices[i].position_static = mesh->positions[i];
+        mesh->vertices[i].normal = mesh->normals[i];
+        mesh->vertices[i].normal_static = mesh->normals[i];
+    }
     for(int i = 0; i < mesh->num_tris; i++){
-        Triangle tri = mesh->tris[i];
-        Vector3 edge_1 = vec3_sub(tri.b->position, tri.a->position);
-        Vector3 edge_2 = vec3_sub(tri.c->position, tri.a->position);
+        mesh->tris[i].a = mesh->vertices + mesh->indices[3 * i];
+        mesh->tris[i].b = mesh->vertices + mesh->indices[3 * i + 1];
+        mesh->tris[i].c = mesh->vertices + mesh->indices[3 * i + 2];
+        mesh->tris[i].normal = mesh->face_normals[i];
+    }
+}
 
-        mesh->tris[i].normal = vec3_normalized(vec3_cross_prod(edge_1, edge_2));
+void compute_triangle_records(Mesh* mesh){
+    TriangleRecords* records = &mesh->tri_records;
+    mesh->generation++;
+    for(int i = 0; i < mesh->num_tris; i++){
+        Vector3 a = mesh->positions[mesh->indices[3 * i]];
+        Vector3 b = mesh->positions[mesh->indices[3 * i + 1]];
+        Vector3 c = mesh->positions[mesh->indices[3 * i + 2]];
+        records->v0_x[i] = a.x;
+        records->v0_y[i] = a.y;
+        records->v0_z[i] = a.z;
+        records->edge_1_x[i] = b.x - a.x;
+        records->edge_1_y[i] = b.y - a.y;
+        records->edge_1_z[i] = b.z - a.z;
+        records->edge_2_x[i] = c.x - a.x;
+        records->edge_2_y[i] = c.y - a.y;
+        records->edge_2_z[i] = c.z - a.z;
     }
 }
 
+void copy_positions_to_vertices(Mesh* mesh){
+    for(int i = 0; i < mesh->num_vertices; i++){
+        mesh->vertices[i].position = mesh->positions[i];
+    }
+}
+
+/**
+ * @brief Sets the face normal of every triangle to the normalized cross product of its edges, scaled by sign
+ */
+static void compute_normals_with_sign(Mesh* mesh, double sign){
+    mesh->generation++;
+    for(int i = 0; i < mesh->num_tris; i++){
+        Vector3 a = mesh->positions[mesh->indices[3 * i]];
+        Vector3 b = mesh->positions[mesh->indices[3 * i + 1]];
+        Vector3 c = mesh->positions[mesh->indices[3 * i + 2]];
+        Vector3 edge_1 = vec3_sub(b, a);
+        Vector3 edge_2 = vec3_sub(c, a);
+
+        Vector3 normal = vec3_normalized(vec3_cross_prod(edge_1, edge_2));
+        if(sign < 0) normal = vec3_scale(normal, -1);
+        mesh->face_normals[i] = normal;
+        mesh->tris[i].normal = normal;
+    }
+}
+
+void compute_plane_normals(Mesh* plane){
+    compute_normals_with_sign(plane, -1);
+}
+
+void compute_face_normals(Mesh* mesh){
+    compute_normals_with_sign(mesh, 1);
+}
+
 void invert_vertex_normals(Mesh* mesh){
+    mesh->generation++;
     for(int i = 0; i < mesh->num_vertices; i++){
         mesh->vertices[i].normal = vec3_scale(mesh->vertices[i].normal, -1);
+        mesh->normals[i] = mesh->vertices[i].normal;
     }
 }
 
@@ -322,9 +983,14 @@ void print_mesh(Mesh mesh){
 Mesh* get_mesh(char* filename){
     Mesh* mesh = (Mesh*)malloc(sizeof(Mesh));
     if(mesh == NULL) goto MEM_ERROR;
-    load_mesh_from_ply(mesh, filename);
-    compute_face_normals(mesh);
-    compute_mesh_bounds(mesh);
+    if(!USE_MESH_CACHE || !load_mesh_cache(mesh, filename)){
+        load_mesh_from_ply(mesh, filename);
+        compute_face_normals(mesh);
+        compute_mesh_bounds(mesh);
+        mesh->bvh = NULL_BVH;
+        build_mesh_bvh(mesh);
+        if(USE_MESH_CACHE) save_mesh_cache(mesh, filename);
+    }
     //matricies
     M3d_make_identity(mesh->transform);
     M3d_make_identity(mesh->inverse_transform);
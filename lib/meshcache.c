@@ -0,0 +1,318 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "meshcache.h"
+#include "triblock.h"
+
+// Every section starts on a cache line so the arrays are as aligned as malloc'd ones
+#define CACHE_ALIGNMENT 64
+
+static const char CACHE_MAGIC[8] = {'G', 'M', 'E', 'S', 'H', '\r', '\n', 0x1a};
+static const uint32_t CACHE_BYTE_ORDER = 0x01020304;
+
+typedef enum {
+    CACHE_INDICES,
+    CACHE_POSITIONS,
+    CACHE_NORMALS,
+    CACHE_FACE_NORMALS,
+    CACHE_TRI_RECORDS,
+    CACHE_COLORS,
+    CACHE_UVS,
+    CACHE_BVH_NODES,
+    CACHE_BVH_PRIM_INDICES,
+    CACHE_NUM_SECTIONS
+} CacheSectionId;
+
+/**
+ * @brief Where one array is stored, counted from the first byte of the file. Empty arrays have a size of 0
+ */
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} CacheSection;
+
+/**
+ * @brief The start of every .gmesh file. The arrays follow it, each in its own aligned section
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    // The sizes of the stored structs, so caches from a build that lays them out differently are rejected
+    uint32_t header_size;
+    uint32_t vector_size;
+    uint32_t bvh_node_size;
+    uint32_t padding;
+    uint64_t file_size;
+
+    // The .ply file the cache was made from, as it was when the cache was written
+    uint64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+
+    int32_t num_vertices;
+    int32_t num_tris;
+    int32_t num_bvh_nodes;
+    int32_t num_bvh_prims;
+    Vector3 bounding_box_min;
+    Vector3 bounding_box_max;
+    CacheSection sections[CACHE_NUM_SECTIONS];
+} MeshCacheHeader;
+
+bool mesh_cache_filename(char* out, size_t out_size, const char* ply_filename){
+    size_t length = strlen(ply_filename);
+    int written;
+    if(length >= 4 && !strcmp(ply_filename + length - 4, ".ply")){
+        written = snprintf(out, out_size, "%.*s.gmesh", (int)(length - 4), ply_filename);
+    }
+    else written = snprintf(out, out_size, "%s.gmesh", ply_filename);
+    return written >= 0 && (size_t)written < out_size;
+}
+
+bool mesh_cache_contains(const Mesh* mesh, const void* array){
+    if(mesh->cache_mapping == NULL || array == NULL) return false;
+    uintptr_t start = (uintptr_t)mesh->cache_mapping;
+    return (uintptr_t)array >= start && (uintptr_t)array < start + mesh->cache_mapping_size;
+}
+
+/**
+ * @brief Gets the sizes every section must have for a given header
+ */
+static void expected_section_sizes(uint64_t* sizes, const MeshCacheHeader* header){
+    uint64_t num_vertices = (uint64_t)header->num_vertices;
+    uint64_t num_tris = (uint64_t)header->num_tris;
+    sizes[CACHE_INDICES] = sizeof(uint32_t) * 3 * num_tris;
+    sizes[CACHE_POSITIONS] = sizeof(Vector3) * num_vertices;
+    sizes[CACHE_NORMALS] = sizeof(Vector3) * num_vertices;
+    sizes[CACHE_FACE_NORMALS] = sizeof(Vector3) * num_tris;
+    sizes[CACHE_TRI_RECORDS] = sizeof(double) * 9 * num_tris;
+    sizes[CACHE_COLORS] = sizeof(Color3) * num_vertices;
+    sizes[CACHE_UVS] = sizeof(Vector2) * num_vertices;
+    sizes[CACHE_BVH_NODES] = sizeof(BVHNode) * (uint64_t)header->num_bvh_nodes;
+    sizes[CACHE_BVH_PRIM_INDICES] = sizeof(int) * (uint64_t)header->num_bvh_prims;
+}
+
+/**
+ * @brief Checks that a mapped cache file is complete, matches this build and is consistent with itself
+ */
+static bool is_valid_cache(const unsigned char* data, size_t size, const struct stat* source_info){
+    if(size < sizeof(MeshCacheHeader)) return false;
+    const MeshCacheHeader* header = (const MeshCacheHeader*)data;
+    if(memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) || header->version != MESH_CACHE_VERSION ||
+       header->byte_order != CACHE_BYTE_ORDER || header->header_size != sizeof(MeshCacheHeader) ||
+       header->vector_size != sizeof(Vector3) || header->bvh_node_size != sizeof(BVHNode) ||
+       header->file_size != size) return false;
+
+    if(header->source_size != (uint64_t)source_info->st_size ||
+       header->source_mtime_sec != (int64_t)source_info->st_mtim.tv_sec ||
+       header->source_mtime_nsec != (int64_t)source_info->st_mtim.tv_nsec) return false;
+
+    if(header->num_vertices < 0 || header->num_tris < 0 || header->num_bvh_nodes < 0 || header->num_bvh_prims < 0) return false;
+    uint64_t sizes[CACHE_NUM_SECTIONS];
+    expected_section_sizes(sizes, header);
+    for(int i = 0; i < CACHE_NUM_SECTIONS; i++){
+        const CacheSection* section = &header->sections[i];
+        bool optional = i == CACHE_COLORS || i == CACHE_UVS;
+        if(section->size != sizes[i] && !(optional && section->size == 0)) return false;
+        if(section->size == 0) continue;
+        if(section->offset % CACHE_ALIGNMENT != 0 || section->offset > size || size - section->offset < section->size) return false;
+    }
+
+    // Indices are checked so that a damaged file can't send the raytracer outside the arrays
+    const uint32_t* indices = (const uint32_t*)(data + header->sections[CACHE_INDICES].offset);
+    for(uint64_t i = 0; i < 3 * (uint64_t)header->num_tris; i++){
+        if(indices[i] >= (uint32_t)header->num_vertices) return false;
+    }
+    const int* prim_indices = (const int*)(data + header->sections[CACHE_BVH_PRIM_INDICES].offset);
+    for(int i = 0; i < header->num_bvh_prims; i++){
+        if(prim_indices[i] < 0 || prim_indices[i] >= header->num_tris) return false;
+    }
+    const BVHNode* nodes = (const BVHNode*)(data + header->sections[CACHE_BVH_NODES].offset);
+    for(int i = 0; i < header->num_bvh_nodes; i++){
+        if(nodes[i].count < 0 || nodes[i].left_or_first < 0) return false;
+        // Children always come after their parent, so a damaged file can't make the traversal loop
+        if(nodes[i].count == 0 && (nodes[i].left_or_first <= i || nodes[i].left_or_first >= header->num_bvh_nodes - 1)) return false;
+        if(nodes[i].count > 0 && nodes[i].left_or_first > header->num_bvh_prims - nodes[i].count) return false;
+    }
+
+    // The traversal stacks only have room for a tree as deep as build_bvh makes
+    if(header->num_bvh_nodes == 0) return true;
+    int* depths = (int*)calloc(header->num_bvh_nodes, sizeof(int));
+    if(depths == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for mesh cache validation\n");
+        exit(1);
+    }
+    bool valid = true;
+    for(int i = 0; i < header->num_bvh_nodes && valid; i++){
+        if(nodes[i].count > 0) continue;
+        if(depths[i] >= BVH_MAX_DEPTH) valid = false;
+        for(int child = nodes[i].left_or_first; child <= nodes[i].left_or_first + 1; child++){
+            if(depths[child] < depths[i] + 1) depths[child] = depths[i] + 1;
+        }
+    }
+    free(depths);
+    return valid;
+}
+
+bool load_mesh_cache(Mesh* mesh, const char* ply_filename){
+    char cache_filename[4096];
+    if(!mesh_cache_filename(cache_filename, sizeof(cache_filename), ply_filename)) return false;
+
+    struct stat source_info, cache_info;
+    if(stat(ply_filename, &source_info) != 0) return false;
+    int fd = open(cache_filename, O_RDONLY);
+    if(fd < 0) return false;
+    if(fstat(fd, &cache_info) != 0 || cache_info.st_size < (off_t)sizeof(MeshCacheHeader)){
+        close(fd);
+        return false;
+    }
+    // A cache older than its .ply file is stale even if it recorded the same size and time
+    if(cache_info.st_mtim.tv_sec < source_info.st_mtim.tv_sec ||
+       (cache_info.st_mtim.tv_sec == source_info.st_mtim.tv_sec && cache_info.st_mtim.tv_nsec < source_info.st_mtim.tv_nsec)){
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)cache_info.st_size;
+    // Copy on write, so the mesh can move its vertices and normals without touching the file
+    unsigned char* data = (unsigned char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) return false;
+    if(!is_valid_cache(data, size, &source_info)){
+        munmap(data, size);
+        return false;
+    }
+
+    const MeshCacheHeader* header = (const MeshCacheHeader*)data;
+    const CacheSection* sections = header->sections;
+    #define SECTION(id, type) (sections[id].size == 0 ? NULL : (type*)(data + sections[id].offset))
+    mesh->num_vertices = header->num_vertices;
+    mesh->num_tris = header->num_tris;
+    mesh->indices = SECTION(CACHE_INDICES, uint32_t);
+    mesh->positions = SECTION(CACHE_POSITIONS, Vector3);
+    mesh->normals = SECTION(CACHE_NORMALS, Vector3);
+    mesh->face_normals = SECTION(CACHE_FACE_NORMALS, Vector3);
+    mesh->colors = SECTION(CACHE_COLORS, Color3);
+    mesh->uvs = SECTION(CACHE_UVS, Vector2);
+
+    double* records = SECTION(CACHE_TRI_RECORDS, double);
+    int num_tris = mesh->num_tris;
+    mesh->tri_records.v0_x = records;
+    mesh->tri_records.v0_y = records + num_tris;
+    mesh->tri_records.v0_z = records + 2 * num_tris;
+    mesh->tri_records.edge_1_x = records + 3 * num_tris;
+    mesh->tri_records.edge_1_y = records + 4 * num_tris;
+    mesh->tri_records.edge_1_z = records + 5 * num_tris;
+    mesh->tri_records.edge_2_x = records + 6 * num_tris;
+    mesh->tri_records.edge_2_y = records + 7 * num_tris;
+    mesh->tri_records.edge_2_z = records + 8 * num_tris;
+
+    mesh->bvh.num_nodes = header->num_bvh_nodes;
+    mesh->bvh.nodes = SECTION(CACHE_BVH_NODES, BVHNode);
+    mesh->bvh.num_prims = header->num_bvh_prims;
+    mesh->bvh.prim_indices = SECTION(CACHE_BVH_PRIM_INDICES, int);
+    mesh->bvh.build_cost = bvh_sah_cost(&mesh->bvh);
+    #undef SECTION
+
+    mesh->bounding_box_min = header->bounding_box_min;
+    mesh->bounding_box_max = header->bounding_box_max;
+    mesh->cache_mapping = data;
+    mesh->cache_mapping_size = size;
+    build_legacy_mesh(mesh);
+    // The blocks depend on the CPU, so they are rebuilt rather than cached
+    mesh->tri_blocks = NULL_TRIANGLE_BLOCKS;
+    build_triangle_blocks(mesh);
+    mesh->source = NULL;
+    mesh->generation = 0;
+    return true;
+}
+
+/**
+ * @brief Pads the file up to the next section boundary and writes one array there
+ */
+static bool write_section(FILE* file, CacheSection* section, const void* array, uint64_t size){
+    section->offset = 0;
+    section->size = 0;
+    if(array == NULL || size == 0) return true;
+
+    static const char ZEROS[CACHE_ALIGNMENT] = {0};
+    long position = ftell(file);
+    if(position < 0) return false;
+    long padding = (CACHE_ALIGNMENT - position % CACHE_ALIGNMENT) % CACHE_ALIGNMENT;
+    if(fwrite(ZEROS, 1, padding, file) != (size_t)padding) return false;
+    if(fwrite(array, 1, size, file) != size) return false;
+    section->offset = (uint64_t)(position + padding);
+    section->size = size;
+    return true;
+}
+
+void save_mesh_cache(const Mesh* mesh, const char* ply_filename){
+    char cache_filename[4096];
+    char temp_filename[4096 + 32];
+    if(!mesh_cache_filename(cache_filename, sizeof(cache_filename), ply_filename)) return;
+    snprintf(temp_filename, sizeof(temp_filename), "%s.%ld.tmp", cache_filename, (long)getpid());
+
+    struct stat source_info;
+    if(stat(ply_filename, &source_info) != 0) return;
+
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = MESH_CACHE_VERSION;
+    header.byte_order = CACHE_BYTE_ORDER;
+    header.header_size = sizeof(MeshCacheHeader);
+    header.vector_size = sizeof(Vector3);
+    header.bvh_node_size = sizeof(BVHNode);
+    header.source_size = (uint64_t)source_info.st_size;
+    header.source_mtime_sec = (int64_t)source_info.st_mtim.tv_sec;
+    header.source_mtime_nsec = (int64_t)source_info.st_mtim.tv_nsec;
+    header.num_vertices = mesh->num_vertices;
+    header.num_tris = mesh->num_tris;
+    header.num_bvh_nodes = mesh->bvh.num_nodes;
+    header.num_bvh_prims = mesh->bvh.num_prims;
+    header.bounding_box_min = mesh->bounding_box_min;
+    header.bounding_box_max = mesh->bounding_box_max;
+
+    uint64_t sizes[CACHE_NUM_SECTIONS];
+    expected_section_sizes(sizes, &header);
+    const void* arrays[CACHE_NUM_SECTIONS] = {
+        [CACHE_INDICES] = mesh->indices,
+        [CACHE_POSITIONS] = mesh->positions,
+        [CACHE_NORMALS] = mesh->normals,
+        [CACHE_FACE_NORMALS] = mesh->face_normals,
+        // every record array lives in the block that starts at v0_x
+        [CACHE_TRI_RECORDS] = mesh->tri_records.v0_x,
+        [CACHE_COLORS] = mesh->colors,
+        [CACHE_UVS] = mesh->uvs,
+        [CACHE_BVH_NODES] = mesh->bvh.nodes,
+        [CACHE_BVH_PRIM_INDICES] = mesh->bvh.prim_indices
+    };
+
+    FILE* file = fopen(temp_filename, "wb");
+    if(file == NULL) goto WRITE_ERROR;
+    // The header is written again at the end once the section offsets are known
+    if(fwrite(&header, sizeof(header), 1, file) != 1) goto WRITE_ERROR;
+    for(int i = 0; i < CACHE_NUM_SECTIONS; i++){
+        if(!write_section(file, &header.sections[i], arrays[i], sizes[i])) goto WRITE_ERROR;
+    }
+    long file_size = ftell(file);
+    if(file_size < 0) goto WRITE_ERROR;
+    header.file_size = (uint64_t)file_size;
+    if(fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1) goto WRITE_ERROR;
+    if(fclose(file) != 0){
+        file = NULL;
+        goto WRITE_ERROR;
+    }
+    file = NULL;
+    if(rename(temp_filename, cache_filename) != 0) goto WRITE_ERROR;
+    return;
+    WRITE_ERROR:
+    if(file != NULL) fclose(file);
+    remove(temp_filename);
+    fprintf(stderr, "Warning: failed to write mesh cache '%s'\n", cache_filename);
+}
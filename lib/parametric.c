@@ -2,6 +2,10 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
 #include "parametric.h"
 #include "vector.h"
 #include "matrix.h"
@@ -10,11 +14,1265 @@
 #include "FPToolkit.h"
 #include "texture.h"
 #include "xwd_tools.h"
+#include "framebuffer.h"
+#include "threadpool.h"
 
 static const bool BACKFACE_CULLING = false; //TODO: Make this an option that can be passed in?
 
 double NORMAL_DELTA = 0.001;
 
+bool RASTERIZE_PARAMETRIC_TRIANGLES = false;
+void invert_rasterize_parametric_triangles(){ RASTERIZE_PARAMETRIC_TRIANGLES = !RASTERIZE_PARAMETRIC_TRIANGLES; }
+
+bool ADAPTIVE_PARAMETRIC_SAMPLING = false;
+void invert_adaptive_parametric_sampling(){ ADAPTIVE_PARAMETRIC_SAMPLING = !ADAPTIVE_PARAMETRIC_SAMPLING; }
+
+// Adaptive sampling starts from this many patches along u and along v
+#define ADAPTIVE_ROOT_PATCHES 16
+// How many times a root patch can be halved along u or along v
+#define ADAPTIVE_MAX_DEPTH 10
+// Patches are halved until their edges are at most this many pixels long on screen
+#define ADAPTIVE_SAMPLE_SPACING 1.0
+
+bool DEFERRED_PARAMETRIC_SHADING = false;
+void invert_deferred_parametric_shading(){ DEFERRED_PARAMETRIC_SHADING = !DEFERRED_PARAMETRIC_SHADING; }
+
+bool USE_TESSELLATION_CACHE = true;
+void invert_use_tessellation_cache(){ USE_TESSELLATION_CACHE = !USE_TESSELLATION_CACHE; }
+
+// The cached tessellations are all dropped once they take more memory than this
+#define TESSELLATION_CACHE_BYTES ((size_t)256 << 20)
+
+/**
+ * @brief Everything an object's tessellation depends on. The transform is left out, since the
+ * tessellation is kept in object space
+ */
+typedef struct {
+    Vector3 (*f)(double, double);
+    double u_start;
+    double u_end;
+    double u_step;
+    double v_start;
+    double v_end;
+    double v_step;
+    // NULL_TEXTURE and 0 for surfaces without displacement
+    Texture displacement;
+    double displacement_scale;
+} TessellationKey;
+
+/**
+ * @brief The corners of an object's u/v grid in object space, a step apart and reaching u_end
+ * and v_end. Corner (i, j), the ith along u and the jth along v, is at index i * rows + j
+ */
+typedef struct {
+    TessellationKey key;
+    int columns;
+    int rows;
+    // Before displacement
+    Vector3* points;
+    // Three per corner, the points its normal is found from. See object_point
+    Vector3* normal_points;
+    // How far each corner is moved along its normal by the displacement texture
+    double* displacements;
+    Vector2* uvs;
+} Tessellation;
+
+// The tessellations kept across frames, and an open addressing hash table of indices into them.
+// Each is allocated on its own so that pointers to them stay valid as more are cached
+static Tessellation** tessellations = NULL;
+static int num_tessellations = 0;
+static int tessellations_capacity = 0;
+static int* tessellation_slots = NULL;
+static int num_tessellation_slots = 0;
+static size_t tessellation_bytes = 0;
+
+static TessellationKey tessellation_key(const ParametricObject3D* object){
+    bool displaced = !texture_is_null(object->material.texture_displacement);
+    TessellationKey key = {
+        .f=object->f,
+        .u_start=object->u_start,
+        .u_end=object->u_end,
+        .u_step=object->u_step,
+        .v_start=object->v_start,
+        .v_end=object->v_end,
+        .v_step=object->v_step,
+        .displacement=displaced ? object->material.texture_displacement : NULL_TEXTURE,
+        .displacement_scale=displaced ? object->material.displacement_scale : 0
+    };
+    return key;
+}
+
+static bool same_texture(const Texture* a, const Texture* b){
+    if(a->width != b->width || a->height != b->height || a->type != b->type) return false;
+    return a->type == PNG ? a->data.row_pointers == b->data.row_pointers : a->data.xwd_texture_id == b->data.xwd_texture_id;
+}
+
+static bool same_tessellation_key(const TessellationKey* a, const TessellationKey* b){
+    return a->f == b->f && a->u_start == b->u_start && a->u_end == b->u_end && a->u_step == b->u_step &&
+           a->v_start == b->v_start && a->v_end == b->v_end && a->v_step == b->v_step &&
+           same_texture(&a->displacement, &b->displacement) && a->displacement_scale == b->displacement_scale;
+}
+
+static uint64_t mix_hash(uint64_t hash, uint64_t value){
+    hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+static uint64_t double_bits(double value){
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static uint64_t hash_tessellation_key(const TessellationKey* key){
+    uint64_t hash = mix_hash(0, (uint64_t)(uintptr_t)key->f);
+    double fields[7] = {key->u_start, key->u_end, key->u_step, key->v_start, key->v_end, key->v_step, key->displacement_scale};
+    for(int i = 0; i < 7; i++) hash = mix_hash(hash, double_bits(fields[i]));
+    return mix_hash(hash, (uint64_t)key->displacement.width << 32 | (uint32_t)key->displacement.height);
+}
+
+static void free_tessellation(Tessellation* tessellation){
+    free(tessellation->points);
+    free(tessellation->normal_points);
+    free(tessellation->displacements);
+    free(tessellation->uvs);
+}
+
+void clear_parametric_tessellations(){
+    for(int t = 0; t < num_tessellations; t++){
+        free_tessellation(tessellations[t]);
+        free(tessellations[t]);
+    }
+    free(tessellations);
+    free(tessellation_slots);
+    tessellations = NULL;
+    num_tessellations = 0;
+    tessellations_capacity = 0;
+    tessellation_slots = NULL;
+    num_tessellation_slots = 0;
+    tessellation_bytes = 0;
+}
+
+/**
+ * @brief Gets where a texture is sampled at u, v of an object. The corners and triangles reach u_end and
+ * v_end, which would sample one past the last texel, so they sample the last one instead
+ */
+static Vector2 texture_position(const ParametricObject3D* object, const Texture* texture, double u, double v){
+    double u_range = object->u_end - object->u_start;
+    double v_range = object->v_end - object->v_start;
+    return (Vector2){fmin(u / u_range * texture->width, texture->width - 1), fmin(v / v_range * texture->height, texture->height - 1)};
+}
+
+/**
+ * @brief Evaluates a surface at u, v in object space, along with what moving it into the world needs.
+ * Normals are found by finite differences once the points are in the world, so that they follow the
+ * tangents through any transform
+ *
+ * @param normal_points_out Set to the point the tangents along v and u start from, then the points a step
+ * along v and a step along u. The tangents start from the point at u, v except where they vanish, like the
+ * poles of a sphere, where they start from a point just beside it
+ * @param displacement_out Set to how far the point is moved along its normal by the displacement texture
+ * @return The point before displacement
+ */
+static Vector3 object_point(const ParametricObject3D* object, double u, double v, Vector3 normal_points_out[3], double* displacement_out){
+    Vector3 point = object->f(u, v);
+    normal_points_out[0] = point;
+    normal_points_out[1] = object->f(u, v + NORMAL_DELTA);
+    normal_points_out[2] = object->f(u + NORMAL_DELTA, v);
+    Vector3 tangent_a = vec3_normalized(vec3_sub(normal_points_out[1], point));
+    Vector3 tangent_b = vec3_normalized(vec3_sub(normal_points_out[2], point));
+    Vector3 normal = vec3_cross_prod(tangent_a, tangent_b);
+    if(!isfinite(normal.x) || !isfinite(normal.y) || !isfinite(normal.z)){
+        normal_points_out[0] = object->f(u + NORMAL_DELTA, v + NORMAL_DELTA);
+        normal_points_out[1] = object->f(u + NORMAL_DELTA, v + 2 * NORMAL_DELTA);
+        normal_points_out[2] = object->f(u + 2 * NORMAL_DELTA, v + NORMAL_DELTA);
+    }
+
+    *displacement_out = 0;
+    Texture displacement = object->material.texture_displacement;
+    if(!texture_is_null(displacement)){
+        Color3 displacement_color = get_texture_color(displacement, texture_position(object, &displacement, u, v));
+        *displacement_out = displacement_color.r * object->material.displacement_scale; // Use red channel
+    }
+    return point;
+}
+
+/**
+ * @brief Evaluates the corners of an object's u/v grid
+ *
+ * @return false if the grid has no cells
+ */
+static bool build_tessellation(Tessellation* tessellation, const ParametricObject3D* object){
+    TessellationKey key = tessellation_key(object);
+    int cells_u = (int)ceil((key.u_end - key.u_start) / key.u_step);
+    int cells_v = (int)ceil((key.v_end - key.v_start) / key.v_step);
+    if(!(cells_u >= 1 && cells_v >= 1)) return false;
+    int columns = cells_u + 1;
+    int rows = cells_v + 1;
+    size_t num_corners = (size_t)columns * rows;
+    *tessellation = (Tessellation){
+        .key=key,
+        .columns=columns,
+        .rows=rows,
+        .points=(Vector3*)malloc(sizeof(Vector3) * num_corners),
+        .normal_points=(Vector3*)malloc(sizeof(Vector3) * 3 * num_corners),
+        .displacements=(double*)malloc(sizeof(double) * num_corners),
+        .uvs=(Vector2*)malloc(sizeof(Vector2) * num_corners)
+    };
+    if(tessellation->points == NULL || tessellation->normal_points == NULL || tessellation->displacements == NULL || tessellation->uvs == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for parametric tessellation\n");
+        exit(1);
+    }
+
+    for(int i = 0; i < columns; i++){
+        double u = fmin(key.u_start + i * key.u_step, key.u_end);
+        for(int j = 0; j < rows; j++){
+            double v = fmin(key.v_start + j * key.v_step, key.v_end);
+            size_t index = (size_t)i * rows + j;
+            tessellation->points[index] = object_point(object, u, v, &tessellation->normal_points[3 * index], &tessellation->displacements[index]);
+            tessellation->uvs[index] = (Vector2){u, v};
+        }
+    }
+    return true;
+}
+
+static size_t tessellation_size(const Tessellation* tessellation){
+    return (size_t)tessellation->columns * tessellation->rows * (4 * sizeof(Vector3) + sizeof(double) + sizeof(Vector2));
+}
+
+/**
+ * @brief Drops every cached tessellation once they take more than TESSELLATION_CACHE_BYTES. Only called
+ * before a frame starts using the cache, so that tessellations are never freed in the middle of drawing
+ */
+static void trim_tessellation_cache(){
+    if(tessellation_bytes > TESSELLATION_CACHE_BYTES) clear_parametric_tessellations();
+}
+
+static Tessellation* find_cached_tessellation(const TessellationKey* key){
+    if(num_tessellation_slots == 0) return NULL;
+    uint64_t hash = hash_tessellation_key(key);
+    for(int slot = hash & (num_tessellation_slots - 1); tessellation_slots[slot] >= 0; slot = (slot + 1) & (num_tessellation_slots - 1)){
+        Tessellation* candidate = tessellations[tessellation_slots[slot]];
+        if(same_tessellation_key(&candidate->key, key)) return candidate;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Adds a tessellation to the cache, which takes ownership of it
+ *
+ * @param tessellation A tessellation allocated with malloc, not already cached
+ */
+static void cache_tessellation(Tessellation* tessellation){
+    if(num_tessellations == tessellations_capacity){
+        tessellations_capacity = tessellations_capacity > 0 ? 2 * tessellations_capacity : 16;
+        tessellations = (Tessellation**)realloc(tessellations, sizeof(Tessellation*) * tessellations_capacity);
+        if(tessellations == NULL){
+            fprintf(stderr, "Failed to allocate sufficient memory for parametric tessellation\n");
+            exit(1);
+        }
+    }
+    // The table stays at most half full
+    if(2 * (num_tessellations + 1) > num_tessellation_slots){
+        free(tessellation_slots);
+        num_tessellation_slots = num_tessellation_slots > 0 ? 2 * num_tessellation_slots : 32;
+        tessellation_slots = (int*)malloc(sizeof(int) * num_tessellation_slots);
+        if(tessellation_slots == NULL){
+            fprintf(stderr, "Failed to allocate sufficient memory for parametric tessellation\n");
+            exit(1);
+        }
+        for(int slot = 0; slot < num_tessellation_slots; slot++) tessellation_slots[slot] = -1;
+        for(int t = 0; t < num_tessellations; t++){
+            int slot = hash_tessellation_key(&tessellations[t]->key) & (num_tessellation_slots - 1);
+            while(tessellation_slots[slot] >= 0) slot = (slot + 1) & (num_tessellation_slots - 1);
+            tessellation_slots[slot] = t;
+        }
+    }
+    int slot = hash_tessellation_key(&tessellation->key) & (num_tessellation_slots - 1);
+    while(tessellation_slots[slot] >= 0) slot = (slot + 1) & (num_tessellation_slots - 1);
+    tessellation_slots[slot] = num_tessellations;
+    tessellations[num_tessellations++] = tessellation;
+    tessellation_bytes += tessellation_size(tessellation);
+}
+
+static Tessellation* allocate_tessellation(){
+    Tessellation* tessellation = (Tessellation*)malloc(sizeof(Tessellation));
+    if(tessellation == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for parametric tessellation\n");
+        exit(1);
+    }
+    return tessellation;
+}
+
+/**
+ * @brief Finds the cached tessellation of an object, tessellating it and caching the result if there is none
+ *
+ * @return NULL if the object's u/v grid has no cells
+ */
+static const Tessellation* cached_tessellation(const ParametricObject3D* object){
+    TessellationKey key = tessellation_key(object);
+    Tessellation* tessellation = find_cached_tessellation(&key);
+    if(tessellation != NULL) return tessellation;
+
+    tessellation = allocate_tessellation();
+    if(!build_tessellation(tessellation, object)){
+        free(tessellation);
+        return NULL;
+    }
+    cache_tessellation(tessellation);
+    return tessellation;
+}
+
+/**
+ * @brief The transforms that take an object's tessellation to the camera
+ */
+typedef struct {
+    double (*object_to_world)[4];
+    double (*world_to_camera)[4];
+} SampleTransforms;
+
+static SampleTransforms sample_transforms(ParametricObject3D* object, Camera* cam){
+    SampleTransforms transforms = {
+        .object_to_world=object->transform,
+        .world_to_camera=cam->view_matrix
+    };
+    return transforms;
+}
+
+static Vector3 sample_to_world_space(SampleTransforms* transforms, Vector3 point){
+    return mat4_mult_point(point, transforms->object_to_world);
+}
+
+static Vector3 sample_to_camera_space(SampleTransforms* transforms, Vector3 point){
+    return mat4_mult_point(point, transforms->world_to_camera);
+}
+
+/**
+ * @brief Gets a world space normal from the cross product of the world space tangents along u and v.
+ * It is only a unit vector where the tangents are perpendicular
+ *
+ * @param normal_points The object space points the normal is found from, as set by object_point
+ */
+static Vector3 normal_to_world_space(SampleTransforms* transforms, const Vector3 normal_points[3]){
+    Vector3 point = sample_to_world_space(transforms, normal_points[0]);
+    Vector3 tangent_a = vec3_normalized(vec3_sub(sample_to_world_space(transforms, normal_points[1]), point));
+    Vector3 tangent_b = vec3_normalized(vec3_sub(sample_to_world_space(transforms, normal_points[2]), point));
+    return vec3_cross_prod(tangent_a, tangent_b);
+}
+
+/**
+ * @brief Moves an object space point into the world, then along its world space normal
+ *
+ * @param normal_points The object space points the normal is found from, as set by object_point
+ * @param displacement How far the point is moved along its normal
+ */
+static Vector3 displaced_to_world_space(SampleTransforms* transforms, Vector3 point, const Vector3 normal_points[3], double displacement){
+    point = sample_to_world_space(transforms, point);
+    if(displacement == 0) return point;
+    return vec3_add(point, vec3_scale(normal_to_world_space(transforms, normal_points), displacement));
+}
+
+/**
+ * @brief Gets the color of a point of a surface in a view mode
+ *
+ * @param point The world space point at u, v
+ * @param normal The surface normal at the point, only read by the LIT and NORMAL modes
+ * @param normalized_z_dist The depth of the point from 0 at the near clip plane to 1 at the far one
+ */
+static Color3 shade_sample(const ParametricObject3D* object, Camera cam, PhongLight* lights, int num_lights,
+                           double u, double v, Vector3 point, Vector3 normal, double normalized_z_dist, enum ViewMode mode){
+    double u_range = object->u_end - object->u_start;
+    double v_range = object->v_end - object->v_start;
+    PhongMaterial material = object->material;
+    //Apply texture
+    if(!texture_is_null(material.texture_diffuse) && (mode == UNLIT || mode == LIT)){ // Width is 0 if NULL texture
+        Color3 tex_col = get_texture_color(material.texture_diffuse, texture_position(object, &material.texture_diffuse, u, v));
+        material.base_color = tex_col;
+        material.diffuse = tex_col;
+    }
+    switch(mode){
+        case UNLIT: return material.base_color;
+        case UV: return (Color3){u / u_range, v / v_range, 0};
+        case Z_BUFF: return (Color3){normalized_z_dist, normalized_z_dist, normalized_z_dist};
+        case NORMAL: return normal;
+        case LIT:
+            if(!texture_is_null(material.texture_specular)){
+                double spec_value = get_texture_color(material.texture_specular, texture_position(object, &material.texture_specular, u, v)).r; // Just use red channel
+                material.specular = vec3_scale(material.specular, spec_value);
+            }
+            return phong_lighting(point, normal, cam, material, lights, num_lights);
+    }
+    return material.base_color;
+}
+
+/**
+ * @brief The surface seen through each pixel by a deferred draw, kept until every object has been depth
+ * tested so that each pixel is shaded once
+ */
+typedef struct {
+    int width;
+    int height;
+    // The index among the objects being drawn of the one seen through each pixel, or -1 where none has been drawn
+    int* object_ids;
+    // Depth from 0 at the near clip plane to 1 at the far one
+    double* depths;
+    Vector3* positions;
+    Vector3* normals;
+    Vector2* uvs;
+} GBuffer;
+
+static GBuffer new_gbuffer(int width, int height){
+    size_t num_pixels = (size_t)width * height;
+    GBuffer gbuffer = {
+        .width=width,
+        .height=height,
+        .object_ids=(int*)malloc(sizeof(int) * num_pixels),
+        .depths=(double*)malloc(sizeof(double) * num_pixels),
+        .positions=(Vector3*)malloc(sizeof(Vector3) * num_pixels),
+        .normals=(Vector3*)malloc(sizeof(Vector3) * num_pixels),
+        .uvs=(Vector2*)malloc(sizeof(Vector2) * num_pixels)
+    };
+    if(gbuffer.object_ids == NULL || gbuffer.depths == NULL || gbuffer.positions == NULL || gbuffer.normals == NULL || gbuffer.uvs == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for G-buffer\n");
+        exit(1);
+    }
+    for(size_t i = 0; i < num_pixels; i++) gbuffer.object_ids[i] = -1;
+    return gbuffer;
+}
+
+static void delete_gbuffer(GBuffer* gbuffer){
+    free(gbuffer->object_ids);
+    free(gbuffer->depths);
+    free(gbuffer->positions);
+    free(gbuffer->normals);
+    free(gbuffer->uvs);
+}
+
+/**
+ * @brief Where the pixels of a surface are drawn: straight to FPToolkit, or into a framebuffer from one of
+ * the threads drawing it a tile at a time. Pixels outside the target's rectangle are left alone
+ */
+typedef struct {
+    // NULL draws with FPToolkit
+    Framebuffer* framebuffer;
+    int x_start;
+    int y_start;
+    // Exclusive
+    int x_end;
+    int y_end;
+    // If not NULL, samples passing the depth test are recorded here to be shaded later instead of shaded now
+    GBuffer* gbuffer;
+    // The index of the object being drawn, recorded in the G-buffer
+    int object_id;
+} DrawTarget;
+
+static void draw_target_pixel(const DrawTarget* target, int x, int y, Color3 color){
+    if(target->framebuffer != NULL){
+        framebuffer_set_pixel(target->framebuffer, x, y, color);
+        return;
+    }
+    G_rgb(SPREAD_COL3(color));
+    G_pixel(x, y);
+}
+
+/**
+ * @brief Draws a sample of a surface that passed the depth test, or records it in the target's G-buffer.
+ * The arguments are those of shade_sample
+ */
+static void draw_target_sample(const DrawTarget* target, const ParametricObject3D* object, Camera cam,
+                               PhongLight* lights, int num_lights, int x, int y,
+                               double u, double v, Vector3 point, Vector3 normal, double normalized_z_dist, enum ViewMode mode){
+    GBuffer* gbuffer = target->gbuffer;
+    if(gbuffer == NULL){
+        draw_target_pixel(target, x, y, shade_sample(object, cam, lights, num_lights, u, v, point, normal, normalized_z_dist, mode));
+        return;
+    }
+    int i = y * gbuffer->width + x;
+    gbuffer->object_ids[i] = target->object_id;
+    gbuffer->depths[i] = normalized_z_dist;
+    gbuffer->positions[i] = point;
+    gbuffer->normals[i] = normal;
+    gbuffer->uvs[i] = (Vector2){u, v};
+}
+
+/**
+ * @brief Shades every pixel of a target's rectangle that its G-buffer saw a surface through. Each pixel
+ * gets the color its last recorded sample would have been drawn with, so deferred shading draws exactly
+ * what shading every sample would
+ *
+ * @param objects The objects the G-buffer's object indices refer to
+ */
+static void resolve_gbuffer(const DrawTarget* target, const ParametricObject3D* objects, Camera cam,
+                            PhongLight* lights, int num_lights, enum ViewMode mode){
+    GBuffer* gbuffer = target->gbuffer;
+    for(int y = target->y_start; y < target->y_end; y++){
+        for(int x = target->x_start; x < target->x_end; x++){
+            int i = y * gbuffer->width + x;
+            if(gbuffer->object_ids[i] < 0) continue;
+            Color3 color = shade_sample(&objects[gbuffer->object_ids[i]], cam, lights, num_lights, gbuffer->uvs[i].x, gbuffer->uvs[i].y,
+                                        gbuffer->positions[i], gbuffer->normals[i], gbuffer->depths[i], mode);
+            draw_target_pixel(target, x, y, color);
+        }
+    }
+}
+
+/**
+ * @brief A corner of the triangles a surface is tessellated into, moved into the world
+ */
+typedef struct {
+    double u;
+    double v;
+    Vector3 point;
+    Vector3 normal;
+    // Where the corner lands in the window, and 1 over its camera space depth
+    Vector2 window;
+    double inverse_z;
+    // Whether the corner is in front of the near clip plane
+    bool in_front;
+} SurfaceVertex;
+
+static SurfaceVertex surface_vertex(const Tessellation* tessellation, size_t index, SampleTransforms* transforms,
+                                    Camera cam, int width, int height){
+    SurfaceVertex vertex = {
+        .u=tessellation->uvs[index].x,
+        .v=tessellation->uvs[index].y,
+        .normal=normal_to_world_space(transforms, &tessellation->normal_points[3 * index])
+    };
+    vertex.point = sample_to_world_space(transforms, tessellation->points[index]);
+    if(tessellation->displacements[index] != 0) vertex.point = vec3_add(vertex.point, vec3_scale(vertex.normal, tessellation->displacements[index]));
+    Vector3 camera_point = sample_to_camera_space(transforms, vertex.point);
+    vertex.in_front = camera_point.z >= cam.near_clip_plane;
+    if(vertex.in_front){
+        vertex.window = to_window_coordinates(to_camera_screen_space(camera_point, cam), width, height);
+        vertex.inverse_z = 1 / camera_point.z;
+    }
+    return vertex;
+}
+
+static double edge_function(Vector2 a, Vector2 b, Vector2 p){
+    return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+/**
+ * @brief Gets the range of pixels whose centers lie within the bounding box of a triangle in the window.
+ * Tiny triangles get an empty range when they fall between pixel centers
+ */
+static void triangle_pixel_bounds(const SurfaceVertex* a, const SurfaceVertex* b, const SurfaceVertex* c,
+                                  int* x_start, int* x_end, int* y_start, int* y_end){
+    double x_low = fmin(a->window.x, fmin(b->window.x, c->window.x));
+    double x_high = fmax(a->window.x, fmax(b->window.x, c->window.x));
+    double y_low = fmin(a->window.y, fmin(b->window.y, c->window.y));
+    double y_high = fmax(a->window.y, fmax(b->window.y, c->window.y));
+    // Clamped before converting, so that triangles far off screen do not overflow
+    *x_start = (int)fmax(ceil(x_low - 0.5), -1);
+    *x_end = (int)fmin(floor(x_high - 0.5), INT_MAX / 2);
+    *y_start = (int)fmax(ceil(y_low - 0.5), -1);
+    *y_end = (int)fmin(floor(y_high - 0.5), INT_MAX / 2);
+}
+
+/**
+ * @brief Scan converts a triangle of a tessellated surface, shading every pixel whose center it covers
+ * and that passes the z-test. Depth, position, normal and u/v are interpolated perspective correctly
+ * by interpolating them over z and 1/z linearly across the window. Triangles that cross the near clip
+ * plane are dropped
+ */
+static void rasterize_surface_triangle(const ParametricObject3D* object, const SurfaceVertex* a, const SurfaceVertex* b,
+                                       const SurfaceVertex* c, Camera cam, PhongLight* lights, int num_lights,
+                                       int width, int height, double z_buffer[width][height], enum ViewMode mode,
+                                       const DrawTarget* target){
+    if(!a->in_front || !b->in_front || !c->in_front) return;
+    double area = edge_function(a->window, b->window, c->window);
+    if(fabs(area) < 1e-12) return;
+
+    int x_start, x_end, y_start, y_end;
+    triangle_pixel_bounds(a, b, c, &x_start, &x_end, &y_start, &y_end);
+    x_start = x_start > target->x_start ? x_start : target->x_start;
+    x_end = x_end < target->x_end - 1 ? x_end : target->x_end - 1;
+    y_start = y_start > target->y_start ? y_start : target->y_start;
+    y_end = y_end < target->y_end - 1 ? y_end : target->y_end - 1;
+    double depth_range = cam.far_clip_plane - cam.near_clip_plane;
+
+    for(int y = y_start; y <= y_end; y++){
+        for(int x = x_start; x <= x_end; x++){
+            Vector2 center = {x + 0.5, y + 0.5};
+            // Dividing by the signed area makes the weights positive inside whichever way the triangle winds
+            double weight_a = edge_function(b->window, c->window, center) / area;
+            double weight_b = edge_function(c->window, a->window, center) / area;
+            double weight_c = edge_function(a->window, b->window, center) / area;
+            if(weight_a < 0 || weight_b < 0 || weight_c < 0) continue;
+
+            double z = 1 / (weight_a * a->inverse_z + weight_b * b->inverse_z + weight_c * c->inverse_z);
+            double normalized_z_dist = (z - cam.near_clip_plane) / depth_range;
+            if(normalized_z_dist < 0 || normalized_z_dist > 1) continue;
+            if(normalized_z_dist > z_buffer[x][y]) continue;
+            z_buffer[x][y] = normalized_z_dist;
+
+            // The screen space weights turned into weights over the surface
+            double surface_a = weight_a * a->inverse_z * z;
+            double surface_b = weight_b * b->inverse_z * z;
+            double surface_c = weight_c * c->inverse_z * z;
+            double u = surface_a * a->u + surface_b * b->u + surface_c * c->u;
+            double v = surface_a * a->v + surface_b * b->v + surface_c * c->v;
+            Vector3 point = vec3_add(vec3_add(vec3_scale(a->point, surface_a), vec3_scale(b->point, surface_b)), vec3_scale(c->point, surface_c));
+            Vector3 normal = vec3_add(vec3_add(vec3_scale(a->normal, surface_a), vec3_scale(b->normal, surface_b)), vec3_scale(c->normal, surface_c));
+            if(mode == LIT || mode == NORMAL) normal = vec3_normalized(normal);
+
+            draw_target_sample(target, object, cam, lights, num_lights, x, y, u, v, point, normal, normalized_z_dist, mode);
+        }
+    }
+}
+
+/**
+ * @brief Draws a tessellated object as the triangles of its u/v grid
+ */
+static void draw_parametric_triangles(ParametricObject3D* object, const Tessellation* tessellation, Camera cam,
+                                      PhongLight* lights, int num_lights,
+                                      int width, int height, double z_buffer[width][height], enum ViewMode mode,
+                                      const DrawTarget* target){
+    SampleTransforms transforms = sample_transforms(object, &cam);
+    int rows = tessellation->rows;
+    // Corners are moved into the world a column of constant u at a time, and each pair of columns makes a strip of cells
+    SurfaceVertex* columns = (SurfaceVertex*)malloc(sizeof(SurfaceVertex) * 2 * rows);
+    if(columns == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for parametric triangles\n");
+        exit(1);
+    }
+    SurfaceVertex* previous = columns;
+    SurfaceVertex* current = columns + rows;
+    for(int i = 0; i < tessellation->columns; i++){
+        for(int j = 0; j < rows; j++) current[j] = surface_vertex(tessellation, (size_t)i * rows + j, &transforms, cam, width, height);
+        if(i > 0){
+            for(int j = 0; j < rows - 1; j++){
+                rasterize_surface_triangle(object, &previous[j], &current[j], &current[j + 1], cam, lights, num_lights, width, height, z_buffer, mode, target);
+                rasterize_surface_triangle(object, &previous[j], &current[j + 1], &previous[j + 1], cam, lights, num_lights, width, height, z_buffer, mode, target);
+            }
+        }
+        SurfaceVertex* swap = previous;
+        previous = current;
+        current = swap;
+    }
+    free(columns);
+}
+
+/**
+ * @brief Plots one sample of a surface as a pixel, if it is in view and passes the z-test
+ *
+ * @param point The world space point at u, v
+ * @param camera_point The point in camera space
+ * @param normal_points The object space points the normal at the point is found from, as set by object_point
+ */
+static void plot_sample(const ParametricObject3D* object, SampleTransforms* transforms, Camera cam,
+                        PhongLight* lights, int num_lights, int width, int height, double z_buffer[width][height],
+                        enum ViewMode mode, const DrawTarget* target,
+                        double u, double v, Vector3 point, Vector3 camera_point, const Vector3 normal_points[3]){
+    if(!is_visible_to_camera(cam, camera_point)) return; //Cull point if not visible
+    
+    double normalized_z_dist = (camera_point.z - cam.near_clip_plane) / (cam.far_clip_plane - cam.near_clip_plane);
+    Vector2 pixel_location = to_window_coordinates(to_camera_screen_space(camera_point, cam), width, height);
+    int x = (int)pixel_location.x;
+    int y = (int)pixel_location.y;
+    if(x < target->x_start || x >= target->x_end || y < target->y_start || y >= target->y_end) return;
+    
+    if(normalized_z_dist >  z_buffer[x][y]) return;
+
+    z_buffer[x][y] = normalized_z_dist;
+
+    Vector3 normal = {0, 0, 0};
+    bool normal_is_calculated = false;
+    if(BACKFACE_CULLING){ //TODO: Make this more optimized. View vector can be reused in phong lighting.
+        normal = normal_to_world_space(transforms, normal_points);
+        normal_is_calculated = true;
+        Vector3 view_vec = vec3_normalized(vec3_sub(cam.eye, point));
+        if(vec3_dot_prod(normal, view_vec) < 0) {
+            return; //cull if cant see
+        } 
+    }
+    if(!normal_is_calculated && (mode == LIT || mode == NORMAL)) normal = normal_to_world_space(transforms, normal_points);
+    draw_target_sample(target, object, cam, lights, num_lights, x, y, u, v, point, normal, normalized_z_dist, mode);
+}
+
+/**
+ * @brief Draws a tessellated object as one pixel per corner, leaving out the corners on u_end and v_end
+ */
+static void draw_parametric_samples(ParametricObject3D* object, const Tessellation* tessellation, Camera cam,
+                                    PhongLight* lights, int num_lights,
+                                    int width, int height, double z_buffer[width][height], enum ViewMode mode,
+                                    const DrawTarget* target){
+    SampleTransforms transforms = sample_transforms(object, &cam);
+    int rows = tessellation->rows;
+    for(int i = 0; i < tessellation->columns - 1; i++){
+        for(int j = 0; j < rows - 1; j++){
+            size_t index = (size_t)i * rows + j;
+            const Vector3* normal_points = &tessellation->normal_points[3 * index];
+            Vector3 point = displaced_to_world_space(&transforms, tessellation->points[index], normal_points, tessellation->displacements[index]);
+            Vector3 camera_point = sample_to_camera_space(&transforms, point);
+            Vector2 uv = tessellation->uvs[index];
+            plot_sample(object, &transforms, cam, lights, num_lights, width, height, z_buffer, mode, target,
+                        uv.x, uv.y, point, camera_point, normal_points);
+        }
+    }
+}
+
+/**
+ * @brief A corner of a patch of the u/v domain, moved into the world and projected into the window
+ */
+typedef struct {
+    double u;
+    double v;
+    Vector3 point;
+    Vector3 camera_point;
+    // The object space points the normal is found from, as set by object_point
+    Vector3 normal_points[3];
+    Vector2 window;
+    // Whether the corner is in front of the near clip plane. The window position is only set if it is
+    bool in_front;
+} PatchCorner;
+
+/**
+ * @param object_space_point The point before displacement
+ * @param normal_points The points the normal is found from, as set by object_point
+ * @param displacement How far the point is moved along its normal
+ */
+static PatchCorner patch_corner(Vector3 object_space_point, const Vector3 normal_points[3], double displacement, double u, double v,
+                                SampleTransforms* transforms, Camera cam, int width, int height){
+    PatchCorner corner = {.u=u, .v=v, .normal_points={normal_points[0], normal_points[1], normal_points[2]}};
+    corner.point = displaced_to_world_space(transforms, object_space_point, normal_points, displacement);
+    corner.camera_point = sample_to_camera_space(transforms, corner.point);
+    corner.in_front = corner.camera_point.z >= cam.near_clip_plane;
+    if(corner.in_front) corner.window = to_window_coordinates(to_camera_screen_space(corner.camera_point, cam), width, height);
+    return corner;
+}
+
+static PatchCorner evaluate_patch_corner(const ParametricObject3D* object, double u, double v,
+                                         SampleTransforms* transforms, Camera cam, int width, int height){
+    Vector3 normal_points[3];
+    double displacement;
+    Vector3 point = object_point(object, u, v, normal_points, &displacement);
+    return patch_corner(point, normal_points, displacement, u, v, transforms, cam, width, height);
+}
+
+/**
+ * @brief A growing list of the surface samples an object is drawn with, in the order they are drawn
+ */
+typedef struct {
+    PatchCorner* samples;
+    int num_samples;
+    int capacity;
+} SampleList;
+
+static void add_sample(SampleList* list, const PatchCorner* sample){
+    if(list->num_samples == list->capacity){
+        list->capacity = list->capacity > 0 ? 2 * list->capacity : 1024;
+        list->samples = (PatchCorner*)realloc(list->samples, sizeof(PatchCorner) * list->capacity);
+        if(list->samples == NULL){
+            fprintf(stderr, "Failed to allocate sufficient memory for parametric samples\n");
+            exit(1);
+        }
+    }
+    list->samples[list->num_samples++] = *sample;
+}
+
+static double window_distance(const PatchCorner* a, const PatchCorner* b){
+    return vec2_magnitude(vec2_sub(a->window, b->window));
+}
+
+/**
+ * @brief Samples a patch of the u/v domain, halving it along u and v until its edges are at most about
+ * ADAPTIVE_SAMPLE_SPACING pixels long on screen, then taking the corner at its lowest u and v. Patches
+ * crossing the near clip plane are halved until they are in front or behind it, and patches entirely out
+ * of the window are dropped
+ *
+ * @param corners The corners at (u0, v0), (u1, v0), (u0, v1) and (u1, v1)
+ * @param depth_u How many times the root patch has been halved along u
+ * @param depth_v How many times the root patch has been halved along v
+ * @param samples The list the samples are added to
+ */
+static void sample_patch(const ParametricObject3D* object, const PatchCorner corners[4], int depth_u, int depth_v,
+                         SampleTransforms* transforms, Camera cam, int width, int height, SampleList* samples){
+    int num_in_front = corners[0].in_front + corners[1].in_front + corners[2].in_front + corners[3].in_front;
+    if(num_in_front == 0) return;
+
+    bool split_u, split_v;
+    if(num_in_front == 4){
+        // The longest of the projected edges along u and along v estimate how far a step in u or v moves on screen
+        double u_length = fmax(window_distance(&corners[0], &corners[1]), window_distance(&corners[2], &corners[3]));
+        double v_length = fmax(window_distance(&corners[0], &corners[2]), window_distance(&corners[1], &corners[3]));
+        // A curved patch can bulge out past its corners, by about as much as its edges are long
+        double margin = fmax(u_length, v_length);
+        Vector2 low = corners[0].window, high = corners[0].window;
+        for(int c = 1; c < 4; c++){
+            low = (Vector2){fmin(low.x, corners[c].window.x), fmin(low.y, corners[c].window.y)};
+            high = (Vector2){fmax(high.x, corners[c].window.x), fmax(high.y, corners[c].window.y)};
+        }
+        if(high.x + margin < 0 || high.y + margin < 0 || low.x - margin > width || low.y - margin > height) return;
+        split_u = u_length > ADAPTIVE_SAMPLE_SPACING && depth_u < ADAPTIVE_MAX_DEPTH;
+        split_v = v_length > ADAPTIVE_SAMPLE_SPACING && depth_v < ADAPTIVE_MAX_DEPTH;
+    }
+    else {
+        split_u = depth_u < ADAPTIVE_MAX_DEPTH;
+        split_v = depth_v < ADAPTIVE_MAX_DEPTH;
+    }
+
+    if(!split_u && !split_v){
+        if(is_visible_to_camera(cam, corners[0].camera_point)) add_sample(samples, &corners[0]);
+        return;
+    }
+
+    double u_middle = (corners[0].u + corners[1].u) / 2;
+    double v_middle = (corners[0].v + corners[2].v) / 2;
+    if(split_u && split_v){
+        PatchCorner bottom = evaluate_patch_corner(object, u_middle, corners[0].v, transforms, cam, width, height);
+        PatchCorner top = evaluate_patch_corner(object, u_middle, corners[2].v, transforms, cam, width, height);
+        PatchCorner left = evaluate_patch_corner(object, corners[0].u, v_middle, transforms, cam, width, height);
+        PatchCorner right = evaluate_patch_corner(object, corners[1].u, v_middle, transforms, cam, width, height);
+        PatchCorner center = evaluate_patch_corner(object, u_middle, v_middle, transforms, cam, width, height);
+        PatchCorner children[4][4] = {
+            {corners[0], bottom, left, center},
+            {bottom, corners[1], center, right},
+            {left, center, corners[2], top},
+            {center, right, top, corners[3]}
+        };
+        for(int c = 0; c < 4; c++){
+            sample_patch(object, children[c], depth_u + 1, depth_v + 1, transforms, cam, width, height, samples);
+        }
+    }
+    else if(split_u){
+        PatchCorner bottom = evaluate_patch_corner(object, u_middle, corners[0].v, transforms, cam, width, height);
+        PatchCorner top = evaluate_patch_corner(object, u_middle, corners[2].v, transforms, cam, width, height);
+        PatchCorner children[2][4] = {
+            {corners[0], bottom, corners[2], top},
+            {bottom, corners[1], top, corners[3]}
+        };
+        for(int c = 0; c < 2; c++){
+            sample_patch(object, children[c], depth_u + 1, depth_v, transforms, cam, width, height, samples);
+        }
+    }
+    else {
+        PatchCorner left = evaluate_patch_corner(object, corners[0].u, v_middle, transforms, cam, width, height);
+        PatchCorner right = evaluate_patch_corner(object, corners[1].u, v_middle, transforms, cam, width, height);
+        PatchCorner children[2][4] = {
+            {corners[0], corners[1], left, right},
+            {left, right, corners[2], corners[3]}
+        };
+        for(int c = 0; c < 2; c++){
+            sample_patch(object, children[c], depth_u, depth_v + 1, transforms, cam, width, height, samples);
+        }
+    }
+}
+
+/**
+ * @brief Samples an object with the samples spaced about a pixel apart on screen. The root patches are
+ * the cells of a coarse tessellation, split further each frame as the view needs
+ *
+ * @param roots A tessellation of the object with ADAPTIVE_ROOT_PATCHES cells along u and v
+ * @param samples The list the samples are added to
+ */
+static void collect_adaptive_samples(ParametricObject3D* object, const Tessellation* roots, SampleTransforms* transforms,
+                                     Camera cam, int width, int height, SampleList* samples){
+    int rows = roots->rows;
+    for(int i = 0; i < roots->columns - 1; i++){
+        for(int j = 0; j < rows - 1; j++){
+            PatchCorner corners[4];
+            size_t indices[4] = {(size_t)i * rows + j, (size_t)(i + 1) * rows + j, (size_t)i * rows + j + 1, (size_t)(i + 1) * rows + j + 1};
+            for(int c = 0; c < 4; c++){
+                size_t index = indices[c];
+                corners[c] = patch_corner(roots->points[index], &roots->normal_points[3 * index], roots->displacements[index],
+                                          roots->uvs[index].x, roots->uvs[index].y, transforms, cam, width, height);
+            }
+            sample_patch(object, corners, 0, 0, transforms, cam, width, height, samples);
+        }
+    }
+}
+
+/**
+ * @brief Draws an object as one pixel per sample, with the samples spaced about a pixel apart on screen
+ */
+static void draw_adaptive_parametric_samples(ParametricObject3D* object, const Tessellation* roots, Camera cam,
+                                             PhongLight* lights, int num_lights,
+                                             int width, int height, double z_buffer[width][height], enum ViewMode mode,
+                                             const DrawTarget* target){
+    SampleTransforms transforms = sample_transforms(object, &cam);
+    SampleList samples = {NULL, 0, 0};
+    collect_adaptive_samples(object, roots, &transforms, cam, width, height, &samples);
+    for(int s = 0; s < samples.num_samples; s++){
+        PatchCorner* sample = &samples.samples[s];
+        plot_sample(object, &transforms, cam, lights, num_lights, width, height, z_buffer, mode, target,
+                    sample->u, sample->v, sample->point, sample->camera_point, sample->normal_points);
+    }
+    free(samples.samples);
+}
+
+/**
+ * @brief Gets the object whose tessellation an object is drawn from. Adaptive sampling only tessellates
+ * the root patches, and refines them to suit the view
+ */
+static ParametricObject3D tessellated_object(const ParametricObject3D* object, bool adaptive){
+    ParametricObject3D tessellated = *object;
+    if(adaptive){
+        tessellated.u_step = (object->u_end - object->u_start) / ADAPTIVE_ROOT_PATCHES;
+        tessellated.v_step = (object->v_end - object->v_start) / ADAPTIVE_ROOT_PATCHES;
+    }
+    return tessellated;
+}
+
+static void draw_parametric_object_serial(ParametricObject3D* object, Camera cam, PhongLight* lights, int num_lights,
+                                          int width, int height, double z_buffer[width][height], enum ViewMode mode,
+                                          const DrawTarget* target){
+    bool adaptive = ADAPTIVE_PARAMETRIC_SAMPLING && !RASTERIZE_PARAMETRIC_TRIANGLES;
+    ParametricObject3D tessellated = tessellated_object(object, adaptive);
+
+    // Without the cache the object is tessellated again every frame
+    Tessellation uncached;
+    const Tessellation* tessellation;
+    if(USE_TESSELLATION_CACHE){
+        trim_tessellation_cache();
+        tessellation = cached_tessellation(&tessellated);
+    }
+    else tessellation = build_tessellation(&uncached, &tessellated) ? &uncached : NULL;
+    if(tessellation == NULL) return;
+
+    if(RASTERIZE_PARAMETRIC_TRIANGLES) draw_parametric_triangles(object, tessellation, cam, lights, num_lights, width, height, z_buffer, mode, target);
+    else if(adaptive) draw_adaptive_parametric_samples(object, tessellation, cam, lights, num_lights, width, height, z_buffer, mode, target);
+    else draw_parametric_samples(object, tessellation, cam, lights, num_lights, width, height, z_buffer, mode, target);
+    if(!USE_TESSELLATION_CACHE) free_tessellation(&uncached);
+}
+
+// 1 draws on the calling thread, 0 uses every core
+int PARAMETRIC_THREADS = 1;
+static ThreadPool* parametric_pool = NULL;
+#define PARAMETRIC_TILE_SIZE 32
+
+static ThreadPool* get_parametric_pool(){
+    int num_threads = PARAMETRIC_THREADS > 0 ? PARAMETRIC_THREADS : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(parametric_pool != NULL && threadpool_num_threads(parametric_pool) != num_threads){
+        threadpool_delete(parametric_pool);
+        parametric_pool = NULL;
+    }
+    if(parametric_pool == NULL) parametric_pool = threadpool_create(num_threads);
+    return parametric_pool;
+}
+
+void set_parametric_threads(int num_threads){ PARAMETRIC_THREADS = num_threads; }
+
+/**
+ * @brief The indices of the primitives of an object that touch a tile
+ */
+typedef struct {
+    int* entries;
+    int num_entries;
+    int capacity;
+} TileBin;
+
+static void add_tile_entry(TileBin* bin, int primitive){
+    if(bin->num_entries == bin->capacity){
+        bin->capacity = bin->capacity > 0 ? 2 * bin->capacity : 64;
+        bin->entries = (int*)realloc(bin->entries, sizeof(int) * bin->capacity);
+        if(bin->entries == NULL){
+            fprintf(stderr, "Failed to allocate sufficient memory for parametric tiles\n");
+            exit(1);
+        }
+    }
+    bin->entries[bin->num_entries++] = primitive;
+}
+
+/**
+ * @brief The primitives of one object, binned into the tiles they touch
+ */
+typedef struct {
+    ParametricObject3D* object;
+    const Tessellation* tessellation;
+    SampleTransforms transforms;
+    // The corners of the tessellation moved into the world, when drawing triangles
+    SurfaceVertex* vertices;
+    // The samples, when sampling adaptively. Other samples are the corners of the tessellation
+    SampleList samples;
+    // The primitives touching each tile, in the order they are drawn. NULL if the object has nothing to draw
+    TileBin* tiles;
+} ObjectBins;
+
+/**
+ * @brief A frame of parametric objects drawn a tile at a time. Each tile is drawn by one thread, which
+ * goes through the primitives binned into it in the same order as drawing serially does, so the depth
+ * test and shading of its pixels need no locks and give exactly the serial result
+ */
+typedef struct {
+    ParametricObject3D* objects;
+    ObjectBins* bins;
+    int num_objs;
+    Camera cam;
+    PhongLight* lights;
+    int num_lights;
+    int width;
+    int height;
+    // The caller's z_buffer[width][height]
+    double* z_buffer;
+    enum ViewMode mode;
+    bool adaptive;
+    // NULL unless shading is deferred
+    GBuffer* gbuffer;
+    int tiles_x;
+    int tiles_y;
+    Framebuffer framebuffer;
+    // The objects to tessellate, and the tessellations built from them
+    ParametricObject3D* to_tessellate;
+    Tessellation** built;
+} ParametricJob;
+
+static void build_tessellation_task(void* context, int task, int thread){
+    ParametricJob* job = (ParametricJob*)context;
+    Tessellation* tessellation = allocate_tessellation();
+    if(!build_tessellation(tessellation, &job->to_tessellate[task])){
+        free(tessellation);
+        tessellation = NULL;
+    }
+    job->built[task] = tessellation;
+}
+
+/**
+ * @brief Gets one of the two triangles of each cell of an object's tessellation, in the order
+ * draw_parametric_triangles draws them
+ */
+static void triangle_vertices(const ObjectBins* bins, int triangle,
+                              const SurfaceVertex** a, const SurfaceVertex** b, const SurfaceVertex** c){
+    int rows = bins->tessellation->rows;
+    int cell = triangle / 2;
+    int j = cell % (rows - 1);
+    const SurfaceVertex* previous = bins->vertices + (size_t)(cell / (rows - 1)) * rows;
+    const SurfaceVertex* current = previous + rows;
+    *a = &previous[j];
+    if(triangle % 2 == 0){
+        *b = &current[j];
+        *c = &current[j + 1];
+    }
+    else {
+        *b = &current[j + 1];
+        *c = &previous[j + 1];
+    }
+}
+
+/**
+ * @brief Gets the corner of a tessellation that is its nth sample when drawn one pixel per sample
+ */
+static size_t tessellation_sample_index(const Tessellation* tessellation, int sample){
+    return (size_t)(sample / (tessellation->rows - 1)) * tessellation->rows + sample % (tessellation->rows - 1);
+}
+
+/**
+ * @brief Gets a sample of an object drawn one pixel per sample, either one found adaptively or a corner of
+ * its tessellation. Corners are moved into the world again every time, which is cheaper than keeping them
+ */
+static PatchCorner object_sample(const ParametricJob* job, ObjectBins* bins, int primitive){
+    if(job->adaptive) return bins->samples.samples[primitive];
+    const Tessellation* tessellation = bins->tessellation;
+    size_t index = tessellation_sample_index(tessellation, primitive);
+    return patch_corner(tessellation->points[index], &tessellation->normal_points[3 * index], tessellation->displacements[index],
+                        tessellation->uvs[index].x, tessellation->uvs[index].y, &bins->transforms, job->cam, job->width, job->height);
+}
+
+/**
+ * @brief Adds a primitive of an object to the bins of the tiles holding pixels it can draw
+ */
+static void bin_primitive(const ParametricJob* job, ObjectBins* bins, int primitive){
+    int x_start, x_end, y_start, y_end;
+    if(RASTERIZE_PARAMETRIC_TRIANGLES){
+        const SurfaceVertex *a, *b, *c;
+        triangle_vertices(bins, primitive, &a, &b, &c);
+        if(!a->in_front || !b->in_front || !c->in_front) return;
+        if(fabs(edge_function(a->window, b->window, c->window)) < 1e-12) return;
+        triangle_pixel_bounds(a, b, c, &x_start, &x_end, &y_start, &y_end);
+        x_start = x_start > 0 ? x_start : 0;
+        x_end = x_end < job->width - 1 ? x_end : job->width - 1;
+        y_start = y_start > 0 ? y_start : 0;
+        y_end = y_end < job->height - 1 ? y_end : job->height - 1;
+        if(x_start > x_end || y_start > y_end) return;
+    }
+    else {
+        PatchCorner sample = object_sample(job, bins, primitive);
+        if(!is_visible_to_camera(job->cam, sample.camera_point)) return;
+        x_start = x_end = (int)sample.window.x;
+        y_start = y_end = (int)sample.window.y;
+        if(x_start < 0 || x_start >= job->width || y_start < 0 || y_start >= job->height) return;
+    }
+    for(int ty = y_start / PARAMETRIC_TILE_SIZE; ty <= y_end / PARAMETRIC_TILE_SIZE; ty++){
+        for(int tx = x_start / PARAMETRIC_TILE_SIZE; tx <= x_end / PARAMETRIC_TILE_SIZE; tx++){
+            add_tile_entry(&bins->tiles[ty * job->tiles_x + tx], primitive);
+        }
+    }
+}
+
+/**
+ * @brief Moves an object's tessellation into the world, sets up its samples or triangles, and bins them into tiles
+ */
+static void bin_object_task(void* context, int o, int thread){
+    ParametricJob* job = (ParametricJob*)context;
+    ObjectBins* bins = &job->bins[o];
+    const Tessellation* tessellation = bins->tessellation;
+    if(tessellation == NULL) return;
+    bins->transforms = sample_transforms(bins->object, &job->cam);
+    bins->tiles = (TileBin*)calloc(job->tiles_x * job->tiles_y, sizeof(TileBin));
+    if(bins->tiles == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for parametric tiles\n");
+        exit(1);
+    }
+
+    int num_primitives;
+    int rows = tessellation->rows;
+    if(RASTERIZE_PARAMETRIC_TRIANGLES){
+        bins->vertices = (SurfaceVertex*)malloc(sizeof(SurfaceVertex) * tessellation->columns * rows);
+        if(bins->vertices == NULL){
+            fprintf(stderr, "Failed to allocate sufficient memory for parametric triangles\n");
+            exit(1);
+        }
+        for(size_t index = 0; index < (size_t)tessellation->columns * rows; index++){
+            bins->vertices[index] = surface_vertex(tessellation, index, &bins->transforms, job->cam, job->width, job->height);
+        }
+        num_primitives = 2 * (tessellation->columns - 1) * (rows - 1);
+    }
+    else if(job->adaptive){
+        collect_adaptive_samples(bins->object, tessellation, &bins->transforms, job->cam, job->width, job->height, &bins->samples);
+        num_primitives = bins->samples.num_samples;
+    }
+    else num_primitives = (tessellation->columns - 1) * (rows - 1);
+
+    for(int p = 0; p < num_primitives; p++) bin_primitive(job, bins, p);
+}
+
+static void draw_tile_task(void* context, int tile, int thread){
+    ParametricJob* job = (ParametricJob*)context;
+    int x_start = (tile % job->tiles_x) * PARAMETRIC_TILE_SIZE;
+    int y_start = (tile / job->tiles_x) * PARAMETRIC_TILE_SIZE;
+    DrawTarget target = {
+        .framebuffer=&job->framebuffer,
+        .x_start=x_start,
+        .y_start=y_start,
+        .x_end=x_start + PARAMETRIC_TILE_SIZE < job->width ? x_start + PARAMETRIC_TILE_SIZE : job->width,
+        .y_end=y_start + PARAMETRIC_TILE_SIZE < job->height ? y_start + PARAMETRIC_TILE_SIZE : job->height,
+        .gbuffer=job->gbuffer
+    };
+    int width = job->width, height = job->height;
+    double (*z_buffer)[height] = (double (*)[height])job->z_buffer;
+
+    for(int o = 0; o < job->num_objs; o++){
+        ObjectBins* bins = &job->bins[o];
+        if(bins->tiles == NULL) continue;
+        target.object_id = o;
+        TileBin* bin = &bins->tiles[tile];
+        for(int e = 0; e < bin->num_entries; e++){
+            int primitive = bin->entries[e];
+            if(RASTERIZE_PARAMETRIC_TRIANGLES){
+                const SurfaceVertex *a, *b, *c;
+                triangle_vertices(bins, primitive, &a, &b, &c);
+                rasterize_surface_triangle(bins->object, a, b, c, job->cam, job->lights, job->num_lights,
+                                           width, height, z_buffer, job->mode, &target);
+            }
+            else if(job->adaptive){
+                PatchCorner* sample = &bins->samples.samples[primitive];
+                plot_sample(bins->object, &bins->transforms, job->cam, job->lights, job->num_lights,
+                            width, height, z_buffer, job->mode, &target,
+                            sample->u, sample->v, sample->point, sample->camera_point, sample->normal_points);
+            }
+            else {
+                // plot_sample projects the corner itself
+                const Tessellation* tessellation = bins->tessellation;
+                size_t index = tessellation_sample_index(tessellation, primitive);
+                const Vector3* normal_points = &tessellation->normal_points[3 * index];
+                Vector3 point = displaced_to_world_space(&bins->transforms, tessellation->points[index], normal_points, tessellation->displacements[index]);
+                Vector3 camera_point = sample_to_camera_space(&bins->transforms, point);
+                plot_sample(bins->object, &bins->transforms, job->cam, job->lights, job->num_lights,
+                            width, height, z_buffer, job->mode, &target,
+                            tessellation->uvs[index].x, tessellation->uvs[index].y, point, camera_point, normal_points);
+            }
+        }
+    }
+    if(job->gbuffer != NULL) resolve_gbuffer(&target, job->objects, job->cam, job->lights, job->num_lights, job->mode);
+}
+
+/**
+ * @brief Draws objects on the parametric thread pool. Objects are tessellated and binned into tiles in
+ * parallel, then every tile is depth tested and shaded by one thread into a private framebuffer, which
+ * FPToolkit only sees at the end
+ */
+static void draw_parametric_objects_tiled(ParametricObject3D* objects, int num_objs, Camera cam,
+                                          PhongLight* lights, int num_lights,
+                                          int width, int height, double z_buffer[width][height], enum ViewMode mode,
+                                          GBuffer* gbuffer){
+    ParametricJob job = {
+        .objects=objects,
+        .bins=(ObjectBins*)calloc(num_objs, sizeof(ObjectBins)),
+        .num_objs=num_objs,
+        .cam=cam,
+        .lights=lights,
+        .num_lights=num_lights,
+        .width=width,
+        .height=height,
+        .z_buffer=&z_buffer[0][0],
+        .mode=mode,
+        .adaptive=ADAPTIVE_PARAMETRIC_SAMPLING && !RASTERIZE_PARAMETRIC_TRIANGLES,
+        .gbuffer=gbuffer,
+        .tiles_x=(width + PARAMETRIC_TILE_SIZE - 1) / PARAMETRIC_TILE_SIZE,
+        .tiles_y=(height + PARAMETRIC_TILE_SIZE - 1) / PARAMETRIC_TILE_SIZE,
+        .framebuffer=new_framebuffer(width, height),
+        .to_tessellate=(ParametricObject3D*)malloc(sizeof(ParametricObject3D) * num_objs),
+        .built=(Tessellation**)malloc(sizeof(Tessellation*) * num_objs)
+    };
+    int* built_for = (int*)malloc(sizeof(int) * num_objs);
+    if(job.bins == NULL || job.to_tessellate == NULL || job.built == NULL || built_for == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for parametric objects\n");
+        exit(1);
+    }
+    ThreadPool* pool = get_parametric_pool();
+
+    // The cache is only looked up and added to here on the calling thread, and objects sharing a
+    // tessellation that is missing build it once
+    if(USE_TESSELLATION_CACHE) trim_tessellation_cache();
+    int num_to_tessellate = 0;
+    for(int o = 0; o < num_objs; o++){
+        job.bins[o].object = &objects[o];
+        ParametricObject3D tessellated = tessellated_object(&objects[o], job.adaptive);
+        TessellationKey key = tessellation_key(&tessellated);
+        built_for[o] = -1;
+        if(USE_TESSELLATION_CACHE && (job.bins[o].tessellation = find_cached_tessellation(&key)) != NULL) continue;
+        for(int t = 0; t < num_to_tessellate && built_for[o] < 0; t++){
+            TessellationKey built_key = tessellation_key(&job.to_tessellate[t]);
+            if(same_tessellation_key(&built_key, &key)) built_for[o] = t;
+        }
+        if(built_for[o] < 0){
+            job.to_tessellate[num_to_tessellate] = tessellated;
+            built_for[o] = num_to_tessellate++;
+        }
+    }
+    threadpool_run(pool, num_to_tessellate, build_tessellation_task, &job);
+    for(int t = 0; t < num_to_tessellate; t++){
+        if(USE_TESSELLATION_CACHE && job.built[t] != NULL) cache_tessellation(job.built[t]);
+    }
+    for(int o = 0; o < num_objs; o++){
+        if(built_for[o] >= 0) job.bins[o].tessellation = job.built[built_for[o]];
+    }
+
+    threadpool_run(pool, num_objs, bin_object_task, &job);
+    threadpool_run(pool, job.tiles_x * job.tiles_y, draw_tile_task, &job);
+    present_framebuffer(&job.framebuffer);
+
+    for(int o = 0; o < num_objs; o++){
+        free(job.bins[o].vertices);
+        free(job.bins[o].samples.samples);
+        if(job.bins[o].tiles == NULL) continue;
+        for(int t = 0; t < job.tiles_x * job.tiles_y; t++) free(job.bins[o].tiles[t].entries);
+        free(job.bins[o].tiles);
+    }
+    if(!USE_TESSELLATION_CACHE){
+        for(int t = 0; t < num_to_tessellate; t++){
+            if(job.built[t] == NULL) continue;
+            free_tessellation(job.built[t]);
+            free(job.built[t]);
+        }
+    }
+    delete_framebuffer(&job.framebuffer);
+    free(job.bins);
+    free(job.to_tessellate);
+    free(job.built);
+    free(built_for);
+}
 
 void draw_parametric_object_3d(ParametricObject3D object,
                             Camera cam,
@@ -24,92 +1282,7 @@ void draw_parametric_object_3d(ParametricObject3D object,
                             double z_buffer[width][height],
                             enum ViewMode mode)
 {
-    double u_range = object.u_end - object.u_start;
-    double v_range = object.v_end - object.v_start;
-    for(double u = object.u_start; u < object.u_end; u += object.u_step){
-        for(double v = object.v_start; v < object.v_end; v += object.v_step){
-            Vector3 tangent_a;
-            Vector3 tangent_b;
-            Vector3 normal;
-            bool normal_is_calculated = false;
-
-            Vector3 point = mat4_mult_point(object.f(u, v), object.transform);
-
-            if(!texture_is_null(object.material.texture_displacement)){
-                tangent_a = vec3_normalized(vec3_sub(mat4_mult_point(object.f(u, v + NORMAL_DELTA), object.transform), point));
-                tangent_b = vec3_normalized(vec3_sub(mat4_mult_point(object.f(u + NORMAL_DELTA, v), object.transform), point));
-                normal = vec3_cross_prod(tangent_a, tangent_b);
-                normal_is_calculated = true;
-                Vector2 texture_coordinates = {u / u_range * object.material.texture_displacement.width, v / v_range * object.material.texture_displacement.height};
-                Color3 displacement_color = get_texture_color(object.material.texture_displacement, texture_coordinates);
-                point = vec3_add(point, vec3_scale(normal, displacement_color.r * object.material.displacement_scale)); // Use red channel
-            }
-
-            Vector3 camera_point = to_camera_space(point, cam);
-            if(!is_visible_to_camera(cam, camera_point)) continue; //Cull point if not visible
-            
-            double normalized_z_dist = (camera_point.z - cam.near_clip_plane) / (cam.far_clip_plane - cam.near_clip_plane);
-            Vector2 pixel_location = to_window_coordinates(to_camera_screen_space(camera_point, cam), width, height);
-            
-            if(normalized_z_dist >  z_buffer[(int)pixel_location.x][(int)pixel_location.y]) continue;
-
-            z_buffer[(int)pixel_location.x][(int)pixel_location.y] = normalized_z_dist;
-
-            
-            if(BACKFACE_CULLING){ //TODO: Make this more optimized. View vector can be reused in phong lighting.
-                if(!normal_is_calculated){
-                    tangent_a = vec3_normalized(vec3_sub(mat4_mult_point(object.f(u, v + NORMAL_DELTA), object.transform), point));
-                    tangent_b = vec3_normalized(vec3_sub(mat4_mult_point(object.f(u + NORMAL_DELTA, v), object.transform), point));
-                    normal = vec3_cross_prod(tangent_a, tangent_b);
-                    normal_is_calculated = true;
-                }
-                Vector3 view_vec = vec3_normalized(vec3_sub(cam.eye, point));
-                if(vec3_dot_prod(normal, view_vec) < 0) {
-                    continue; //cull if cant see
-                } 
-            }
-            //Apply texture
-            if(!texture_is_null(object.material.texture_diffuse) && (mode == UNLIT || mode == LIT)){ // Width is 0 if NULL texture
-                Vector2 uv = {u / u_range * object.material.texture_diffuse.width, v / v_range * object.material.texture_diffuse.height};
-                Color3 tex_col = get_texture_color(object.material.texture_diffuse, uv);
-                object.material.base_color = tex_col;
-                object.material.diffuse = tex_col;
-            }
-            if(mode == UNLIT){
-                G_rgb(SPREAD_COL3(object.material.base_color));
-            } else if(mode == UV){
-                G_rgb(u / u_range, v / v_range, 0);
-            } 
-            else if(mode == Z_BUFF){
-                double brightness = z_buffer[(int)pixel_location.x][(int)pixel_location.y];
-                G_rgb(brightness, brightness, brightness);
-            } else{
-                /* Do lighting calculations */
-                if(!normal_is_calculated){
-                    tangent_a = vec3_normalized(vec3_sub(mat4_mult_point(object.f(u, v + NORMAL_DELTA), object.transform), point));
-                    tangent_b = vec3_normalized(vec3_sub(mat4_mult_point(object.f(u + NORMAL_DELTA, v), object.transform), point));
-                    normal = vec3_cross_prod(tangent_a, tangent_b);
-                }
-
-                if(mode == NORMAL){
-                    G_rgb(SPREAD_COL3(normal));
-                } else if (mode == LIT){
-                    // Hacky specular modification so I don't have to mess with `phong_lighting`
-                    Color3 base_specular = object.material.specular;
-                    if(!texture_is_null(object.material.texture_specular)){
-                        Vector2 uv = {u / u_range * object.material.texture_specular.width, v / v_range * object.material.texture_specular.height};
-                        double spec_value = get_texture_color(object.material.texture_specular, uv).r; // Just use red channel
-                        object.material.specular = vec3_scale(base_specular, spec_value);
-                    }
-                    Color3 col = phong_lighting(point, normal, cam, object.material, lights, num_lights);
-                    object.material.specular = base_specular;
-                    G_rgb(SPREAD_COL3(col));
-                }
-            }
-            draw:
-            G_pixel(SPREAD_VEC2(pixel_location));
-        }
-    }
+    draw_parametric_objects_3d(&object, 1, cam, lights, num_lights, width, height, z_buffer, mode);
 }
 
 void draw_parametric_objects_3d(ParametricObject3D* objects,
@@ -122,9 +1295,28 @@ void draw_parametric_objects_3d(ParametricObject3D* objects,
                                 double z_buffer[width][height],
                                 enum ViewMode mode)
 {
-    for(int o = 0; o < num_objs; o++){
-        draw_parametric_object_3d(objects[o], cam, lights, num_lights, width, height, z_buffer, mode);
+    GBuffer gbuffer;
+    if(DEFERRED_PARAMETRIC_SHADING) gbuffer = new_gbuffer(width, height);
+    if(PARAMETRIC_THREADS != 1){
+        draw_parametric_objects_tiled(objects, num_objs, cam, lights, num_lights, width, height, z_buffer, mode,
+                                      DEFERRED_PARAMETRIC_SHADING ? &gbuffer : NULL);
+    }
+    else {
+        DrawTarget target = {
+            .framebuffer=NULL,
+            .x_start=0,
+            .y_start=0,
+            .x_end=width,
+            .y_end=height,
+            .gbuffer=DEFERRED_PARAMETRIC_SHADING ? &gbuffer : NULL
+        };
+        for(int o = 0; o < num_objs; o++){
+            target.object_id = o;
+            draw_parametric_object_serial(&objects[o], cam, lights, num_lights, width, height, z_buffer, mode, &target);
+        }
+        if(DEFERRED_PARAMETRIC_SHADING) resolve_gbuffer(&target, objects, cam, lights, num_lights, mode);
     }
+    if(DEFERRED_PARAMETRIC_SHADING) delete_gbuffer(&gbuffer);
 }
 
 
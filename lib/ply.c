@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "ply.h"
+
+typedef struct {
+    const char* name;
+    PlyType type;
+} PlyTypeName;
+
+static const PlyTypeName TYPE_NAMES[] = {
+    {"char", PLY_INT8}, {"int8", PLY_INT8},
+    {"uchar", PLY_UINT8}, {"uint8", PLY_UINT8},
+    {"short", PLY_INT16}, {"int16", PLY_INT16},
+    {"ushort", PLY_UINT16}, {"uint16", PLY_UINT16},
+    {"int", PLY_INT32}, {"int32", PLY_INT32},
+    {"uint", PLY_UINT32}, {"uint32", PLY_UINT32},
+    {"float", PLY_FLOAT32}, {"float32", PLY_FLOAT32},
+    {"double", PLY_FLOAT64}, {"float64", PLY_FLOAT64}
+};
+
+static bool parse_type(PlyType* type_out, const char* name){
+    for(int i = 0; i < (int)(sizeof(TYPE_NAMES) / sizeof(TYPE_NAMES[0])); i++){
+        if(!strcmp(name, TYPE_NAMES[i].name)){
+            *type_out = TYPE_NAMES[i].type;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Copies the next header line into a buffer without its line ending
+ *
+ * @return size_t The offset of the line after it, or 0 if there is no complete line
+ */
+static size_t next_line(char* line, size_t line_size, const char* data, size_t size, size_t offset){
+    size_t end = offset;
+    while(end < size && data[end] != '\n') end++;
+    if(end >= size) return 0;
+
+    size_t length = end - offset;
+    if(length > 0 && data[end - 1] == '\r') length--;
+    if(length >= line_size) length = line_size - 1;
+    memcpy(line, data + offset, length);
+    line[length] = '\0';
+    return end + 1;
+}
+
+void ply_parse_header(PlyHeader* header, const char* data, size_t size, const char* filename){
+    char line[256];
+    char* words[8];
+    size_t offset = next_line(line, sizeof(line), data, size, 0);
+    if(offset == 0 || strcmp(line, "ply")){
+        fprintf(stderr, "'%s' is not a .ply file\n", filename);
+        exit(1);
+    }
+
+    header->num_elements = 0;
+    bool has_format = false;
+    while(true){
+        offset = next_line(line, sizeof(line), data, size, offset);
+        if(offset == 0){
+            fprintf(stderr, "'%s' ends before end_header\n", filename);
+            exit(1);
+        }
+
+        int num_words = 0;
+        char* save;
+        for(char* word = strtok_r(line, " \t", &save); word != NULL && num_words < 8; word = strtok_r(NULL, " \t", &save)){
+            words[num_words++] = word;
+        }
+        if(num_words == 0) continue;
+
+        if(!strcmp(words[0], "end_header")) break;
+        if(!strcmp(words[0], "comment") || !strcmp(words[0], "obj_info")) continue;
+
+        if(!strcmp(words[0], "format") && num_words >= 2){
+            if(!strcmp(words[1], "ascii")) header->format = PLY_ASCII;
+            else if(!strcmp(words[1], "binary_little_endian")) header->format = PLY_BINARY_LITTLE_ENDIAN;
+            else if(!strcmp(words[1], "binary_big_endian")) header->format = PLY_BINARY_BIG_ENDIAN;
+            else goto BAD_LINE;
+            has_format = true;
+        }
+        else if(!strcmp(words[0], "element") && num_words >= 3){
+            if(header->num_elements == PLY_MAX_ELEMENTS) goto BAD_LINE;
+            PlyElement* element = &header->elements[header->num_elements++];
+            snprintf(element->name, PLY_MAX_NAME, "%s", words[1]);
+            element->count = atol(words[2]);
+            element->num_properties = 0;
+            if(element->count < 0) goto BAD_LINE;
+        }
+        else if(!strcmp(words[0], "property") && header->num_elements > 0){
+            PlyElement* element = &header->elements[header->num_elements - 1];
+            if(element->num_properties == PLY_MAX_PROPERTIES) goto BAD_LINE;
+            PlyProperty* property = &element->properties[element->num_properties];
+            if(num_words >= 5 && !strcmp(words[1], "list")){
+                property->is_list = true;
+                if(!parse_type(&property->count_type, words[2]) || !parse_type(&property->type, words[3])) goto BAD_LINE;
+                snprintf(property->name, PLY_MAX_NAME, "%s", words[4]);
+            }
+            else if(num_words >= 3){
+                property->is_list = false;
+                if(!parse_type(&property->type, words[1])) goto BAD_LINE;
+                snprintf(property->name, PLY_MAX_NAME, "%s", words[2]);
+            }
+            else goto BAD_LINE;
+            element->num_properties++;
+        }
+        else goto BAD_LINE;
+    }
+
+    if(!has_format){
+        fprintf(stderr, "'%s' has no format line\n", filename);
+        exit(1);
+    }
+    header->data_offset = offset;
+    return;
+    BAD_LINE:
+    fprintf(stderr, "Unsupported .ply header line in '%s': '%s'\n", filename, line);
+    exit(1);
+}
+
+int ply_find_element(const PlyHeader* header, const char* name){
+    for(int i = 0; i < header->num_elements; i++){
+        if(!strcmp(header->elements[i].name, name)) return i;
+    }
+    return -1;
+}
+
+int ply_find_property(const PlyElement* element, const char* const* names, int num_names){
+    for(int n = 0; n < num_names; n++){
+        for(int i = 0; i < element->num_properties; i++){
+            if(!strcmp(element->properties[i].name, names[n])) return i;
+        }
+    }
+    return -1;
+}
+
+int ply_type_size(PlyType type){
+    switch(type){
+        case PLY_INT8: case PLY_UINT8: return 1;
+        case PLY_INT16: case PLY_UINT16: return 2;
+        case PLY_INT32: case PLY_UINT32: case PLY_FLOAT32: return 4;
+        case PLY_FLOAT64: return 8;
+    }
+    return 0;
+}
+
+long ply_record_size(const PlyElement* element){
+    long size = 0;
+    for(int i = 0; i < element->num_properties; i++){
+        if(element->properties[i].is_list) return -1;
+        size += ply_type_size(element->properties[i].type);
+    }
+    return size;
+}
+
+bool ply_needs_swap(PlyFormat format){
+    const uint16_t one = 1;
+    bool little_endian = *(const unsigned char*)&one == 1;
+    if(format == PLY_BINARY_LITTLE_ENDIAN) return !little_endian;
+    if(format == PLY_BINARY_BIG_ENDIAN) return little_endian;
+    return false;
+}
+
+double ply_read_binary(const unsigned char* p, PlyType type, bool swap){
+    unsigned char bytes[8];
+    int size = ply_type_size(type);
+    // The data has no alignment guarantees so every value is copied out byte by byte
+    if(swap){
+        for(int i = 0; i < size; i++) bytes[i] = p[size - 1 - i];
+    }
+    else memcpy(bytes, p, size);
+
+    switch(type){
+        case PLY_INT8: { int8_t v; memcpy(&v, bytes, 1); return v; }
+        case PLY_UINT8: { uint8_t v; memcpy(&v, bytes, 1); return v; }
+        case PLY_INT16: { int16_t v; memcpy(&v, bytes, 2); return v; }
+        case PLY_UINT16: { uint16_t v; memcpy(&v, bytes, 2); return v; }
+        case PLY_INT32: { int32_t v; memcpy(&v, bytes, 4); return v; }
+        case PLY_UINT32: { uint32_t v; memcpy(&v, bytes, 4); return v; }
+        case PLY_FLOAT32: { float v; memcpy(&v, bytes, 4); return v; }
+        case PLY_FLOAT64: { double v; memcpy(&v, bytes, 8); return v; }
+    }
+    return 0;
+}
+
+const unsigned char* ply_skip_binary_record(const unsigned char* p, const unsigned char* end, const PlyElement* element, bool swap){
+    for(int i = 0; i < element->num_properties; i++){
+        const PlyProperty* property = &element->properties[i];
+        if(property->is_list){
+            int count_size = ply_type_size(property->count_type);
+            if(end - p < count_size) return NULL;
+            double count = ply_read_binary(p, property->count_type, swap);
+            p += count_size;
+            if(count < 0 || (end - p) / ply_type_size(property->type) < count) return NULL;
+            p += (long)count * ply_type_size(property->type);
+        }
+        else {
+            if(end - p < ply_type_size(property->type)) return NULL;
+            p += ply_type_size(property->type);
+        }
+    }
+    return p;
+}
+
+// Every power of ten up to 10^22 is exactly representable as a double
+static const double EXACT_POWERS_OF_TEN[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool is_digit(char c){ return c >= '0' && c <= '9'; }
+
+const char* ply_parse_ascii_number(const char* p, const char* end, double* out){
+    while(p < end && (*p == ' ' || *p == '\t')) p++;
+    if(p >= end || *p == '\n' || *p == '\r') return NULL;
+    const char* start = p;
+
+    bool negative = false;
+    if(*p == '-' || *p == '+'){
+        negative = *p == '-';
+        p++;
+    }
+
+    // Read the digits into an integer mantissa and a power of ten
+    uint64_t mantissa = 0;
+    int num_digits = 0;
+    int exponent = 0;
+    bool any_digits = false;
+    while(p < end && *p == '0'){ p++; any_digits = true; }
+    while(p < end && is_digit(*p)){
+        if(num_digits < 19) mantissa = mantissa * 10 + (*p - '0');
+        else exponent++;
+        num_digits++;
+        any_digits = true;
+        p++;
+    }
+    if(p < end && *p == '.'){
+        p++;
+        if(num_digits == 0){
+            while(p < end && *p == '0'){ p++; exponent--; any_digits = true; }
+        }
+        while(p < end && is_digit(*p)){
+            if(num_digits < 19){
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+            num_digits++;
+            any_digits = true;
+            p++;
+        }
+    }
+    if(any_digits && p < end && (*p == 'e' || *p == 'E')){
+        const char* exponent_start = p;
+        p++;
+        bool negative_exponent = false;
+        if(p < end && (*p == '-' || *p == '+')){
+            negative_exponent = *p == '-';
+            p++;
+        }
+        if(p < end && is_digit(*p)){
+            int written_exponent = 0;
+            while(p < end && is_digit(*p)){
+                if(written_exponent < 100000) written_exponent = written_exponent * 10 + (*p - '0');
+                p++;
+            }
+            exponent += negative_exponent ? -written_exponent : written_exponent;
+        }
+        else p = exponent_start;
+    }
+
+    bool at_separator = p >= end || *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r';
+    // Clinger's fast path: an exactly representable mantissa scaled by an exactly representable
+    // power of ten is a single correctly rounded operation, so it matches strtod bit for bit
+    if(any_digits && at_separator && num_digits <= 19 && mantissa <= (1ull << 53) &&
+       exponent >= -22 && exponent <= 22){
+        double value = (double)mantissa;
+        if(exponent < 0) value /= EXACT_POWERS_OF_TEN[-exponent];
+        else value *= EXACT_POWERS_OF_TEN[exponent];
+        *out = negative ? -value : value;
+        return p;
+    }
+
+    // Anything else (long mantissas, huge exponents, inf, nan, hex) goes to strtod on a terminated copy
+    char token[128];
+    p = start;
+    int length = 0;
+    while(p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r'){
+        if(length < (int)sizeof(token) - 1) token[length++] = *p;
+        p++;
+    }
+    token[length] = '\0';
+    *out = strtod(token, NULL);
+    return p;
+}
@@ -0,0 +1,301 @@
+#include <math.h>
+#include <stdbool.h>
+#include "primitive.h"
+#include "parametric.h"
+
+// Must match the EPSILON of the scalar triangle test in raytrace.c
+static const double EPSILON = 0.000001;
+// Newton steps that polish each root of the torus quartic after the closed form solution
+#define QUARTIC_NEWTON_STEPS 2
+
+/**
+ * @brief Solves a x^2 + b x + c = 0, falling back to the linear equation when a is 0
+ *
+ * @param roots Set to the real roots in ascending order
+ * @return The number of real roots
+ */
+static int solve_quadratic(double a, double b, double c, double roots[2]){
+    if(a == 0){
+        if(b == 0) return 0;
+        roots[0] = -c / b;
+        return 1;
+    }
+    double discriminant = b * b - 4 * a * c;
+    if(discriminant < 0) return 0;
+    // Adding quantities of the same sign avoids cancellation in the smaller root
+    double q = -0.5 * (b + copysign(sqrt(discriminant), b));
+    double r1 = q / a;
+    double r2 = q != 0 ? c / q : r1;
+    roots[0] = fmin(r1, r2);
+    roots[1] = fmax(r1, r2);
+    return 2;
+}
+
+/**
+ * @brief Solves the monic cubic x^3 + a x^2 + b x + c = 0
+ *
+ * @param roots Set to the real roots
+ * @return The number of real roots, 1 or 3
+ */
+static int solve_cubic(double a, double b, double c, double roots[3]){
+    double q = (a * a - 3 * b) / 9;
+    double r = (2 * a * a * a - 9 * a * b + 27 * c) / 54;
+    double q3 = q * q * q;
+    if(r * r < q3){
+        double theta = acos(r / sqrt(q3));
+        double scale = -2 * sqrt(q);
+        roots[0] = scale * cos(theta / 3) - a / 3;
+        roots[1] = scale * cos((theta + 2 * M_PI) / 3) - a / 3;
+        roots[2] = scale * cos((theta - 2 * M_PI) / 3) - a / 3;
+        return 3;
+    }
+    double big = -copysign(cbrt(fabs(r) + sqrt(r * r - q3)), r);
+    double small = big != 0 ? q / big : 0;
+    roots[0] = big + small - a / 3;
+    return 1;
+}
+
+/**
+ * @brief Solves the monic quartic x^4 + a x^3 + b x^2 + c x + d = 0 with Ferrari's method, then
+ * polishes every root with Newton's method
+ *
+ * @param roots Set to the real roots, in no particular order
+ * @return The number of real roots found
+ */
+static int solve_quartic(double a, double b, double c, double d, double roots[4]){
+    // Substituting x = y - a / 4 leaves y^4 + p y^2 + q y + r = 0
+    double a2 = a * a;
+    double p = b - 3 * a2 / 8;
+    double q = c - a * b / 2 + a2 * a / 8;
+    double r = d - a * c / 4 + a2 * b / 16 - 3 * a2 * a2 / 256;
+    double shift = -a / 4;
+    int num_roots = 0;
+
+    if(fabs(q) < 1e-12){
+        // Biquadratic: a quadratic in y^2
+        double squares[2];
+        int num_squares = solve_quadratic(1, p, r, squares);
+        for(int i = 0; i < num_squares; i++){
+            if(squares[i] < 0) continue;
+            roots[num_roots++] = sqrt(squares[i]) + shift;
+            roots[num_roots++] = -sqrt(squares[i]) + shift;
+        }
+    }
+    else {
+        // Any positive root m of the resolvent cubic splits the quartic into two quadratics
+        double cubic_roots[3];
+        int num_cubic = solve_cubic(p, p * p / 4 - r, -q * q / 8, cubic_roots);
+        double m = cubic_roots[0];
+        for(int i = 1; i < num_cubic; i++) m = fmax(m, cubic_roots[i]);
+        if(m <= 0) return 0;
+        double s = sqrt(2 * m);
+        double halves[2];
+        int num_halves = solve_quadratic(1, -s, p / 2 + m + q / (2 * s), halves);
+        for(int i = 0; i < num_halves; i++) roots[num_roots++] = halves[i] + shift;
+        num_halves = solve_quadratic(1, s, p / 2 + m - q / (2 * s), halves);
+        for(int i = 0; i < num_halves; i++) roots[num_roots++] = halves[i] + shift;
+    }
+
+    for(int i = 0; i < num_roots; i++){
+        for(int step = 0; step < QUARTIC_NEWTON_STEPS; step++){
+            double x = roots[i];
+            double f = (((x + a) * x + b) * x + c) * x + d;
+            double df = ((4 * x + 3 * a) * x + 2 * b) * x + c;
+            if(df == 0) break;
+            roots[i] = x - f / df;
+        }
+    }
+    return num_roots;
+}
+
+/**
+ * @brief Turns a normal of an open surface to the side the ray comes from
+ */
+static Vector3 facing_normal(Vector3 normal, Vector3 direction){
+    return vec3_dot_prod(normal, direction) > 0 ? vec3_scale(normal, -1) : normal;
+}
+
+static bool intersect_sphere(double* t_out, Vector3* normal_out, Ray ray){
+    Vector3 tsource = ray.origin;
+    Vector3 tdir = ray.direction;
+
+    // Now we need to foil the terms:
+    //(tsrc * tsrc)
+    Vector3 va = vec3_mult(tdir, tdir);
+    // (tdir * tsrc) + (tsrc * tdir)
+    Vector3 vb = vec3_scale(vec3_mult(tdir, tsource), 2);
+    // (tdir * tdir)
+    Vector3 vc = vec3_mult(tsource, tsource);
+    //Add terms together
+    double a = va.x + va.y + va.z;
+    double b = vb.x + vb.y + vb.z;
+    double c = vc.x + vc.y + vc.z - 1;
+
+    double under_sqrt = (b * b) - (4 * a * c);
+    if(under_sqrt < 0) return false; // did not intersect with object
+    double t_plus = (-b + sqrt(under_sqrt)) / (2 * a);
+    double t_minus = (-b - sqrt(under_sqrt)) / (2 * a);
+
+    double t;
+    if(t_plus < 0 && t_minus < 0) return false; // object is behind camera
+    if(t_plus > 0 && (t_plus < t_minus || t_minus < 0)) t = t_plus;
+    else t = t_minus;
+
+    *t_out = t;
+    // The gradient of x^2 + y^2 + z^2 - 1
+    if(normal_out != NULL) *normal_out = vec3_scale(vec3_add(tsource, vec3_scale(tdir, t)), 2);
+    return true;
+}
+
+static bool intersect_plane(double* t_out, Vector3* normal_out, Ray ray){
+    if(ray.direction.y == 0) return false;
+    double t = -ray.origin.y / ray.direction.y;
+    if(t <= EPSILON) return false;
+    *t_out = t;
+    if(normal_out != NULL) *normal_out = facing_normal((Vector3){0, 1, 0}, ray.direction);
+    return true;
+}
+
+static bool intersect_disk(double* t_out, Vector3* normal_out, Ray ray){
+    if(ray.direction.z == 0) return false;
+    double t = -ray.origin.z / ray.direction.z;
+    if(t <= EPSILON) return false;
+    double x = ray.origin.x + ray.direction.x * t;
+    double y = ray.origin.y + ray.direction.y * t;
+    if(x * x + y * y > 1) return false;
+    *t_out = t;
+    if(normal_out != NULL) *normal_out = facing_normal((Vector3){0, 0, 1}, ray.direction);
+    return true;
+}
+
+static bool intersect_box(double* t_out, Vector3* normal_out, Ray ray){
+    AABB box = {{-1, -1, -1}, {1, 1, 1}};
+    Vector3 inverse_direction = {1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z};
+    double t_enter;
+    if(!aabb_ray_intersect(&box, ray.origin, inverse_direction, INFINITY, &t_enter)) return false;
+
+    double t = t_enter;
+    if(t <= EPSILON){
+        // The ray starts inside the box, so it leaves through the nearest face ahead of it
+        Vector3 exits = {
+            (copysign(1, ray.direction.x) - ray.origin.x) * inverse_direction.x,
+            (copysign(1, ray.direction.y) - ray.origin.y) * inverse_direction.y,
+            (copysign(1, ray.direction.z) - ray.origin.z) * inverse_direction.z
+        };
+        t = fmin(exits.x, fmin(exits.y, exits.z));
+        if(t <= EPSILON) return false;
+    }
+    *t_out = t;
+    if(normal_out != NULL){
+        // The face hit is the one the hit point is furthest out along
+        Vector3 p = vec3_add(ray.origin, vec3_scale(ray.direction, t));
+        Vector3 a = {fabs(p.x), fabs(p.y), fabs(p.z)};
+        if(a.x >= a.y && a.x >= a.z) *normal_out = (Vector3){copysign(1, p.x), 0, 0};
+        else if(a.y >= a.z) *normal_out = (Vector3){0, copysign(1, p.y), 0};
+        else *normal_out = (Vector3){0, 0, copysign(1, p.z)};
+    }
+    return true;
+}
+
+/**
+ * @brief Intersects the open cylinder (taper 0) or cone (taper 0.5) around the z axis between
+ * z = -1 and 1, whose radius at height z is 1 - taper * (1 + z)
+ */
+static bool intersect_tube(double* t_out, Vector3* normal_out, Ray ray, double taper){
+    Vector3 o = ray.origin;
+    Vector3 d = ray.direction;
+    // x^2 + y^2 = (radius at z)^2, with the radius linear in z
+    double base = 1 - taper * (1 + o.z);
+    double a = d.x * d.x + d.y * d.y - taper * taper * d.z * d.z;
+    double b = 2 * (o.x * d.x + o.y * d.y + taper * base * d.z);
+    double c = o.x * o.x + o.y * o.y - base * base;
+    double roots[2];
+    int num_roots = solve_quadratic(a, b, c, roots);
+    for(int i = 0; i < num_roots; i++){
+        double t = roots[i];
+        if(t <= EPSILON) continue;
+        Vector3 p = vec3_add(o, vec3_scale(d, t));
+        if(p.z < -1 || p.z > 1) continue;
+        *t_out = t;
+        if(normal_out != NULL){
+            double radius = 1 - taper * (1 + p.z);
+            *normal_out = facing_normal((Vector3){p.x, p.y, taper * radius}, d);
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool intersect_torus(double* t_out, Vector3* normal_out, Ray ray){
+    double major = TORUS_MAJOR_RADIUS;
+    double minor = TORUS_MINOR_RADIUS;
+    AABB bounds;
+    primitive_bounds(TORUS, &bounds);
+    Vector3 inverse_direction = {1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z};
+    double t_enter;
+    if(!aabb_ray_intersect(&bounds, ray.origin, inverse_direction, INFINITY, &t_enter)) return false;
+
+    // The quartic is far better conditioned with a unit direction and an origin near the torus
+    double t_start = fmax(t_enter, 0);
+    double length = vec3_magnitude(ray.direction);
+    Vector3 d = vec3_scale(ray.direction, 1 / length);
+    Vector3 o = vec3_add(ray.origin, vec3_scale(ray.direction, t_start));
+
+    // (|p|^2 + R^2 - r^2)^2 = 4 R^2 (x^2 + y^2) along p = o + s d
+    double k = vec3_dot_prod(o, d);
+    double m = vec3_dot_prod(o, o) + major * major - minor * minor;
+    double four_r2 = 4 * major * major;
+    double roots[4];
+    int num_roots = solve_quartic(
+        4 * k,
+        4 * k * k + 2 * m - four_r2 * (d.x * d.x + d.y * d.y),
+        4 * k * m - 2 * four_r2 * (o.x * d.x + o.y * d.y),
+        m * m - four_r2 * (o.x * o.x + o.y * o.y),
+        roots);
+
+    double best = INFINITY;
+    for(int i = 0; i < num_roots; i++){
+        double t = t_start + roots[i] / length;
+        if(t > EPSILON && t < best) best = t;
+    }
+    if(best == INFINITY) return false;
+    *t_out = best;
+    if(normal_out != NULL){
+        Vector3 p = vec3_add(ray.origin, vec3_scale(ray.direction, best));
+        double sum = vec3_dot_prod(p, p);
+        double ring = sum - major * major - minor * minor;
+        // The gradient of the implicit torus, divided by 4
+        *normal_out = (Vector3){p.x * ring, p.y * ring, p.z * (ring + 2 * major * major)};
+    }
+    return true;
+}
+
+bool intersect_primitive(double* t_out, Vector3* normal_out, Ray ray, enum RaytracedObjectType type){
+    switch(type){
+        case SPHERE: return intersect_sphere(t_out, normal_out, ray);
+        case PLANE: return intersect_plane(t_out, normal_out, ray);
+        case BOX: return intersect_box(t_out, normal_out, ray);
+        case CYLINDER: return intersect_tube(t_out, normal_out, ray, 0);
+        case CONE: return intersect_tube(t_out, normal_out, ray, 0.5);
+        case DISK: return intersect_disk(t_out, normal_out, ray);
+        case TORUS: return intersect_torus(t_out, normal_out, ray);
+    }
+    return false;
+}
+
+bool primitive_bounds(enum RaytracedObjectType type, AABB* bounds_out){
+    switch(type){
+        case PLANE: return false;
+        case DISK:
+            *bounds_out = (AABB){{-1, -1, 0}, {1, 1, 0}};
+            return true;
+        case TORUS: {
+            double outer = TORUS_MAJOR_RADIUS + TORUS_MINOR_RADIUS;
+            *bounds_out = (AABB){{-outer, -outer, -TORUS_MINOR_RADIUS}, {outer, outer, TORUS_MINOR_RADIUS}};
+            return true;
+        }
+        default:
+            *bounds_out = (AABB){{-1, -1, -1}, {1, 1, 1}};
+            return true;
+    }
+}
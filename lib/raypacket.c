@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "raypacket.h"
+
+// Must match the EPSILON of the scalar triangle test in raytrace.c
+static const double EPSILON = 0.000001;
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define KERNEL_WIDTH 2
+#define KERNEL_NAME(name) name##_sse2
+#define KERNEL_ATTRIBUTES __attribute__((target("sse2"), optimize("fp-contract=off")))
+#include "raypacket_kernel.h"
+#undef KERNEL_WIDTH
+#undef KERNEL_NAME
+#undef KERNEL_ATTRIBUTES
+
+#define KERNEL_WIDTH 4
+#define KERNEL_NAME(name) name##_avx2
+#define KERNEL_ATTRIBUTES __attribute__((target("avx2"), optimize("fp-contract=off")))
+#include "raypacket_kernel.h"
+#undef KERNEL_WIDTH
+#undef KERNEL_NAME
+#undef KERNEL_ATTRIBUTES
+
+#define KERNEL_WIDTH 8
+#define KERNEL_NAME(name) name##_avx512
+#define KERNEL_ATTRIBUTES __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#include "raypacket_kernel.h"
+#undef KERNEL_WIDTH
+#undef KERNEL_NAME
+#undef KERNEL_ATTRIBUTES
+
+static bool supports_sse2(){ return true; }
+static bool supports_avx2(){ __builtin_cpu_init(); return __builtin_cpu_supports("avx2"); }
+static bool supports_avx512(){ __builtin_cpu_init(); return __builtin_cpu_supports("avx512f"); }
+
+#else
+
+// Other architectures get whatever two wide vectors the compiler targets by default
+#define KERNEL_WIDTH 2
+#define KERNEL_NAME(name) name##_generic
+#define KERNEL_ATTRIBUTES __attribute__((optimize("fp-contract=off")))
+#include "raypacket_kernel.h"
+#undef KERNEL_WIDTH
+#undef KERNEL_NAME
+#undef KERNEL_ATTRIBUTES
+
+static bool supports_generic(){ return true; }
+
+#endif
+
+typedef struct {
+    const char* name;
+    uint32_t (*intersect)(PacketHits* hits, const RayPacket* packet, const Mesh* mesh, uint32_t active);
+    bool (*supported)();
+} PacketIsa;
+
+// In order of preference
+static const PacketIsa PACKET_ISAS[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx512", packet_intersect_bvh_avx512, supports_avx512},
+    {"avx2", packet_intersect_bvh_avx2, supports_avx2},
+    {"sse2", packet_intersect_bvh_sse2, supports_sse2}
+#else
+    {"generic", packet_intersect_bvh_generic, supports_generic}
+#endif
+};
+#define NUM_PACKET_ISAS ((int)(sizeof(PACKET_ISAS) / sizeof(PACKET_ISAS[0])))
+
+static const PacketIsa* packet_isa = NULL;
+
+static const PacketIsa* get_packet_isa(){
+    if(packet_isa != NULL) return packet_isa;
+    for(int i = 0; i < NUM_PACKET_ISAS; i++){
+        if(PACKET_ISAS[i].supported()){
+            packet_isa = &PACKET_ISAS[i];
+            break;
+        }
+    }
+    return packet_isa;
+}
+
+const char* ray_packet_isa(){
+    return get_packet_isa()->name;
+}
+
+bool set_ray_packet_isa(const char* name){
+    for(int i = 0; i < NUM_PACKET_ISAS; i++){
+        if(!strcmp(PACKET_ISAS[i].name, name) && PACKET_ISAS[i].supported()){
+            packet_isa = &PACKET_ISAS[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+void ray_packet_set(RayPacket* packet, int lane, Vector3 origin, Vector3 direction){
+    packet->origin_x[lane] = origin.x;
+    packet->origin_y[lane] = origin.y;
+    packet->origin_z[lane] = origin.z;
+    packet->direction_x[lane] = direction.x;
+    packet->direction_y[lane] = direction.y;
+    packet->direction_z[lane] = direction.z;
+    packet->inverse_direction_x[lane] = 1.0 / direction.x;
+    packet->inverse_direction_y[lane] = 1.0 / direction.y;
+    packet->inverse_direction_z[lane] = 1.0 / direction.z;
+}
+
+uint32_t packet_intersect_mesh(PacketHits* hits, const RayPacket* packet, const Mesh* mesh, uint32_t active){
+    if(mesh->bvh.num_nodes == 0 || active == 0) return 0;
+    return get_packet_isa()->intersect(hits, packet, mesh, active);
+}
@@ -0,0 +1,203 @@
+/*
+ * The packet kernels, written once for any vector width with GCC vector extensions.
+ * raypacket.c includes this file once per instruction set after defining:
+ *   KERNEL_WIDTH       the number of doubles in one vector
+ *   KERNEL_NAME(name)  name with the instruction set appended
+ *   KERNEL_ATTRIBUTES  the function attributes that select the instruction set
+ *
+ * Floating point contraction is turned off so that every product and sum is rounded exactly as
+ * in the scalar intersection code, which keeps both paths finding the same hits.
+ */
+
+#define VEC KERNEL_NAME(Vec)
+#define MASK KERNEL_NAME(Mask)
+#define LANE_BITS ((1u << KERNEL_WIDTH) - 1)
+
+typedef double VEC __attribute__((vector_size(KERNEL_WIDTH * sizeof(double))));
+typedef long long MASK __attribute__((vector_size(KERNEL_WIDTH * sizeof(double))));
+
+static inline KERNEL_ATTRIBUTES VEC KERNEL_NAME(load)(const double* p){
+    VEC v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline KERNEL_ATTRIBUTES VEC KERNEL_NAME(select)(MASK mask, VEC a, VEC b){
+    return (VEC)(((MASK)a & mask) | ((MASK)b & ~mask));
+}
+
+// The same as fmin and fmax, which ignore a NaN argument
+static inline KERNEL_ATTRIBUTES VEC KERNEL_NAME(vmin)(VEC a, VEC b){
+    return KERNEL_NAME(select)((MASK)(a < b) | (MASK)(b != b), a, b);
+}
+
+static inline KERNEL_ATTRIBUTES VEC KERNEL_NAME(vmax)(VEC a, VEC b){
+    return KERNEL_NAME(select)((MASK)(a > b) | (MASK)(b != b), a, b);
+}
+
+static inline KERNEL_ATTRIBUTES uint32_t KERNEL_NAME(bits)(MASK mask){
+    uint32_t result = 0;
+    for(int k = 0; k < KERNEL_WIDTH; k++) result |= (uint32_t)(mask[k] & 1) << k;
+    return result;
+}
+
+/**
+ * @brief clip_to_slabs of bvh.c for a vector of rays. Rays parallel to the slabs leave where they are
+ * inside the box as it is
+ *
+ * @return MASK The rays that are parallel to the slabs and outside of them
+ */
+static inline KERNEL_ATTRIBUTES MASK KERNEL_NAME(clip_to_slabs)(double min, double max, VEC origin, VEC inverse_direction, VEC* t_enter, VEC* t_exit){
+    MASK parallel = (MASK)(inverse_direction == INFINITY) | (MASK)(inverse_direction == -INFINITY);
+    VEC infinity = (VEC){0} + INFINITY;
+    VEC t1 = KERNEL_NAME(select)(parallel, -infinity, (min - origin) * inverse_direction);
+    VEC t2 = KERNEL_NAME(select)(parallel, infinity, (max - origin) * inverse_direction);
+    *t_enter = KERNEL_NAME(vmax)(*t_enter, KERNEL_NAME(vmin)(t1, t2));
+    *t_exit = KERNEL_NAME(vmin)(*t_exit, KERNEL_NAME(vmax)(t1, t2));
+    return parallel & ((MASK)(origin < min) | (MASK)(origin > max));
+}
+
+/**
+ * @brief The slab test of aabb_ray_intersect for every active ray of a packet
+ *
+ * @param t_enter_out Set to where each passing ray enters the box
+ * @return uint32_t The active rays that enter the box before their max_t
+ */
+static inline KERNEL_ATTRIBUTES uint32_t KERNEL_NAME(box_test)(const AABB* box, const RayPacket* packet, const double* max_t, uint32_t active, double* t_enter_out){
+    uint32_t result = 0;
+    for(int base = 0; base < RAY_PACKET_SIZE; base += KERNEL_WIDTH){
+        uint32_t lanes = (active >> base) & LANE_BITS;
+        if(lanes == 0) continue;
+
+        VEC infinity = (VEC){0} + INFINITY;
+        VEC t_enter = -infinity;
+        VEC t_exit = infinity;
+        MASK miss = KERNEL_NAME(clip_to_slabs)(box->min.x, box->max.x, KERNEL_NAME(load)(&packet->origin_x[base]),
+                                               KERNEL_NAME(load)(&packet->inverse_direction_x[base]), &t_enter, &t_exit);
+        miss |= KERNEL_NAME(clip_to_slabs)(box->min.y, box->max.y, KERNEL_NAME(load)(&packet->origin_y[base]),
+                                           KERNEL_NAME(load)(&packet->inverse_direction_y[base]), &t_enter, &t_exit);
+        miss |= KERNEL_NAME(clip_to_slabs)(box->min.z, box->max.z, KERNEL_NAME(load)(&packet->origin_z[base]),
+                                           KERNEL_NAME(load)(&packet->inverse_direction_z[base]), &t_enter, &t_exit);
+
+        miss |= (MASK)(t_enter > t_exit) | (MASK)(t_exit < 0) | (MASK)(t_enter > KERNEL_NAME(load)(&max_t[base]));
+        memcpy(&t_enter_out[base], &t_enter, sizeof(t_enter));
+        result |= (KERNEL_NAME(bits)(~miss) & lanes) << base;
+    }
+    return result;
+}
+
+/**
+ * @brief The test of intersect_triangle_record for one triangle and every active ray of a packet
+ *
+ * @return uint32_t The rays whose closest hit is now this triangle
+ */
+static inline KERNEL_ATTRIBUTES uint32_t KERNEL_NAME(triangle_test)(PacketHits* hits, const RayPacket* packet, const TriangleRecords* records, int i, uint32_t active){
+    double v0_x = records->v0_x[i], v0_y = records->v0_y[i], v0_z = records->v0_z[i];
+    double edge_1_x = records->edge_1_x[i], edge_1_y = records->edge_1_y[i], edge_1_z = records->edge_1_z[i];
+    double edge_2_x = records->edge_2_x[i], edge_2_y = records->edge_2_y[i], edge_2_z = records->edge_2_z[i];
+    uint32_t result = 0;
+
+    for(int base = 0; base < RAY_PACKET_SIZE; base += KERNEL_WIDTH){
+        uint32_t lanes = (active >> base) & LANE_BITS;
+        if(lanes == 0) continue;
+
+        VEC direction_x = KERNEL_NAME(load)(&packet->direction_x[base]);
+        VEC direction_y = KERNEL_NAME(load)(&packet->direction_y[base]);
+        VEC direction_z = KERNEL_NAME(load)(&packet->direction_z[base]);
+
+        // pvec = direction x edge_2
+        VEC pvec_x = (direction_y * edge_2_z) - (edge_2_y * direction_z);
+        VEC pvec_y = (direction_z * edge_2_x) - (edge_2_z * direction_x);
+        VEC pvec_z = (direction_x * edge_2_y) - (edge_2_x * direction_y);
+        VEC determinant = (edge_1_x * pvec_x) + (edge_1_y * pvec_y) + (edge_1_z * pvec_z);
+        MASK miss = (MASK)(determinant < EPSILON) & (MASK)(determinant > -EPSILON);
+        VEC inverse_determinant = 1.0 / determinant;
+
+        VEC vertex_to_origin_x = KERNEL_NAME(load)(&packet->origin_x[base]) - v0_x;
+        VEC vertex_to_origin_y = KERNEL_NAME(load)(&packet->origin_y[base]) - v0_y;
+        VEC vertex_to_origin_z = KERNEL_NAME(load)(&packet->origin_z[base]) - v0_z;
+        VEC u = ((vertex_to_origin_x * pvec_x) + (vertex_to_origin_y * pvec_y) + (vertex_to_origin_z * pvec_z)) * inverse_determinant;
+        miss |= (MASK)(u < 0) | (MASK)(u > 1);
+
+        // qvec = vertex_to_origin x edge_1
+        VEC qvec_x = (vertex_to_origin_y * edge_1_z) - (edge_1_y * vertex_to_origin_z);
+        VEC qvec_y = (vertex_to_origin_z * edge_1_x) - (edge_1_z * vertex_to_origin_x);
+        VEC qvec_z = (vertex_to_origin_x * edge_1_y) - (edge_1_x * vertex_to_origin_y);
+        VEC v = ((direction_x * qvec_x) + (direction_y * qvec_y) + (direction_z * qvec_z)) * inverse_determinant;
+        miss |= (MASK)(v < 0) | (MASK)(u + v > 1);
+
+        VEC t = ((edge_2_x * qvec_x) + (edge_2_y * qvec_y) + (edge_2_z * qvec_z)) * inverse_determinant;
+        MASK hit = ~miss & (MASK)(t < KERNEL_NAME(load)(&hits->t[base])) & (MASK)(t > EPSILON);
+
+        uint32_t hit_lanes = KERNEL_NAME(bits)(hit) & lanes;
+        while(hit_lanes != 0){
+            int k = __builtin_ctz(hit_lanes);
+            hit_lanes &= hit_lanes - 1;
+            hits->t[base + k] = t[k];
+            hits->u[base + k] = u[k];
+            hits->v[base + k] = v[k];
+            hits->triangle[base + k] = i;
+            result |= 1u << (base + k);
+        }
+    }
+    return result;
+}
+
+static KERNEL_ATTRIBUTES uint32_t KERNEL_NAME(packet_intersect_bvh)(PacketHits* hits, const RayPacket* packet, const Mesh* mesh, uint32_t active){
+    const BVH* bvh = &mesh->bvh;
+    const TriangleRecords* records = &mesh->tri_records;
+    double t_left[RAY_PACKET_SIZE];
+    double t_right[RAY_PACKET_SIZE];
+    uint32_t hit_rays = 0;
+
+    int node_stack[BVH_MAX_DEPTH + 1];
+    uint32_t ray_stack[BVH_MAX_DEPTH + 1];
+    int stack_size = 0;
+    uint32_t rays = KERNEL_NAME(box_test)(&bvh->nodes[0].bounds, packet, hits->t, active, t_left);
+    if(rays == 0) return 0;
+    node_stack[0] = 0;
+    ray_stack[0] = rays;
+    stack_size = 1;
+
+    while(stack_size > 0){
+        stack_size--;
+        const BVHNode* node = &bvh->nodes[node_stack[stack_size]];
+        rays = ray_stack[stack_size];
+        if(node->count > 0){
+            for(int i = node->left_or_first; i < node->left_or_first + node->count; i++){
+                hit_rays |= KERNEL_NAME(triangle_test)(hits, packet, records, bvh->prim_indices[i], rays);
+            }
+            continue;
+        }
+
+        int left = node->left_or_first;
+        uint32_t left_rays = KERNEL_NAME(box_test)(&bvh->nodes[left].bounds, packet, hits->t, rays, t_left);
+        uint32_t right_rays = KERNEL_NAME(box_test)(&bvh->nodes[left + 1].bounds, packet, hits->t, rays, t_right);
+        if(left_rays != 0 && right_rays != 0){
+            // Visit first the child that most of the rays entering both reach first
+            int left_votes = 0;
+            for(uint32_t both = left_rays & right_rays; both != 0; both &= both - 1){
+                int k = __builtin_ctz(both);
+                left_votes += t_left[k] <= t_right[k] ? 1 : -1;
+            }
+            bool left_first = left_votes >= 0;
+            node_stack[stack_size] = left_first ? left + 1 : left;
+            ray_stack[stack_size++] = left_first ? right_rays : left_rays;
+            node_stack[stack_size] = left_first ? left : left + 1;
+            ray_stack[stack_size++] = left_first ? left_rays : right_rays;
+        }
+        else if(left_rays != 0){
+            node_stack[stack_size] = left;
+            ray_stack[stack_size++] = left_rays;
+        }
+        else if(right_rays != 0){
+            node_stack[stack_size] = left + 1;
+            ray_stack[stack_size++] = right_rays;
+        }
+    }
+    return hit_rays;
+}
+
+#undef VEC
+#undef MASK
+#undef LANE_BITS
@@ -1,25 +1,54 @@
 #include "raytrace.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
 #include "matrix.h"
 #include "FPToolkit.h"
 #include "colors.h"
 #include "trig.h"
 #include "lightmodel.h"
+#include "framebuffer.h"
+#include "threadpool.h"
+#include "raypacket.h"
+#include "triblock.h"
+#include "primitive.h"
+#include "parametric.h"
 
 bool SHOW_WORLD_DIRECTION = false;
 bool SHOW_TRIANGLE_NORMALS = false;
 bool SMOOTH_LIGHTING_NORMALS = false;
 bool SHOW_WORLD_DIRECTION_MISSES = false;
+bool USE_MESH_BVH = true;
+bool USE_TRIANGLE_RECORDS = true;
+bool SHADOWS = false;
+bool USE_RAY_PACKETS = true;
+bool USE_TRIANGLE_BLOCKS = true;
+bool USE_INSTANCE_BVH = true;
+bool USE_OBJECT_BVH = true;
 void invert_show_world_direction(){ SHOW_WORLD_DIRECTION = !SHOW_WORLD_DIRECTION; }
 void invert_show_triangle_normals(){ SHOW_TRIANGLE_NORMALS = !SHOW_TRIANGLE_NORMALS; }
 void invert_smooth_lighting_normals(){ SMOOTH_LIGHTING_NORMALS = !SMOOTH_LIGHTING_NORMALS; }
 void invert_show_world_direction_misses(){ SHOW_WORLD_DIRECTION_MISSES = !SHOW_WORLD_DIRECTION_MISSES; }
+void invert_use_mesh_bvh(){ USE_MESH_BVH = !USE_MESH_BVH; }
+void invert_use_triangle_records(){ USE_TRIANGLE_RECORDS = !USE_TRIANGLE_RECORDS; }
+void invert_shadows(){ SHADOWS = !SHADOWS; }
+void invert_use_ray_packets(){ USE_RAY_PACKETS = !USE_RAY_PACKETS; }
+void invert_use_triangle_blocks(){ USE_TRIANGLE_BLOCKS = !USE_TRIANGLE_BLOCKS; }
+void invert_use_instance_bvh(){ USE_INSTANCE_BVH = !USE_INSTANCE_BVH; }
+void invert_use_object_bvh(){ USE_OBJECT_BVH = !USE_OBJECT_BVH; }
 #define SHOW_MISSES 0
 
 int MAX_BOUNCES = 6;
 
+// 1 traces on the calling thread, 0 uses every core
+int RAYTRACE_THREADS = 1;
+static ThreadPool* raytrace_pool = NULL;
+#define TILE_SIZE 16
+
 
 const double EPSILON = 0.000001;
 
@@ -58,9 +87,49 @@ bool intersect_triangle(double* t_out, Vector2* barycentric_out, double closest_
     return false;
 }
 
-bool intersects_bounding_box(Mesh mesh, Ray ray){
-    Vector3 box_min = mesh.bounding_box_min;
-    Vector3 box_max = mesh.bounding_box_max;
+bool intersect_triangle_record(double* t_out, Vector2* barycentric_out, double closest_t, Ray ray, const TriangleRecords* records, int i){
+    Vector3 v0 = {records->v0_x[i], records->v0_y[i], records->v0_z[i]};
+    Vector3 edge_1 = {records->edge_1_x[i], records->edge_1_y[i], records->edge_1_z[i]};
+    Vector3 edge_2 = {records->edge_2_x[i], records->edge_2_y[i], records->edge_2_z[i]};
+
+    Vector3 pvec = vec3_cross_prod(ray.direction, edge_2);
+    double determinant = vec3_dot_prod(edge_1, pvec);
+    if(fabs(determinant) < EPSILON) return false; //Ray is paralell to triangle
+
+    double inverse_determinant = 1.0 / determinant;
+    Vector3 vertex_to_origin = vec3_sub(ray.origin, v0);
+
+    double u = vec3_dot_prod(vertex_to_origin, pvec) * inverse_determinant;
+    if(u < 0 || u > 1) return false;
+
+    Vector3 edge_1_cross_prod = vec3_cross_prod(vertex_to_origin, edge_1);
+    double v = vec3_dot_prod(ray.direction, edge_1_cross_prod) * inverse_determinant;
+
+    if(v < 0 || u + v > 1) return false;
+
+    double t = vec3_dot_prod(edge_2, edge_1_cross_prod) * inverse_determinant;
+    if(t < closest_t && t > EPSILON) {
+        if(t_out != NULL) *t_out = t;
+        if(barycentric_out != NULL){
+            barycentric_out->x = u;
+            barycentric_out->y = v;
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Tests triangle i of a mesh with whichever triangle layout is selected
+ */
+static inline bool intersect_mesh_triangle(double* t_out, Vector2* barycentric_out, double closest_t, Ray ray, const Mesh* mesh, int i){
+    if(USE_TRIANGLE_RECORDS) return intersect_triangle_record(t_out, barycentric_out, closest_t, ray, &mesh->tri_records, i);
+    return intersect_triangle(t_out, barycentric_out, closest_t, ray, mesh->tris[i]);
+}
+
+bool intersects_bounding_box(const Mesh* mesh, Ray ray){
+    Vector3 box_min = mesh->bounding_box_min;
+    Vector3 box_max = mesh->bounding_box_max;
 
     Vector3 direction_inv = {1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z};
     Vector3 tmin = {(box_min.x - ray.origin.x) * direction_inv.x, (box_min.y - ray.origin.y) * direction_inv.y, (box_min.z - ray.origin.z) * direction_inv.z};
@@ -85,201 +154,1595 @@ bool intersects_bounding_box(Mesh mesh, Ray ray){
     return t_enter <= t_exit && t_exit >= 0;
 }
 
-void raytrace_scene(int width, int height, Camera cam, 
-                    RaytracedParametricObject3D* objs, int num_objs, 
-                    Mesh* meshes, int num_meshes, bool skipMeshes,
-                    PhongLight* lights, int num_lights, 
-                    int numBounces){
-    double dwidth = (double)width;
-    double dheight = (double)height;
-    double film_extent = tan(to_radians(cam.half_fov_degrees));
-    for(int y = 0; y < height; y++){
-        for(int x = 0; x < width; x++){
-            //TODO: make this work for different aspect ratios
-            Vector3 pixel_camera_space = {
-                ((x - (dwidth / 2)) / dwidth) * (film_extent * 2),
-                ((y - (dheight / 2)) / dheight) * (film_extent * 2),
-                1
-            };
+/**
+ * @brief Finds the closest triangle of a mesh hit by a ray by testing every triangle
+ * 
+ * @return true if a triangle closer than closest_t was hit
+ */
+static bool intersect_mesh_linear(int* tri_out, double* t_out, Vector2* barycentric_out, double closest_t, Ray ray, const Mesh* mesh){
+    bool did_hit = false;
+    for(int i = 0; i < mesh->num_tris; i++){
+        if(intersect_mesh_triangle(&closest_t, barycentric_out, closest_t, ray, mesh, i)){
+            *tri_out = i;
+            did_hit = true;
+        }
+    }
+    *t_out = closest_t;
+    return did_hit;
+}
+
+/**
+ * @brief Finds the closest triangle of a mesh hit by a ray by walking the mesh's BVH front to back
+ * 
+ * @return true if a triangle closer than closest_t was hit
+ */
+static bool intersect_mesh_bvh(int* tri_out, double* t_out, Vector2* barycentric_out, double closest_t, Ray ray, const Mesh* mesh){
+    if(USE_TRIANGLE_RECORDS && USE_TRIANGLE_BLOCKS && mesh->tri_blocks.num_nodes > 0){
+        return triangle_blocks_intersect(tri_out, t_out, barycentric_out, closest_t, ray, mesh);
+    }
+    const BVH* bvh = &mesh->bvh;
+    Vector3 inverse_direction = {1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z};
+    bool did_hit = false;
+
+    int stack[BVH_MAX_DEPTH + 1];
+    int stack_size = 0;
+    if(!aabb_ray_intersect(&bvh->nodes[0].bounds, ray.origin, inverse_direction, closest_t, NULL)) return false;
+    stack[stack_size++] = 0;
+
+    while(stack_size > 0){
+        BVHNode* node = &bvh->nodes[stack[--stack_size]];
+        if(node->count > 0){
+            for(int i = node->left_or_first; i < node->left_or_first + node->count; i++){
+                int tri = bvh->prim_indices[i];
+                if(intersect_mesh_triangle(&closest_t, barycentric_out, closest_t, ray, mesh, tri)){
+                    *tri_out = tri;
+                    did_hit = true;
+                }
+            }
+            continue;
+        }
+
+        // Visit the nearer child first so that closest_t shrinks as fast as possible
+        int left = node->left_or_first;
+        double t_left, t_right;
+        bool hit_left = aabb_ray_intersect(&bvh->nodes[left].bounds, ray.origin, inverse_direction, closest_t, &t_left);
+        bool hit_right = aabb_ray_intersect(&bvh->nodes[left + 1].bounds, ray.origin, inverse_direction, closest_t, &t_right);
+        if(hit_left && hit_right){
+            if(t_left <= t_right){
+                stack[stack_size++] = left + 1;
+                stack[stack_size++] = left;
+            }
+            else {
+                stack[stack_size++] = left;
+                stack[stack_size++] = left + 1;
+            }
+        }
+        else if(hit_left) stack[stack_size++] = left;
+        else if(hit_right) stack[stack_size++] = left + 1;
+    }
+    *t_out = closest_t;
+    return did_hit;
+}
+
+/**
+ * @brief Finds whether anything blocks a ray before max_t by walking a mesh's BVH,
+ * stopping at the first triangle hit rather than looking for the closest one
+ */
+static bool occluded_mesh_bvh(double max_t, Ray ray, const Mesh* mesh){
+    if(USE_TRIANGLE_RECORDS && USE_TRIANGLE_BLOCKS && mesh->tri_blocks.num_nodes > 0){
+        return triangle_blocks_occluded(max_t, ray, mesh);
+    }
+    const BVH* bvh = &mesh->bvh;
+    Vector3 inverse_direction = {1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z};
+
+    int stack[BVH_MAX_DEPTH + 1];
+    int stack_size = 0;
+    if(!aabb_ray_intersect(&bvh->nodes[0].bounds, ray.origin, inverse_direction, max_t, NULL)) return false;
+    stack[stack_size++] = 0;
+
+    while(stack_size > 0){
+        BVHNode* node = &bvh->nodes[stack[--stack_size]];
+        if(node->count > 0){
+            for(int i = node->left_or_first; i < node->left_or_first + node->count; i++){
+                if(intersect_mesh_triangle(NULL, NULL, max_t, ray, mesh, bvh->prim_indices[i])) return true;
+            }
+            continue;
+        }
+        int left = node->left_or_first;
+        if(aabb_ray_intersect(&bvh->nodes[left].bounds, ray.origin, inverse_direction, max_t, NULL)) stack[stack_size++] = left;
+        if(aabb_ray_intersect(&bvh->nodes[left + 1].bounds, ray.origin, inverse_direction, max_t, NULL)) stack[stack_size++] = left + 1;
+    }
+    return false;
+}
+
+/**
+ * @brief Intersects a ray with an object, in the object's space
+ *
+ * @param t_out Set to the ray parameter of the nearest intersection in front of the ray's origin
+ * @param obj_space_normal_out If not NULL, set to the object space normal at that intersection, not normalized
+ * @param tip The point at t = 1 along the ray
+ * @return true if the object is hit in front of the ray's origin
+ */
+static bool intersect_object(double* t_out, Vector3* obj_space_normal_out, Ray ray, Vector3 tip, RaytracedParametricObject3D* object){
+    Vector3 tsource = mat4_mult_point(ray.origin, object->inverse);
+    Ray obj_space_ray = {
+        .origin=tsource,
+        .direction=vec3_sub(mat4_mult_point(tip, object->inverse), tsource)
+    };
+    return intersect_primitive(t_out, obj_space_normal_out, obj_space_ray, object->object_type);
+}
+
+bool raytrace_mesh(int* tri_out, double* t_out, Vector2* barycentric_out, double closest_t, Ray ray, const Mesh* mesh){
+    if(USE_MESH_BVH && mesh->bvh.num_nodes > 0) return intersect_mesh_bvh(tri_out, t_out, barycentric_out, closest_t, ray, mesh);
+    return intersect_mesh_linear(tri_out, t_out, barycentric_out, closest_t, ray, mesh);
+}
+
+/**
+ * @brief The closest surface hit by a ray. Exactly one of mesh and object is set
+ */
+typedef struct {
+    double t;
+    Mesh* mesh;
+    int triangle;
+    Vector2 surface_coords;
+    RaytracedParametricObject3D* object;
+    Vector3 obj_space_normal;
+} ClosestHit;
+
+/**
+ * @brief The meshes of a scene, each an instance placed by its transform, and the top level of the two
+ * level hierarchy over them: a BVH whose primitives are the meshes' world space bounds. Each mesh's own
+ * BVH is the bottom level, walked with the ray moved into the mesh's object space
+ */
+typedef struct {
+    Mesh* meshes;
+    int num_meshes;
+    // NULL_BVH tests every mesh in turn
+    BVH instances;
+} SceneMeshes;
+
+/**
+ * @brief Gathers the meshes of a scene, building the top level BVH over them if there are enough to need it
+ */
+static SceneMeshes make_scene_meshes(Mesh* meshes, int num_meshes, bool build_instance_bvh){
+    SceneMeshes scene = {
+        .meshes=meshes,
+        .num_meshes=num_meshes,
+        .instances=NULL_BVH
+    };
+    if(!build_instance_bvh || !USE_INSTANCE_BVH || !USE_MESH_BVH || num_meshes < 2) return scene;
+
+    AABB* bounds = (AABB*)malloc(sizeof(AABB) * num_meshes);
+    Vector3* centroids = (Vector3*)malloc(sizeof(Vector3) * num_meshes);
+    if(bounds == NULL || centroids == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for instance BVH\n");
+        exit(1);
+    }
+    for(int m = 0; m < num_meshes; m++){
+        // Meshes nothing can hit still need a finite box, so they get a point at the origin
+        if(meshes[m].hidden || mesh_geometry(&meshes[m])->num_tris <= 0) bounds[m] = (AABB){{0, 0, 0}, {0, 0, 0}};
+        else mesh_world_bounds(&meshes[m], &bounds[m]);
+        centroids[m] = vec3_scale(vec3_add(bounds[m].min, bounds[m].max), 0.5);
+    }
+    bvh_build(&scene.instances, bounds, centroids, num_meshes);
+    free(bounds);
+    free(centroids);
+    return scene;
+}
+
+static void delete_scene_meshes(SceneMeshes* scene){
+    bvh_delete(&scene->instances);
+}
+
+/**
+ * @brief Moves a world space ray into the object space of a mesh. Ray parameters are the same in both spaces
+ */
+static Ray ray_to_object_space(Ray ray, double inverse[4][4]){
+    Ray result = {
+        .origin=mat4_mult_point(ray.origin, inverse),
+        .direction={
+            inverse[0][0] * ray.direction.x + inverse[0][1] * ray.direction.y + inverse[0][2] * ray.direction.z,
+            inverse[1][0] * ray.direction.x + inverse[1][1] * ray.direction.y + inverse[1][2] * ray.direction.z,
+            inverse[2][0] * ray.direction.x + inverse[2][1] * ray.direction.y + inverse[2][2] * ray.direction.z
+        }
+    };
+    return result;
+}
+
+/**
+ * @brief Moves an object space normal into world space with the transpose of the object's inverse transform.
+ * The result is not normalized
+ */
+static Vector3 normal_to_world_space(Vector3 normal, double inverse[4][4]){
+    Vector3 result = {
+        normal.x * inverse[0][0] + normal.y * inverse[1][0] + normal.z * inverse[2][0],
+        normal.x * inverse[0][1] + normal.y * inverse[1][1] + normal.z * inverse[2][1],
+        normal.x * inverse[0][2] + normal.y * inverse[1][2] + normal.z * inverse[2][2]
+    };
+    return result;
+}
+
+/**
+ * @brief Intersects a world space ray with one mesh of a scene
+ *
+ * @param hit Updated if the mesh is hit closer than hit->t
+ * @return true if the mesh was hit closer than hit->t
+ */
+static bool intersect_scene_mesh(ClosestHit* hit, Ray ray, Mesh* mesh){
+    if(mesh->hidden) return false;
+    if(mesh_is_transformed(mesh)) ray = ray_to_object_space(ray, mesh->inverse_transform);
+    const Mesh* geometry = mesh_geometry(mesh);
+    if(!intersects_bounding_box(geometry, ray)) return false;
+    int tri;
+    double t;
+    Vector2 surface_coords;
+    if(!raytrace_mesh(&tri, &t, &surface_coords, hit->t, ray, geometry)) return false;
+    hit->t = t;
+    hit->mesh = mesh;
+    hit->triangle = tri;
+    hit->surface_coords = surface_coords;
+    return true;
+}
+
+/**
+ * @brief Checks whether any triangle of one mesh of a scene blocks a world space ray before max_t
+ */
+static bool occluded_scene_mesh(double max_t, Ray ray, Mesh* mesh){
+    if(mesh->hidden) return false;
+    if(mesh_is_transformed(mesh)) ray = ray_to_object_space(ray, mesh->inverse_transform);
+    const Mesh* geometry = mesh_geometry(mesh);
+    if(!intersects_bounding_box(geometry, ray)) return false;
+    if(USE_MESH_BVH && geometry->bvh.num_nodes > 0) return occluded_mesh_bvh(max_t, ray, geometry);
+    for(int i = 0; i < geometry->num_tris; i++){
+        if(intersect_mesh_triangle(NULL, NULL, max_t, ray, geometry, i)) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Pushes the children of an interior node that a ray enters before max_t onto a traversal stack,
+ * the nearer one last so that it is popped first
+ *
+ * @return The new size of the stack
+ */
+static int push_children_front_to_back(int* stack, int stack_size, const BVH* bvh, const BVHNode* node,
+                                       Ray ray, Vector3 inverse_direction, double max_t){
+    int left = node->left_or_first;
+    double t_left, t_right;
+    bool hit_left = aabb_ray_intersect(&bvh->nodes[left].bounds, ray.origin, inverse_direction, max_t, &t_left);
+    bool hit_right = aabb_ray_intersect(&bvh->nodes[left + 1].bounds, ray.origin, inverse_direction, max_t, &t_right);
+    if(hit_left && hit_right){
+        if(t_left <= t_right){
+            stack[stack_size++] = left + 1;
+            stack[stack_size++] = left;
+        }
+        else {
+            stack[stack_size++] = left;
+            stack[stack_size++] = left + 1;
+        }
+    }
+    else if(hit_left) stack[stack_size++] = left;
+    else if(hit_right) stack[stack_size++] = left + 1;
+    return stack_size;
+}
+
+/**
+ * @brief Finds the closest mesh hit by a ray, walking the top level BVH front to back when the scene has one
+ *
+ * @param hit Updated if a mesh is hit closer than hit->t
+ */
+static void find_closest_mesh_hit(ClosestHit* hit, Ray ray, const SceneMeshes* scene){
+    const BVH* bvh = &scene->instances;
+    if(bvh->num_nodes == 0){
+        for(int m = 0; m < scene->num_meshes; m++) intersect_scene_mesh(hit, ray, &scene->meshes[m]);
+        return;
+    }
+
+    Vector3 inverse_direction = {1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z};
+    int stack[BVH_MAX_DEPTH + 1];
+    int stack_size = 0;
+    if(!aabb_ray_intersect(&bvh->nodes[0].bounds, ray.origin, inverse_direction, hit->t, NULL)) return;
+    stack[stack_size++] = 0;
 
-            Vector3 world_space_dir = vec3_sub(mat4_mult_point(pixel_camera_space, cam.inverse_view_matrix), cam.eye);
-            Ray ray = {
-                .origin=cam.eye,
-                .direction=world_space_dir
+    while(stack_size > 0){
+        const BVHNode* node = &bvh->nodes[stack[--stack_size]];
+        if(node->count > 0){
+            for(int i = node->left_or_first; i < node->left_or_first + node->count; i++){
+                intersect_scene_mesh(hit, ray, &scene->meshes[bvh->prim_indices[i]]);
+            }
+            continue;
+        }
+        stack_size = push_children_front_to_back(stack, stack_size, bvh, node, ray, inverse_direction, hit->t);
+    }
+}
+
+/**
+ * @brief Checks whether any mesh of a scene blocks a ray before max_t
+ */
+static bool scene_meshes_occluded(Ray ray, double max_t, const SceneMeshes* scene){
+    const BVH* bvh = &scene->instances;
+    if(bvh->num_nodes == 0){
+        for(int m = 0; m < scene->num_meshes; m++){
+            if(occluded_scene_mesh(max_t, ray, &scene->meshes[m])) return true;
+        }
+        return false;
+    }
+
+    Vector3 inverse_direction = {1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z};
+    int stack[BVH_MAX_DEPTH + 1];
+    int stack_size = 0;
+    if(!aabb_ray_intersect(&bvh->nodes[0].bounds, ray.origin, inverse_direction, max_t, NULL)) return false;
+    stack[stack_size++] = 0;
+
+    while(stack_size > 0){
+        const BVHNode* node = &bvh->nodes[stack[--stack_size]];
+        if(node->count > 0){
+            for(int i = node->left_or_first; i < node->left_or_first + node->count; i++){
+                if(occluded_scene_mesh(max_t, ray, &scene->meshes[bvh->prim_indices[i]])) return true;
+            }
+            continue;
+        }
+        int left = node->left_or_first;
+        if(aabb_ray_intersect(&bvh->nodes[left].bounds, ray.origin, inverse_direction, max_t, NULL)) stack[stack_size++] = left;
+        if(aabb_ray_intersect(&bvh->nodes[left + 1].bounds, ray.origin, inverse_direction, max_t, NULL)) stack[stack_size++] = left + 1;
+    }
+    return false;
+}
+
+/**
+ * @brief The parametric objects of a scene and a BVH over their world space bounds, so that a ray
+ * only tests the objects whose boxes it passes through
+ */
+typedef struct {
+    RaytracedParametricObject3D* objs;
+    int num_objs;
+    // NULL_BVH tests every object in turn
+    BVH bvh;
+    // The object under each primitive of the BVH, followed by the unbounded objects every ray tests
+    int* order;
+    int num_bounded;
+} SceneObjects;
+
+/**
+ * @brief Computes the world space bounds of an object
+ *
+ * @return false if the object is unbounded
+ */
+static bool object_world_bounds(RaytracedParametricObject3D* object, AABB* bounds_out){
+    double (*m)[4] = object->transform;
+    if(object->object_type != SPHERE){
+        AABB local;
+        if(!primitive_bounds(object->object_type, &local)) return false;
+        bounds_out->min = (Vector3){INFINITY, INFINITY, INFINITY};
+        bounds_out->max = (Vector3){-INFINITY, -INFINITY, -INFINITY};
+        for(int corner = 0; corner < 8; corner++){
+            Vector3 point = {
+                corner & 1 ? local.max.x : local.min.x,
+                corner & 2 ? local.max.y : local.min.y,
+                corner & 4 ? local.max.z : local.min.z
             };
-            if(SHOW_WORLD_DIRECTION_MISSES){
-                G_rgb(SPREAD_COL3(vec3_normalized(world_space_dir)));
-                G_pixel(x, y);
+            aabb_grow_point(bounds_out, mat4_mult_point(point, object->transform));
+        }
+        // Rounding in the intersection can put a hit on a face just outside the box
+        Vector3 pad = vec3_scale(vec3_sub(bounds_out->max, bounds_out->min), 1e-9);
+        bounds_out->min = vec3_sub(bounds_out->min, pad);
+        bounds_out->max = vec3_add(bounds_out->max, pad);
+        return true;
+    }
+
+    // An affine transform stretches the unit sphere into an ellipsoid reaching the length of row i
+    // of the transform from its center along axis i
+    Vector3 center = {m[0][3], m[1][3], m[2][3]};
+    Vector3 extent = {
+        sqrt(m[0][0] * m[0][0] + m[0][1] * m[0][1] + m[0][2] * m[0][2]),
+        sqrt(m[1][0] * m[1][0] + m[1][1] * m[1][1] + m[1][2] * m[1][2]),
+        sqrt(m[2][0] * m[2][0] + m[2][1] * m[2][1] + m[2][2] * m[2][2])
+    };
+    // Rounding in the intersection can put a grazing hit just outside the exact box
+    extent = vec3_scale(extent, 1 + 1e-9);
+    bounds_out->min = vec3_sub(center, extent);
+    bounds_out->max = vec3_add(center, extent);
+    return true;
+}
+
+/**
+ * @brief Gathers the objects of a scene, building the BVH over them if there are enough to need it
+ */
+static SceneObjects make_scene_objects(RaytracedParametricObject3D* objs, int num_objs, bool build_object_bvh){
+    SceneObjects objects = {
+        .objs=objs,
+        .num_objs=num_objs,
+        .bvh=NULL_BVH,
+        .order=NULL,
+        .num_bounded=0
+    };
+    if(!build_object_bvh || !USE_OBJECT_BVH || num_objs < 2) return objects;
+
+    AABB* bounds = (AABB*)malloc(sizeof(AABB) * num_objs);
+    Vector3* centroids = (Vector3*)malloc(sizeof(Vector3) * num_objs);
+    objects.order = (int*)malloc(sizeof(int) * num_objs);
+    if(bounds == NULL || centroids == NULL || objects.order == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for object BVH\n");
+        exit(1);
+    }
+    int num_unbounded = 0;
+    for(int o = 0; o < num_objs; o++){
+        int b = objects.num_bounded;
+        if(!object_world_bounds(&objs[o], &bounds[b])){
+            objects.order[num_objs - ++num_unbounded] = o;
+            continue;
+        }
+        centroids[b] = vec3_scale(vec3_add(bounds[b].min, bounds[b].max), 0.5);
+        objects.order[objects.num_bounded++] = o;
+    }
+    if(objects.num_bounded >= 2) bvh_build(&objects.bvh, bounds, centroids, objects.num_bounded);
+    else {
+        free(objects.order);
+        objects.order = NULL;
+        objects.num_bounded = 0;
+    }
+    free(bounds);
+    free(centroids);
+    return objects;
+}
+
+static void delete_scene_objects(SceneObjects* objects){
+    bvh_delete(&objects->bvh);
+    free(objects->order);
+}
+
+/**
+ * @brief Tests a ray against one object of a scene
+ *
+ * @param hit Updated if the object is hit closer than hit->t
+ */
+static void intersect_scene_object(ClosestHit* hit, Ray ray, Vector3 tip, RaytracedParametricObject3D* object){
+    double t;
+    Vector3 obj_space_normal;
+    if(!intersect_object(&t, &obj_space_normal, ray, tip, object)) return;
+    if(t < hit->t && t > 0){
+        hit->t = t;
+        hit->object = object;
+        hit->obj_space_normal = obj_space_normal;
+    }
+}
+
+/**
+ * @brief Checks whether any object of a scene blocks a ray before max_t
+ */
+static bool scene_objects_occluded(Ray ray, double max_t, const SceneObjects* objects){
+    Vector3 tip = vec3_add(ray.origin, ray.direction);
+    const BVH* bvh = &objects->bvh;
+    if(bvh->num_nodes == 0){
+        for(int o = 0; o < objects->num_objs; o++){
+            double t;
+            if(intersect_object(&t, NULL, ray, tip, &objects->objs[o]) && t > EPSILON && t < max_t) return true;
+        }
+        return false;
+    }
+
+    for(int i = objects->num_bounded; i < objects->num_objs; i++){
+        double t;
+        if(intersect_object(&t, NULL, ray, tip, &objects->objs[objects->order[i]]) && t > EPSILON && t < max_t) return true;
+    }
+
+    Vector3 inverse_direction = {1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z};
+    int stack[BVH_MAX_DEPTH + 1];
+    int stack_size = 0;
+    if(!aabb_ray_intersect(&bvh->nodes[0].bounds, ray.origin, inverse_direction, max_t, NULL)) return false;
+    stack[stack_size++] = 0;
+
+    while(stack_size > 0){
+        const BVHNode* node = &bvh->nodes[stack[--stack_size]];
+        if(node->count > 0){
+            for(int i = node->left_or_first; i < node->left_or_first + node->count; i++){
+                double t;
+                RaytracedParametricObject3D* object = &objects->objs[objects->order[bvh->prim_indices[i]]];
+                if(intersect_object(&t, NULL, ray, tip, object) && t > EPSILON && t < max_t) return true;
             }
-            RayHitInfo hit;
-            if(raytrace(&hit, ray, numBounces ? numBounces : MAX_BOUNCES, 
-                        objs, num_objs, 
-                        meshes,num_meshes, false,
-                        lights, num_lights)){
-                G_rgb(SPREAD_COL3(hit.color));
-                G_pixel(x, y);
+            continue;
+        }
+        int left = node->left_or_first;
+        if(aabb_ray_intersect(&bvh->nodes[left].bounds, ray.origin, inverse_direction, max_t, NULL)) stack[stack_size++] = left;
+        if(aabb_ray_intersect(&bvh->nodes[left + 1].bounds, ray.origin, inverse_direction, max_t, NULL)) stack[stack_size++] = left + 1;
+    }
+    return false;
+}
+
+/**
+ * @brief raytrace_occluded over a scene's meshes and objects
+ */
+static bool scene_occluded(Ray ray, double max_t, const SceneObjects* objects, const SceneMeshes* scene){
+    return scene_meshes_occluded(ray, max_t, scene) || scene_objects_occluded(ray, max_t, objects);
+}
+
+bool raytrace_occluded(Ray ray, double max_t,
+                       RaytracedParametricObject3D* objs, int num_objs,
+                       Mesh* meshes, int num_meshes){
+    SceneMeshes scene = make_scene_meshes(meshes, num_meshes, false);
+    SceneObjects objects = make_scene_objects(objs, num_objs, false);
+    return scene_occluded(ray, max_t, &objects, &scene);
+}
+
+/**
+ * @brief Replaces a ray's closest hit with the closest object that is strictly closer than it,
+ * walking the object BVH front to back when the scene has one
+ *
+ * @param hit The closest hit on the meshes, with t = INFINITY and no mesh if there is none
+ * @return true if anything was hit
+ */
+static bool find_closest_object_hit(ClosestHit* hit, Ray ray, const SceneObjects* objects){
+    Vector3 tip = vec3_add(ray.origin, ray.direction);
+    const BVH* bvh = &objects->bvh;
+    if(bvh->num_nodes == 0){
+        for(int o = 0; o < objects->num_objs; o++) intersect_scene_object(hit, ray, tip, &objects->objs[o]);
+    }
+    else {
+        // Unbounded objects go first so that their hits can cut the walk short
+        for(int i = objects->num_bounded; i < objects->num_objs; i++){
+            intersect_scene_object(hit, ray, tip, &objects->objs[objects->order[i]]);
+        }
+        Vector3 inverse_direction = {1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z};
+        int stack[BVH_MAX_DEPTH + 1];
+        int stack_size = 0;
+        if(aabb_ray_intersect(&bvh->nodes[0].bounds, ray.origin, inverse_direction, hit->t, NULL)) stack[stack_size++] = 0;
+
+        while(stack_size > 0){
+            const BVHNode* node = &bvh->nodes[stack[--stack_size]];
+            if(node->count > 0){
+                for(int i = node->left_or_first; i < node->left_or_first + node->count; i++){
+                    intersect_scene_object(hit, ray, tip, &objects->objs[objects->order[bvh->prim_indices[i]]]);
+                }
+                continue;
+            }
+            stack_size = push_children_front_to_back(stack, stack_size, bvh, node, ray, inverse_direction, hit->t);
+        }
+    }
+    if(hit->object != NULL) hit->mesh = NULL;
+    return hit->mesh != NULL || hit->object != NULL;
+}
+
+/**
+ * @brief Finds the closest mesh triangle or object hit by a ray. Objects only win over
+ * meshes when they are strictly closer
+ *
+ * @return true if anything was hit
+ */
+static bool find_closest_hit(ClosestHit* hit, Ray ray, const SceneObjects* objects,
+                             const SceneMeshes* scene, bool skipMeshes){
+    hit->t = INFINITY;
+    hit->mesh = NULL;
+    hit->object = NULL;
+    if(!skipMeshes) find_closest_mesh_hit(hit, ray, scene);
+    return find_closest_object_hit(hit, ray, objects);
+}
+
+/**
+ * @brief The scene a shadow ray is traced through, and the point it starts from
+ */
+typedef struct {
+    Vector3 origin;
+    const SceneObjects* objects;
+    const SceneMeshes* scene;
+} ShadowQuery;
+
+static bool light_is_visible(void* context, const PhongLight* light){
+    ShadowQuery* query = (ShadowQuery*)context;
+    // The direction reaches the light at t = 1, so anything hit before that casts a shadow
+    Ray shadow_ray = {
+        .origin=query->origin,
+        .direction=vec3_sub(light->position, query->origin)
+    };
+    return !scene_occluded(shadow_ray, 1 - EPSILON, query->objects, query->scene);
+}
+
+/**
+ * @brief One level of the bounce stack: the shading of a hit and what its reflection
+ * contributes if the reflected ray finds nothing
+ */
+typedef struct {
+    Color3 local;
+    double roughness;
+    Color3 miss_color;
+} Bounce;
+
+/**
+ * @brief Where the rays of a path went: the surfaces they hit, and the direction of the last ray if it
+ * hit nothing. Shadow rays run from every vertex to the lights
+ */
+typedef struct {
+    // Room for as many vertices as the path has bounces
+    Vector3* vertices;
+    int length;
+    bool escaped;
+    Vector3 escape_direction;
+} PathRecord;
+
+/**
+ * @brief The bounce loop behind raytrace
+ *
+ * @param first_hit The closest hit of the ray if it is already known, as it is for packets, or NULL to find it
+ * @param path If not NULL, set to where the rays went
+ */
+static bool trace_ray(RayHitInfo* out, Ray ray, int depth, const ClosestHit* first_hit, PathRecord* path,
+                      const SceneObjects* objects,
+                      const SceneMeshes* scene, bool skipMeshes,
+                      PhongLight* lights, int num_lights){
+    if(depth <= 0) return false;
+    if(depth > RAYTRACE_MAX_DEPTH) depth = RAYTRACE_MAX_DEPTH;
+
+    // Every hit along the reflection path is shaded on the way down and the colors are
+    // blended on the way back up, deepest first, just as the recursion used to
+    Bounce bounces[RAYTRACE_MAX_DEPTH];
+    int num_bounces = 0;
+    ShadowQuery shadows = {
+        .objects=objects,
+        .scene=scene
+    };
+    if(path != NULL) path->escaped = false;
+
+    while(num_bounces < depth){
+        ClosestHit hit;
+        bool found;
+        if(num_bounces == 0 && first_hit != NULL){
+            hit = *first_hit;
+            found = hit.mesh != NULL || hit.object != NULL;
+        }
+        // Only the primary ray may skip the meshes
+        else found = find_closest_hit(&hit, ray, objects, scene, skipMeshes && num_bounces == 0);
+        if(!found){
+            if(path != NULL){
+                path->escaped = true;
+                path->escape_direction = ray.direction;
             }
-            else if (SHOW_MISSES){
-                G_rgb(.2,.54,.54);
-                G_pixel(x, y);
+            break;
+        }
+
+        Bounce* bounce = &bounces[num_bounces];
+        Vector3 location;
+        Vector3 normal;
+        const PhongMaterial* material;
+        if(hit.object != NULL){
+            RaytracedParametricObject3D* object = hit.object;
+            double (*inverse)[4] = object->inverse;
+            location = vec3_add(ray.origin, vec3_scale(ray.direction, hit.t));
+            normal = normal_to_world_space(hit.obj_space_normal, inverse);
+            material = &object->material;
+            bounce->roughness = object->roughness;
+        }
+        else {
+            Mesh* mesh = hit.mesh;
+            const Mesh* geometry = mesh_geometry(mesh);
+            bool transformed = mesh_is_transformed(mesh);
+            Vector3 face_normal = geometry->face_normals[hit.triangle];
+            if(transformed) face_normal = normal_to_world_space(face_normal, mesh->inverse_transform);
+            const uint32_t* indices = &geometry->indices[3 * hit.triangle];
+            Vector2 surface_coords = hit.surface_coords;
+
+            //project incoming ray onto triangle normal
+            double num = vec3_dot_prod(vec3_normalized(ray.origin), face_normal);
+            double den = vec3_dot_prod(face_normal,face_normal);
+            normal = vec3_normalized(vec3_scale(face_normal, num/den));
+            if(SMOOTH_LIGHTING_NORMALS){
+                Vector3 smooth_normal = vec3_add(
+                    vec3_scale(geometry->normals[indices[1]], surface_coords.x),
+                    vec3_scale(geometry->normals[indices[2]], surface_coords.y)
+                );
+                smooth_normal = vec3_add(smooth_normal, vec3_scale(geometry->normals[indices[0]], 1 - surface_coords.x - surface_coords.y));
+                normal = transformed ? normal_to_world_space(smooth_normal, mesh->inverse_transform) : smooth_normal;
             }
-    
+            location = vec3_add(ray.origin, vec3_scale(ray.direction, hit.t));
+            material = &mesh->material;
+            bounce->roughness = mesh->roughness;
         }
+
+        if(path != NULL) path->vertices[num_bounces] = location;
+        Vector3 offset_location = vec3_add(location, vec3_scale(normal, 0.0000000001));
+        vec3_normalize(&normal);
+        if(num_bounces == 0){
+            out->location = location;
+            out->normal = normal;
+        }
+
+        Vector3 reflection = vec3_reflection(
+            vec3_normalized(vec3_sub(location, ray.origin)),
+            normal);
+
+        shadows.origin = offset_location;
+        bounce->local = phong_lighting_eye_visible(location, normal, ray.origin, material, lights, num_lights,
+                                                   SHADOWS ? light_is_visible : NULL, &shadows);
+        if(hit.object != NULL) bounce->miss_color = reflection;
+        else if(SHOW_WORLD_DIRECTION) bounce->miss_color = vec3_normalized(reflection);
+        else if(SHOW_TRIANGLE_NORMALS) bounce->miss_color = normal;
+        else bounce->miss_color = (Color3){BLACK};
+        num_bounces++;
+
+        ray.origin = offset_location;
+        ray.direction = reflection;
+    }
+    if(path != NULL) path->length = num_bounces;
+    if(num_bounces == 0) return false;
+
+    // The deepest reflection found nothing, or ran out of bounces
+    Color3 color = bounces[num_bounces - 1].miss_color;
+    for(int i = num_bounces - 1; i >= 0; i--){
+        color = vec3_add(
+                    vec3_scale(bounces[i].local, bounces[i].roughness),
+                    vec3_scale(color, 1.0 - bounces[i].roughness));
     }
+    out->color = color;
+    return true;
 }
 
 bool raytrace  (RayHitInfo* out, Ray ray, int depth,
                 RaytracedParametricObject3D* objs, int num_objs, 
                 Mesh* meshes, int num_meshes, bool skipMeshes,
                 PhongLight* lights, int num_lights){
-    double closest_t = INFINITY;
-    bool did_hit = false;
-    if(depth == 0) return false;
-    // RayHitInfo result = {
-    //     .location={NAN, NAN, NAN},
-    //     .normal={NAN, NAN, NAN},
-    //     .color={BLACK}
-    // };
-    Vector3 tip = vec3_add(ray.origin, ray.direction);
-    if(!skipMeshes && num_meshes > 0){
-        for(int m = 0; m < num_meshes; m++){
-            if(meshes[m].hidden) continue;
-            Mesh mesh = meshes[m];
-            // printf("Mesh %d\tintersects: %d\n", m, intersects_bounding_box(mesh, ray));
-            if(!intersects_bounding_box(mesh, ray)) continue;
-            for(int t = 0; t < mesh.num_tris; t++){
-                Triangle triangle = mesh.tris[t];
-                double t;
-                Vector2 surface_coords;
-                if(intersect_triangle(&t, &surface_coords, closest_t, ray, triangle)){
-                    closest_t = t;
-                    if(out == NULL) return true;
-                    did_hit = true;
+    if(depth <= 0) return false;
+    if(out == NULL) return raytrace_occluded(ray, INFINITY, objs, num_objs, meshes, skipMeshes ? 0 : num_meshes);
+    SceneMeshes scene = make_scene_meshes(meshes, num_meshes, false);
+    SceneObjects objects = make_scene_objects(objs, num_objs, false);
+    return trace_ray(out, ray, depth, NULL, NULL, &objects, &scene, skipMeshes, lights, num_lights);
+}
+
+/**
+ * @brief Everything needed to trace the pixels of a frame, shared by every tile
+ */
+typedef struct {
+    // The pixels traced, which cover a frame_width x frame_height screen in blocks of pixel_size
+    int width;
+    int height;
+    int frame_width;
+    int frame_height;
+    int pixel_size;
+    Camera* cam;
+    double film_extent;
+    SceneObjects* objects;
+    SceneMeshes* scene;
+    PhongLight* lights;
+    int num_lights;
+    int depth;
+    int tiles_x;
+    bool use_packets;
+    // NULL draws every pixel straight to FPToolkit
+    Framebuffer* framebuffer;
+    // If set, every pixel adds a sample here instead of being drawn
+    AccumulationBuffer* accumulation;
+    // Where the primary rays pass through each pixel, in pixels from its corner
+    Vector2 sample_offset;
+    // If set, only the pixels marked here are traced
+    const bool* active_pixels;
+    // If set, pixels are traced as its modes say and only stored in it, to be drawn at the end
+    HitCache* cache;
+} RaytraceJob;
+
+/**
+ * @brief Gets the primary ray through a pixel
+ */
+static Ray primary_ray(RaytraceJob* job, int x, int y){
+    double dwidth = (double)job->frame_width;
+    double dheight = (double)job->frame_height;
+    double screen_x = (x + job->sample_offset.x) * job->pixel_size;
+    double screen_y = (y + job->sample_offset.y) * job->pixel_size;
+    //TODO: make this work for different aspect ratios
+    Vector3 pixel_camera_space = {
+        ((screen_x - (dwidth / 2)) / dwidth) * (job->film_extent * 2),
+        ((screen_y - (dheight / 2)) / dheight) * (job->film_extent * 2),
+        1
+    };
+
+    Vector3 world_space_dir = vec3_sub(mat4_mult_point(pixel_camera_space, job->cam->inverse_view_matrix), job->cam->eye);
+    Ray ray = {
+        .origin=job->cam->eye,
+        .direction=world_space_dir
+    };
+    return ray;
+}
+
+/**
+ * @brief Traces a primary ray and its reflections
+ * 
+ * @param color_out Set to the color of the pixel
+ * @param first_hit The closest hit of the ray if it is already known, or NULL to find it
+ * @param path If not NULL, set to where the rays went
+ * @return true if the pixel should be drawn
+ */
+static bool shade_primary_ray(Color3* color_out, RaytraceJob* job, Ray ray, const ClosestHit* first_hit, PathRecord* path){
+    RayHitInfo hit;
+    if(trace_ray(&hit, ray, job->depth, first_hit, path,
+                 job->objects,
+                 job->scene, false,
+                 job->lights, job->num_lights)){
+        *color_out = hit.color;
+        return true;
+    }
+    else if (SHOW_MISSES){
+        *color_out = (Color3){.2,.54,.54};
+        return true;
+    }
+    else if(SHOW_WORLD_DIRECTION_MISSES){
+        *color_out = vec3_normalized(ray.direction);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Adds a pixel's sample to the job's accumulation buffer, or writes the pixel to the job's
+ * framebuffer, or straight to FPToolkit when it has neither
+ *
+ * @param color The color of the pixel, or NULL if its ray hit nothing and it should not be drawn
+ */
+static void put_pixel(RaytraceJob* job, int x, int y, const Color3* color){
+    if(job->accumulation != NULL){
+        accumulate_sample(job->accumulation, x, y, color);
+        return;
+    }
+    if(color == NULL) return;
+    if(job->framebuffer != NULL){
+        framebuffer_set_pixel(job->framebuffer, x, y, *color);
+        return;
+    }
+    G_rgb(SPREAD_COL3(*color));
+    G_pixel(x, y);
+}
+
+static bool pixel_is_active(RaytraceJob* job, int x, int y){
+    return job->active_pixels == NULL || job->active_pixels[y * job->width + x];
+}
+
+/**
+ * @brief Traces the pixels of a block of at most RAY_PACKET_SIDE x RAY_PACKET_SIDE pixels. Their
+ * primary rays walk the mesh BVHs together as one packet. Objects, shading and reflections, whose rays
+ * are no longer coherent, are then traced one ray at a time
+ */
+static void trace_packet(RaytraceJob* job, int x_start, int y_start, int x_end, int y_end){
+    RayPacket packet;
+    PacketHits packet_hits;
+    Ray rays[RAY_PACKET_SIZE];
+    ClosestHit hits[RAY_PACKET_SIZE];
+    uint32_t active = 0;
+
+    for(int lane = 0; lane < RAY_PACKET_SIZE; lane++){
+        int x = x_start + lane % RAY_PACKET_SIDE;
+        int y = y_start + lane / RAY_PACKET_SIDE;
+        if(x < x_end && y < y_end && pixel_is_active(job, x, y)) active |= 1u << lane;
+        // Lanes past the edge of the frame or on finished pixels repeat the first ray so that they hold ordinary numbers
+        else rays[lane] = lane > 0 ? rays[0] : primary_ray(job, x_start, y_start);
+        if(active & (1u << lane)) rays[lane] = primary_ray(job, x, y);
+        ray_packet_set(&packet, lane, rays[lane].origin, rays[lane].direction);
+        packet_hits.t[lane] = INFINITY;
+        hits[lane].mesh = NULL;
+        hits[lane].object = NULL;
+    }
+    if(active == 0) return;
+
+    for(int m = 0; m < job->scene->num_meshes; m++){
+        Mesh* mesh = &job->scene->meshes[m];
+        if(mesh->hidden) continue;
+        for(uint32_t hit_rays = packet_intersect_mesh(&packet_hits, &packet, mesh_geometry(mesh), active); hit_rays != 0; hit_rays &= hit_rays - 1){
+            int lane = __builtin_ctz(hit_rays);
+            hits[lane].mesh = mesh;
+            hits[lane].triangle = packet_hits.triangle[lane];
+            hits[lane].surface_coords = (Vector2){packet_hits.u[lane], packet_hits.v[lane]};
+        }
+    }
+
+    for(uint32_t lanes = active; lanes != 0; lanes &= lanes - 1){
+        int lane = __builtin_ctz(lanes);
+        hits[lane].t = packet_hits.t[lane];
+        find_closest_object_hit(&hits[lane], rays[lane], job->objects);
+        Color3 color;
+        bool drawn = shade_primary_ray(&color, job, rays[lane], &hits[lane], NULL);
+        put_pixel(job, x_start + lane % RAY_PACKET_SIDE, y_start + lane / RAY_PACKET_SIDE, drawn ? &color : NULL);
+    }
+}
+
+/**
+ * @brief Checks whether the primary rays of a frame can be traced in packets. Packets always walk
+ * the BVH over the triangle records, so they are only used when the scalar path would do the same.
+ * They also test every mesh in turn in world space, so scenes with placed instances go through the
+ * top level BVH one ray at a time instead
+ */
+static bool can_use_packets(Mesh* meshes, int num_meshes){
+    if(!USE_RAY_PACKETS || !USE_MESH_BVH || !USE_TRIANGLE_RECORDS) return false;
+    for(int m = 0; m < num_meshes; m++){
+        if(meshes[m].hidden || mesh_geometry(&meshes[m])->num_tris <= 0) continue;
+        if(mesh_geometry(&meshes[m])->bvh.num_nodes == 0 || mesh_is_transformed(&meshes[m])) return false;
+    }
+    return true;
+}
+
+static void trace_cached_pixel(RaytraceJob* job, int x, int y);
+
+static void raytrace_tile(void* context, int tile, int thread){
+    RaytraceJob* job = (RaytraceJob*)context;
+    int x_start = (tile % job->tiles_x) * TILE_SIZE;
+    int y_start = (tile / job->tiles_x) * TILE_SIZE;
+    int x_end = x_start + TILE_SIZE < job->width ? x_start + TILE_SIZE : job->width;
+    int y_end = y_start + TILE_SIZE < job->height ? y_start + TILE_SIZE : job->height;
 
-                    //project incoming ray onto triangle normal
-                    double num = vec3_dot_prod(vec3_normalized(ray.origin), triangle.normal);
-                    double den = vec3_dot_prod(triangle.normal,triangle.normal);
-                    out->normal = vec3_normalized(vec3_scale(triangle.normal, num/den));
-                    if(SMOOTH_LIGHTING_NORMALS){
-                        Vector3 smooth_normal = vec3_add(
-                            vec3_scale(triangle.b->normal, surface_coords.x),
-                            vec3_scale(triangle.c->normal, surface_coords.y)
-                        );
-                        smooth_normal = vec3_add(smooth_normal, vec3_scale(triangle.a->normal, 1 - surface_coords.x - surface_coords.y));
-                        out->normal = smooth_normal;
-                    }
-
-
-                    Vector3 obj_space_location = vec3_add(ray.origin, vec3_scale(ray.direction, t));
-                    out->location = obj_space_location;
-                    
-                    // out->normal = triangle.normal;
-                    Vector3 offset_location = vec3_add(out->location, vec3_scale(out->normal, 0.0000000001));
-                    vec3_normalize(&out->normal);
-                    
-                    Vector3 reflection = vec3_reflection(
-                        vec3_normalized(vec3_sub(out->location, ray.origin)),
-                        out->normal);
-
-                    Ray reflection_ray = {
-                        .origin=offset_location,
-                        .direction=reflection
-                    };
-
-                    RayHitInfo reflections;
-                    bool hit = raytrace(&reflections, reflection_ray, depth - 1, objs, num_objs, meshes, num_meshes, false, lights, num_lights);
-                    Color3 color = phong_lighting_eye(out->location, out->normal, ray.origin, mesh.material, lights, num_lights);
-
-                    out->color = vec3_add(  
-                                    vec3_scale(color, mesh.roughness),
-                                    vec3_scale(
-                                        (hit ? 
-                                        reflections.color : 
-                                        SHOW_WORLD_DIRECTION ? 
-                                            vec3_normalized(reflection_ray.direction) : 
-                                        SHOW_TRIANGLE_NORMALS ?
-                                            out->normal :
-                                        
-                                            (Color3) {BLACK}
-                                        ),
-                                        1.0 - mesh.roughness)
-                                    );
+    if(job->use_packets){
+        for(int y = y_start; y < y_end; y += RAY_PACKET_SIDE){
+            for(int x = x_start; x < x_end; x += RAY_PACKET_SIDE){
+                trace_packet(job, x, y, x_end, y_end);
+            }
+        }
+        return;
+    }
+    if(job->cache != NULL){
+        for(int y = y_start; y < y_end; y++){
+            for(int x = x_start; x < x_end; x++) trace_cached_pixel(job, x, y);
+        }
+        return;
+    }
+    for(int y = y_start; y < y_end; y++){
+        for(int x = x_start; x < x_end; x++){
+            if(!pixel_is_active(job, x, y)) continue;
+            Color3 color;
+            bool drawn = shade_primary_ray(&color, job, primary_ray(job, x, y), NULL, NULL);
+            put_pixel(job, x, y, drawn ? &color : NULL);
+        }
+    }
+}
+
+static ThreadPool* get_raytrace_pool(){
+    int num_threads = RAYTRACE_THREADS > 0 ? RAYTRACE_THREADS : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(raytrace_pool != NULL && threadpool_num_threads(raytrace_pool) != num_threads){
+        threadpool_delete(raytrace_pool);
+        raytrace_pool = NULL;
+    }
+    if(raytrace_pool == NULL) raytrace_pool = threadpool_create(num_threads);
+    return raytrace_pool;
+}
+
+void set_raytrace_threads(int num_threads){ RAYTRACE_THREADS = num_threads; }
+
+/**
+ * @brief Sets up a job over a scene, building the top level BVHs its rays walk into scene and objects.
+ * The job draws to FPToolkit until it is given an accumulation buffer. Paired with end_raytrace_job
+ */
+static void begin_raytrace_job(RaytraceJob* job, SceneMeshes* scene, SceneObjects* objects,
+                               int width, int height, Camera* cam,
+                               RaytracedParametricObject3D* objs, int num_objs,
+                               Mesh* meshes, int num_meshes,
+                               PhongLight* lights, int num_lights, int numBounces){
+    bool use_packets = can_use_packets(meshes, num_meshes);
+    // Packets test the meshes themselves, but shadow and bounce rays still walk the top level BVH
+    *scene = make_scene_meshes(meshes, num_meshes, true);
+    *objects = make_scene_objects(objs, num_objs, true);
+    *job = (RaytraceJob){
+        .width=width,
+        .height=height,
+        .frame_width=width,
+        .frame_height=height,
+        .pixel_size=1,
+        .cam=cam,
+        .film_extent=tan(to_radians(cam->half_fov_degrees)),
+        .objects=objects,
+        .scene=scene,
+        .lights=lights,
+        .num_lights=num_lights,
+        .depth=numBounces ? numBounces : MAX_BOUNCES,
+        .tiles_x=(width + TILE_SIZE - 1) / TILE_SIZE,
+        .use_packets=use_packets,
+        .framebuffer=NULL,
+        .accumulation=NULL,
+        .sample_offset={0, 0},
+        .active_pixels=NULL,
+        .cache=NULL
+    };
+}
+
+static void end_raytrace_job(RaytraceJob* job){
+    delete_scene_meshes(job->scene);
+    delete_scene_objects(job->objects);
+}
+
+/**
+ * @brief Traces every tile of a job's frame
+ */
+static void run_raytrace_job(RaytraceJob* job){
+    int num_tiles = job->tiles_x * ((job->height + TILE_SIZE - 1) / TILE_SIZE);
+    if(RAYTRACE_THREADS == 1){
+        for(int tile = 0; tile < num_tiles; tile++) raytrace_tile(job, tile, 0);
+    }
+    else if(job->accumulation != NULL || job->cache != NULL){
+        // Every tile only writes its own pixels of the accumulation buffer or cache, which FPToolkit never sees
+        threadpool_run(get_raytrace_pool(), num_tiles, raytrace_tile, job);
+    }
+    else {
+        // Tiles are traced in parallel into a private framebuffer, which FPToolkit only sees at the end
+        Framebuffer framebuffer = new_framebuffer(job->width, job->height);
+        job->framebuffer = &framebuffer;
+        threadpool_run(get_raytrace_pool(), num_tiles, raytrace_tile, job);
+        present_framebuffer(&framebuffer);
+        delete_framebuffer(&framebuffer);
+        job->framebuffer = NULL;
+    }
+}
+
+/**
+ * @brief Gets where in its pixels a pass of a progressive render samples. The offsets follow the R2
+ * low discrepancy sequence, so every run of passes covers the pixel evenly however many passes there
+ * end up being, and the first pass samples the pixel corner just as raytrace_scene does
+ */
+static Vector2 pass_sample_offset(int pass){
+    // The plastic number generalizes the golden ratio to two dimensions
+    const double plastic = 1.32471795724474602596;
+    double x = 0.5 + pass / plastic;
+    double y = 0.5 + pass / (plastic * plastic);
+    return (Vector2){x - floor(x) - 0.5, y - floor(y) - 0.5};
+}
+
+/**
+ * @brief Traces one pass of a job into an accumulation buffer
+ */
+static void run_accumulation_pass(RaytraceJob* job, AccumulationBuffer* accumulation){
+    job->accumulation = accumulation;
+    job->sample_offset = pass_sample_offset(accumulation->passes);
+    run_raytrace_job(job);
+    accumulation->passes++;
+}
+
+static double now_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void raytrace_scene(int width, int height, Camera cam, 
+                    RaytracedParametricObject3D* objs, int num_objs, 
+                    Mesh* meshes, int num_meshes, bool skipMeshes,
+                    PhongLight* lights, int num_lights, 
+                    int numBounces){
+    RaytraceJob job;
+    SceneMeshes scene;
+    SceneObjects objects;
+    begin_raytrace_job(&job, &scene, &objects, width, height, &cam, objs, num_objs, meshes, num_meshes, lights, num_lights, numBounces);
+    run_raytrace_job(&job);
+    end_raytrace_job(&job);
+}
+
+void raytrace_scene_pass(AccumulationBuffer* accumulation, Camera cam,
+                         RaytracedParametricObject3D* objs, int num_objs,
+                         Mesh* meshes, int num_meshes, bool skipMeshes,
+                         PhongLight* lights, int num_lights,
+                         int numBounces){
+    RaytraceJob job;
+    SceneMeshes scene;
+    SceneObjects objects;
+    begin_raytrace_job(&job, &scene, &objects, accumulation->width, accumulation->height, &cam,
+                       objs, num_objs, meshes, num_meshes, lights, num_lights, numBounces);
+    run_accumulation_pass(&job, accumulation);
+    end_raytrace_job(&job);
+}
+
+int raytrace_scene_progressive(int width, int height, Camera cam,
+                               RaytracedParametricObject3D* objs, int num_objs,
+                               Mesh* meshes, int num_meshes, bool skipMeshes,
+                               PhongLight* lights, int num_lights,
+                               int numBounces, int max_samples, double max_seconds){
+    double start = now_seconds();
+    AccumulationBuffer accumulation = new_accumulation_buffer(width, height);
+    RaytraceJob job;
+    SceneMeshes scene;
+    SceneObjects objects;
+    // The scene's top level BVHs are built once and walked by every pass
+    begin_raytrace_job(&job, &scene, &objects, width, height, &cam, objs, num_objs, meshes, num_meshes, lights, num_lights, numBounces);
+    do {
+        run_accumulation_pass(&job, &accumulation);
+        present_accumulation_buffer(&accumulation);
+        G_display_image();
+    } while((max_samples <= 0 || accumulation.passes < max_samples) &&
+            (max_seconds <= 0 || now_seconds() - start < max_seconds) &&
+            (max_samples > 0 || max_seconds > 0));
+    int samples = accumulation.passes;
+    end_raytrace_job(&job);
+    delete_accumulation_buffer(&accumulation);
+    return samples;
+}
+
+/**
+ * @brief Marks the pixels of an accumulation buffer that need more samples: those whose error is
+ * still above max_error, and their 8 neighbours, so that an edge that the first samples of a pixel
+ * happened to miss is still found through the pixel next to it
+ *
+ * @param active Set to whether each pixel needs more samples
+ * @return The number of pixels marked
+ */
+static int mark_unconverged_pixels(bool* active, const AccumulationBuffer* accumulation, double max_error){
+    int width = accumulation->width;
+    int height = accumulation->height;
+    for(int i = 0; i < width * height; i++) active[i] = false;
+    for(int y = 0; y < height; y++){
+        for(int x = 0; x < width; x++){
+            if(accumulation_pixel_error(accumulation, y * width + x) <= max_error) continue;
+            for(int ny = y - 1; ny <= y + 1; ny++){
+                for(int nx = x - 1; nx <= x + 1; nx++){
+                    if(nx >= 0 && nx < width && ny >= 0 && ny < height) active[ny * width + nx] = true;
                 }
             }
         }
     }
+    int num_active = 0;
+    for(int i = 0; i < width * height; i++) num_active += active[i];
+    return num_active;
+}
 
-    for(int o = 0; o < num_objs; o++){
-        
-        RaytracedParametricObject3D object =  objs[o] ;
-        
-        Vector3 tsource = mat4_mult_point(ray.origin, object.inverse);
-        Vector3 tdir = vec3_sub(mat4_mult_point(tip, object.inverse), tsource);
-
-        // Now we need to foil the terms:
-        //(tsrc * tsrc)
-        // Vector3 tip_dir = ray.direction; //vec3_sub(ttip, tsource);
-        // Vector3 tsource = ray.origin;
-        Vector3 va = vec3_mult(tdir, tdir);
-        // (tdir * tsrc) + (tsrc * tdir)
-        Vector3 vb = vec3_scale(vec3_mult(tdir, tsource), 2);
-        // (tdir * tdir)
-        Vector3 vc = vec3_mult(tsource, tsource);
-        //Add terms together
-        double a = va.x + va.y + va.z;
-        double b = vb.x + vb.y + vb.z;
-        double c = vc.x + vc.y + vc.z - 1;
-
-        //
-        double under_sqrt = (b * b) - (4 * a * c);
-        if(under_sqrt < 0) continue; // did not intersect with object
-        double t_plus = (-b + sqrt(under_sqrt)) / (2 * a);
-        double t_minus = (-b - sqrt(under_sqrt)) / (2 * a);
+double raytrace_scene_adaptive(int width, int height, Camera cam,
+                               RaytracedParametricObject3D* objs, int num_objs,
+                               Mesh* meshes, int num_meshes, bool skipMeshes,
+                               PhongLight* lights, int num_lights,
+                               int numBounces, int min_samples, int max_samples, double max_error){
+    if(min_samples < 2) min_samples = 2;
+    if(max_samples < min_samples) max_samples = min_samples;
+    AccumulationBuffer accumulation = new_accumulation_buffer(width, height);
+    bool* active = (bool*)malloc(sizeof(bool) * width * height);
+    if(active == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for adaptive sampling\n");
+        exit(1);
+    }
+    RaytraceJob job;
+    SceneMeshes scene;
+    SceneObjects objects;
+    begin_raytrace_job(&job, &scene, &objects, width, height, &cam, objs, num_objs, meshes, num_meshes, lights, num_lights, numBounces);
 
-        double t;
-        if(t_plus < 0 && t_minus < 0) continue; // object is behind camera
-        if(t_plus > 0 && (t_plus < t_minus || t_minus < 0)) t = t_plus;
-        else t = t_minus;
+    // Every pixel gets the same first samples, which its error is estimated from
+    long samples = 0;
+    while(accumulation.passes < min_samples){
+        run_accumulation_pass(&job, &accumulation);
+        samples += (long)width * height;
+    }
+    job.active_pixels = active;
+    while(accumulation.passes < max_samples){
+        int num_active = mark_unconverged_pixels(active, &accumulation, max_error);
+        if(num_active == 0) break;
+        run_accumulation_pass(&job, &accumulation);
+        samples += num_active;
+    }
+    present_accumulation_buffer(&accumulation);
 
-        if(t < closest_t && t > 0){
-            closest_t = t;
-            if(out == NULL) return true;
-            did_hit = true;
+    end_raytrace_job(&job);
+    free(active);
+    delete_accumulation_buffer(&accumulation);
+    return (double)samples / ((double)width * height);
+}
+
+// The block sizes a preview can be traced at, finest first
+static const int PREVIEW_PIXEL_SIZES[] = {1, 2, 3, 4, 6, 8, 12, 16};
+#define NUM_PREVIEW_PIXEL_SIZES (int)(sizeof(PREVIEW_PIXEL_SIZES) / sizeof(PREVIEW_PIXEL_SIZES[0]))
+
+InteractiveRender new_interactive_render(int width, int height, double target_seconds, int max_samples){
+    InteractiveRender render = {
+        .width=width,
+        .height=height,
+        .target_seconds=target_seconds,
+        .max_samples=max_samples > 0 ? max_samples : 1,
+        .num_costs=0,
+        .next_cost=0,
+        .has_frame=false,
+        .pixel_size=1,
+        .bounces=0,
+        .accumulation=new_accumulation_buffer(width, height)
+    };
+    return render;
+}
 
-            Vector3 obj_space_location = vec3_add(tsource, vec3_scale(tdir, t));
-            out->location = vec3_add(ray.origin, vec3_scale(ray.direction, t));
-            Vector3 obj_normal = vec3_scale(obj_space_location, 2);
-            out->normal.x = obj_normal.x * object.inverse[0][0] + obj_normal.y * object.inverse[1][0] + obj_normal.z * object.inverse[2][0];
-            out->normal.y = obj_normal.x * object.inverse[0][1] + obj_normal.y * object.inverse[1][1] + obj_normal.z * object.inverse[2][1];
-            out->normal.z = obj_normal.x * object.inverse[0][2] + obj_normal.y * object.inverse[1][2] + obj_normal.z * object.inverse[2][2];
+void delete_interactive_render(InteractiveRender* render){
+    delete_accumulation_buffer(&render->accumulation);
+}
 
-            Vector3 offset_location = vec3_add(out->location, vec3_scale(out->normal, 0.0000000001));
+void restart_interactive_render(InteractiveRender* render){
+    render->has_frame = false;
+}
 
-            vec3_normalize(&out->normal);
-            
-            Vector3 reflection = vec3_reflection(
-                vec3_normalized(vec3_sub(out->location, ray.origin)),
-                out->normal);
+static bool camera_moved(const Camera* a, const Camera* b){
+    return !vec3_is_equal(a->eye, b->eye) || !vec3_is_equal(a->coi, b->coi) || !vec3_is_equal(a->up, b->up) ||
+           a->half_fov_degrees != b->half_fov_degrees;
+}
 
-            Ray reflection_ray = {
-                .origin=offset_location,
-                .direction=reflection
-            };
+/**
+ * @brief Predicts how many bounces fit the target frame time at a block size, from the average cost per
+ * traced pixel per bounce of recent frames
+ */
+static int affordable_bounces(const InteractiveRender* render, int pixel_size, int full_bounces){
+    double cost = 0;
+    for(int i = 0; i < render->num_costs; i++) cost += render->costs[i];
+    cost /= render->num_costs;
+    double pixels = (double)((render->width + pixel_size - 1) / pixel_size) * ((render->height + pixel_size - 1) / pixel_size);
+    double bounces = render->target_seconds / (cost * pixels);
+    return bounces < full_bounces ? (int)bounces : full_bounces;
+}
 
-            RayHitInfo reflections;
-            bool hit = raytrace(&reflections, reflection_ray, depth - 1, objs, num_objs, meshes, num_meshes, false, lights, num_lights);
-            Color3 color = phong_lighting_eye(out->location, out->normal, ray.origin, object.material, lights, num_lights);
-            out->color = vec3_add(
-                            vec3_scale(color, object.roughness),
-                            vec3_scale(
-                                (hit ? 
-                                reflections.color : 
-                                // (Color3) {BLACK}
-                                reflection_ray.direction
-                                ),
-                                1.0 - object.roughness)
-                            );
+/**
+ * @brief Picks the finest block size at which a preview with at least one bounce fits the target frame
+ * time, and then the most bounces that still fit. Without any history the preview starts at the coarsest size
+ */
+static void pick_preview_quality(InteractiveRender* render, int full_bounces){
+    render->pixel_size = PREVIEW_PIXEL_SIZES[NUM_PREVIEW_PIXEL_SIZES - 1];
+    render->bounces = 1;
+    if(render->num_costs == 0) return;
+
+    for(int i = 0; i < NUM_PREVIEW_PIXEL_SIZES; i++){
+        int bounces = affordable_bounces(render, PREVIEW_PIXEL_SIZES[i], full_bounces);
+        if(bounces < 1) continue;
+        render->pixel_size = PREVIEW_PIXEL_SIZES[i];
+        render->bounces = bounces;
+        return;
+    }
+}
+
+/**
+ * @brief Traces one pass of a job at the render's current block size and bounce count
+ *
+ * @return The seconds it took
+ */
+static double run_interactive_pass(RaytraceJob* job, InteractiveRender* render){
+    job->pixel_size = render->pixel_size;
+    job->width = (render->width + render->pixel_size - 1) / render->pixel_size;
+    job->height = (render->height + render->pixel_size - 1) / render->pixel_size;
+    job->tiles_x = (job->width + TILE_SIZE - 1) / TILE_SIZE;
+    job->depth = render->bounces;
+    double start = now_seconds();
+    run_accumulation_pass(job, &render->accumulation);
+    return now_seconds() - start;
+}
+
+bool raytrace_scene_interactive(InteractiveRender* render, Camera cam,
+                                RaytracedParametricObject3D* objs, int num_objs,
+                                Mesh* meshes, int num_meshes, bool skipMeshes,
+                                PhongLight* lights, int num_lights,
+                                int numBounces){
+    int full_bounces = numBounces ? numBounces : MAX_BOUNCES;
+    bool moved = !render->has_frame || camera_moved(&render->last_camera, &cam);
+    bool refined = render->pixel_size == 1 && render->bounces == full_bounces;
+    if(!moved && refined && render->accumulation.passes >= render->max_samples) return false;
+    render->last_camera = cam;
+    render->has_frame = true;
+
+    RaytraceJob job;
+    SceneMeshes scene;
+    SceneObjects objects;
+    begin_raytrace_job(&job, &scene, &objects, render->width, render->height, &cam,
+                       objs, num_objs, meshes, num_meshes, lights, num_lights, full_bounces);
+    if(moved || !refined){
+        if(moved) pick_preview_quality(render, full_bounces);
+        else if(render->pixel_size > 1){
+            // The camera stopped, so each frame doubles the resolution of the last, with as many bounces as fit
+            render->pixel_size = render->pixel_size / 2 > 1 ? render->pixel_size / 2 : 1;
+            int bounces = affordable_bounces(render, render->pixel_size, full_bounces);
+            if(bounces > render->bounces) render->bounces = bounces;
         }
+        else render->bounces = full_bounces;
+        clear_accumulation_buffer(&render->accumulation);
+        double seconds = run_interactive_pass(&job, render);
+        double traced = (double)job.width * job.height * render->bounces;
+        render->costs[render->next_cost] = seconds / traced;
+        render->next_cost = (render->next_cost + 1) % INTERACTIVE_HISTORY;
+        if(render->num_costs < INTERACTIVE_HISTORY) render->num_costs++;
     }
-    return did_hit;
+    else {
+        // Still and at full quality: spend the frame adding samples
+        double start = now_seconds();
+        do {
+            run_interactive_pass(&job, render);
+        } while(render->accumulation.passes < render->max_samples && now_seconds() - start < render->target_seconds);
+    }
+    end_raytrace_job(&job);
+
+    G_rgb(SPREAD_COL3(render->accumulation.background));
+    G_clear();
+    present_accumulation_buffer_scaled(&render->accumulation, render->pixel_size);
+    return true;
+}
+
+// What a pixel of a hit cache needs this frame
+enum CachedPixelMode {
+    // Nothing it saw changed, so its color is kept
+    PIXEL_KEEP,
+    // Shaded again from its cached primary hit
+    PIXEL_SHADE,
+    // Traced again from scratch
+    PIXEL_TRACE
+};
+
+HitCache new_hit_cache(int width, int height){
+    HitCache cache = {
+        .width=width,
+        .height=height,
+        .pixels=(CachedPixel*)malloc(sizeof(CachedPixel) * width * height),
+        .path_vertices=NULL,
+        .depth=0,
+        .modes=(unsigned char*)malloc(width * height),
+        .valid=false,
+        .objs=NULL,
+        .num_objs=0,
+        .meshes=NULL,
+        .num_meshes=0,
+        .lights=NULL,
+        .num_lights=0
+    };
+    if(cache.pixels == NULL || cache.modes == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for hit cache\n");
+        exit(1);
+    }
+    return cache;
+}
+
+void delete_hit_cache(HitCache* cache){
+    free(cache->pixels);
+    free(cache->path_vertices);
+    free(cache->modes);
+    free(cache->objs);
+    free(cache->meshes);
+    free(cache->lights);
+    *cache = (HitCache){0};
+}
+
+void invalidate_hit_cache(HitCache* cache){
+    cache->valid = false;
+}
+
+/**
+ * @brief Traces or shades a pixel of a job's hit cache again, as its mode says
+ */
+static void trace_cached_pixel(RaytraceJob* job, int x, int y){
+    HitCache* cache = job->cache;
+    int i = y * cache->width + x;
+    if(cache->modes[i] == PIXEL_KEEP) return;
+
+    CachedPixel* pixel = &cache->pixels[i];
+    Ray ray = primary_ray(job, x, y);
+    ClosestHit hit;
+    if(cache->modes[i] == PIXEL_TRACE){
+        find_closest_hit(&hit, ray, job->objects, job->scene, false);
+        pixel->mesh = hit.mesh != NULL ? (int)(hit.mesh - job->scene->meshes) : -1;
+        pixel->object = hit.object != NULL ? (int)(hit.object - job->objects->objs) : -1;
+        pixel->t = hit.t;
+        if(hit.mesh != NULL){
+            pixel->triangle = hit.triangle;
+            pixel->surface_coords = hit.surface_coords;
+        }
+        if(hit.object != NULL) pixel->obj_space_normal = hit.obj_space_normal;
+    }
+    else {
+        hit.t = pixel->t;
+        hit.mesh = pixel->mesh >= 0 ? &job->scene->meshes[pixel->mesh] : NULL;
+        hit.triangle = pixel->triangle;
+        hit.surface_coords = pixel->surface_coords;
+        hit.object = pixel->object >= 0 ? &job->objects->objs[pixel->object] : NULL;
+        hit.obj_space_normal = pixel->obj_space_normal;
+    }
+
+    PathRecord path = {.vertices=&cache->path_vertices[(size_t)i * cache->depth]};
+    pixel->drawn = shade_primary_ray(&pixel->color, job, ray, &hit, &path);
+    pixel->path_length = path.length;
+    pixel->escaped = path.escaped;
+    pixel->escape_direction = path.escape_direction;
+}
+
+static bool material_changed(const PhongMaterial* a, const PhongMaterial* b){
+    return !vec3_is_equal(a->base_color, b->base_color) || !vec3_is_equal(a->diffuse, b->diffuse) ||
+           !vec3_is_equal(a->specular, b->specular) || a->shininess != b->shininess;
+}
+
+static bool object_changed(const RaytracedParametricObject3D* a, const RaytracedParametricObject3D* b){
+    return a->object_type != b->object_type ||
+           memcmp(a->transform, b->transform, sizeof(a->transform)) != 0 ||
+           memcmp(a->inverse, b->inverse, sizeof(a->inverse)) != 0 ||
+           material_changed(&a->material, &b->material) || a->roughness != b->roughness;
+}
+
+/**
+ * @brief Compares a mesh with the copy of it a hit cache keeps (see cache_mesh_copies)
+ */
+static bool mesh_changed(const Mesh* mesh, const Mesh* cached){
+    const Mesh* geometry = mesh_geometry(mesh);
+    return mesh->hidden != cached->hidden || geometry->positions != cached->positions ||
+           geometry->generation != cached->generation ||
+           memcmp(mesh->transform, cached->transform, sizeof(mesh->transform)) != 0 ||
+           memcmp(mesh->inverse_transform, cached->inverse_transform, sizeof(mesh->inverse_transform)) != 0 ||
+           material_changed(&mesh->material, &cached->material) || mesh->roughness != cached->roughness;
+}
+
+static bool lights_changed(const PhongLight* a, const PhongLight* b, int num_lights){
+    for(int l = 0; l < num_lights; l++){
+        if(!vec3_is_equal(a[l].position, b[l].position) || !vec3_is_equal(a[l].diffuse, b[l].diffuse) ||
+           !vec3_is_equal(a[l].specular, b[l].specular)) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Packs the switches that change how hits are shaded
+ */
+static int shading_toggles(){
+    return SHOW_WORLD_DIRECTION | SHOW_TRIANGLE_NORMALS << 1 | SMOOTH_LIGHTING_NORMALS << 2 |
+           SHOW_WORLD_DIRECTION_MISSES << 3 | SHADOWS << 4;
+}
+
+/**
+ * @brief Adds the world space bounds of a mesh to a list of boxes, unless nothing can hit it
+ */
+static void add_mesh_box(AABB* boxes, int* num_boxes, Mesh* mesh){
+    if(mesh->hidden || mesh_geometry(mesh)->num_tris <= 0) return;
+    AABB* box = &boxes[(*num_boxes)++];
+    mesh_world_bounds(mesh, box);
+    // Hits on the faces of the box must still land inside it
+    Vector3 pad = vec3_scale(vec3_sub(box->max, box->min), 1e-9);
+    box->min = vec3_sub(box->min, pad);
+    box->max = vec3_add(box->max, pad);
+}
+
+static bool ray_touches_boxes(Vector3 origin, Vector3 direction, double max_t, const AABB* boxes, int num_boxes){
+    Vector3 inverse_direction = {1.0 / direction.x, 1.0 / direction.y, 1.0 / direction.z};
+    for(int b = 0; b < num_boxes; b++){
+        if(aabb_ray_intersect(&boxes[b], origin, inverse_direction, max_t, NULL)) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Decides what a pixel needs from the boxes around everything that changed: its primary ray,
+ * followed up to its first vertex or out of the scene, decides whether it is traced again, and its
+ * reflections and shadow rays whether it is shaded again
+ */
+static enum CachedPixelMode changed_pixel_mode(const HitCache* cache, int i, Vector3 eye, const AABB* boxes,
+                                               int num_boxes, const PhongLight* lights, int num_lights){
+    const CachedPixel* pixel = &cache->pixels[i];
+    const Vector3* vertices = &cache->path_vertices[(size_t)i * cache->depth];
+    if(pixel->path_length == 0) return ray_touches_boxes(eye, pixel->escape_direction, INFINITY, boxes, num_boxes) ? PIXEL_TRACE : PIXEL_KEEP;
+    if(ray_touches_boxes(eye, vec3_sub(vertices[0], eye), 1, boxes, num_boxes)) return PIXEL_TRACE;
+
+    for(int v = 1; v < pixel->path_length; v++){
+        if(ray_touches_boxes(vertices[v - 1], vec3_sub(vertices[v], vertices[v - 1]), 1, boxes, num_boxes)) return PIXEL_SHADE;
+    }
+    if(pixel->escaped &&
+       ray_touches_boxes(vertices[pixel->path_length - 1], pixel->escape_direction, INFINITY, boxes, num_boxes)) return PIXEL_SHADE;
+    if(SHADOWS){
+        for(int v = 0; v < pixel->path_length; v++){
+            for(int l = 0; l < num_lights; l++){
+                if(ray_touches_boxes(vertices[v], vec3_sub(lights[l].position, vertices[v]), 1, boxes, num_boxes)) return PIXEL_SHADE;
+            }
+        }
+    }
+    return PIXEL_KEEP;
+}
+
+/**
+ * @brief Compares a scene with the one a hit cache was traced from and marks what every pixel needs
+ *
+ * @return The number of pixels to trace or shade again
+ */
+static int mark_cached_pixel_modes(HitCache* cache, const Camera* cam, int depth,
+                                   RaytracedParametricObject3D* objs, int num_objs,
+                                   Mesh* meshes, int num_meshes,
+                                   PhongLight* lights, int num_lights){
+    int num_pixels = cache->width * cache->height;
+    bool retrace = !cache->valid || camera_moved(&cache->camera, cam) || depth != cache->depth ||
+                   num_objs != cache->num_objs || num_meshes != cache->num_meshes ||
+                   TORUS_MAJOR_RADIUS != cache->torus_major_radius || TORUS_MINOR_RADIUS != cache->torus_minor_radius;
+    bool reshade = num_lights != cache->num_lights || shading_toggles() != cache->toggles ||
+                   lights_changed(lights, cache->lights, num_lights);
+
+    // The old and new bounds of everything that changed
+    AABB* boxes = NULL;
+    int num_boxes = 0;
+    if(!retrace){
+        boxes = (AABB*)malloc(sizeof(AABB) * (2 * (num_objs + num_meshes) + 1));
+        if(boxes == NULL){
+            fprintf(stderr, "Failed to allocate sufficient memory for hit cache\n");
+            exit(1);
+        }
+        for(int o = 0; o < num_objs && !retrace; o++){
+            if(!object_changed(&objs[o], &cache->objs[o])) continue;
+            // A plane reaches every pixel
+            retrace = !object_world_bounds(&cache->objs[o], &boxes[num_boxes]) ||
+                      !object_world_bounds(&objs[o], &boxes[num_boxes + 1]);
+            num_boxes += 2;
+        }
+        for(int m = 0; m < num_meshes; m++){
+            if(!mesh_changed(&meshes[m], &cache->meshes[m])) continue;
+            add_mesh_box(boxes, &num_boxes, &cache->meshes[m]);
+            add_mesh_box(boxes, &num_boxes, &meshes[m]);
+        }
+    }
+
+    int num_changed = 0;
+    for(int i = 0; i < num_pixels; i++){
+        if(retrace) cache->modes[i] = PIXEL_TRACE;
+        else {
+            cache->modes[i] = num_boxes > 0 ? changed_pixel_mode(cache, i, cam->eye, boxes, num_boxes, lights, num_lights) : PIXEL_KEEP;
+            if(reshade && cache->modes[i] == PIXEL_KEEP) cache->modes[i] = PIXEL_SHADE;
+        }
+        num_changed += cache->modes[i] != PIXEL_KEEP;
+    }
+    free(boxes);
+    return num_changed;
+}
+
+/**
+ * @brief Copies an array into a buffer of its own, growing the buffer to fit
+ */
+static void* copy_into(void* buffer, const void* array, size_t size){
+    if(size == 0) return buffer;
+    buffer = realloc(buffer, size);
+    if(buffer == NULL){
+        fprintf(stderr, "Failed to allocate sufficient memory for hit cache\n");
+        exit(1);
+    }
+    memcpy(buffer, array, size);
+    return buffer;
+}
+
+/**
+ * @brief Copies the meshes of a frame into a hit cache. An instance's copy takes the positions, bounds and
+ * generation its source has now, since the source may change before the next frame
+ */
+static void cache_mesh_copies(HitCache* cache, Mesh* meshes, int num_meshes){
+    cache->meshes = copy_into(cache->meshes, meshes, sizeof(Mesh) * num_meshes);
+    cache->num_meshes = num_meshes;
+    for(int m = 0; m < num_meshes; m++){
+        Mesh* copy = &cache->meshes[m];
+        if(copy->source == NULL) continue;
+        copy->num_tris = copy->source->num_tris;
+        copy->positions = copy->source->positions;
+        copy->bounding_box_min = copy->source->bounding_box_min;
+        copy->bounding_box_max = copy->source->bounding_box_max;
+        copy->generation = copy->source->generation;
+        copy->source = NULL;
+    }
+}
+
+int raytrace_scene_cached(HitCache* cache, Camera cam,
+                          RaytracedParametricObject3D* objs, int num_objs,
+                          Mesh* meshes, int num_meshes, bool skipMeshes,
+                          PhongLight* lights, int num_lights,
+                          int numBounces){
+    RaytraceJob job;
+    SceneMeshes scene;
+    SceneObjects objects;
+    begin_raytrace_job(&job, &scene, &objects, cache->width, cache->height, &cam,
+                       objs, num_objs, meshes, num_meshes, lights, num_lights, numBounces);
+    int depth = job.depth < RAYTRACE_MAX_DEPTH ? job.depth : RAYTRACE_MAX_DEPTH;
+    int num_changed = mark_cached_pixel_modes(cache, &cam, depth, objs, num_objs, meshes, num_meshes, lights, num_lights);
+    if(depth != cache->depth){
+        free(cache->path_vertices);
+        cache->path_vertices = (Vector3*)malloc(sizeof(Vector3) * cache->width * cache->height * depth);
+        if(cache->path_vertices == NULL){
+            fprintf(stderr, "Failed to allocate sufficient memory for hit cache\n");
+            exit(1);
+        }
+        cache->depth = depth;
+    }
+
+    if(num_changed > 0){
+        // Pixels are traced one at a time, since only some of them are and the primary hits are kept
+        job.use_packets = false;
+        job.cache = cache;
+        run_raytrace_job(&job);
+    }
+    end_raytrace_job(&job);
+
+    for(int y = 0; y < cache->height; y++){
+        for(int x = 0; x < cache->width; x++){
+            const CachedPixel* pixel = &cache->pixels[y * cache->width + x];
+            if(!pixel->drawn) continue;
+            G_rgb(SPREAD_COL3(pixel->color));
+            G_pixel(x, y);
+        }
+    }
+
+    cache->valid = true;
+    cache->camera = cam;
+    cache->objs = copy_into(cache->objs, objs, sizeof(RaytracedParametricObject3D) * num_objs);
+    cache->num_objs = num_objs;
+    cache_mesh_copies(cache, meshes, num_meshes);
+    cache->lights = copy_into(cache->lights, lights, sizeof(PhongLight) * num_lights);
+    cache->num_lights = num_lights;
+    cache->toggles = shading_toggles();
+    cache->torus_major_radius = TORUS_MAJOR_RADIUS;
+    cache->torus_minor_radius = TORUS_MINOR_RADIUS;
+    return num_changed;
 }
@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "threadpool.h"
+
+/**
+ * @brief A range of task indices owned by one thread. The owner takes tasks from the
+ * front and thieves take from the back.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    int begin;
+    int end;
+} WorkQueue;
+
+typedef struct {
+    ThreadPool* pool;
+    int index;
+} Worker;
+
+struct ThreadPool {
+    int num_threads;
+    pthread_t* threads;
+    Worker* workers;
+    WorkQueue* queues;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    unsigned long generation;
+    bool shutting_down;
+
+    ThreadPoolTask task;
+    void* context;
+    int num_tasks;
+    int num_completed;
+    int num_active;
+};
+
+/**
+ * @brief Takes the next task from a thread's own queue, or steals from another thread
+ *
+ * @return int The task index, or -1 if every queue is empty
+ */
+static int next_task(ThreadPool* pool, int thread){
+    WorkQueue* own = &pool->queues[thread];
+    pthread_mutex_lock(&own->lock);
+    if(own->begin < own->end){
+        int task = own->begin++;
+        pthread_mutex_unlock(&own->lock);
+        return task;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for(int i = 1; i < pool->num_threads; i++){
+        WorkQueue* victim = &pool->queues[(thread + i) % pool->num_threads];
+        pthread_mutex_lock(&victim->lock);
+        int remaining = victim->end - victim->begin;
+        if(remaining <= 0){
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        // Take the back half so the victim keeps working on the tasks near where it is
+        int stolen = (remaining + 1) / 2;
+        int first = victim->end - stolen;
+        victim->end = first;
+        pthread_mutex_unlock(&victim->lock);
+
+        pthread_mutex_lock(&own->lock);
+        own->begin = first + 1;
+        own->end = first + stolen;
+        pthread_mutex_unlock(&own->lock);
+        return first;
+    }
+    return -1;
+}
+
+/**
+ * @brief Runs tasks until there are none left and reports how many were run
+ */
+static void work(ThreadPool* pool, int thread, ThreadPoolTask task, void* context){
+    int completed = 0;
+    int t;
+    while((t = next_task(pool, thread)) != -1){
+        task(context, t, thread);
+        completed++;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->num_completed += completed;
+    pool->num_active--;
+    if(pool->num_active == 0) pthread_cond_broadcast(&pool->work_done);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void* worker_main(void* arg){
+    Worker* worker = (Worker*)arg;
+    ThreadPool* pool = worker->pool;
+    unsigned long seen_generation = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while(true){
+        while(!pool->shutting_down && pool->generation == seen_generation){
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if(pool->shutting_down) break;
+
+        seen_generation = pool->generation;
+        ThreadPoolTask task = pool->task;
+        void* context = pool->context;
+        pool->num_active++;
+        pthread_mutex_unlock(&pool->lock);
+
+        work(pool, worker->index, task, context);
+
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ThreadPool* threadpool_create(int num_threads){
+    if(num_threads < 1) num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_threads < 1) num_threads = 1;
+
+    ThreadPool* pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    if(pool == NULL) goto MEM_ERROR;
+    pool->num_threads = num_threads;
+    pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+    pool->workers = (Worker*)malloc(sizeof(Worker) * num_threads);
+    pool->queues = (WorkQueue*)malloc(sizeof(WorkQueue) * num_threads);
+    if(pool->threads == NULL || pool->workers == NULL || pool->queues == NULL) goto MEM_ERROR;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    for(int i = 0; i < num_threads; i++){
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+        pool->queues[i].begin = 0;
+        pool->queues[i].end = 0;
+    }
+
+    // Thread 0 is whichever thread calls threadpool_run
+    for(int i = 1; i < num_threads; i++){
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if(pthread_create(&pool->threads[i], NULL, worker_main, &pool->workers[i]) != 0){
+            fprintf(stderr, "Failed to create thread pool worker\n");
+            exit(1);
+        }
+    }
+    return pool;
+    MEM_ERROR:
+    fprintf(stderr, "Failed to allocate sufficient memory for thread pool\n");
+    exit(1);
+}
+
+void threadpool_run(ThreadPool* pool, int num_tasks, ThreadPoolTask task, void* context){
+    if(num_tasks <= 0) return;
+    if(pool->num_threads == 1){
+        for(int t = 0; t < num_tasks; t++) task(context, t, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    // Workers that woke up late for the previous run may still be leaving it
+    while(pool->num_active > 0) pthread_cond_wait(&pool->work_done, &pool->lock);
+
+    for(int i = 0; i < pool->num_threads; i++){
+        pool->queues[i].begin = (int)((long)num_tasks * i / pool->num_threads);
+        pool->queues[i].end = (int)((long)num_tasks * (i + 1) / pool->num_threads);
+    }
+    pool->task = task;
+    pool->context = context;
+    pool->num_tasks = num_tasks;
+    pool->num_completed = 0;
+    pool->num_active = 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    work(pool, 0, task, context);
+
+    pthread_mutex_lock(&pool->lock);
+    while(pool->num_completed < pool->num_tasks || pool->num_active > 0){
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int threadpool_num_threads(ThreadPool* pool){
+    return pool->num_threads;
+}
+
+void threadpool_delete(ThreadPool* pool){
+    if(pool == NULL) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->shutting_down = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i = 1; i < pool->num_threads; i++){
+        pthread_join(pool->threads[i], NULL);
+    }
+    for(int i = 0; i < pool->num_threads; i++){
+        pthread_mutex_destroy(&pool->queues[i].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->queues);
+    free(pool);
+}
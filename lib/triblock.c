@@ -0,0 +1,374 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "triblock.h"
+
+const TriangleBlocks NULL_TRIANGLE_BLOCKS = {0, 0, NULL, 0, NULL, NULL};
+
+// 0 picks the width from the CPU
+int TRIANGLE_BLOCK_WIDTH = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define KERNEL_ATTRIBUTES __attribute__((target("sse2")))
+#define KERNEL_WIDTH 8
+#define KERNEL_NAME(name) name##_8_sse2
+#include "triblock_kernel.h"
+#undef KERNEL_WIDTH
+#undef KERNEL_NAME
+#define KERNEL_WIDTH 16
+#define KERNEL_NAME(name) name##_16_sse2
+#include "triblock_kernel.h"
+#undef KERNEL_WIDTH
+#undef KERNEL_NAME
+#undef KERNEL_ATTRIBUTES
+
+#define KERNEL_ATTRIBUTES __attribute__((target("avx2")))
+#define KERNEL_WIDTH 8
+#define KERNEL_NAME(name) name##_8_avx2
+#include "triblock_kernel.h"
+#undef KERNEL_WIDTH
+#undef KERNEL_NAME
+#define KERNEL_WIDTH 16
+#define KERNEL_NAME(name) name##_16_avx2
+#include "triblock_kernel.h"
+#undef KERNEL_WIDTH
+#undef KERNEL_NAME
+#undef KERNEL_ATTRIBUTES
+
+#define KERNEL_ATTRIBUTES __attribute__((target("avx512f")))
+#define KERNEL_WIDTH 8
+#define KERNEL_NAME(name) name##_8_avx512
+#include "triblock_kernel.h"
+#undef KERNEL_WIDTH
+#undef KERNEL_NAME
+#define KERNEL_WIDTH 16
+#define KERNEL_NAME(name) name##_16_avx512
+#include "triblock_kernel.h"
+#undef KERNEL_WIDTH
+#undef KERNEL_NAME
+#undef KERNEL_ATTRIBUTES
+
+static bool supports_sse2(){ return true; }
+static bool supports_avx2(){ __builtin_cpu_init(); return __builtin_cpu_supports("avx2"); }
+static bool supports_avx512(){ __builtin_cpu_init(); return __builtin_cpu_supports("avx512f"); }
+
+#else
+
+#define KERNEL_ATTRIBUTES
+#define KERNEL_WIDTH 8
+#define KERNEL_NAME(name) name##_8_generic
+#include "triblock_kernel.h"
+#undef KERNEL_WIDTH
+#undef KERNEL_NAME
+#define KERNEL_WIDTH 16
+#define KERNEL_NAME(name) name##_16_generic
+#include "triblock_kernel.h"
+#undef KERNEL_WIDTH
+#undef KERNEL_NAME
+#undef KERNEL_ATTRIBUTES
+
+static bool supports_generic(){ return true; }
+
+#endif
+
+typedef uint32_t (*BlockTest)(const float* block, const float* ray, float max_t);
+
+typedef struct {
+    const char* name;
+    BlockTest test_8;
+    BlockTest test_16;
+    bool (*supported)();
+} BlockIsa;
+
+// In order of preference
+static const BlockIsa BLOCK_ISAS[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx512", block_test_8_avx512, block_test_16_avx512, supports_avx512},
+    {"avx2", block_test_8_avx2, block_test_16_avx2, supports_avx2},
+    {"sse2", block_test_8_sse2, block_test_16_sse2, supports_sse2}
+#else
+    {"generic", block_test_8_generic, block_test_16_generic, supports_generic}
+#endif
+};
+#define NUM_BLOCK_ISAS ((int)(sizeof(BLOCK_ISAS) / sizeof(BLOCK_ISAS[0])))
+
+static const BlockIsa* block_isa = NULL;
+
+static const BlockIsa* get_block_isa(){
+    if(block_isa != NULL) return block_isa;
+    for(int i = 0; i < NUM_BLOCK_ISAS; i++){
+        if(BLOCK_ISAS[i].supported()){
+            block_isa = &BLOCK_ISAS[i];
+            break;
+        }
+    }
+    return block_isa;
+}
+
+const char* triangle_block_isa(){
+    return get_block_isa()->name;
+}
+
+void set_triangle_block_width(int width){
+    TRIANGLE_BLOCK_WIDTH = width == 8 || width == 16 ? width : 0;
+}
+
+int triangle_block_width(){
+    if(TRIANGLE_BLOCK_WIDTH != 0) return TRIANGLE_BLOCK_WIDTH;
+    return strcmp(triangle_block_isa(), "avx512") ? 8 : 16;
+}
+
+/**
+ * @brief Finds the range of primitive indices under a BVH node. The leaves of a subtree always own
+ * one contiguous range, with the left child's primitives before the right child's
+ */
+static void subtree_prims(const BVH* bvh, int node, int* first_out, int* count_out){
+    int first_leaf = node;
+    while(bvh->nodes[first_leaf].count == 0) first_leaf = bvh->nodes[first_leaf].left_or_first;
+    int last_leaf = node;
+    while(bvh->nodes[last_leaf].count == 0) last_leaf = bvh->nodes[last_leaf].left_or_first + 1;
+    *first_out = bvh->nodes[first_leaf].left_or_first;
+    *count_out = bvh->nodes[last_leaf].left_or_first + bvh->nodes[last_leaf].count - *first_out;
+}
+
+/**
+ * @brief Counts the nodes and blocks a BVH subtree collapses into
+ */
+static void count_collapsed(const BVH* bvh, int node, int width, int* num_nodes, int* num_blocks){
+    int first, count;
+    subtree_prims(bvh, node, &first, &count);
+    (*num_nodes)++;
+    if(bvh->nodes[node].count > 0 || count <= width){
+        *num_blocks += (count + width - 1) / width;
+        return;
+    }
+    int left = bvh->nodes[node].left_or_first;
+    count_collapsed(bvh, left, width, num_nodes, num_blocks);
+    count_collapsed(bvh, left + 1, width, num_nodes, num_blocks);
+}
+
+/**
+ * @brief Converts triangle i of a mesh's records to floats and stores it in lane k of a block
+ */
+static void store_triangle(float* data, int width, int k, const TriangleRecords* records, int i){
+    data[k] = (float)records->v0_x[i];
+    data[width + k] = (float)records->v0_y[i];
+    data[2 * width + k] = (float)records->v0_z[i];
+    data[3 * width + k] = (float)records->edge_1_x[i];
+    data[4 * width + k] = (float)records->edge_1_y[i];
+    data[5 * width + k] = (float)records->edge_1_z[i];
+    data[6 * width + k] = (float)records->edge_2_x[i];
+    data[7 * width + k] = (float)records->edge_2_y[i];
+    data[8 * width + k] = (float)records->edge_2_z[i];
+}
+
+/**
+ * @brief Copies triangles from a mesh's records into the next blocks
+ */
+static void fill_blocks(TriangleBlocks* blocks, const TriangleRecords* records, const int* prim_indices, int count){
+    int width = blocks->width;
+    for(int start = 0; start < count; start += width){
+        float* data = blocks->data + 9 * width * blocks->num_blocks;
+        int* triangles = blocks->triangles + width * blocks->num_blocks;
+        blocks->num_blocks++;
+        // Padding is left as a triangle with no area at the origin
+        memset(data, 0, sizeof(float) * 9 * width);
+        for(int k = 0; k < width; k++){
+            if(start + k >= count){
+                triangles[k] = -1;
+                continue;
+            }
+            triangles[k] = prim_indices[start + k];
+            store_triangle(data, width, k, records, triangles[k]);
+        }
+    }
+}
+
+/**
+ * @brief Copies a BVH subtree into the collapsed tree, turning it into a leaf once it holds no more
+ * triangles than fit in a block
+ */
+static void collapse_node(TriangleBlocks* blocks, const BVH* bvh, const TriangleRecords* records, int source, int target){
+    int first, count;
+    subtree_prims(bvh, source, &first, &count);
+    BVHNode* node = &blocks->nodes[target];
+    node->bounds = bvh->nodes[source].bounds;
+    if(bvh->nodes[source].count > 0 || count <= blocks->width){
+        node->left_or_first = blocks->num_blocks;
+        node->count = (count + blocks->width - 1) / blocks->width;
+        fill_blocks(blocks, records, bvh->prim_indices + first, count);
+        return;
+    }
+    int left = blocks->num_nodes;
+    blocks->num_nodes += 2;
+    node->left_or_first = left;
+    node->count = 0;
+    collapse_node(blocks, bvh, records, bvh->nodes[source].left_or_first, left);
+    collapse_node(blocks, bvh, records, bvh->nodes[source].left_or_first + 1, left + 1);
+}
+
+void build_triangle_blocks(Mesh* mesh){
+    delete_triangle_blocks(&mesh->tri_blocks);
+    const BVH* bvh = &mesh->bvh;
+    if(bvh->num_nodes == 0) return;
+
+    TriangleBlocks* blocks = &mesh->tri_blocks;
+    int width = triangle_block_width();
+    int num_nodes = 0;
+    int num_blocks = 0;
+    count_collapsed(bvh, 0, width, &num_nodes, &num_blocks);
+
+    blocks->width = width;
+    blocks->nodes = (BVHNode*)malloc(sizeof(BVHNode) * num_nodes);
+    blocks->data = (float*)malloc(sizeof(float) * 9 * width * num_blocks);
+    blocks->triangles = (int*)malloc(sizeof(int) * width * num_blocks);
+    if(blocks->nodes == NULL || blocks->data == NULL || blocks->triangles == NULL) goto MEM_ERROR;
+
+    blocks->num_nodes = 1;
+    blocks->num_blocks = 0;
+    collapse_node(blocks, bvh, &mesh->tri_records, 0, 0);
+    return;
+    MEM_ERROR:
+    fprintf(stderr, "Failed to allocate sufficient memory for triangle blocks\n");
+    exit(1);
+}
+
+void refit_triangle_blocks(Mesh* mesh, const AABB* prim_bounds){
+    TriangleBlocks* blocks = &mesh->tri_blocks;
+    int width = blocks->width;
+    for(int b = 0; b < blocks->num_blocks; b++){
+        for(int k = 0; k < width; k++){
+            int i = blocks->triangles[width * b + k];
+            if(i >= 0) store_triangle(blocks->data + 9 * width * b, width, k, &mesh->tri_records, i);
+        }
+    }
+
+    // Children are always stored after their parent, so walking backwards visits them first
+    for(int n = blocks->num_nodes - 1; n >= 0; n--){
+        BVHNode* node = &blocks->nodes[n];
+        AABB bounds = {{INFINITY, INFINITY, INFINITY}, {-INFINITY, -INFINITY, -INFINITY}};
+        if(node->count > 0){
+            for(int i = width * node->left_or_first; i < width * (node->left_or_first + node->count); i++){
+                if(blocks->triangles[i] >= 0) aabb_grow(&bounds, prim_bounds[blocks->triangles[i]]);
+            }
+        }
+        else {
+            aabb_grow(&bounds, blocks->nodes[node->left_or_first].bounds);
+            aabb_grow(&bounds, blocks->nodes[node->left_or_first + 1].bounds);
+        }
+        node->bounds = bounds;
+    }
+}
+
+void delete_triangle_blocks(TriangleBlocks* blocks){
+    free(blocks->nodes);
+    free(blocks->data);
+    free(blocks->triangles);
+    *blocks = NULL_TRIANGLE_BLOCKS;
+}
+
+/**
+ * @brief Gets the block test for a width with the best instruction set the CPU supports
+ */
+static BlockTest get_block_test(int width){
+    const BlockIsa* isa = get_block_isa();
+    return width == 16 ? isa->test_16 : isa->test_8;
+}
+
+/**
+ * @brief Tests a ray against every triangle of a leaf, confirming the triangles that pass the single
+ * precision test with the double precision one in the order they are stored in
+ *
+ * @param max_t Lowered to the ray parameter of every confirmed hit when searching for the closest hit
+ * @param any_hit true to stop at the first confirmed hit
+ * @return true if a triangle was hit before max_t
+ */
+static bool test_leaf(int* tri_out, double* max_t, Vector2* barycentric_out, Ray ray, const float* ray_f,
+                      const Mesh* mesh, const BVHNode* node, BlockTest test, bool any_hit){
+    const TriangleBlocks* blocks = &mesh->tri_blocks;
+    int width = blocks->width;
+    bool did_hit = false;
+    for(int b = node->left_or_first; b < node->left_or_first + node->count; b++){
+        uint32_t candidates = test(blocks->data + 9 * width * b, ray_f, (float)*max_t * (1 + TRIANGLE_BLOCK_MARGIN));
+        while(candidates != 0){
+            int k = __builtin_ctz(candidates);
+            candidates &= candidates - 1;
+            int tri = blocks->triangles[width * b + k];
+            if(intersect_triangle_record(max_t, barycentric_out, *max_t, ray, &mesh->tri_records, tri)){
+                if(any_hit) return true;
+                *tri_out = tri;
+                did_hit = true;
+            }
+        }
+    }
+    return did_hit;
+}
+
+bool triangle_blocks_intersect(int* tri_out, double* t_out, Vector2* barycentric_out, double closest_t, Ray ray, const Mesh* mesh){
+    const TriangleBlocks* blocks = &mesh->tri_blocks;
+    BlockTest test = get_block_test(blocks->width);
+    float ray_f[6] = {ray.origin.x, ray.origin.y, ray.origin.z, ray.direction.x, ray.direction.y, ray.direction.z};
+    Vector3 inverse_direction = {1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z};
+    bool did_hit = false;
+
+    int stack[BVH_MAX_DEPTH + 1];
+    int stack_size = 0;
+    if(!aabb_ray_intersect(&blocks->nodes[0].bounds, ray.origin, inverse_direction, closest_t, NULL)) return false;
+    stack[stack_size++] = 0;
+
+    while(stack_size > 0){
+        const BVHNode* node = &blocks->nodes[stack[--stack_size]];
+        if(node->count > 0){
+            if(test_leaf(tri_out, &closest_t, barycentric_out, ray, ray_f, mesh, node, test, false)) did_hit = true;
+            continue;
+        }
+
+        // Visit the nearer child first so that closest_t shrinks as fast as possible
+        int left = node->left_or_first;
+        double t_left, t_right;
+        bool hit_left = aabb_ray_intersect(&blocks->nodes[left].bounds, ray.origin, inverse_direction, closest_t, &t_left);
+        bool hit_right = aabb_ray_intersect(&blocks->nodes[left + 1].bounds, ray.origin, inverse_direction, closest_t, &t_right);
+        if(hit_left && hit_right){
+            if(t_left <= t_right){
+                stack[stack_size++] = left + 1;
+                stack[stack_size++] = left;
+            }
+            else {
+                stack[stack_size++] = left;
+                stack[stack_size++] = left + 1;
+            }
+        }
+        else if(hit_left) stack[stack_size++] = left;
+        else if(hit_right) stack[stack_size++] = left + 1;
+    }
+    *t_out = closest_t;
+    return did_hit;
+}
+
+bool triangle_blocks_occluded(double max_t, Ray ray, const Mesh* mesh){
+    const TriangleBlocks* blocks = &mesh->tri_blocks;
+    BlockTest test = get_block_test(blocks->width);
+    float ray_f[6] = {ray.origin.x, ray.origin.y, ray.origin.z, ray.direction.x, ray.direction.y, ray.direction.z};
+    Vector3 inverse_direction = {1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z};
+    int tri;
+
+    int stack[BVH_MAX_DEPTH + 1];
+    int stack_size = 0;
+    if(!aabb_ray_intersect(&blocks->nodes[0].bounds, ray.origin, inverse_direction, max_t, NULL)) return false;
+    stack[stack_size++] = 0;
+
+    while(stack_size > 0){
+        const BVHNode* node = &blocks->nodes[stack[--stack_size]];
+        if(node->count > 0){
+            if(test_leaf(&tri, &max_t, NULL, ray, ray_f, mesh, node, test, true)) return true;
+            continue;
+        }
+        int left = node->left_or_first;
+        if(aabb_ray_intersect(&blocks->nodes[left].bounds, ray.origin, inverse_direction, max_t, NULL)) stack[stack_size++] = left;
+        if(aabb_ray_intersect(&blocks->nodes[left + 1].bounds, ray.origin, inverse_direction, max_t, NULL)) stack[stack_size++] = left + 1;
+    }
+    return false;
+}
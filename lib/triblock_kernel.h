@@ -0,0 +1,80 @@
+/*
+ * The triangle block test, written once for any block width with GCC vector extensions.
+ * triblock.c includes this file once per block width and instruction set after defining:
+ *   KERNEL_WIDTH       the number of triangles in a block, which is the number of floats in one vector
+ *   KERNEL_NAME(name)  name with the width and instruction set appended
+ *   KERNEL_ATTRIBUTES  the function attributes that select the instruction set
+ *
+ * Widths wider than the instruction set's registers still work; the compiler splits the vectors.
+ */
+
+#define VEC KERNEL_NAME(Vec)
+#define MASK KERNEL_NAME(Mask)
+
+typedef float VEC __attribute__((vector_size(KERNEL_WIDTH * sizeof(float))));
+typedef int MASK __attribute__((vector_size(KERNEL_WIDTH * sizeof(float))));
+
+// Vectors are passed by pointer so that no function takes or returns one wider than the
+// instruction set's registers, which would change the calling convention
+static inline KERNEL_ATTRIBUTES void KERNEL_NAME(load)(VEC* v, const float* p){
+    memcpy(v, p, sizeof(*v));
+}
+
+static inline KERNEL_ATTRIBUTES uint32_t KERNEL_NAME(bits)(const MASK* mask){
+    uint32_t result = 0;
+    for(int k = 0; k < KERNEL_WIDTH; k++) result |= (uint32_t)((*mask)[k] & 1) << k;
+    return result;
+}
+
+/**
+ * @brief The test of intersect_triangle_record in single precision for one ray and every triangle of
+ * a block, loosened by TRIANGLE_BLOCK_MARGIN. Padding triangles have no area and never pass
+ *
+ * @param block The 9 component arrays of the block
+ * @param ray The ray's origin followed by its direction
+ * @param max_t Triangles hit at or beyond this ray parameter fail
+ * @return uint32_t One bit per triangle that may be hit
+ */
+static KERNEL_ATTRIBUTES uint32_t KERNEL_NAME(block_test)(const float* block, const float* ray, float max_t){
+    const float* v0 = block;
+    const float* edge_1 = block + 3 * KERNEL_WIDTH;
+    const float* edge_2 = block + 6 * KERNEL_WIDTH;
+    VEC v0_x, v0_y, v0_z, edge_1_x, edge_1_y, edge_1_z, edge_2_x, edge_2_y, edge_2_z;
+    KERNEL_NAME(load)(&v0_x, v0);
+    KERNEL_NAME(load)(&v0_y, v0 + KERNEL_WIDTH);
+    KERNEL_NAME(load)(&v0_z, v0 + 2 * KERNEL_WIDTH);
+    KERNEL_NAME(load)(&edge_1_x, edge_1);
+    KERNEL_NAME(load)(&edge_1_y, edge_1 + KERNEL_WIDTH);
+    KERNEL_NAME(load)(&edge_1_z, edge_1 + 2 * KERNEL_WIDTH);
+    KERNEL_NAME(load)(&edge_2_x, edge_2);
+    KERNEL_NAME(load)(&edge_2_y, edge_2 + KERNEL_WIDTH);
+    KERNEL_NAME(load)(&edge_2_z, edge_2 + 2 * KERNEL_WIDTH);
+    float direction_x = ray[3], direction_y = ray[4], direction_z = ray[5];
+
+    // pvec = direction x edge_2
+    VEC pvec_x = (direction_y * edge_2_z) - (edge_2_y * direction_z);
+    VEC pvec_y = (direction_z * edge_2_x) - (edge_2_z * direction_x);
+    VEC pvec_z = (direction_x * edge_2_y) - (edge_2_x * direction_y);
+    VEC determinant = (edge_1_x * pvec_x) + (edge_1_y * pvec_y) + (edge_1_z * pvec_z);
+    VEC inverse_determinant = 1.0f / determinant;
+
+    VEC vertex_to_origin_x = ray[0] - v0_x;
+    VEC vertex_to_origin_y = ray[1] - v0_y;
+    VEC vertex_to_origin_z = ray[2] - v0_z;
+    VEC u = ((vertex_to_origin_x * pvec_x) + (vertex_to_origin_y * pvec_y) + (vertex_to_origin_z * pvec_z)) * inverse_determinant;
+
+    // qvec = vertex_to_origin x edge_1
+    VEC qvec_x = (vertex_to_origin_y * edge_1_z) - (edge_1_y * vertex_to_origin_z);
+    VEC qvec_y = (vertex_to_origin_z * edge_1_x) - (edge_1_z * vertex_to_origin_x);
+    VEC qvec_z = (vertex_to_origin_x * edge_1_y) - (edge_1_x * vertex_to_origin_y);
+    VEC v = ((direction_x * qvec_x) + (direction_y * qvec_y) + (direction_z * qvec_z)) * inverse_determinant;
+    VEC t = ((edge_2_x * qvec_x) + (edge_2_y * qvec_y) + (edge_2_z * qvec_z)) * inverse_determinant;
+
+    // Written so that a NaN from a zero determinant fails every comparison
+    MASK pass = (MASK)(u >= -TRIANGLE_BLOCK_MARGIN) & (MASK)(v >= -TRIANGLE_BLOCK_MARGIN) &
+                (MASK)(u + v <= 1 + TRIANGLE_BLOCK_MARGIN) & (MASK)(t < max_t);
+    return KERNEL_NAME(bits)(&pass);
+}
+
+#undef VEC
+#undef MASK